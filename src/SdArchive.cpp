@@ -0,0 +1,293 @@
+// Arduino SD Card Server Library
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// tar archives of a directory
+
+#include "SdCardServerPrivate.h"
+
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Support routines
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//------------------------------------------------------------------------------
+// archiveNameLength
+//      Determine the length of the member name, the path of the file from
+//      the root directory
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this archive
+//
+//  Returns:
+//      The length of the member name in bytes
+//------------------------------------------------------------------------------
+static
+size_t
+archiveNameLength (
+    SD_TRANSFER * transfer
+    )
+{
+    return (transfer->path[0] ? strlen(transfer->path) + 1 : 0)
+         + strlen(transfer->entryName);
+}
+
+//------------------------------------------------------------------------------
+// archiveNameCopy
+//      Copy a portion of the member name, the directory path, a slash and
+//      the file name
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this archive
+//      buffer: Address of the buffer to receive the portion of the name
+//      offset: Offset of the portion in the member name
+//      length: Number of bytes to copy
+//------------------------------------------------------------------------------
+static
+void
+archiveNameCopy (
+    SD_TRANSFER * transfer,
+    char * buffer,
+    size_t offset,
+    size_t length
+    )
+{
+    size_t pathLength;
+
+    pathLength = transfer->path[0] ? strlen(transfer->path) + 1 : 0;
+    while (length--) {
+        if (offset >= pathLength)
+            *buffer++ = transfer->entryName[offset - pathLength];
+        else
+            *buffer++ = (offset == (pathLength - 1)) ? '/' : transfer->path[offset];
+        offset++;
+    }
+}
+
+//------------------------------------------------------------------------------
+// archiveClose
+//      Close the file and directory of the archive
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this archive
+//------------------------------------------------------------------------------
+static
+void
+archiveClose (
+    SD_TRANSFER * transfer
+    )
+{
+    if (transfer->file.isOpen())
+        transfer->file.close();
+    if (transfer->dir.isOpen())
+        transfer->dir.close();
+    transfer->state = LS_DONE;
+}
+
+//------------------------------------------------------------------------------
+// tarHeader
+//      Build a ustar header for an archive member
+//
+//  Inputs:
+//      buffer: Address of a zeroed TAR_BLOCK_SIZE buffer holding the member
+//              name, receives the rest of the header
+//      size: Size of the member data in bytes
+//      mtime: Modify time in seconds since 1 Jan 1970
+//      type: Member type, '0' for a file, 'L' for a GNU long name
+//------------------------------------------------------------------------------
+static
+void
+tarHeader (
+    char * buffer,
+    uint64_t size,
+    uint32_t mtime,
+    char type
+    )
+{
+    uint32_t checksum;
+    int index;
+
+    strcpy(&buffer[100], "0000644");
+    strcpy(&buffer[108], "0000000");
+    strcpy(&buffer[116], "0000000");
+
+    // Sizes of 8 GB and larger use the GNU base-256 encoding
+    if (size > 077777777777ull) {
+        buffer[124] = (char)0x80;
+        for (index = 135; index > 124; index--) {
+            buffer[index] = (char)size;
+            size >>= 8;
+        }
+    } else
+        sprintf(&buffer[124], "%011llo", (unsigned long long)size);
+    sprintf(&buffer[136], "%011lo", (unsigned long)mtime);
+    buffer[156] = type;
+    memcpy(&buffer[257], "ustar", 6);
+    memcpy(&buffer[263], "00", 2);
+
+    // The checksum is computed with spaces in the checksum field
+    memset(&buffer[148], ' ', 8);
+    checksum = 0;
+    for (index = 0; index < TAR_BLOCK_SIZE; index++)
+        checksum += (uint8_t)buffer[index];
+    sprintf(&buffer[148], "%06lo", (unsigned long)checksum);
+}
+
+//------------------------------------------------------------------------------
+// archiveMember
+//      Place the headers for the next archive member into the line buffer
+//      and start reading the file.  The member name includes the directory
+//      path.  Names of 100 bytes or longer are preceded by a GNU long name
+//      member and take two passes through the line buffer.  The caller must
+//      hold the SD card lock.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this archive
+//------------------------------------------------------------------------------
+static
+void
+archiveMember (
+    SD_TRANSFER * transfer
+    )
+{
+    char * buffer;
+    uint32_t firstSector;
+    uint32_t lastSector;
+    size_t length;
+
+    buffer = transfer->lineBuffer;
+    transfer->lineBufferData = buffer;
+    length = archiveNameLength(transfer);
+    if ((length >= TAR_NAME_SIZE) && (!transfer->archiveHeader)) {
+        // Start the long name member, the name is zero terminated and fills
+        // at most two blocks
+        memset(buffer, 0, 2 * TAR_BLOCK_SIZE);
+        strcpy(buffer, "././@LongLink");
+        tarHeader(buffer, length + 1, 0, 'L');
+        buffer += TAR_BLOCK_SIZE;
+        archiveNameCopy(transfer, buffer, 0,
+                        (length < TAR_BLOCK_SIZE) ? length : TAR_BLOCK_SIZE);
+        transfer->lineBufferDataEnd = buffer + TAR_BLOCK_SIZE;
+        transfer->archiveHeader = true;
+        return;
+    }
+
+    // Finish the long name
+    if (transfer->archiveHeader && (length >= TAR_BLOCK_SIZE)) {
+        memset(buffer, 0, TAR_BLOCK_SIZE);
+        archiveNameCopy(transfer, buffer, TAR_BLOCK_SIZE, length - TAR_BLOCK_SIZE);
+        buffer += TAR_BLOCK_SIZE;
+    }
+    transfer->archiveHeader = false;
+
+    // Add the file header, the name is truncated to 99 bytes
+    memset(buffer, 0, TAR_BLOCK_SIZE);
+    archiveNameCopy(transfer, buffer, 0,
+                    (length < TAR_NAME_SIZE) ? length : TAR_NAME_SIZE - 1);
+    tarHeader(buffer, transfer->entry.fileSize,
+              fatToEpoch(transfer->entry.modifyDate, transfer->entry.modifyTime),
+              '0');
+    transfer->lineBufferDataEnd = buffer + TAR_BLOCK_SIZE;
+    transfer->fileSize = transfer->entry.fileSize;
+    transfer->rangeRemaining = transfer->entry.fileSize;
+
+    // Read the sectors of a contiguous file directly from the SD card
+    transfer->contiguousSector = 0;
+    if (transfer->file.contiguousRange(&firstSector, &lastSector))
+        transfer->contiguousSector = firstSector;
+}
+
+//------------------------------------------------------------------------------
+// archiveRead
+//      Get the next portion of the tar archive of the listed files.  The
+//      headers are built as each file is reached and the file data is read
+//      directly into the response buffer.  A read error ends the response
+//      early, the client detects the short archive.  The caller must hold
+//      the SD card lock.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this archive
+//      buffer: Address of a buffer to receive the next portion of the archive
+//      maxLen: Maximum length of the next portion of the archive
+//
+//  Returns:
+//      The number of bytes written to the response buffer, zero (0) at the
+//      end of the archive
+//------------------------------------------------------------------------------
+size_t
+archiveRead (
+    SD_TRANSFER * transfer,
+    uint8_t * buffer,
+    size_t maxLen
+    )
+{
+    int bytesRead;
+    size_t bytesWritten;
+    size_t length;
+    size_t padding;
+
+    bytesWritten = 0;
+    while (bytesWritten < maxLen) {
+        // Send the rest of the headers, padding or trailer
+        if (transfer->lineBufferData < transfer->lineBufferDataEnd) {
+            length = transfer->lineBufferDataEnd - transfer->lineBufferData;
+            if (length > (maxLen - bytesWritten))
+                length = maxLen - bytesWritten;
+            memcpy(&buffer[bytesWritten], transfer->lineBufferData, length);
+            transfer->lineBufferData += length;
+            bytesWritten += length;
+            continue;
+        }
+
+        // Finish the long name
+        if (transfer->archiveHeader) {
+            archiveMember(transfer);
+            continue;
+        }
+
+        // Send the file data
+        if (transfer->rangeRemaining) {
+            length = maxLen - bytesWritten;
+            if (length > transfer->rangeRemaining)
+                length = transfer->rangeRemaining;
+            bytesRead = fileRead(transfer, &buffer[bytesWritten], length);
+
+            // The header promised the file size, end the response without
+            // the rest of the archive upon error
+            if (bytesRead <= 0) {
+                archiveClose(transfer);
+                transfer->rangeRemaining = 0;
+                break;
+            }
+            transfer->rangeRemaining -= bytesRead;
+            bytesWritten += bytesRead;
+            if (transfer->rangeRemaining)
+                continue;
+
+            // Pad the file data to the block size
+            padding = (TAR_BLOCK_SIZE - (transfer->fileSize % TAR_BLOCK_SIZE))
+                    % TAR_BLOCK_SIZE;
+            memset(transfer->lineBuffer, 0, padding);
+            transfer->lineBufferData = transfer->lineBuffer;
+            transfer->lineBufferDataEnd = &transfer->lineBuffer[padding];
+            continue;
+        }
+
+        // Done when the trailer is sent
+        if (transfer->state == LS_DONE)
+            break;
+
+        // Add the next file
+        if (listingNextMatch(transfer)) {
+            archiveMember(transfer);
+            continue;
+        }
+
+        // End the archive with two zero blocks
+        archiveClose(transfer);
+        memset(transfer->lineBuffer, 0, 2 * TAR_BLOCK_SIZE);
+        transfer->lineBufferData = transfer->lineBuffer;
+        transfer->lineBufferDataEnd = &transfer->lineBuffer[2 * TAR_BLOCK_SIZE];
+    }
+    return bytesWritten;
+}
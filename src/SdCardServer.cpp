@@ -3,98 +3,85 @@
 // Copyright (C) 2022 by Lee Leahy and licensed under
 // GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
 
-#include <malloc.h>
-#include <string.h>
-
-#include "SdCardServer.h"
+#include "SdCardServerPrivate.h"
 
 //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 // Constants
 //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
-#define MAX_FILE_NAME_SIZE      (256 * 3)   // File names are 255 UTF-8 characters
-
-//#define NEXT_ENTRY_SIZE         ((2 * MAX_FILE_NAME_SIZE) + 128)
-#define NEXT_ENTRY_SIZE         MAX_FILE_NAME_SIZE
+static prog_char htmlBodyEnd[] PROGMEM = HTML_BODY_END;
 
-#define LINE_BUFFER_SIZE        1024    // Buffer to hold line across packets
-
-typedef enum {
-    LS_HEADER = 0,
-    LS_DISPLAY_FILES,
-    LS_TRAILER,
-    LS_DONE
-} LISTING_STATE;
+static prog_char htmlUlListEnd[] PROGMEM = HTML_LIST_END;
 
 //------------------------------------------------------------------------------
-// HTML header pieces
+// sd/
 //------------------------------------------------------------------------------
 
-static prog_char htmlHeaderStart[] PROGMEM = "<!DOCTYPE HTML>\n<html lang=\"en\">\n<head>\n";
+#define SD_FILES_H1             "%s SD Card"
 
-static prog_char htmlContentType[] PROGMEM = "  <meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\"/>\n";
+// sprintf format: size, size
+static prog_char sdHeader[] PROGMEM = HTML_HEADER_START HTML_CONTENT_TYPE
+    HTML_TITLE SD_FILES_H1 HTML_TITLE_END HTML_HEADER_END_BODY_START "\n"
+    "  <h1>" SD_FILES_H1 "</h1>\n";
 
-static prog_char htmlRedirect[] PROGMEM = "  <meta http-equiv=\"refresh\" content=\"0; url='http://";
-
-static prog_char htmlRedirectEnd[] PROGMEM = "'\" />\n";
-
-static prog_char htmlTitle[] PROGMEM = R"rawliteral(  <title>)rawliteral";
-
-static prog_char htmlTitleEnd[] PROGMEM = R"rawliteral(</title>
-)rawliteral";
+// The list items are built in two pieces, the URL and the name, so that each
+// piece fits in the line buffer with the longest file name
 
-static prog_char htmlHeaderEnd[] PROGMEM = R"rawliteral(</head>
-)rawliteral";
+// sprintf format: date, URL
+static prog_char sdListItem[] PROGMEM = HTML_LIST_ITEM_START "%s, "
+    HTML_ANCHOR_START "%s" HTML_ANCHOR_CENTER;
 
-static prog_char htmlHeaderEndBodyStart[] PROGMEM = R"rawliteral(</head>
-<body>)rawliteral";
+// sprintf format: name, size
+static prog_char sdListItemEnd[] PROGMEM = "%s" HTML_ANCHOR_END ", "
+    "%s bytes" HTML_LIST_ITEM_END;
 
-static prog_char htmlBodyEnd[] PROGMEM = R"rawliteral(</body>
-</html>
-)rawliteral";
+// sprintf format: date, URL
+static prog_char sdDirItem[] PROGMEM = HTML_LIST_ITEM_START "%s, "
+    HTML_LINK_START "%s/" HTML_ANCHOR_CENTER;
 
-//------------------------------------------------------------------------------
-// html anchor
-//------------------------------------------------------------------------------
+// sprintf format: name
+static prog_char sdDirItemEnd[] PROGMEM = "%s/" HTML_ANCHOR_END
+    HTML_LIST_ITEM_END;
 
-static prog_char htmlAnchorStart[] PROGMEM = R"rawliteral(<a target=)rawliteral";
+// sprintf format: URL
+static prog_char sdPathStart[] PROGMEM = "  <p>" HTML_LINK_START "%s"
+    HTML_ANCHOR_CENTER "SD Card" HTML_ANCHOR_END;
 
-static prog_char htmlAnchorBlank[] PROGMEM = R"rawliteral(_blank)rawliteral";
+// sprintf format: URL, name length, name
+static prog_char sdPathLink[] PROGMEM = " / " HTML_LINK_START "%s"
+    HTML_ANCHOR_CENTER "%.*s" HTML_ANCHOR_END;
 
-static prog_char htmlAnchorHref[] PROGMEM = R"rawliteral( href=)rawliteral";
+// sprintf format: name
+static prog_char sdPathEnd[] PROGMEM = " / %s</p>\n";
 
-static prog_char htmlAnchorCenter[] PROGMEM = R"rawliteral(>)rawliteral";
+static prog_char sdListStart[] PROGMEM = R"rawliteral(  <ol start="%lu">
+)rawliteral";
 
-static prog_char htmlAnchorEnd[] PROGMEM = R"rawliteral(</a>)rawliteral";
+static prog_char sdPageLinkStart[] PROGMEM = R"rawliteral(  <p>)rawliteral";
 
-//------------------------------------------------------------------------------
-// html lists
-//------------------------------------------------------------------------------
+static prog_char sdPageLinkEnd[] PROGMEM = R"rawliteral(</p>
+)rawliteral";
 
-static prog_char htmlListItemStart[] PROGMEM = R"rawliteral(    <li>)rawliteral";
+static prog_char jsonListStart[] PROGMEM = "{\"entries\":[\n";
 
-static prog_char htmlListItemEnd[] PROGMEM = R"rawliteral(</li>
-)rawliteral";
+static prog_char jsonListEnd[] PROGMEM = "\n],\"more\":%s}\n";
 
-static prog_char htmlUlListStart[] PROGMEM = R"rawliteral(  <ol>
-)rawliteral";
+static prog_char csvListStart[] PROGMEM = "name,size,mtime,dir\r\n";
 
-static prog_char htmlUlListEnd[] PROGMEM = R"rawliteral(  </ol>
+static prog_char sdArchiveLink[] PROGMEM = R"rawliteral(  <p><a href="?format=tar">Download the files as a tar archive</a></p>
 )rawliteral";
-
 //------------------------------------------------------------------------------
-// sd/
+// HTTP dates
 //------------------------------------------------------------------------------
 
-static const char sdFilesH1[] PROGMEM = "%SZ% SD Card";
-
-static prog_char sdHeader[] PROGMEM = R"rawliteral(%H%%CT%%T%%H1%%/T%%/HB%
-  <h1>%H1%</h1>
-)rawliteral";
+static const char * const dayNames[7] = {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
 
-static prog_char sdNoCard[] PROGMEM = R"rawliteral(
-  <p>MicroSD card socket is empty!</p>
-)rawliteral";
+static const char * const monthNames[12] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
 
 static prog_char sdNoFiles[] PROGMEM = R"rawliteral(
   <p>No files found!</p>
@@ -102,104 +89,150 @@ static prog_char sdNoFiles[] PROGMEM = R"rawliteral(
 
 //------------------------------------------------------------------------------
 // index.html
+//
+// The remaining %token% values are replaced by the processor routine
 //------------------------------------------------------------------------------
 
-static const char titleName[] PROGMEM = "SD Card Server";
+#define TITLE_NAME              "SD Card Server"
 
-static const char index_html[] PROGMEM = R"rawliteral(%H%%CT%%T%%Title%%/T%%/HB%
-  <h1>%Title%</h1>
-  <p>%A%%SD%%Q%>%H1%</a></p>
-%/B%
-)rawliteral";
+#define HTML_PAGE_START         HTML_HEADER_START HTML_CONTENT_TYPE HTML_TITLE \
+                                TITLE_NAME HTML_TITLE_END \
+                                HTML_HEADER_END_BODY_START "\n" \
+                                "  <h1>" TITLE_NAME "</h1>\n"
 
-static const char redirect_html[] PROGMEM = R"rawliteral(%H%%R%%IP%%SD%%R/%%/H%%/HTML%
-)rawliteral";
+#define HTML_ERROR_PAGE(message)    HTML_PAGE_START \
+                                    "  <p>ERROR - " message "</p>\n" \
+                                    HTML_BODY_END "\n"
 
-static const char no_sd_card_html[] PROGMEM = R"rawliteral(%H%%CT%%T%%Title%%/T%%/HB%
-  <h1>%Title%</h1>
-  <p>ERROR - SD card not present!</a></p>
-%/B%
-)rawliteral";
+static const char index_html[] PROGMEM = HTML_PAGE_START
+    "  <p>" HTML_ANCHOR_START "%SD%" HTML_ANCHOR_CENTER "%SZ% SD Card"
+    HTML_ANCHOR_END "%FR%</p>\n" HTML_BODY_END "\n";
 
-static const char invalid_SD_card_format_html[] PROGMEM = R"rawliteral(%H%%CT%%T%%Title%%/T%%/HB%
-  <h1>%Title%</h1>
-  <p>ERROR - SD card has invalid format!</a></p>
-%/B%
-)rawliteral";
+static const char redirect_html[] PROGMEM = HTML_HEADER_START HTML_REDIRECT
+    "%IP%%SD%" HTML_REDIRECT_END HTML_HEADER_END "\n";
 
-static const char memory_allocation_failed[] PROGMEM = R"rawliteral(%H%%CT%%T%%Title%%/T%%/HB%
-  <h1>%Title%</h1>
-  <p>ERROR - Memory allocation failed!</a></p>
-%/B%
-)rawliteral";
+static const char no_sd_card_html[] PROGMEM = HTML_ERROR_PAGE("SD card not present!");
 
-static const char not_implemented_html[] PROGMEM = R"rawliteral(%H%%CT%%T%%Title%%/T%%/HB%
-  <h1>%Title%</h1>
-  <p>ERROR - Not implemented!</a></p>
-%/B%
-)rawliteral";
+static const char invalid_SD_card_format_html[] PROGMEM = HTML_ERROR_PAGE("SD card has invalid format!");
+
+
+static const char too_many_transfers_html[] PROGMEM = HTML_ERROR_PAGE("Too many transfers in progress, try again later!");
+
+static const char not_implemented_html[] PROGMEM = HTML_ERROR_PAGE("Not implemented!");
 
 //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 // Locals
 //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
-static SD_CARD_PRESENT cardPresent;    // Routine to determine if SD card is present
-static char htmlBuffer[256];           // Buffer for HTML token replacement
-static char * lineBuffer;              // Temporary buffer to hold the next line
-static char * lineBufferData;
-static char * lineBufferDataEnd;
-static int sdCardEmpty;                // No files found in the FAT file system
-static float sdCardSizeMB;             // Size of the SD card in MB (1000 * 1000 bytes)
-static SdFat * sdFat;                  // Address of a SdFat object
-static SdFile * sdFile;                // File on the SD card
-static SdFile * sdRootDir;             // Root directory file on the SD card
-static const char * serverHdrText;     // Zero terminated string for web server name
-static LISTING_STATE state;            // Listing state
-static const char * webPage;           // Zero terminated string for SD card's web pages
-static int webPageMissingSlash;        // Non zero if last character is a not a slash
-static int webPageLength;              // Length of the webPage string
+static uint32_t etagSeed;              // Distinguishes the listing ETags by boot
+static int volumeCount;                // Number of entries in volumes
+static SD_VOLUME ** volumes;           // SdCardServer instances sorted by URL
+#ifdef PREFETCH_ENABLED
+static portMUX_TYPE prefetchLock = portMUX_INITIALIZER_UNLOCKED; // Buffer state
+static TaskHandle_t prefetchTask;      // Task reading ahead from the SD card
+static SemaphoreHandle_t volumesMutex; // Serialize volumes changes with the prefetch task
+#endif  // PREFETCH_ENABLED
 
 //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
-// Support Classes
+// Support routines
 //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
-class HtmlPrint : public Print
+//------------------------------------------------------------------------------
+// sdLock
+//      Gain exclusive access to the SD card.  The SdFat library is not thread
+//      safe and the prefetch task reads the SD card while the web server
+//      builds the listings.  The volumes using different SdFat objects do not
+//      wait for each other.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//------------------------------------------------------------------------------
+void
+sdLock (
+    SD_VOLUME * volume
+    )
 {
-    uint8_t * buf;
-
-public:
-    HtmlPrint(void) {
-        buf = NULL;
-    }
-
-    void setBufferAddress(uint8_t * buffer) {
-        buf = buffer;
-    }
+#ifdef PREFETCH_ENABLED
+    xSemaphoreTake(volume->cardLock->mutex, portMAX_DELAY);
+#else   // PREFETCH_ENABLED
+    (void)volume;
+#endif  // PREFETCH_ENABLED
+}
 
-    size_t write(uint8_t data) {
-        *buf++ = data;
-        *buf = 0;
-        return 1;
-    }
+//------------------------------------------------------------------------------
+// sdUnlock
+//      Release exclusive access to the SD card
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//------------------------------------------------------------------------------
+void
+sdUnlock (
+    SD_VOLUME * volume
+    )
+{
+#ifdef PREFETCH_ENABLED
+    xSemaphoreGive(volume->cardLock->mutex);
+#else   // PREFETCH_ENABLED
+    (void)volume;
+#endif  // PREFETCH_ENABLED
+}
 
-    size_t write(const uint8_t *buffer, size_t size) {
-        memcpy (buf, buffer, size);
-        buf[size] = 0;
-        buf += size;
-        return size;
-    }
-};
+//------------------------------------------------------------------------------
+// tokenHash
+//      Compute the hash of a token name.  The routine is evaluated by the
+//      compiler for the case labels in processor, a collision between tokens
+//      causes a duplicate case value error.
+//
+//  Inputs:
+//      token: Zero terminated string containing the token name
+//      hash: Hash of the previous characters
+//
+//  Returns:
+//      Returns the hash of the token name
+//------------------------------------------------------------------------------
+static
+constexpr
+uint32_t
+tokenHash (
+    const char * token,
+    uint32_t hash = 5381
+    )
+{
+    return *token ? tokenHash(token + 1, (hash * 33) ^ (uint8_t)*token) : hash;
+}
 
-//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
-// Support routines
-//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//------------------------------------------------------------------------------
+// sdCardSizeText
+//      Format the SD card size for display
+//
+//  Inputs:
+//      buffer: Address of the buffer to receive the size text
+//      sizeMB: Size in MB (1000 * 1000 bytes)
+//
+//  Returns:
+//      The number of characters written to the buffer
+//------------------------------------------------------------------------------
+static
+int
+sdCardSizeText (
+    char * buffer,
+    float sizeMB
+    )
+{
+    return sprintf (buffer, "%3.0f %s",
+                    sizeMB < 1000. ? sizeMB : sizeMB / 1000.,
+                    sizeMB < 1000. ? "MB" : "GB");
+}
 
 //------------------------------------------------------------------------------
 // processor
 //      Process the tokens in the HTML strings passed to AsyncWebServer in
-//      the HTML response
+//      the HTML response.  The static portions of the pages are built by the
+//      compiler, only the dynamic values remain as tokens.
 //
 //  Inputs:
+//      volume: Address of the SD_VOLUME object
 //      var: String containing the token found in the HTML response
 //
 //  Returns:
@@ -208,372 +241,3593 @@ public:
 static
 String
 processor (
+    SD_VOLUME * volume,
     const String& var
     )
 {
-    if (var == "A") {
-        strcpy_P(htmlBuffer, htmlAnchorStart);
-        strcat(htmlBuffer, "\"");
-        strcat_P(htmlBuffer, htmlAnchorBlank);
-        strcat(htmlBuffer, "\"");
-        strcat_P(htmlBuffer, htmlAnchorHref);
-        strcat(htmlBuffer, "\"");
-        return String(htmlBuffer);
-    }
-    if (var == "AC")
-        return String(htmlAnchorCenter);
-    if (var == "/A")
-        return String(htmlAnchorEnd);
-    if (var == "/B")
-        return String(htmlBodyEnd);
-    if (var == "CT")
-        return String(htmlContentType);
-    if (var == "H")
-        return String(htmlHeaderStart);
-    if (var == "/H")
-        return String(htmlHeaderEnd);
-    if (var == "H1")
-        return String(sdFilesH1);
-    if (var == "/HB")
-        return String(htmlHeaderEndBodyStart);
-    if (var == "IP") {
-        IPAddress ip = WiFi.localIP();
-        sprintf (htmlBuffer, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
-        return String(htmlBuffer);
-    }
-    if (var == "LI")
-        return String(htmlListItemStart);
-    if (var == "/LI")
-        return String(htmlListItemEnd);
-    if (var == "SD")
-        return String(webPage);
-    if (var == "SZ") {
-        sprintf (htmlBuffer, "%3.0f %s",
-                 sdCardSizeMB < 1000. ? sdCardSizeMB : sdCardSizeMB / 1000.,
-                 sdCardSizeMB < 1000. ? "MB" : "GB");
-        return String(htmlBuffer);
-    }
-    if (var == "Q")
-        return String("\"");
-    if (var == "R")
-        return String(htmlRedirect);
-    if (var == "R/")
-        return String(htmlRedirectEnd);
-    if (var == "T")
-        return String(htmlTitle);
-    if (var == "Title")
-        return String(titleName);
-    if (var == "/T")
-        return String(htmlTitleEnd);
-    if (var == "UL")
-        return String(htmlUlListStart);
-    if (var == "/UL")
-        return String(htmlUlListEnd);
-    return String();
+    IPAddress ip;
+
+    volume->htmlBuffer[0] = 0;
+    switch (tokenHash(var.c_str())) {
+    case tokenHash("IP"):
+        ip = WiFi.localIP();
+        sprintf (volume->htmlBuffer, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+        break;
+
+    case tokenHash("SD"):
+        return String(volume->webPage);
+
+    case tokenHash("SZ"):
+        sdCardSizeText(volume->htmlBuffer, volume->sdCardSizeMB);
+        break;
+
+    case tokenHash("FR"):
+        // Free space, once counted in the background
+        if (volume->cardFreeClusters >= 0) {
+            strcpy(volume->htmlBuffer, ", ");
+            sdCardSizeText(&volume->htmlBuffer[2], 0.000001 * volume->cardFreeClusters
+                                           * volume->cardClusterBytes);
+            strcat(volume->htmlBuffer, " free");
+        }
+        break;
+    }
+    return String(volume->htmlBuffer);
 }
 
 //------------------------------------------------------------------------------
-// sdCardSize
-//      Get the SD card size in bytes
+// sdCardIdentify
+//      Read the identity and size of the SD card.  A different SD card changes
+//      the SD card contents.  The caller must hold the SD card lock.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
 //
 //  Returns:
-//      Returns the size of the SD card in bytes, zero (0) if the SD card is not
-//      present.
+//      True if the SD card matches the previous identity, false otherwise
 //------------------------------------------------------------------------------
 static
-uint64_t
-sdCardSize(
-    void
+bool
+sdCardIdentify(
+    SD_VOLUME * volume
     )
 {
-    csd_t csd;
-    uint64_t sdCardBytes;
+    bool changed;
+    cid_t cid;
 
-    // Verify that the SD card is present
-    if (!cardPresent())
-        return 0;
+    // Compare the card identification
+    if (!volume->sdFat->card()->readCID(&cid))
+        memset(&cid, 0, sizeof(cid));
+    changed = (memcmp(&cid, &volume->cardCid, sizeof(cid)) != 0);
+    if (volume->cardBytes && (!changed))
+        return true;
+    if (changed) {
+        volume->cardCid = cid;
+        volume->cardFreeClusters = -1;
+        volume->sdGeneration += 1;
+    }
 
     // Get the SD card size
-    sdFat->card()->readCSD(&csd); //Card Specific Data
-    sdCardBytes = sdFat->card()->sectorCount();
-    sdCardBytes <<= 9;
-    sdCardSizeMB = 0.000001 * sdCardBytes;
-    return sdCardBytes;
+    volume->cardBytes = (uint64_t)volume->sdFat->card()->sectorCount() << 9;
+    volume->sdCardSizeMB = 0.000001 * volume->cardBytes;
+    return !changed;
 }
 
 //------------------------------------------------------------------------------
-// addFileName
-//      Add a file name and file size to the SD card listing page
+// freeSpaceStale
+//      Determine if the free space needs to be counted
 //
 //  Inputs:
-//      htmlPrint: Address of an HtmlPrint class object
-//      buffer: Address of a buffer to receive the file link
+//      volume: Address of the SD_VOLUME object
+//
+//  Returns:
+//      True if the free space is not known or the SD card contents changed
+//      since the last count, false otherwise
+//------------------------------------------------------------------------------
+static
+bool
+freeSpaceStale(
+    SD_VOLUME * volume
+    )
+{
+    if (!volume->cardBytes)
+        return false;
+    if (volume->cardFreeClusters < 0)
+        return true;
+    return (volume->cardFreeGeneration != volume->sdGeneration)
+        && ((millis() - volume->cardFreeMsec) >= SD_CARD_SERVER_FREE_SPACE_MSEC);
+}
+
+//------------------------------------------------------------------------------
+// freeSpaceCount
+//      Count the free clusters on the SD card, which reads the entire file
+//      allocation table.  The SD card identity is verified at the same time.
+//      The caller must hold the SD card lock.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//------------------------------------------------------------------------------
+void
+freeSpaceCount(
+    SD_VOLUME * volume
+    )
+{
+    int32_t clusters;
+    uint32_t generation;
+
+    // A different SD card was inserted
+    if (!sdCardIdentify(volume))
+        return;
+
+    // Count the free clusters
+    generation = volume->sdGeneration;
+    clusters = volume->sdFat->freeClusterCount();
+    volume->cardClusterBytes = volume->sdFat->bytesPerCluster();
+    volume->cardFreeGeneration = generation;
+    volume->cardFreeMsec = millis();
+    volume->cardFreeClusters = (clusters < 0) ? 0 : clusters;
+}
+
+//------------------------------------------------------------------------------
+// indexRealloc
+//      Change the size of a cached directory index or file allocation, using
+//      PSRAM when it is available
+//
+//  Inputs:
+//      data: Address of the existing allocation or NULL
+//      length: Number of bytes to allocate
+//
+//  Returns:
+//      Returns the address of the allocation or NULL upon failure
+//------------------------------------------------------------------------------
+static
+void *
+indexRealloc (
+    void * data,
+    size_t length
+    )
+{
+#ifdef BOARD_HAS_PSRAM
+    if (psramFound())
+        return ps_realloc(data, length);
+#endif  // BOARD_HAS_PSRAM
+    return realloc(data, length);
+}
+
+//------------------------------------------------------------------------------
+// indexFree
+//      Free a directory index and its arrays
+//
+//  Inputs:
+//      index: Address of the SD_DIR_INDEX object or NULL
+//------------------------------------------------------------------------------
+static
+void
+indexFree (
+    SD_DIR_INDEX * index
+    )
+{
+    int sort;
+
+    if (index) {
+        for (sort = 0; sort < SORT_COUNT; sort++)
+            free(index->sorted[sort]);
+        free(index->entries);
+        free(index->names);
+        free(index);
+    }
+}
+
+//------------------------------------------------------------------------------
+// indexRelease
+//      Release a reference to a cached directory index.  When the last
+//      reference is released, the larger of the index and the spare index is
+//      kept as the spare to build the next index without allocating memory.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      index: Address of the SD_DIR_INDEX object
 //------------------------------------------------------------------------------
 static
 void
-buildHtmlAnchor(HtmlPrint * htmlPrint, char * buffer) {
-    uint64_t u64;
-    uint32_t u32;
+indexRelease (
+    SD_VOLUME * volume,
+    SD_DIR_INDEX * index
+    )
+{
+    SD_DIR_INDEX * spare;
+
+    index->references -= 1;
+    if (!index->references) {
+        spare = volume->dirIndexSpare;
+        if (spare && ((spare->entryMax > index->entryMax)
+                      || ((spare->entryMax == index->entryMax)
+                          && (spare->namesMax >= index->namesMax))))
+            indexFree(index);
+        else {
+            indexFree(spare);
+            volume->dirIndexSpare = index;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// indexAllocate
+//      Get an empty directory index, reusing the spare index when available
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      path: Zero terminated directory path
+//
+//  Returns:
+//      Returns the address of the SD_DIR_INDEX object or NULL upon failure
+//------------------------------------------------------------------------------
+static
+SD_DIR_INDEX *
+indexAllocate (
+    SD_VOLUME * volume,
+    const char * path
+    )
+{
+    SD_DIR_INDEX * index;
 
-    // Start the list item
-    strcpy(buffer, "%LI%");
+    index = volume->dirIndexSpare;
+    if (index)
+        volume->dirIndexSpare = NULL;
+    else {
+        index = (SD_DIR_INDEX *)calloc(1, sizeof(SD_DIR_INDEX));
+        if (!index)
+            return NULL;
+    }
 
-    // Display the file date
-    htmlPrint->setBufferAddress((uint8_t *)(buffer + strlen(buffer)));
-    sdFile->printModifyDateTime(htmlPrint);
-    strcat(buffer, ", ");
+    // Keep the arrays, discard the previous contents
+    index->entryCount = 0;
+    index->namesLength = 0;
+    index->newest = 0;
+    index->totalBytes = 0;
+    index->sortedValid = 0;
+    index->generation = volume->sdGeneration;
+    index->references = 1;
+    index->lastUse = 0;
+    strcpy(index->path, path);
+    return index;
+}
 
-    // Build the HTML anchor
-    strcat(buffer, "%A%%SD%");
-    htmlPrint->setBufferAddress((uint8_t *)(buffer + strlen(buffer)));
-    sdFile->printName(htmlPrint);
-    strcat(buffer, "\">");
-    htmlPrint->setBufferAddress((uint8_t *)(buffer + strlen(buffer)));
-    sdFile->printName(htmlPrint);
-    strcat(buffer, "%/A%, ");
+//------------------------------------------------------------------------------
+// indexBytes
+//      Determine the memory used by a directory index
+//
+//  Inputs:
+//      index: Address of the SD_DIR_INDEX object
+//
+//  Returns:
+//      Returns the number of bytes allocated for the index
+//------------------------------------------------------------------------------
+static
+size_t
+indexBytes (
+    SD_DIR_INDEX * index
+    )
+{
+    size_t bytes;
+    int sort;
 
-    // Display the file size
-    u64 = sdFile->fileSize();
-    u32 = u64 / (1ull * 1000 * 1000 * 1000);
-    if (u32)
-        strcat(buffer, String(u32).c_str());
-    u32 = u64 % (1ull * 1000 * 1000 * 1000);
-    strcat(buffer, String(u32).c_str());
-    strcat(buffer, " bytes%/LI%");
+    bytes = sizeof(*index) + (index->entryMax * sizeof(SD_DIR_ENTRY))
+          + index->namesMax;
+    for (sort = 0; sort < SORT_COUNT; sort++)
+        bytes += index->sortedMax[sort] * sizeof(uint32_t);
+    return bytes;
 }
 
 //------------------------------------------------------------------------------
-// cardListing
-//      Start the listing of files on the SD card
+// indexFind
+//      Locate the cached index of a directory.  The indexes built before the
+//      SD card contents changed are discarded.
 //
 //  Inputs:
-//      buffer: Address of a buffer to receive the next portion of the HTML response
-//      maxLen: Maximum length of the next portion of the HTML response
+//      volume: Address of the SD_VOLUME object
+//      path: Address of the directory path
+//      length: Length of the directory path in bytes
 //
 //  Returns:
-//      The number of characters written to the response buffer
+//      Returns the address of the SD_DIR_INDEX object or NULL if the
+//      directory is not in the cache
+//------------------------------------------------------------------------------
+static
+SD_DIR_INDEX *
+indexFind (
+    SD_VOLUME * volume,
+    const char * path,
+    size_t length
+    )
+{
+    SD_DIR_INDEX * index;
+    int slot;
+
+    for (slot = 0; slot < DIR_INDEXES; slot++) {
+        index = volume->dirIndexes[slot];
+        if (!index)
+            continue;
+        if (index->generation != volume->sdGeneration) {
+            volume->dirIndexes[slot] = NULL;
+            indexRelease(volume, index);
+            continue;
+        }
+        if ((!strncmp(index->path, path, length)) && (!index->path[length])) {
+            index->lastUse = ++volume->dirIndexUse;
+            return index;
+        }
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+// indexInsert
+//      Add a directory index to the cache, replacing the previous index of
+//      the directory, an empty slot or the least recently used index.  The
+//      spare index and the least recently used indexes are then discarded
+//      until the cache and the spare fit in SD_CARD_SERVER_INDEX_BYTES.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      index: Address of the SD_DIR_INDEX object, the caller's reference is
+//             passed to the cache
+//------------------------------------------------------------------------------
+static
+void
+indexInsert (
+    SD_VOLUME * volume,
+    SD_DIR_INDEX * index
+    )
+{
+    size_t bytes;
+    int slot;
+    uint32_t use;
+    int victim;
+    uint32_t victimUse;
+
+    // Select the slot for the index
+    victim = 0;
+    victimUse = UINT32_MAX;
+    for (slot = 0; slot < DIR_INDEXES; slot++) {
+        if (volume->dirIndexes[slot]
+            && (!strcmp(volume->dirIndexes[slot]->path, index->path))) {
+            victim = slot;
+            break;
+        }
+        use = volume->dirIndexes[slot] ? volume->dirIndexes[slot]->lastUse : 0;
+        if (use < victimUse) {
+            victim = slot;
+            victimUse = use;
+        }
+    }
+    if (volume->dirIndexes[victim])
+        indexRelease(volume, volume->dirIndexes[victim]);
+    index->lastUse = ++volume->dirIndexUse;
+    volume->dirIndexes[victim] = index;
+
+    // Discard the spare and the least recently used indexes to stay within
+    // the memory limit
+    for (;;) {
+        bytes = volume->dirIndexSpare ? indexBytes(volume->dirIndexSpare) : 0;
+        victim = -1;
+        for (slot = 0; slot < DIR_INDEXES; slot++) {
+            if (!volume->dirIndexes[slot])
+                continue;
+            bytes += indexBytes(volume->dirIndexes[slot]);
+            if ((volume->dirIndexes[slot] != index)
+                && ((victim < 0) || (volume->dirIndexes[slot]->lastUse
+                                     < volume->dirIndexes[victim]->lastUse)))
+                victim = slot;
+        }
+        if (bytes <= SD_CARD_SERVER_INDEX_BYTES)
+            break;
+        if (volume->dirIndexSpare) {
+            indexFree(volume->dirIndexSpare);
+            volume->dirIndexSpare = NULL;
+            continue;
+        }
+        if (victim < 0)
+            break;
+        indexRelease(volume, volume->dirIndexes[victim]);
+        volume->dirIndexes[victim] = NULL;
+    }
+}
+
+//------------------------------------------------------------------------------
+// indexAppend
+//      Add an entry to the index being built
+//
+//  Inputs:
+//      index: Address of the SD_DIR_INDEX object
+//      entry: Address of the SD_DIR_ENTRY to add
+//      name: Zero terminated string containing the entry name
+//
+//  Returns:
+//      True if the entry was added, false if the index is too large or memory
+//      is not available
+//------------------------------------------------------------------------------
+static
+bool
+indexAppend (
+    SD_DIR_INDEX * index,
+    const SD_DIR_ENTRY * entry,
+    const char * name
+    )
+{
+    void * data;
+    uint32_t dateTime;
+    size_t length;
+    uint32_t newMax;
+
+    // Grow the entry array
+    if (index->entryCount >= index->entryMax) {
+        newMax = index->entryMax + INDEX_ENTRIES_INCREMENT;
+        if (((newMax * sizeof(SD_DIR_ENTRY)) + index->namesMax)
+            > SD_CARD_SERVER_INDEX_BYTES)
+            return false;
+        data = indexRealloc(index->entries, newMax * sizeof(SD_DIR_ENTRY));
+        if (!data)
+            return false;
+        index->entries = (SD_DIR_ENTRY *)data;
+        index->entryMax = newMax;
+    }
+
+    // Grow the name pool
+    length = strlen(name) + 1;
+    if ((index->namesLength + length) > index->namesMax) {
+        newMax = index->namesMax + INDEX_NAMES_INCREMENT;
+        if (((index->entryMax * sizeof(SD_DIR_ENTRY)) + newMax)
+            > SD_CARD_SERVER_INDEX_BYTES)
+            return false;
+        data = indexRealloc(index->names, newMax);
+        if (!data)
+            return false;
+        index->names = (char *)data;
+        index->namesMax = newMax;
+    }
+
+    // Add the entry
+    index->entries[index->entryCount] = *entry;
+    index->entries[index->entryCount].nameOffset = index->namesLength;
+    memcpy(&index->names[index->namesLength], name, length);
+    index->namesLength += length;
+    index->entryCount += 1;
+
+    // Summarize the directory for the listing ETag
+    dateTime = ((uint32_t)entry->modifyDate << 16) | entry->modifyTime;
+    if (index->newest < dateTime)
+        index->newest = dateTime;
+    index->totalBytes += entry->fileSize;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// indexCompare
+//      Compare two directory entries
+//
+//  Inputs:
+//      index: Address of the SD_DIR_INDEX object
+//      sort: Sort order
+//      a: First entry number
+//      b: Second entry number
+//
+//  Returns:
+//      Less than zero if a sorts before b, zero if equal and greater than zero
+//      if a sorts after b
 //------------------------------------------------------------------------------
 static
 int
-cardListing (
-    uint8_t * buffer,
-    size_t maxLen
+indexCompare (
+    const SD_DIR_INDEX * index,
+    LISTING_SORT sort,
+    uint32_t a,
+    uint32_t b
     )
 {
-    int bytesWritten;
-    HtmlPrint * htmlPrint;
-    int length;
+    SD_DIR_ENTRY * entryA;
+    SD_DIR_ENTRY * entryB;
+    uint32_t dateTimeA;
+    uint32_t dateTimeB;
 
-    bytesWritten = 0;
-    if (maxLen && lineBuffer) {
-        // Redirect the output to the web page
-        htmlPrint = new HtmlPrint();
-        *buffer = 0;
-        do {
-            // Determine if the previous buffer was too small for all of the data
-            if (lineBufferData >= lineBufferDataEnd) {
-                // Add the next file name
-                lineBuffer[0] = 0;
-                switch (state) {
-                case LS_HEADER:
-                    // Add the header, start the body and add the heading
-                    strcpy_P(lineBuffer, sdHeader);
-                    state = LS_DISPLAY_FILES;
-                    break;
+    entryA = &index->entries[a];
+    entryB = &index->entries[b];
+    switch (sort) {
+    default:
+        break;
 
-                case LS_DISPLAY_FILES:
-                    // Add the next file name
-                    sdFile = new SdFile();
-                    if ((!sdRootDir) || (!sdFile) || (!sdFile->openNext(sdRootDir, O_RDONLY))) {
-                        state = LS_TRAILER;
-                        if (sdFile) {
-                            delete sdFile;
-                            sdFile = NULL;
-                        }
-                        if (!sdCardEmpty) {
-                            // No more files, at least one file displayed
-                            break;
-                        }
+    case SORT_MTIME:
+        dateTimeA = ((uint32_t)entryA->modifyDate << 16) | entryA->modifyTime;
+        dateTimeB = ((uint32_t)entryB->modifyDate << 16) | entryB->modifyTime;
+        if (dateTimeA != dateTimeB)
+            return (dateTimeA < dateTimeB) ? -1 : 1;
+        break;
+
+    case SORT_SIZE:
+        if (entryA->fileSize != entryB->fileSize)
+            return (entryA->fileSize < entryB->fileSize) ? -1 : 1;
+        break;
+    }
+
+    // Sort by name when the keys match
+    return strcasecmp(&index->names[entryA->nameOffset],
+                      &index->names[entryB->nameOffset]);
+}
+
+//------------------------------------------------------------------------------
+// indexSift
+//      Move an entry number down the heap until both of its children sort
+//      before it
+//
+//  Inputs:
+//      index: Address of the SD_DIR_INDEX object
+//      sort: Sort order
+//      heap: Address of the entry numbers
+//      parent: Position of the entry number to move
+//      count: Number of entry numbers in the heap
+//------------------------------------------------------------------------------
+static
+void
+indexSift (
+    const SD_DIR_INDEX * index,
+    LISTING_SORT sort,
+    uint32_t * heap,
+    uint32_t parent,
+    uint32_t count
+    )
+{
+    uint32_t child;
+    uint32_t entry;
+
+    entry = heap[parent];
+    while ((child = (parent * 2) + 1) < count) {
+        if (((child + 1) < count)
+            && (indexCompare(index, sort, heap[child], heap[child + 1]) < 0))
+            child += 1;
+        if (indexCompare(index, sort, entry, heap[child]) >= 0)
+            break;
+        heap[parent] = heap[child];
+        parent = child;
+    }
+    heap[parent] = entry;
+}
+
+//------------------------------------------------------------------------------
+// indexSorted
+//      Get the entry numbers of the directory index in sorted order.  The
+//      sorted order is computed once and kept with the index, the array is
+//      reused when the index is recycled.  The heap sort does not allocate
+//      memory, unlike some qsort implementations.
+//
+//  Inputs:
+//      index: Address of the SD_DIR_INDEX object
+//      sort: Sort order
+//
+//  Returns:
+//      Returns the address of the sorted entry numbers or NULL upon failure
+//------------------------------------------------------------------------------
+static
+uint32_t *
+indexSorted (
+    SD_DIR_INDEX * index,
+    LISTING_SORT sort
+    )
+{
+    uint32_t count;
+    uint32_t entry;
+    uint32_t * sorted;
+    uint32_t temp;
+
+    if ((!(index->sortedValid & (1 << sort))) && index->entryCount) {
+        if (index->sortedMax[sort] < index->entryCount) {
+            sorted = (uint32_t *)indexRealloc(index->sorted[sort],
+                                              index->entryCount * sizeof(uint32_t));
+            if (!sorted)
+                return NULL;
+            index->sorted[sort] = sorted;
+            index->sortedMax[sort] = index->entryCount;
+        }
+        sorted = index->sorted[sort];
+        count = index->entryCount;
+        for (entry = 0; entry < count; entry++)
+            sorted[entry] = entry;
+
+        // Build the heap, then move the largest remaining entry to the end
+        for (entry = count / 2; entry > 0; entry--)
+            indexSift(index, sort, sorted, entry - 1, count);
+        while (count > 1) {
+            count -= 1;
+            temp = sorted[0];
+            sorted[0] = sorted[count];
+            sorted[count] = temp;
+            indexSift(index, sort, sorted, 0, count);
+        }
+        index->sortedValid |= 1 << sort;
+    }
+    return index->sorted[sort];
+}
+
+//------------------------------------------------------------------------------
+// indexBuildDone
+//      Stop building an index.  The index is added to the cached directory
+//      indexes when the directory walk completed and the SD card contents did
+//      not change during the walk.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object building the index
+//      complete: True if the entire directory was walked
+//------------------------------------------------------------------------------
+static
+void
+indexBuildDone (
+    SD_TRANSFER * transfer,
+    bool complete
+    )
+{
+    SD_DIR_INDEX * index;
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+
+    index = transfer->building;
+    if (index) {
+        transfer->building = NULL;
+
+        // Sorted listings are sent from the index, even if the SD card
+        // contents changed during the walk
+        if (complete && (transfer->state == LS_INDEX)) {
+            transfer->index = index;
+            index->references += 1;
+        }
+        if (complete && (index->generation == volume->sdGeneration))
+            indexInsert(volume, index);
+        else
+            indexRelease(volume, index);
+    }
+}
+
+//------------------------------------------------------------------------------
+// fileRead
+//      Read the file being downloaded.  The sectors of a contiguous file are
+//      read directly from the SD card into the buffer with a single
+//      multi-sector read, bypassing the cluster chain and the volume cache.
+//      The caller must hold the SD card lock.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//      buffer: Address of a buffer to receive the data
+//      length: Number of bytes to read, must not extend past the end of the
+//              file
+//
+//  Returns:
+//      The number of bytes read, zero (0) at the end of the file or -1 upon
+//      error
+//------------------------------------------------------------------------------
+int
+fileRead (
+    SD_TRANSFER * transfer,
+    uint8_t * buffer,
+    size_t length
+    )
+{
+    int bytesRead;
+    uint64_t position;
+    size_t sectors;
+    uint32_t start;
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+
+    // Read the whole sectors when the file position is sector aligned
+    start = micros();
+    volume->metrics.sdReads += 1;
+    position = transfer->file.curPosition();
+    sectors = length / 512;
+    if (transfer->contiguousSector && sectors && (!(position & (512 - 1)))) {
+        if (volume->sdFat->card()->readSectors(transfer->contiguousSector
+                                       + (uint32_t)(position / 512),
+                                       buffer, sectors)
+            && transfer->file.seekSet(position + (sectors * 512))) {
+            volume->metrics.sdReadUsec += micros() - start;
+            return sectors * 512;
+        }
+
+        // Fall back to the cluster chain upon error
+        volume->metrics.errors[ME_READ] += 1;
+        transfer->contiguousSector = 0;
+        transfer->file.seekSet(position);
+    }
+
+    // Read the partial sectors and the fragmented files
+    bytesRead = transfer->file.read(buffer, length);
+    if (bytesRead < 0)
+        volume->metrics.errors[ME_READ] += 1;
+    volume->metrics.sdReadUsec += micros() - start;
+    return bytesRead;
+}
+
+//------------------------------------------------------------------------------
+// cacheRelease
+//      Release a reference to a cached file.  When the entry is no longer
+//      used, the larger of the entry and the spare entry is kept as the spare
+//      to load the next file without allocating memory.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      entry: Address of the SD_FILE_CACHE object
+//------------------------------------------------------------------------------
+static
+void
+cacheRelease (
+    SD_VOLUME * volume,
+    SD_FILE_CACHE * entry
+    )
+{
+    entry->references -= 1;
+    if (!entry->references) {
+        if (volume->cacheSpare && (volume->cacheSpare->capacity >= entry->capacity))
+            free(entry);
+        else {
+            free(volume->cacheSpare);
+            volume->cacheSpare = entry;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// cacheRemove
+//      Remove a file from the cache, downloads in progress keep sending
+//      the data until they release the entry
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      entry: Address of the SD_FILE_CACHE object
+//------------------------------------------------------------------------------
+static
+void
+cacheRemove (
+    SD_VOLUME * volume,
+    SD_FILE_CACHE * entry
+    )
+{
+    SD_FILE_CACHE ** previous;
+
+    for (previous = &volume->cache; *previous; previous = &(*previous)->next)
+        if (*previous == entry) {
+            *previous = entry->next;
+            volume->cacheBytes -= entry->fileSize;
+            cacheRelease(volume, entry);
+            break;
+        }
+}
+
+//------------------------------------------------------------------------------
+// cacheFind
+//      Locate the cached copy of a file and make it the most recently used
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      filename: Zero terminated path of the file relative to the root directory
+//      acceptsGzip: True if the request accepts the gzip copy of the file
+//
+//  Returns:
+//      Returns the address of the SD_FILE_CACHE object or NULL if the file
+//      is not cached.  The caller validates the entry with cacheCurrent or
+//      cacheValid.
+//------------------------------------------------------------------------------
+static
+SD_FILE_CACHE *
+cacheFind (
+    SD_VOLUME * volume,
+    const char * filename,
+    bool acceptsGzip
+    )
+{
+    SD_FILE_CACHE * entry;
+    SD_FILE_CACHE ** previous;
+
+    for (previous = &volume->cache; *previous; previous = &(*previous)->next) {
+        entry = *previous;
+        if ((entry->acceptsGzip == acceptsGzip) && (!strcmp(entry->path, filename))) {
+            *previous = entry->next;
+            entry->next = volume->cache;
+            volume->cache = entry;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+// cacheAttach
+//      Send the download from the cached copy of the file, closing the file
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//      entry: Address of the SD_FILE_CACHE object
+//------------------------------------------------------------------------------
+static
+void
+cacheAttach (
+    SD_TRANSFER * transfer,
+    SD_FILE_CACHE * entry
+    )
+{
+    if (transfer->file.isOpen()) {
+        sdLock(transfer->volume);
+        transfer->file.close();
+        sdUnlock(transfer->volume);
+    }
+    entry->references += 1;
+    transfer->cache = entry;
+    transfer->cachePosition = 0;
+}
+
+//------------------------------------------------------------------------------
+// cacheValid
+//      Determine if the cached copy matches the open file's size, modify
+//      time and location on the SD card
+//
+//  Inputs:
+//      entry: Address of the SD_FILE_CACHE object
+//      gzipFile: True if the open file is the gzip copy
+//      fileSize: Size of the open file in bytes
+//      firstSector: Location of the open file on the SD card
+//      modifyDate: FAT modify date of the open file
+//      modifyTime: FAT modify time of the open file
+//
+//  Returns:
+//      Returns true if the cached copy may be sent
+//------------------------------------------------------------------------------
+static
+bool
+cacheValid (
+    SD_FILE_CACHE * entry,
+    bool gzipFile,
+    uint64_t fileSize,
+    uint32_t firstSector,
+    uint16_t modifyDate,
+    uint16_t modifyTime
+    )
+{
+    return (entry->gzipFile == gzipFile) && (entry->fileSize == fileSize)
+        && (entry->firstSector == firstSector)
+        && (entry->modifyDate == modifyDate) && (entry->modifyTime == modifyTime);
+}
+
+//------------------------------------------------------------------------------
+// cacheCurrent
+//      Determine if the cached copy may be sent without reading the SD card.
+//      The SD card contents must be unchanged since the file was loaded and
+//      the cached index of the directory, when present, must list the file
+//      with the same size and modify time.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      entry: Address of the SD_FILE_CACHE object
+//
+//  Returns:
+//      Returns true if the cached copy may be sent
+//------------------------------------------------------------------------------
+static
+bool
+cacheCurrent (
+    SD_VOLUME * volume,
+    SD_FILE_CACHE * entry
+    )
+{
+    SD_DIR_ENTRY * dirEntry;
+    SD_DIR_INDEX * index;
+    const char * name;
+    size_t nameLength;
+    size_t pathLength;
+    const char * suffix;
+
+    // Verify that the SD card contents have not changed
+    if (entry->generation != volume->sdGeneration)
+        return false;
+
+    // Locate the cached index of the directory
+    name = strrchr(entry->path, '/');
+    pathLength = name ? name - entry->path : 0;
+    name = name ? name + 1 : entry->path;
+    index = indexFind(volume, entry->path, pathLength);
+    if (!index)
+        return true;
+
+    // Compare the file with the directory entry
+    nameLength = strlen(name);
+    suffix = entry->gzipFile ? ".gz" : "";
+    for (dirEntry = index->entries;
+         dirEntry < &index->entries[index->entryCount]; dirEntry++)
+        if ((!strncmp(&index->names[dirEntry->nameOffset], name, nameLength))
+            && (!strcmp(&index->names[dirEntry->nameOffset + nameLength], suffix)))
+            return (dirEntry->fileSize == entry->fileSize)
+                && (dirEntry->modifyDate == entry->modifyDate)
+                && (dirEntry->modifyTime == entry->modifyTime);
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// cachePublish
+//      Add a completely loaded file to the cache as the most recently used
+//      file, replacing an older copy loaded by another download
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object that loaded the file
+//------------------------------------------------------------------------------
+static
+void
+cachePublish (
+    SD_TRANSFER * transfer
+    )
+{
+    SD_FILE_CACHE * entry;
+    SD_FILE_CACHE * previous;
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+    entry = transfer->cacheFill;
+    transfer->cacheFill = NULL;
+    previous = cacheFind(volume, entry->path, entry->acceptsGzip);
+    if (previous)
+        cacheRemove(volume, previous);
+    entry->next = volume->cache;
+    volume->cache = entry;
+}
+
+//------------------------------------------------------------------------------
+// cacheDiscard
+//      Release the partially loaded copy of a file when the download does
+//      not complete
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object loading the file
+//------------------------------------------------------------------------------
+static
+void
+cacheDiscard (
+    SD_TRANSFER * transfer
+    )
+{
+    if (transfer->cacheFill) {
+        transfer->volume->cacheBytes -= transfer->cacheFill->fileSize;
+        cacheRelease(transfer->volume, transfer->cacheFill);
+        transfer->cacheFill = NULL;
+    }
+}
+
+//------------------------------------------------------------------------------
+// cacheStart
+//      Start loading a small file into the cache as the download reads the
+//      file.  The least recently used files are removed to stay within
+//      SD_CARD_SERVER_CACHE_BYTES, counting the files being loaded, and the
+//      spare entry is reused when it is large enough.  The entry is added to
+//      the cache by cacheFill when the entire file was read.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object with the open file
+//      filename: Zero terminated path of the file relative to the root directory
+//      acceptsGzip: True if the request accepts the gzip copy of the file
+//      gzipFile: True if the open file is the gzip copy
+//      fileSize: Size of the open file in bytes
+//      firstSector: Location of the open file on the SD card
+//      modifyDate: FAT modify date of the open file
+//      modifyTime: FAT modify time of the open file
+//------------------------------------------------------------------------------
+static
+void
+cacheStart (
+    SD_TRANSFER * transfer,
+    const char * filename,
+    bool acceptsGzip,
+    bool gzipFile,
+    uint64_t fileSize,
+    uint32_t firstSector,
+    uint16_t modifyDate,
+    uint16_t modifyTime
+    )
+{
+    size_t capacity;
+    SD_FILE_CACHE * entry;
+    size_t length;
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+
+    // Only keep the small files
+    if ((SD_CARD_SERVER_CACHE_BYTES == 0)
+        || (fileSize > SD_CARD_SERVER_CACHE_FILE_BYTES)
+        || (fileSize > SD_CARD_SERVER_CACHE_BYTES))
+        return;
+
+    // Remove the least recently used files to make room
+    while (volume->cache
+           && ((volume->cacheBytes + fileSize) > SD_CARD_SERVER_CACHE_BYTES)) {
+        for (entry = volume->cache; entry->next; entry = entry->next)
+            ;
+        cacheRemove(volume, entry);
+    }
+    if ((volume->cacheBytes + fileSize) > SD_CARD_SERVER_CACHE_BYTES)
+        return;
+
+    // Allocate the entry for the file
+    length = strlen(filename) + 1;
+    capacity = length + fileSize;
+    entry = volume->cacheSpare;
+    if (entry && (entry->capacity >= capacity))
+        volume->cacheSpare = NULL;
+    else {
+        entry = (SD_FILE_CACHE *)indexRealloc(NULL, sizeof(SD_FILE_CACHE) + capacity);
+        if (!entry)
+            return;
+        entry->capacity = capacity;
+    }
+    entry->path = strcpy((char *)&entry[1], filename);
+    entry->data = (uint8_t *)&entry->path[length];
+    entry->references = 1;
+    entry->fileSize = fileSize;
+    entry->firstSector = firstSector;
+    entry->modifyDate = modifyDate;
+    entry->modifyTime = modifyTime;
+    entry->generation = volume->sdGeneration;
+    entry->acceptsGzip = acceptsGzip;
+    entry->gzipFile = gzipFile;
+    entry->next = NULL;
+    volume->cacheBytes += fileSize;
+    transfer->cacheFill = entry;
+    transfer->cachePosition = 0;
+
+    // An empty file is already loaded
+    if (!fileSize)
+        cachePublish(transfer);
+}
+
+//------------------------------------------------------------------------------
+// cacheFill
+//      Copy the data read by the download into the file being loaded into the
+//      cache, adding the file to the cache when the entire file was read
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object loading the file
+//      buffer: Address of the data read from the file
+//      length: Number of bytes read from the file
+//------------------------------------------------------------------------------
+static
+void
+cacheFill (
+    SD_TRANSFER * transfer,
+    const uint8_t * buffer,
+    size_t length
+    )
+{
+    SD_FILE_CACHE * entry;
+
+    entry = transfer->cacheFill;
+    if (length > (entry->fileSize - transfer->cachePosition)) {
+        cacheDiscard(transfer);
+        return;
+    }
+    memcpy(&entry->data[transfer->cachePosition], buffer, length);
+    transfer->cachePosition += length;
+    if (transfer->cachePosition == entry->fileSize)
+        cachePublish(transfer);
+}
+
+#ifdef PREFETCH_ENABLED
+//------------------------------------------------------------------------------
+// prefetchFill
+//      Fill the next read-ahead buffer of a download.  The caller must hold
+//      the SD card lock.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//
+//  Returns:
+//      True if a buffer was filled, false if there is nothing to do
+//------------------------------------------------------------------------------
+static
+bool
+prefetchFill (
+    SD_TRANSFER * transfer
+    )
+{
+    int bytesRead;
+    size_t bytesToRead;
+    int index;
+    SD_RANGE * range;
+
+    // Determine if a buffer is available
+    index = transfer->fillIndex;
+    if (transfer->prefetchDone || transfer->prefetchLength[index])
+        return false;
+
+    // Start the next range
+    if (!transfer->fillRemaining) {
+        if (transfer->fillRangeIndex >= transfer->rangeCount) {
+            transfer->prefetchDone = true;
+            return false;
+        }
+        range = &transfer->ranges[transfer->fillRangeIndex++];
+        transfer->fillRemaining = range->length;
+        if (!transfer->file.seekSet(range->offset)) {
+            transfer->prefetchDone = true;
+            return false;
+        }
+    }
+
+    // Read up to the next sector boundary in the file, then full buffers,
+    // so that the remaining reads are sector aligned
+    bytesToRead = PREFETCH_BUFFER_SIZE
+                - (transfer->file.curPosition() & (512 - 1));
+    if (bytesToRead > transfer->fillRemaining)
+        bytesToRead = transfer->fillRemaining;
+    bytesRead = fileRead(transfer,
+                         &transfer->prefetchData[index * PREFETCH_BUFFER_SIZE],
+                         bytesToRead);
+    if (bytesRead <= 0) {
+        transfer->prefetchDone = true;
+        return false;
+    }
+    transfer->fillRemaining -= bytesRead;
+
+    // Pass the buffer to the web server
+    portENTER_CRITICAL(&prefetchLock);
+    transfer->prefetchLength[index] = bytesRead;
+    portEXIT_CRITICAL(&prefetchLock);
+    transfer->fillIndex = (index + 1) % PREFETCH_BUFFERS;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// prefetchLoop
+//      Read ahead from the SD card for the downloads in progress
+//
+//------------------------------------------------------------------------------
+static
+void
+prefetchLoop (
+    void *
+    )
+{
+    bool busy;
+    bool counted;
+    int index;
+    SD_TRANSFER * transfer;
+    SD_VOLUME * volume;
+
+    while (1) {
+        // Fill one buffer for each download in turn.  The volumes are not
+        // removed while their downloads are read ahead.
+        xSemaphoreTake(volumesMutex, portMAX_DELAY);
+        busy = false;
+        for (index = 0; index < volumeCount; index++) {
+            volume = volumes[index];
+            sdLock(volume);
+            for (transfer = volume->prefetchList; transfer;
+                 transfer = transfer->prefetchNext)
+                busy |= prefetchFill(transfer);
+            sdUnlock(volume);
+        }
+
+        // Count the free space while no downloads are reading ahead
+        counted = false;
+        for (index = 0; (!busy) && (!counted) && (index < volumeCount); index++) {
+            volume = volumes[index];
+            sdLock(volume);
+            if (freeSpaceStale(volume)) {
+                freeSpaceCount(volume);
+                counted = true;
+            }
+            sdUnlock(volume);
+        }
+        xSemaphoreGive(volumesMutex);
+        if (counted)
+            continue;
+
+        // Wait until a buffer is sent or a new download is started
+        if (!busy)
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+//------------------------------------------------------------------------------
+// prefetchTaskStart
+//      Start the prefetch task when it is not already running
+//
+//  Returns:
+//      True if the prefetch task is running, false otherwise
+//------------------------------------------------------------------------------
+static
+bool
+prefetchTaskStart (
+    void
+    )
+{
+    if ((!prefetchTask)
+        && (xTaskCreate(prefetchLoop, "SdPrefetch", PREFETCH_TASK_STACK, NULL,
+                        PREFETCH_TASK_PRIORITY, &prefetchTask) != pdPASS))
+        prefetchTask = NULL;
+    return prefetchTask != NULL;
+}
+
+//------------------------------------------------------------------------------
+// prefetchStart
+//      Start reading ahead for a download.  The ranges must already be
+//      established in the transfer.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//
+//  Returns:
+//      True if the prefetch task is reading the file, false if the file must
+//      be read directly from the web server callback.
+//------------------------------------------------------------------------------
+bool
+prefetchStart (
+    SD_TRANSFER * transfer
+    )
+{
+    SD_VOLUME * volume;
+
+    // Start the prefetch task
+    if (!prefetchTaskStart())
+        return false;
+
+    // The read-ahead buffers are allocated with the transfer pool
+    if (!transfer->prefetchData)
+        return false;
+
+    // Add this download to the prefetch list
+    volume = transfer->volume;
+    sdLock(volume);
+    transfer->prefetchActive = true;
+    transfer->prefetchNext = volume->prefetchList;
+    volume->prefetchList = transfer;
+    sdUnlock(volume);
+    xTaskNotifyGive(prefetchTask);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// prefetchStop
+//      Stop reading ahead for a download.  The caller must hold the SD card
+//      lock.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//------------------------------------------------------------------------------
+static
+void
+prefetchStop (
+    SD_TRANSFER * transfer
+    )
+{
+    SD_TRANSFER ** previous;
+
+    // Remove this download from the prefetch list
+    for (previous = &transfer->volume->prefetchList; *previous;
+         previous = &(*previous)->prefetchNext)
+        if (*previous == transfer) {
+            *previous = transfer->prefetchNext;
+            break;
+        }
+    transfer->prefetchActive = false;
+}
+
+//------------------------------------------------------------------------------
+// prefetchRead
+//      Copy the read-ahead data into the web server's buffer.  When the
+//      prefetch task has not filled the next buffer yet, the buffer is filled
+//      here instead of waiting for the prefetch task.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//      buffer: Address of a buffer to receive the data
+//      maxLen: Maximum number of bytes to copy
+//
+//  Returns:
+//      The number of bytes copied into the buffer or -1 when all of the data
+//      was sent or an error occurred
+//------------------------------------------------------------------------------
+static
+int
+prefetchRead (
+    SD_TRANSFER * transfer,
+    uint8_t * buffer,
+    size_t maxLen
+    )
+{
+    bool done;
+    int index;
+    size_t length;
+
+    // Check for done before checking the buffer since the buffer is filled
+    // before done is set
+    index = transfer->drainIndex;
+    portENTER_CRITICAL(&prefetchLock);
+    done = transfer->prefetchDone;
+    length = transfer->prefetchLength[index];
+    portEXIT_CRITICAL(&prefetchLock);
+    if ((!length) && (!done)) {
+        // All of the buffers are empty, the next buffer to fill is the one
+        // being drained.  The prefetch task is not reading while the SD card
+        // lock is held.
+        sdLock(transfer->volume);
+        prefetchFill(transfer);
+        sdUnlock(transfer->volume);
+        portENTER_CRITICAL(&prefetchLock);
+        length = transfer->prefetchLength[index];
+        portEXIT_CRITICAL(&prefetchLock);
+    }
+    if (!length)
+        return -1;
+
+    // Copy the data
+    length -= transfer->drainOffset;
+    if (length > maxLen)
+        length = maxLen;
+    memcpy(buffer, &transfer->prefetchData[(index * PREFETCH_BUFFER_SIZE)
+                                           + transfer->drainOffset], length);
+    transfer->drainOffset += length;
+
+    // Return the empty buffer to the prefetch task
+    if (transfer->drainOffset >= transfer->prefetchLength[index]) {
+        transfer->drainOffset = 0;
+        transfer->drainIndex = (index + 1) % PREFETCH_BUFFERS;
+        portENTER_CRITICAL(&prefetchLock);
+        transfer->prefetchLength[index] = 0;
+        portEXIT_CRITICAL(&prefetchLock);
+        xTaskNotifyGive(prefetchTask);
+    }
+    return length;
+}
+#endif  // PREFETCH_ENABLED
+
+//------------------------------------------------------------------------------
+// sdCardSize
+//      Get the SD card size in bytes.  The SD card identity and size are read
+//      once when the SD card is first found present, later calls only call
+//      the SD_CARD_PRESENT routine.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//
+//  Returns:
+//      Returns the size of the SD card in bytes, zero (0) if the SD card is not
+//      present.
+//------------------------------------------------------------------------------
+static
+uint64_t
+sdCardSize(
+    SD_VOLUME * volume
+    )
+{
+    // Verify that the SD card is present, the contents change when the SD
+    // card is removed.  The generation changes once upon removal and once
+    // upon insertion, not on each call while the SD card is missing.
+    if (!volume->cardPresent()) {
+        if (volume->cardBytes) {
+            volume->sdGeneration += 1;
+            volume->cardBytes = 0;
+            volume->cardFreeClusters = -1;
+            memset(&volume->cardCid, 0, sizeof(volume->cardCid));
+        }
+        return 0;
+    }
+
+    // Get the SD card identity and size
+    if (!volume->cardBytes) {
+        sdLock(volume);
+        sdCardIdentify(volume);
+        sdUnlock(volume);
+    }
+
+    // Count the free space in the background
+#ifdef PREFETCH_ENABLED
+    if (freeSpaceStale(volume) && prefetchTaskStart())
+        xTaskNotifyGive(prefetchTask);
+#endif  // PREFETCH_ENABLED
+    return volume->cardBytes;
+}
+
+//------------------------------------------------------------------------------
+// sendBusy
+//      Tell the browser that all of the transfers are in use
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      request: Address of the AsyncWebServerRequest object
+//------------------------------------------------------------------------------
+void
+sendBusy (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request
+    )
+{
+    AsyncWebServerResponse * response;
+
+    volume->metrics.errors[ME_BUSY] += 1;
+    response = request->beginResponse_P(503, "text/html", too_many_transfers_html);
+    response->addHeader("Retry-After", RETRY_AFTER_SECONDS);
+    request->send(response);
+}
+
+//------------------------------------------------------------------------------
+// transferCancel
+//      Stop reading ahead and close the files of a transfer, removing the
+//      partial file of an upload that did not complete.  The response ends
+//      with the data already read.  The caller must hold the SD card lock.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object
+//------------------------------------------------------------------------------
+static
+void
+transferCancel (
+    SD_TRANSFER * transfer
+    )
+{
+#ifdef PREFETCH_ENABLED
+    prefetchStop(transfer);
+#endif  // PREFETCH_ENABLED
+#ifdef RESPONSE_TRY_AGAIN
+    transfer->follow = false;
+#endif  // RESPONSE_TRY_AGAIN
+
+    // The upload file is closed after it is renamed, remove the partial
+    // file of an upload that did not complete
+    if (transfer->upload && transfer->file.isOpen()) {
+        transfer->file.remove();
+        transfer->volume->sdGeneration += 1;
+    }
+    if (transfer->file.isOpen())
+        transfer->file.close();
+    if (transfer->dir.isOpen())
+        transfer->dir.close();
+}
+
+//------------------------------------------------------------------------------
+// volumeFree
+//      Release the state of a deleted SdCardServer instance once its last
+//      transfer is done
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//------------------------------------------------------------------------------
+static
+void
+volumeFree (
+    SD_VOLUME * volume
+    )
+{
+    int index;
+
+    // Done with the SD card lock when no other instance uses it
+#ifdef PREFETCH_ENABLED
+    xSemaphoreTake(volumesMutex, portMAX_DELAY);
+    volume->cardLock->users -= 1;
+    if (!volume->cardLock->users) {
+        vSemaphoreDelete(volume->cardLock->mutex);
+        delete volume->cardLock;
+    }
+    xSemaphoreGive(volumesMutex);
+#endif  // PREFETCH_ENABLED
+
+    // Done with the transfer pool
+    if (volume->transfers) {
+#ifdef PREFETCH_ENABLED
+        if (volume->maxTransfers)
+            free(volume->transfers[0].prefetchData);
+#endif  // PREFETCH_ENABLED
+        delete[] volume->transfers;
+    }
+
+    // Done with the cached directory listings and files
+    for (index = 0; index < DIR_INDEXES; index++)
+        if (volume->dirIndexes[index])
+            indexRelease(volume, volume->dirIndexes[index]);
+    indexFree(volume->dirIndexSpare);
+    while (volume->cache)
+        cacheRemove(volume, volume->cache);
+    free(volume->cacheSpare);
+    delete volume;
+}
+
+//------------------------------------------------------------------------------
+// transferFree
+//      Close any open files and release the transfer state.  The state of a
+//      deleted SdCardServer instance is released with its last transfer.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object
+//------------------------------------------------------------------------------
+static
+void
+transferFree (
+    SD_TRANSFER * transfer
+    )
+{
+    bool release;
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+
+    // Done with the SD card
+    sdLock(volume);
+    transferCancel(transfer);
+    sdUnlock(volume);
+
+    // Done with the directory index and cached file
+    indexBuildDone(transfer, false);
+    if (transfer->index)
+        indexRelease(volume, transfer->index);
+    if (transfer->cache)
+        cacheRelease(volume, transfer->cache);
+    cacheDiscard(transfer);
+
+    // Return the transfer state to the pool
+    if (!transfer->metricsRequest)
+        histogramRecord(&volume->metrics.total, millis() - transfer->startMsec);
+    sdLock(volume);
+    transfer->inUse = false;
+    volume->activeTransfers -= 1;
+    release = volume->deleted && (!volume->activeTransfers);
+    sdUnlock(volume);
+    if (release)
+        volumeFree(volume);
+}
+
+//------------------------------------------------------------------------------
+// transferGet
+//      Get the state for a listing, download or upload from the transfer
+//      pool.  The transfer state is released by transferFree when the client
+//      disconnects.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      request: Address of the AsyncWebServerRequest object
+//
+//  Returns:
+//      Returns the address of the SD_TRANSFER object or NULL if the maximum
+//      number of transfers are already in progress
+//------------------------------------------------------------------------------
+SD_TRANSFER *
+transferGet (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request
+    )
+{
+#ifdef PREFETCH_ENABLED
+    uint8_t * prefetchData;
+#endif  // PREFETCH_ENABLED
+    SD_TRANSFER * transfer;
+
+    // Limit the number of simultaneous transfers
+    transfer = NULL;
+    if (volume->activeTransfers < volume->maxTransfers)
+        for (transfer = volume->transfers; transfer->inUse; transfer++)
+            ;
+    if (!transfer)
+        return NULL;
+    volume->activeTransfers += 1;
+
+    // Reset the transfer state, keeping the read-ahead buffers
+#ifdef PREFETCH_ENABLED
+    prefetchData = transfer->prefetchData;
+#endif  // PREFETCH_ENABLED
+    transfer->~SD_TRANSFER();
+    new (transfer) SD_TRANSFER();
+    transfer->inUse = true;
+    transfer->volume = volume;
+#ifdef PREFETCH_ENABLED
+    transfer->prefetchData = prefetchData;
+#endif  // PREFETCH_ENABLED
+
+    // Initialize the transfer state
+    transfer->lineBufferData = transfer->lineBuffer;
+    transfer->lineBufferDataEnd = transfer->lineBuffer;
+    transfer->sdCardEmpty = 1;
+    transfer->state = LS_HEADER;
+    transfer->startMsec = millis();
+    transfer->clientAddress = (uint32_t)request->client()->remoteIP();
+    transfer->rateMsec = transfer->startMsec;
+
+    // Release the transfer state when the request is complete.  The
+    // disconnect event is always delivered, both when the response completes
+    // and when the client aborts the transfer, and the response routine is
+    // not called again after this event.
+    request->onDisconnect([transfer]() {
+        transferFree(transfer);
+    });
+    return transfer;
+}
+
+//------------------------------------------------------------------------------
+// transferAllocate
+//      Get the state for a listing or download from the transfer pool.  The
+//      transfer state is released by transferFree when the client
+//      disconnects.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      request: Address of the AsyncWebServerRequest object
+//
+//  Returns:
+//      Returns the address of the SD_TRANSFER object or NULL if the maximum
+//      number of transfers are already in progress.  An error page is sent to
+//      the browser upon failure.
+//------------------------------------------------------------------------------
+SD_TRANSFER *
+transferAllocate (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request
+    )
+{
+    SD_TRANSFER * transfer;
+
+    transfer = transferGet(volume, request);
+    if (!transfer)
+        sendBusy(volume, request);
+    return transfer;
+}
+
+#ifdef RESPONSE_TRY_AGAIN
+//------------------------------------------------------------------------------
+// scheduleGrant
+//      Determine how much data a listing or download may send now.  Each
+//      stream may send SD_CARD_SERVER_STREAM_QUOTA bytes in a round, the next
+//      round starts when all of the streams used their quota or after
+//      SD_CARD_SERVER_ROUND_MSEC.  A stream that used its quota sends
+//      SCHEDULE_MIN_GRANT bytes per buffer until the next round, so a large
+//      download shares the SD card and the network with the other transfers
+//      without waiting for the web server to call again.  The bytes sent to
+//      each client are also limited to SD_CARD_SERVER_CLIENT_RATE per second
+//      when defined.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object
+//      maxLen: Size of the response buffer
+//
+//  Returns:
+//      The number of bytes that may be sent, zero (0) only when the client
+//      rate limit requires the stream to wait
+//------------------------------------------------------------------------------
+static
+size_t
+scheduleGrant (
+    SD_TRANSFER * transfer,
+    size_t maxLen
+    )
+{
+#if SD_CARD_SERVER_CLIENT_RATE
+    int clients;
+    uint32_t elapsed;
+    int index;
+    uint32_t share;
+#endif  // SD_CARD_SERVER_CLIENT_RATE
+    size_t grant;
+    uint32_t now;
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+
+    // Start the next round
+    now = millis();
+    if ((volume->schedExhausted >= volume->activeTransfers)
+        || ((now - volume->schedRoundStart) >= SD_CARD_SERVER_ROUND_MSEC)) {
+        volume->schedRound += 1;
+        volume->schedRoundStart = now;
+        volume->schedExhausted = 0;
+    }
+    if (transfer->schedRound != volume->schedRound) {
+        transfer->schedRound = volume->schedRound;
+        transfer->schedBytes = 0;
+    }
+
+    // Send the rest of the quota, then a segment at a time until the next
+    // round.  Bytes are never refused since the web server only calls again
+    // upon the next acknowledgement or poll.
+    grant = SCHEDULE_MIN_GRANT;
+    if ((transfer->schedBytes + grant) < SD_CARD_SERVER_STREAM_QUOTA)
+        grant = SD_CARD_SERVER_STREAM_QUOTA - transfer->schedBytes;
+    if (maxLen > grant)
+        maxLen = grant;
+
+#if SD_CARD_SERVER_CLIENT_RATE
+    // Split the client's rate between its transfers
+    clients = 0;
+    for (index = 0; index < volume->maxTransfers; index++)
+        if (volume->transfers[index].inUse
+            && (volume->transfers[index].clientAddress == transfer->clientAddress))
+            clients += 1;
+    share = SD_CARD_SERVER_CLIENT_RATE / (clients ? clients : 1);
+    if (share < RATE_MIN_GRANT)
+        share = RATE_MIN_GRANT;
+
+    // Add the tokens for the elapsed time, allowing up to a second of burst
+    elapsed = now - transfer->rateMsec;
+    if (elapsed) {
+        transfer->rateMsec = now;
+        transfer->rateTokens += (uint32_t)(((uint64_t)share * elapsed) / 1000);
+        if (transfer->rateTokens > share)
+            transfer->rateTokens = share;
+    }
+
+    // Wait for enough tokens to fill a reasonable buffer
+    if ((transfer->rateTokens < RATE_MIN_GRANT)
+        && (transfer->rateTokens < maxLen))
+        return 0;
+    if (maxLen > transfer->rateTokens)
+        maxLen = transfer->rateTokens;
+#endif  // SD_CARD_SERVER_CLIENT_RATE
+    return maxLen;
+}
+
+//------------------------------------------------------------------------------
+// scheduleUsed
+//      Account for the data sent by a listing or download
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object
+//      bytes: Number of bytes placed in the response buffer
+//------------------------------------------------------------------------------
+static
+void
+scheduleUsed (
+    SD_TRANSFER * transfer,
+    size_t bytes
+    )
+{
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+
+    if (bytes == RESPONSE_TRY_AGAIN)
+        return;
+    if ((transfer->schedBytes < SD_CARD_SERVER_STREAM_QUOTA)
+        && ((transfer->schedBytes + bytes) >= SD_CARD_SERVER_STREAM_QUOTA))
+        volume->schedExhausted += 1;
+    transfer->schedBytes += bytes;
+#if SD_CARD_SERVER_CLIENT_RATE
+    transfer->rateTokens -= (bytes < transfer->rateTokens)
+                          ? bytes : transfer->rateTokens;
+#endif  // SD_CARD_SERVER_CLIENT_RATE
+}
+#endif  // RESPONSE_TRY_AGAIN
+
+//------------------------------------------------------------------------------
+// dirHandleOpen
+//      Get an open directory from the directory handles.  A directory that is
+//      not already open is opened from the closest open parent directory,
+//      avoiding walking deep paths from the root directory on each request.
+//      The caller must hold the SD card lock.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      path: Directory path relative to the root directory
+//      length: Number of characters in the directory path
+//
+//  Returns:
+//      Returns the address of the open directory or NULL if the directory is
+//      not found
+//------------------------------------------------------------------------------
+static
+SdFile *
+dirHandleOpen (
+    SD_VOLUME * volume,
+    const char * path,
+    size_t length
+    )
+{
+    SD_DIR_HANDLE * handle;
+    size_t handleLength;
+    SD_DIR_HANDLE * parent;
+    size_t parentLength;
+    SdFile rootDir;
+    bool status;
+    uint32_t use;
+    SD_DIR_HANDLE * victim;
+    uint32_t victimUse;
+
+    if ((!length) || (length >= MAX_PATH_SIZE))
+        return NULL;
+
+    // Look for the directory or the closest parent directory
+    parent = NULL;
+    parentLength = 0;
+    for (handle = volume->dirHandles; handle < &volume->dirHandles[DIR_HANDLES]; handle++) {
+        // Close the directories opened before the SD card contents changed
+        if (handle->dir.isOpen() && (handle->generation != volume->sdGeneration))
+            handle->dir.close();
+        if (!handle->dir.isOpen())
+            continue;
+
+        handleLength = strlen(handle->path);
+        if ((handleLength > length) || strncmp(handle->path, path, handleLength))
+            continue;
+        if (handleLength == length) {
+            handle->lastUse = ++volume->dirHandleUse;
+            return &handle->dir;
+        }
+        if ((path[handleLength] == '/') && (handleLength > parentLength)) {
+            parent = handle;
+            parentLength = handleLength;
+        }
+    }
+
+    // Replace a closed or the least recently used directory, keep the parent
+    victim = NULL;
+    victimUse = 0;
+    for (handle = volume->dirHandles; handle < &volume->dirHandles[DIR_HANDLES]; handle++) {
+        if (handle == parent)
+            continue;
+        use = handle->dir.isOpen() ? handle->lastUse : 0;
+        if ((!victim) || (use < victimUse)) {
+            victim = handle;
+            victimUse = use;
+        }
+    }
+    if (victim->dir.isOpen())
+        victim->dir.close();
+
+    // Open the directory
+    memcpy(victim->path, path, length);
+    victim->path[length] = 0;
+    if (parent)
+        status = victim->dir.open(&parent->dir, &victim->path[parentLength + 1],
+                                  O_RDONLY);
+    else {
+        status = rootDir.openRoot(volume->sdFat->vol())
+              && victim->dir.open(&rootDir, victim->path, O_RDONLY);
+        if (rootDir.isOpen())
+            rootDir.close();
+    }
+    if (status && (!victim->dir.isDir())) {
+        victim->dir.close();
+        status = false;
+    }
+    if (!status)
+        return NULL;
+    victim->generation = volume->sdGeneration;
+    victim->lastUse = ++volume->dirHandleUse;
+    return &victim->dir;
+}
+
+//------------------------------------------------------------------------------
+// pathParent
+//      Get the open parent directory of a file.  The caller must hold the SD
+//      card lock.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      path: Zero terminated path relative to the root directory, without
+//            leading or trailing slashes
+//      rootDir: Address of the SdFile object to open for the files in the
+//               root directory, the caller closes this object
+//      name: Address of the variable to receive the address of the file name
+//            in the path
+//
+//  Returns:
+//      Returns the address of the open parent directory or NULL if the
+//      directory is not found
+//------------------------------------------------------------------------------
+SdFile *
+pathParent (
+    SD_VOLUME * volume,
+    const char * path,
+    SdFile * rootDir,
+    const char ** name
+    )
+{
+    const char * slash;
+
+    // Files in the root directory
+    slash = strrchr(path, '/');
+    if (!slash) {
+        *name = path;
+        return rootDir->openRoot(volume->sdFat->vol()) ? rootDir : NULL;
+    }
+
+    // Files in a subdirectory
+    *name = slash + 1;
+    return dirHandleOpen(volume, path, slash - path);
+}
+
+//------------------------------------------------------------------------------
+// pathOpen
+//      Open a file or directory on the SD card.  The caller must hold the SD
+//      card lock.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      file: Address of the SdFile object to open
+//      path: Zero terminated path relative to the root directory, without
+//            leading or trailing slashes, an empty string opens the root
+//            directory
+//      oflag: Open flags, O_RDONLY by default
+//
+//  Returns:
+//      True if the file or directory was opened, false otherwise
+//------------------------------------------------------------------------------
+bool
+pathOpen (
+    SD_VOLUME * volume,
+    SdFile * file,
+    const char * path,
+    oflag_t oflag
+    )
+{
+    SdFile * dir;
+    const char * name;
+    SdFile rootDir;
+    bool status;
+
+    // Open the root directory
+    if (!path[0])
+        return file->openRoot(volume->sdFat->vol());
+
+    // Open the file in its parent directory
+    dir = pathParent(volume, path, &rootDir, &name);
+    status = dir && file->open(dir, name, oflag);
+    if (rootDir.isOpen())
+        rootDir.close();
+    return status;
+}
+
+//------------------------------------------------------------------------------
+// listingNextEntry
+//      Get the next entry to list, either from the cached directory index or
+//      from the SD card.  Add the entries read from the SD card to the index
+//      being built.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this listing
+//
+//  Returns:
+//      True if transfer->entry and transfer->entryName describe the next
+//      entry, false at the end of the directory
+//------------------------------------------------------------------------------
+static
+bool
+listingNextEntry (
+    SD_TRANSFER * transfer
+    )
+{
+    SD_DIR_ENTRY * entry;
+    uint32_t entryNumber;
+    SD_DIR_INDEX * index;
+    uint32_t * sorted;
+    SdFile * sdFile;
+
+    // List the entries from the cached index
+    index = transfer->index;
+    if (index) {
+        if (transfer->entryIndex >= index->entryCount)
+            return false;
+        entryNumber = transfer->entryIndex++;
+        if (transfer->listDescending)
+            entryNumber = index->entryCount - 1 - entryNumber;
+        if (transfer->listSort != SORT_NONE) {
+            sorted = indexSorted(index, transfer->listSort);
+            if (sorted)
+                entryNumber = sorted[entryNumber];
+        }
+        entry = &index->entries[entryNumber];
+        transfer->entry = *entry;
+        transfer->entryName = &index->names[entry->nameOffset];
+        return true;
+    }
+
+    // Read the next entry from the SD card, the checksum sidecar files are
+    // not listed or archived
+    sdFile = &transfer->file;
+    do {
+        if (sdFile->isOpen())
+            sdFile->close();
+        if (!sdFile->openNext(&transfer->dir, O_RDONLY)) {
+            indexBuildDone(transfer, true);
+            return false;
+        }
+        sdFile->getName(transfer->nameBuffer, sizeof(transfer->nameBuffer));
+    } while ((!sdFile->isDir()) && sumSidecar(transfer, sdFile, transfer->nameBuffer));
+    entry = &transfer->entry;
+    entry->fileSize = sdFile->fileSize();
+    entry->nameOffset = 0;
+    if (!sdFile->getModifyDateTime(&entry->modifyDate, &entry->modifyTime)) {
+        entry->modifyDate = 0;
+        entry->modifyTime = 0;
+    }
+    entry->attributes = (sdFile->isDir() ? SD_ATTR_DIRECTORY : 0)
+                      | (sdFile->isHidden() ? SD_ATTR_HIDDEN : 0)
+                      | (sdFile->isReadOnly() ? SD_ATTR_READ_ONLY : 0);
+    transfer->entryName = transfer->nameBuffer;
+
+    // The archive reads the file data from the open entry
+    if (transfer->format != LF_TAR)
+        sdFile->close();
+
+    // Add the entry to the index, stop building the index if it gets too
+    // large
+    if (transfer->building && !indexAppend(transfer->building, entry,
+                                           transfer->entryName))
+        indexBuildDone(transfer, false);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// matchName
+//      Compare a file name with a pattern.  The comparison ignores case, an
+//      asterisk (*) matches any number of characters and a question mark (?)
+//      matches a single character.
+//
+//  Inputs:
+//      pattern: Zero terminated string containing the pattern
+//      name: Zero terminated string containing the file name
+//
+//  Returns:
+//      True if the name matches the pattern, false otherwise
+//------------------------------------------------------------------------------
+static
+bool
+matchName (
+    const char * pattern,
+    const char * name
+    )
+{
+    const char * retryName;
+    const char * retryPattern;
+
+    retryPattern = NULL;
+    retryName = NULL;
+    while (*name) {
+        if (*pattern == '*') {
+            // Remember where to restart when the remainder does not match
+            retryPattern = ++pattern;
+            retryName = name;
+        } else if ((*pattern == '?')
+            || (*pattern && (tolower(*pattern) == tolower(*name)))) {
+            pattern++;
+            name++;
+        } else if (retryPattern) {
+            // Let the asterisk match one more character
+            pattern = retryPattern;
+            name = ++retryName;
+        } else
+            return false;
+    }
+    while (*pattern == '*')
+        pattern++;
+    return !*pattern;
+}
+
+//------------------------------------------------------------------------------
+// listingFilter
+//      Determine if an entry matches the listing filters
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this listing
+//
+//  Returns:
+//      True if the entry should be listed, false otherwise
+//------------------------------------------------------------------------------
+static
+bool
+listingFilter (
+    SD_TRANSFER * transfer
+    )
+{
+    uint32_t dateTime;
+
+    // The archives contain only the files
+    if ((transfer->format == LF_TAR)
+        && (transfer->entry.attributes & SD_ATTR_DIRECTORY))
+        return false;
+
+    dateTime = ((uint32_t)transfer->entry.modifyDate << 16) | transfer->entry.modifyTime;
+    return (dateTime >= transfer->listFrom)
+        && (dateTime <= transfer->listTo)
+        && ((!transfer->listMatch[0])
+            || matchName(transfer->listMatch, transfer->entryName));
+}
+
+//------------------------------------------------------------------------------
+// listingFiltered
+//      Determine if any listing filters are specified
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this listing
+//
+//  Returns:
+//      True if a filter is specified, false otherwise
+//------------------------------------------------------------------------------
+static
+bool
+listingFiltered (
+    SD_TRANSFER * transfer
+    )
+{
+    return transfer->listMatch[0] || transfer->listFrom
+        || (transfer->listTo != 0xffffffff);
+}
+
+//------------------------------------------------------------------------------
+// listingNextMatch
+//      Get the next entry for this page of the listing
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this listing
+//
+//  Returns:
+//      True if transfer->entry and transfer->entryName describe the next
+//      entry, false at the end of the page
+//------------------------------------------------------------------------------
+bool
+listingNextMatch (
+    SD_TRANSFER * transfer
+    )
+{
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+
+    // Stop at the end of the page, remember if more entries follow
+    if (transfer->listLimit && (transfer->listCount >= transfer->listLimit)) {
+        if (!transfer->moreEntries)
+            while (listingNextEntry(transfer))
+                if (listingFilter(transfer)) {
+                    transfer->moreEntries = true;
+                    break;
+                }
+        return false;
+    }
+
+    // Skip the entries on the previous pages
+    while (listingNextEntry(transfer)) {
+        if (!listingFilter(transfer))
+            continue;
+        if (transfer->listSkipped < transfer->listOffset) {
+            transfer->listSkipped += 1;
+            continue;
+        }
+        transfer->listCount += 1;
+        volume->metrics.listingEntries += 1;
+        return true;
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// parseDate
+//      Convert a YYYY-MM-DD string into a FAT date
+//
+//  Inputs:
+//      value: Zero terminated string containing the date
+//      date: Address of the variable to receive the FAT date
+//
+//  Returns:
+//      True if the date is valid, false otherwise
+//------------------------------------------------------------------------------
+static
+bool
+parseDate (
+    const char * value,
+    uint16_t * date
+    )
+{
+    int day;
+    int month;
+    int year;
+
+    if ((sscanf(value, "%4d-%2d-%2d", &year, &month, &day) != 3)
+        || (year < 1980) || (year > 2107)
+        || (month < 1) || (month > 12)
+        || (day < 1) || (day > 31))
+        return false;
+    *date = ((year - 1980) << 9) | (month << 5) | day;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// listingOptions
+//      Get the paging, sorting and filtering options for the listing from the
+//      URL query parameters:
+//
+//          offset=n        Number of matching entries to skip
+//          limit=n         Maximum number of entries on the page
+//          sort=name|mtime|size
+//          order=asc|desc
+//          match=pattern   File name pattern using * and ? wildcards
+//          from=YYYY-MM-DD First modify date to list
+//          to=YYYY-MM-DD   Last modify date to list
+//          format=html|json|csv|tar
+//
+//  Inputs:
+//      request: Address of the AsyncWebServerRequest object
+//      transfer: Address of the SD_TRANSFER object for this listing
+//------------------------------------------------------------------------------
+static
+void
+listingOptions (
+    AsyncWebServerRequest * request,
+    SD_TRANSFER * transfer
+    )
+{
+    uint16_t date;
+    const char * value;
+
+    transfer->listTo = 0xffffffff;
+    if (request->hasParam("format")) {
+        value = request->getParam("format")->value().c_str();
+        if (!strcasecmp(value, "json"))
+            transfer->format = LF_JSON;
+        else if (!strcasecmp(value, "csv"))
+            transfer->format = LF_CSV;
+        else if (!strcasecmp(value, "tar"))
+            transfer->format = LF_TAR;
+    }
+    if (request->hasParam("offset"))
+        transfer->listOffset = strtoul(request->getParam("offset")->value().c_str(), NULL, 10);
+    if (request->hasParam("limit"))
+        transfer->listLimit = strtoul(request->getParam("limit")->value().c_str(), NULL, 10);
+    if (request->hasParam("sort")) {
+        value = request->getParam("sort")->value().c_str();
+        if (!strcasecmp(value, "name"))
+            transfer->listSort = SORT_NAME;
+        else if (!strcasecmp(value, "mtime"))
+            transfer->listSort = SORT_MTIME;
+        else if (!strcasecmp(value, "size"))
+            transfer->listSort = SORT_SIZE;
+    }
+    if (request->hasParam("order"))
+        transfer->listDescending = !strcasecmp(request->getParam("order")->value().c_str(), "desc");
+    if (request->hasParam("match")) {
+        strncpy(transfer->listMatch, request->getParam("match")->value().c_str(),
+                sizeof(transfer->listMatch) - 1);
+        transfer->listMatch[sizeof(transfer->listMatch) - 1] = 0;
+    }
+    if (request->hasParam("from")
+        && parseDate(request->getParam("from")->value().c_str(), &date)) {
+        transfer->listFrom = (uint32_t)date << 16;
+        strncpy(transfer->listFromText, request->getParam("from")->value().c_str(),
+                sizeof(transfer->listFromText) - 1);
+        transfer->listFromText[sizeof(transfer->listFromText) - 1] = 0;
+    }
+    if (request->hasParam("to")
+        && parseDate(request->getParam("to")->value().c_str(), &date)) {
+        transfer->listTo = ((uint32_t)date << 16) | 0xffff;
+        strncpy(transfer->listToText, request->getParam("to")->value().c_str(),
+                sizeof(transfer->listToText) - 1);
+        transfer->listToText[sizeof(transfer->listToText) - 1] = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+// listingPageLink
+//      Add a link to another page of the listing
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this listing
+//      buffer: Address of the buffer to receive the link
+//      offset: Offset of the first entry on the page
+//      linkText: Zero terminated string containing the link text
+//------------------------------------------------------------------------------
+static
+void
+listingPageLink (
+    SD_TRANSFER * transfer,
+    char * buffer,
+    uint32_t offset,
+    const char * linkText
+    )
+{
+    static const char * const sortNames[SORT_COUNT] = {"", "name", "mtime", "size"};
+    const char * match;
+
+    buffer += strlen(buffer);
+    buffer += sprintf(buffer, "<a href=\"?offset=%lu&amp;limit=%lu",
+                      (unsigned long)offset, (unsigned long)transfer->listLimit);
+    if (transfer->listSort != SORT_NONE)
+        buffer += sprintf(buffer, "&amp;sort=%s", sortNames[transfer->listSort]);
+    if (transfer->listDescending)
+        buffer += sprintf(buffer, "&amp;order=desc");
+    if (transfer->listFromText[0])
+        buffer += sprintf(buffer, "&amp;from=%s", transfer->listFromText);
+    if (transfer->listToText[0])
+        buffer += sprintf(buffer, "&amp;to=%s", transfer->listToText);
+    if (transfer->listMatch[0]) {
+        // Percent encode the pattern
+        buffer += sprintf(buffer, "&amp;match=");
+        for (match = transfer->listMatch; *match; match++)
+            if (isalnum(*match) || strchr("*?-_.~", *match))
+                *buffer++ = *match;
+            else
+                buffer += sprintf(buffer, "%%%02X", (uint8_t)*match);
+    }
+    sprintf(buffer, "\">%s</a> ", linkText);
+}
+
+//------------------------------------------------------------------------------
+// urlEncode
+//      Percent encode the characters in a file name that are not allowed in
+//      a URL path.  The UTF-8 characters are left for the browser to encode.
+//
+//  Inputs:
+//      buffer: Address of the buffer to receive the encoded name
+//      maxLen: Size of the buffer in bytes
+//      name: Zero terminated string containing the file name
+//------------------------------------------------------------------------------
+static
+void
+urlEncode (
+    char * buffer,
+    size_t maxLen,
+    const char * name
+    )
+{
+    char * bufferEnd;
+
+    bufferEnd = &buffer[maxLen - 4];
+    for (; *name && (buffer < bufferEnd); name++)
+        if (((uint8_t)*name <= ' ') || ((uint8_t)*name == 0x7f)
+            || strchr("\"#%&'<>?\\", *name))
+            buffer += sprintf(buffer, "%%%02X", (uint8_t)*name);
+        else
+            *buffer++ = *name;
+    *buffer = 0;
+}
+
+//------------------------------------------------------------------------------
+// parentLink
+//      Build the relative URL of a parent directory
+//
+//  Inputs:
+//      buffer: Address of the buffer to receive the URL
+//      levels: Number of directory levels to move up
+//------------------------------------------------------------------------------
+static
+void
+parentLink (
+    char * buffer,
+    int levels
+    )
+{
+    *buffer = 0;
+    while (levels-- > 0)
+        buffer = stpcpy(buffer, "../");
+}
+
+//------------------------------------------------------------------------------
+// buildPathLink
+//      Add the next directory of the listing path to the SD card listing page.
+//      The parent directories link to their listings.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this listing
+//      buffer: Address of a buffer to receive the directory link
+//      maxLen: Size of the buffer in bytes
+//
+//  Returns:
+//      True when the last directory in the path was added, false otherwise
+//------------------------------------------------------------------------------
+static
+bool
+buildPathLink (
+    SD_TRANSFER * transfer,
+    char * buffer,
+    size_t maxLen
+    )
+{
+    int length;
+    int levels;
+    const char * name;
+    const char * path;
+
+    // Locate the next directory
+    name = &transfer->path[transfer->pathOffset];
+    length = strcspn(name, "/");
+    if (!name[length]) {
+        // The last directory is the one being listed
+        snprintf(buffer, maxLen, sdPathEnd, name);
+        return true;
+    }
+
+    // Count the directories that follow
+    levels = 0;
+    for (path = &name[length]; *path; path++)
+        if (*path == '/')
+            levels += 1;
+
+    // Link to the parent directory
+    parentLink(transfer->volume->hrefBuffer, levels);
+    snprintf(buffer, maxLen, sdPathLink, transfer->volume->hrefBuffer, length,
+             name);
+    transfer->pathOffset += length + 1;
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// buildHtmlAnchor
+//      Start a list item on the SD card listing page with the file date and
+//      the start of the HTML anchor.  Directories link to their listing page.
+//      The item is finished by buildHtmlAnchorEnd.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      entry: Address of the SD_DIR_ENTRY object for the file
+//      name: Zero terminated string containing the file name
+//      buffer: Address of a buffer to receive the file link
+//      maxLen: Size of the buffer in bytes
+//------------------------------------------------------------------------------
+static
+void
+buildHtmlAnchor(SD_VOLUME * volume, const SD_DIR_ENTRY * entry,
+                const char * name, char * buffer, size_t maxLen) {
+    char date[24];
+
+    // Format the file date
+    sprintf(date, "%04d-%02d-%02d %02d:%02d",
+            FS_YEAR(entry->modifyDate), FS_MONTH(entry->modifyDate),
+            FS_DAY(entry->modifyDate), FS_HOUR(entry->modifyTime),
+            FS_MINUTE(entry->modifyTime));
+
+    // Build the list item containing the HTML anchor, the link is relative
+    // to the listing page
+    urlEncode(volume->hrefBuffer, sizeof(volume->hrefBuffer), name);
+    if (entry->attributes & SD_ATTR_DIRECTORY)
+        snprintf(buffer, maxLen, sdDirItem, date, volume->hrefBuffer);
+    else
+        snprintf(buffer, maxLen, sdListItem, date, volume->hrefBuffer);
+}
+
+//------------------------------------------------------------------------------
+// buildHtmlAnchorEnd
+//      Finish the list item started by buildHtmlAnchor with the file name and
+//      file size
+//
+//  Inputs:
+//      entry: Address of the SD_DIR_ENTRY object for the file
+//      name: Zero terminated string containing the file name
+//      buffer: Address of a buffer to receive the end of the list item
+//      maxLen: Size of the buffer in bytes
+//------------------------------------------------------------------------------
+static
+void
+buildHtmlAnchorEnd(const SD_DIR_ENTRY * entry, const char * name, char * buffer,
+                   size_t maxLen) {
+    char size[24];
+
+    if (entry->attributes & SD_ATTR_DIRECTORY)
+        snprintf(buffer, maxLen, sdDirItemEnd, name);
+    else {
+        sprintf(size, "%llu", (unsigned long long)entry->fileSize);
+        snprintf(buffer, maxLen, sdListItemEnd, name, size);
+    }
+}
+
+//------------------------------------------------------------------------------
+// dateToEpoch
+//      Convert a date and time into seconds since 1 Jan 1970
+//
+//  Inputs:
+//      year: Year, 1970 or later
+//      month: Month, 1 - 12
+//      day: Day of the month, 1 - 31
+//      hour: Hour, 0 - 23
+//      minute: Minute, 0 - 59
+//      second: Second, 0 - 59
+//
+//  Returns:
+//      Returns the number of seconds since 1 Jan 1970
+//------------------------------------------------------------------------------
+static
+uint32_t
+dateToEpoch (
+    int year,
+    int month,
+    int day,
+    int hour,
+    int minute,
+    int second
+    )
+{
+    uint32_t days;
+
+    // Count the days using a year that starts in March
+    if (month < 3) {
+        year -= 1;
+        month += 12;
+    }
+    days = (365 * year) + (year / 4) - (year / 100) + (year / 400)
+         + (((153 * (month - 3)) + 2) / 5) + day - 1
+         - 719468;  // Days from 1 Mar 0000 to 1 Jan 1970
+    return (days * 24 * 60 * 60) + (hour * 60 * 60) + (minute * 60) + second;
+}
+
+//------------------------------------------------------------------------------
+// fatToEpoch
+//      Convert a FAT date and time into seconds since 1 Jan 1970
+//
+//  Inputs:
+//      date: FAT date
+//      time: FAT time
+//
+//  Returns:
+//      Returns the number of seconds since 1 Jan 1970
+//------------------------------------------------------------------------------
+uint32_t
+fatToEpoch (
+    uint16_t date,
+    uint16_t time
+    )
+{
+    return dateToEpoch(FS_YEAR(date), FS_MONTH(date), FS_DAY(date),
+                       FS_HOUR(time), FS_MINUTE(time), FS_SECOND(time));
+}
+
+//------------------------------------------------------------------------------
+// httpDate
+//      Format a FAT date and time as an HTTP date.  The FAT time is the
+//      local time of the device writing the file and is sent as GMT.
+//
+//  Inputs:
+//      buffer: Address of the buffer to receive the HTTP date
+//      date: FAT date
+//      time: FAT time
+//------------------------------------------------------------------------------
+static
+void
+httpDate (
+    char * buffer,
+    uint16_t date,
+    uint16_t time
+    )
+{
+    // 1 Jan 1970 is a Thursday
+    sprintf(buffer, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+            dayNames[((fatToEpoch(date, time) / (24 * 60 * 60)) + 4) % 7],
+            FS_DAY(date), monthNames[(FS_MONTH(date) - 1) % 12], FS_YEAR(date),
+            FS_HOUR(time), FS_MINUTE(time), FS_SECOND(time));
+}
+
+//------------------------------------------------------------------------------
+// parseHttpDate
+//      Convert an HTTP date, such as "Sun, 06 Nov 1994 08:49:37 GMT", into
+//      seconds since 1 Jan 1970
+//
+//  Inputs:
+//      value: Zero terminated string containing the HTTP date
+//      seconds: Address of the variable to receive the number of seconds
+//
+//  Returns:
+//      True if the date is valid, false otherwise
+//------------------------------------------------------------------------------
+static
+bool
+parseHttpDate (
+    const char * value,
+    uint32_t * seconds
+    )
+{
+    int day;
+    int hour;
+    int minute;
+    int month;
+    char monthName[4];
+    int second;
+    int year;
+
+    if (sscanf(value, "%*[^,], %d %3s %d %d:%d:%d", &day, monthName, &year,
+               &hour, &minute, &second) != 6)
+        return false;
+    for (month = 0; month < 12; month++)
+        if (!strcasecmp(monthName, monthNames[month]))
+            break;
+    if ((month >= 12) || (year < 1970))
+        return false;
+    *seconds = dateToEpoch(year, month + 1, day, hour, minute, second);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// notModified
+//      Determine if the browser already has the current copy of the listing
+//      or file
+//
+//  Inputs:
+//      request: Address of the AsyncWebServerRequest object
+//      etag: Zero terminated string containing the entity tag
+//      modified: Modify time in seconds since 1 Jan 1970, zero if unknown
+//
+//  Returns:
+//      True if a 304 (Not Modified) response should be sent
+//------------------------------------------------------------------------------
+static
+bool
+notModified (
+    AsyncWebServerRequest * request,
+    const char * etag,
+    uint32_t modified
+    )
+{
+    uint32_t since;
+    const char * value;
+
+    // The entity tag takes precedence over the modify date
+    if (request->hasHeader("If-None-Match")) {
+        value = request->getHeader("If-None-Match")->value().c_str();
+        return (!strcmp(value, "*")) || (strstr(value, etag) != NULL);
+    }
+    return modified && request->hasHeader("If-Modified-Since")
+        && parseHttpDate(request->getHeader("If-Modified-Since")->value().c_str(),
+                         &since)
+        && (modified <= since);
+}
+
+//------------------------------------------------------------------------------
+// addValidators
+//      Add the headers that allow the browser to validate its copy of the
+//      listing or file with a conditional request
+//
+//  Inputs:
+//      response: Address of the AsyncWebServerResponse object
+//      etag: Zero terminated string containing the entity tag
+//      lastModified: Zero terminated string containing the HTTP modify date
+//                    or NULL if unknown
+//------------------------------------------------------------------------------
+static
+void
+addValidators (
+    AsyncWebServerResponse * response,
+    const char * etag,
+    const char * lastModified
+    )
+{
+    response->addHeader("ETag", etag);
+    if (lastModified)
+        response->addHeader("Last-Modified", lastModified);
+
+    // Files and listings change, validate the copy before using it
+    response->addHeader("Cache-Control", "no-cache");
+}
+
+//------------------------------------------------------------------------------
+// sendNotModified
+//      Send the 304 (Not Modified) response
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      request: Address of the AsyncWebServerRequest object
+//      etag: Zero terminated string containing the entity tag
+//      lastModified: Zero terminated string containing the HTTP modify date
+//                    or NULL if unknown
+//------------------------------------------------------------------------------
+static
+void
+sendNotModified (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request,
+    const char * etag,
+    const char * lastModified
+    )
+{
+    AsyncWebServerResponse * response;
+
+    response = request->beginResponse(304);
+    addValidators(response, etag, lastModified);
+    if (volume->serverHdrText)
+        response->addHeader("Server", volume->serverHdrText);
+    request->send(response);
+}
+
+//------------------------------------------------------------------------------
+// buildJsonEntry
+//      Add a directory entry to the JSON listing
+//
+//  Inputs:
+//      entry: Address of the SD_DIR_ENTRY object for the file
+//      name: Zero terminated string containing the file name
+//      buffer: Address of a buffer to receive the entry
+//      first: True for the first entry in the list
+//------------------------------------------------------------------------------
+static
+void
+buildJsonEntry(const SD_DIR_ENTRY * entry, const char * name, char * buffer,
+               bool first) {
+    if (!first)
+        *buffer++ = ',';
+    buffer += sprintf(buffer, "{\"name\":\"");
+    for (; *name; name++) {
+        if ((*name == '"') || (*name == '\\'))
+            *buffer++ = '\\';
+        if ((uint8_t)*name >= ' ')
+            *buffer++ = *name;
+    }
+    sprintf(buffer, "\",\"size\":%llu,\"mtime\":%lu,\"dir\":%s}\n",
+            (unsigned long long)entry->fileSize,
+            (unsigned long)fatToEpoch(entry->modifyDate, entry->modifyTime),
+            (entry->attributes & SD_ATTR_DIRECTORY) ? "true" : "false");
+}
+
+//------------------------------------------------------------------------------
+// buildCsvEntry
+//      Add a directory entry to the CSV listing
+//
+//  Inputs:
+//      entry: Address of the SD_DIR_ENTRY object for the file
+//      name: Zero terminated string containing the file name
+//      buffer: Address of a buffer to receive the entry
+//------------------------------------------------------------------------------
+static
+void
+buildCsvEntry(const SD_DIR_ENTRY * entry, const char * name, char * buffer) {
+    // Quote the names containing commas or quotes
+    if (strpbrk(name, ",\"")) {
+        *buffer++ = '"';
+        for (; *name; name++) {
+            if (*name == '"')
+                *buffer++ = '"';
+            *buffer++ = *name;
+        }
+        *buffer++ = '"';
+    } else
+        buffer += sprintf(buffer, "%s", name);
+    sprintf(buffer, ",%llu,%lu,%d\r\n",
+            (unsigned long long)entry->fileSize,
+            (unsigned long)fatToEpoch(entry->modifyDate, entry->modifyTime),
+            (entry->attributes & SD_ATTR_DIRECTORY) ? 1 : 0);
+}
+
+//------------------------------------------------------------------------------
+// listingFirstState
+//      Determine how the listing starts after the page header
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this listing
+//
+//  Returns:
+//      Returns the listing state following the header
+//------------------------------------------------------------------------------
+static
+LISTING_STATE
+listingFirstState (
+    SD_TRANSFER * transfer
+    )
+{
+    // Sorting requires the directory index, paging and filtering use the
+    // index to avoid walking the directory for each page
+    return (transfer->building
+            && ((transfer->listSort != SORT_NONE)
+                || transfer->listDescending
+                || transfer->listOffset
+                || transfer->listLimit
+                || listingFiltered(transfer)))
+         ? LS_INDEX : LS_DISPLAY_FILES;
+}
+
+//------------------------------------------------------------------------------
+// cardListing
+//      Start the listing of files on the SD card
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this listing
+//      buffer: Address of a buffer to receive the next portion of the HTML response
+//      maxLen: Maximum length of the next portion of the HTML response
+//
+//  Returns:
+//      The number of characters written to the response buffer
+//------------------------------------------------------------------------------
+static
+int
+cardListing (
+    SD_TRANSFER * transfer,
+    uint8_t * buffer,
+    size_t maxLen
+    )
+{
+    int bytesWritten;
+    int entries;
+    size_t length;
+    int levels;
+    char * lineBuffer;
+    const char * path;
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+
+    bytesWritten = 0;
+    if (maxLen && (transfer->state != LS_DONE)) {
+        lineBuffer = transfer->lineBuffer;
+        *buffer = 0;
+        do {
+            // Determine if the previous buffer was too small for all of the data
+            if (transfer->lineBufferData >= transfer->lineBufferDataEnd) {
+                // Add the next file name
+                lineBuffer[0] = 0;
+                switch (transfer->state) {
+                case LS_HEADER:
+                    // Add the header, start the body and add the heading
+                    if (transfer->format == LF_JSON)
+                        strcpy_P(lineBuffer, jsonListStart);
+                    else if (transfer->format == LF_CSV)
+                        strcpy_P(lineBuffer, csvListStart);
+                    else {
+                        sdCardSizeText(volume->htmlBuffer, volume->sdCardSizeMB);
+                        sprintf(lineBuffer, sdHeader, volume->htmlBuffer,
+                                volume->htmlBuffer);
+
+                        // Start the links to the parent directories
+                        if (transfer->path[0]) {
+                            levels = 1;
+                            for (path = transfer->path; *path; path++)
+                                if (*path == '/')
+                                    levels += 1;
+                            parentLink(volume->hrefBuffer, levels);
+                            sprintf(&lineBuffer[strlen(lineBuffer)],
+                                    sdPathStart, volume->hrefBuffer);
+                            transfer->state = LS_PATH;
+                            break;
+                        }
+                    }
+                    transfer->state = listingFirstState(transfer);
+                    break;
+
+                case LS_PATH:
+                    // Add the next directory of the path
+                    if (buildPathLink(transfer, lineBuffer, LINE_BUFFER_SIZE))
+                        transfer->state = listingFirstState(transfer);
+                    break;
+
+                case LS_INDEX:
+                    // Walk a portion of the directory to build the index, send
+                    // white space to keep the response going
+                    strcpy(lineBuffer, "\n");
+                    for (entries = 0; entries < INDEX_WALK_ENTRIES; entries++)
+                        if (!listingNextEntry(transfer))
+                            break;
+                    if (transfer->index) {
+                        // List the entries from the new index
+                        transfer->dir.close();
+                        transfer->state = LS_DISPLAY_FILES;
+                        if (!listingFiltered(transfer)) {
+                            transfer->entryIndex = transfer->listOffset;
+                            transfer->listSkipped = transfer->listOffset;
+                        }
+                    } else if (!transfer->building) {
+                        // The directory does not fit in the index, list the
+                        // entries in directory order
+                        transfer->dir.rewind();
+                        transfer->state = LS_DISPLAY_FILES;
+                    }
+                    break;
+
+                case LS_DISPLAY_FILES:
+                    // Finish the list item of the previous file
+                    if (transfer->entryPending) {
+                        transfer->entryPending = false;
+                        buildHtmlAnchorEnd (&transfer->entry,
+                                            transfer->entryName, lineBuffer,
+                                            LINE_BUFFER_SIZE);
+                        break;
+                    }
+
+                    // Add the next file name
+                    if (!listingNextMatch(transfer)) {
+                        transfer->state = LS_TRAILER;
+                        if ((!transfer->sdCardEmpty)
+                            || (transfer->format != LF_HTML)) {
+                            // No more files, at least one file displayed
+                            break;
+                        }
+
+                        // No files on the SD card
+                        strcpy_P (lineBuffer, sdNoFiles);
+                        break;
+                    }
+
+                    // Add the machine readable entry
+                    if (transfer->format == LF_JSON) {
+                        buildJsonEntry (&transfer->entry, transfer->entryName,
+                                        lineBuffer, transfer->sdCardEmpty);
+                        transfer->sdCardEmpty = 0;
+                        break;
+                    }
+                    if (transfer->format == LF_CSV) {
+                        buildCsvEntry (&transfer->entry, transfer->entryName,
+                                       lineBuffer);
+                        transfer->sdCardEmpty = 0;
+                        break;
+                    }
+
+                    // Start the list if necessary
+                    if (transfer->sdCardEmpty) {
+                        transfer->sdCardEmpty = 0;
+                        sprintf(lineBuffer, sdListStart,
+                                (unsigned long)(transfer->listOffset + 1));
+                    }
+
+                    // Add the anchor if another file exists
+                    length = strlen(lineBuffer);
+                    buildHtmlAnchor (volume, &transfer->entry, transfer->entryName,
+                                     &lineBuffer[length],
+                                     LINE_BUFFER_SIZE - length);
+                    transfer->entryPending = true;
+                    break;
+
+                case LS_TRAILER:
+                    transfer->state = LS_DONE;
+
+                    // The listing is now complete.  Access to the SD card
+                    // file system is no longer necessary.  Close the
+                    // directory which was opened in listingPage below.
+                    if (transfer->dir.isOpen())
+                        transfer->dir.close();
+
+                    // Finish the machine readable list
+                    if (transfer->format == LF_JSON) {
+                        sprintf(lineBuffer, jsonListEnd,
+                                transfer->moreEntries ? "true" : "false");
+                        break;
+                    }
+                    if (transfer->format == LF_CSV)
+                        break;
+
+                    // Finish the list if there are files listed
+                    if (!transfer->sdCardEmpty) {
+                        strcat_P(lineBuffer, htmlUlListEnd);
+                        strcat_P(lineBuffer, sdArchiveLink);
+                    }
+
+                    // Add the links to the other pages
+                    if (transfer->listOffset || transfer->moreEntries) {
+                        strcat_P(lineBuffer, sdPageLinkStart);
+                        if (transfer->listOffset)
+                            listingPageLink(transfer, lineBuffer,
+                                            (transfer->listOffset > transfer->listLimit)
+                                            ? transfer->listOffset - transfer->listLimit : 0,
+                                            "Previous");
+                        if (transfer->moreEntries)
+                            listingPageLink(transfer, lineBuffer,
+                                            transfer->listOffset + transfer->listLimit,
+                                            "Next");
+                        strcat_P(lineBuffer, sdPageLinkEnd);
+                    }
+
+                    // Finish the page body
+                    strcat_P(lineBuffer, htmlBodyEnd);
+                    break;
+
+                case LS_DONE:
+                    break;
+                }
+
+                // Set the temporary buffer length
+                transfer->lineBufferData = lineBuffer;
+                transfer->lineBufferDataEnd = &lineBuffer[strlen(lineBuffer)];
+            }
+
+            // Determine how much data will fit in the buffer
+            length = transfer->lineBufferDataEnd - transfer->lineBufferData;
+            if (length > (maxLen - bytesWritten))
+                length = maxLen - bytesWritten;
+
+            // Move more data into the buffer
+            memcpy(&buffer[bytesWritten], transfer->lineBufferData, length);
+            transfer->lineBufferData += length;
+            bytesWritten += length;
+
+        // Fill the response buffer, the line buffer holds the rest of a
+        // piece that does not fit.  Limit the directory walk to one step
+        // for each call.
+        } while ((bytesWritten < (int)maxLen)
+            && (transfer->state != LS_INDEX)
+            && ((transfer->state != LS_DONE)
+                || (transfer->lineBufferData < transfer->lineBufferDataEnd)));
+    }
+
+    // Send the remainder of the trailer
+    else if (maxLen && (transfer->lineBufferData < transfer->lineBufferDataEnd)) {
+        length = transfer->lineBufferDataEnd - transfer->lineBufferData;
+        if (length > maxLen)
+            length = maxLen;
+        memcpy(buffer, transfer->lineBufferData, length);
+        transfer->lineBufferData += length;
+        bytesWritten = length;
+    }
+
+    // Return this portion of the page to the web server for transmission
+    return bytesWritten;
+}
+
+//------------------------------------------------------------------------------
+// listingPage
+//      The requested URL matches the SD card listing page or the listing page
+//      of one of its directories
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      request: Address of the AsyncWebServerRequest object
+//      path: Address of the directory path relative to the root directory
+//      length: Number of characters in the directory path
+//
+//  Returns:
+//      One (1) if the listing was sent, zero (0) if no directory is found
+//------------------------------------------------------------------------------
+static
+int
+listingPage (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request,
+    const char * path,
+    size_t length
+    )
+{
+    const char * archiveName;
+    char etag[64];
+    SD_DIR_INDEX * index;
+    AsyncWebServerResponse * response;
+    bool status;
+    SD_TRANSFER * transfer;
+
+    if (!sdCardSize(volume))
+        // SD card not present
+        request->send_P(200, "text/html", no_sd_card_html);
+    else {
+        // Identify the listing by the SD card contents and the number of
+        // entries, the newest modify time and the total size of the
+        // directory.  The entity tag is available once the directory index
+        // is cached.
+        etag[0] = 0;
+        index = indexFind(volume, path, length);
+        if (index) {
+            sprintf(etag, "\"%08lx-%lx-%lx-%lx-%llx\"", (unsigned long)etagSeed,
+                    (unsigned long)volume->sdGeneration,
+                    (unsigned long)index->entryCount, (unsigned long)index->newest,
+                    (unsigned long long)index->totalBytes);
+            if (notModified(request, etag, 0)) {
+                sendNotModified(volume, request, etag, NULL);
+                return 1;
+            }
+        }
+
+        // Allocate the state to hold data across packets.
+        volume->metrics.listings += 1;
+        transfer = transferAllocate(volume, request);
+        if (transfer) {
+            memcpy(transfer->path, path, length);
+            transfer->path[length] = 0;
+
+            // Get the paging, sorting and filtering options
+            listingOptions(request, transfer);
+
+            // The archives are sent in directory order
+            if ((transfer->format == LF_TAR)
+                && (request->hasParam("sort") || request->hasParam("order"))) {
+                request->send(400);
+                return 1;
+            }
+
+            // List the files from the cached directory index when possible,
+            // the archives read the files while walking the directory
+            status = true;
+            if (index && (transfer->format != LF_TAR)) {
+                transfer->index = index;
+                index->references += 1;
+
+                // Without filters, go directly to the first entry on the page
+                if (!listingFiltered(transfer)) {
+                    transfer->entryIndex = transfer->listOffset;
+                    transfer->listSkipped = transfer->listOffset;
+                }
+            } else {
+                // Open the directory.  This entry must remain open after
+                // this function exits to allow the code above to access the
+                // SD card file system and send more data as buffers become
+                // available in the web server.
+                sdLock(volume);
+                status = pathOpen(volume, &transfer->dir, transfer->path);
+                if (status && (!transfer->dir.isDir())) {
+                    transfer->dir.close();
+                    status = false;
+                }
+                sdUnlock(volume);
+
+                // Directory not found
+                if ((!status) && transfer->path[0]) {
+                    volume->metrics.errors[ME_NOT_FOUND] += 1;
+                    return 0;
+                }
+
+                // Build the directory index during this listing.  Each
+                // listing builds its own index, allowing concurrent sorted
+                // listings of the same directory.
+                if (status && (transfer->format != LF_TAR)) {
+                    transfer->building = indexAllocate(volume, transfer->path);
+                }
+            }
+            if (!status) {
+                // Invalid SD card format
+                request->send_P(200, "text/html", invalid_SD_card_format_html);
+            } else {
+                // The listings are built without the template processor
+                AwsResponseFiller filler = [transfer, volume](uint8_t *buffer, size_t maxLen, size_t) -> size_t {
+                    int bytesWritten;
+                    uint32_t start;
+
+#ifdef RESPONSE_TRY_AGAIN
+                    maxLen = scheduleGrant(transfer, maxLen);
+                    if (!maxLen)
+                        return RESPONSE_TRY_AGAIN;
+#endif  // RESPONSE_TRY_AGAIN
+                    start = micros();
+                    sdLock(volume);
+                    if (transfer->format == LF_TAR)
+                        bytesWritten = archiveRead(transfer, buffer, maxLen);
+                    else
+                        bytesWritten = cardListing(transfer, buffer, maxLen);
+                    sdUnlock(volume);
+                    volume->metrics.listingUsec += micros() - start;
+                    metricsSent(transfer, bytesWritten);
+#ifdef RESPONSE_TRY_AGAIN
+                    scheduleUsed(transfer, bytesWritten);
+#endif  // RESPONSE_TRY_AGAIN
+                    return bytesWritten;
+                };
+                if (transfer->format == LF_TAR) {
+                    // Name the archive after the directory
+                    response = request->beginChunkedResponse("application/x-tar", filler);
+                    archiveName = strrchr(transfer->path, '/');
+                    archiveName = archiveName ? archiveName + 1
+                                : (transfer->path[0] ? transfer->path : "sd");
+                    snprintf(transfer->lineBuffer, LINE_BUFFER_SIZE,
+                             "attachment; filename=\"%s.tar\"", archiveName);
+                    response->addHeader("Content-Disposition", transfer->lineBuffer);
+                } else if (transfer->format == LF_JSON)
+                    response = request->beginChunkedResponse("application/json", filler);
+                else if (transfer->format == LF_CSV)
+                    response = request->beginChunkedResponse("text/csv", filler);
+                else
+                    response = request->beginChunkedResponse("text/html", filler);
+
+                // Send the response
+                if (etag[0])
+                    addValidators(response, etag, NULL);
+                if (volume->serverHdrText)
+                    response->addHeader("Server", volume->serverHdrText);
+                request->send(response);
+            }
+        }
+    }
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+// transferClose
+//      Close the file being downloaded
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//------------------------------------------------------------------------------
+void
+transferClose (
+    SD_TRANSFER * transfer
+    )
+{
+    // Done with the cached copy of the file, discard the copy being loaded
+    // when the download ends early
+    if (transfer->cache) {
+        cacheRelease(transfer->volume, transfer->cache);
+        transfer->cache = NULL;
+    }
+    cacheDiscard(transfer);
+
+    sdLock(transfer->volume);
+#ifdef PREFETCH_ENABLED
+    prefetchStop(transfer);
+#endif  // PREFETCH_ENABLED
+    transfer->file.close();
+    sdUnlock(transfer->volume);
+}
+
+//------------------------------------------------------------------------------
+// transferRead
+//      Get the next portion of the file being downloaded, either from the
+//      cached copy of the file, the read-ahead buffers or directly from the
+//      SD card
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//      buffer: Address of a buffer to receive the data
+//      maxLen: Maximum number of bytes to read
+//
+//  Returns:
+//      The number of bytes placed in the buffer or -1 at the end of the file
+//      or upon error
+//------------------------------------------------------------------------------
+int
+transferRead (
+    SD_TRANSFER * transfer,
+    uint8_t * buffer,
+    size_t maxLen
+    )
+{
+    int bytesRead;
+
+    // Copy the data from memory
+    if (transfer->cache) {
+        if (transfer->cachePosition >= transfer->cache->fileSize)
+            return -1;
+        if (maxLen > (transfer->cache->fileSize - transfer->cachePosition))
+            maxLen = transfer->cache->fileSize - transfer->cachePosition;
+        memcpy(buffer, &transfer->cache->data[transfer->cachePosition], maxLen);
+        transfer->cachePosition += maxLen;
+        return maxLen;
+    }
+
+#ifdef PREFETCH_ENABLED
+    if (transfer->prefetchActive)
+        bytesRead = prefetchRead(transfer, buffer, maxLen);
+    else
+#endif  // PREFETCH_ENABLED
+    {
+        sdLock(transfer->volume);
+        bytesRead = fileRead(transfer, buffer, maxLen);
+        sdUnlock(transfer->volume);
+    }
+    if (bytesRead <= 0)
+        return -1;
+
+    // Load the small file into the cache
+    if (transfer->cacheFill)
+        cacheFill(transfer, buffer, bytesRead);
+    return bytesRead;
+}
+
+//------------------------------------------------------------------------------
+// transferSeek
+//      Position the file at the start of the next range
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//      offset: Offset in the file
+//
+//  Returns:
+//      True if successful, false upon failure
+//------------------------------------------------------------------------------
+static
+bool
+transferSeek (
+    SD_TRANSFER * transfer,
+    uint64_t offset
+    )
+{
+    bool status;
+
+    // Position in the cached copy of the file
+    if (transfer->cache) {
+        transfer->cachePosition = offset;
+        return true;
+    }
+
+    // The prefetch task performs its own seeks
+#ifdef PREFETCH_ENABLED
+    if (transfer->prefetchActive)
+        return true;
+#endif  // PREFETCH_ENABLED
+
+    sdLock(transfer->volume);
+    status = transfer->file.seekSet(offset);
+    sdUnlock(transfer->volume);
+    return status;
+}
+
+#ifdef RESPONSE_TRY_AGAIN
+//------------------------------------------------------------------------------
+// followFile
+//      Determine if data was appended to the followed file.  The file is
+//      reopened to get the size written by the last sync of the file.  Stop
+//      following the file when it does not grow for the idle time, is
+//      removed or becomes shorter.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//------------------------------------------------------------------------------
+static
+void
+followFile (
+    SD_TRANSFER * transfer
+    )
+{
+    uint64_t fileSize;
+    uint32_t now;
+    uint64_t position;
+    bool status;
 
-                        // No files on the SD card
-                        strcpy_P (lineBuffer, sdNoFiles);
-                        break;
-                    }
+    // Limit the rate of the file size checks
+    now = millis();
+    if ((now - transfer->followPoll) < FOLLOW_POLL_MSEC)
+        return;
+    transfer->followPoll = now;
 
-                    // Start the list if necessary
-                    if (sdCardEmpty) {
-                        sdCardEmpty = 0;
-                        strcpy_P(lineBuffer, htmlUlListStart);
-                    }
+    // Get the current file size
+    position = transfer->fileSize;
+    sdLock(transfer->volume);
+    transfer->file.close();
+    status = pathOpen(transfer->volume, &transfer->file, transfer->path);
+    if (status) {
+        fileSize = transfer->file.fileSize();
+        if (fileSize < position)
+            status = false;
+        else if ((fileSize > position) && transfer->file.seekSet(position)) {
+            // Send the appended data
+            transfer->fileSize = fileSize;
+            transfer->rangeRemaining = fileSize - position;
+            transfer->followIdle = now;
+        }
+    }
+    sdUnlock(transfer->volume);
 
-                    // Add the anchor if another file exists
-                    buildHtmlAnchor (htmlPrint, &lineBuffer[strlen(lineBuffer)]);
+    // Stop following the file
+    if ((!status)
+        || ((now - transfer->followIdle) >= SD_CARD_SERVER_FOLLOW_IDLE_MSEC))
+        transfer->follow = false;
+}
+#endif  // RESPONSE_TRY_AGAIN
 
-                    // Close the file
-                    sdFile->close();
-                    delete sdFile;
-                    sdFile = NULL;
-                    break;
+//------------------------------------------------------------------------------
+// returnFile
+//      Return the next portion of the file to the web server
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//      buffer: Address of a buffer to receive the next portion of the file
+//      maxLen: Maximum length of the next portion of the file
+//
+//  Returns:
+//      The number of bytes written to the response buffer or
+//      RESPONSE_TRY_AGAIN while waiting for a followed file to grow
+//------------------------------------------------------------------------------
+static
+size_t
+returnFile(
+    SD_TRANSFER * transfer,
+    uint8_t * buffer,
+    size_t maxLen
+    )
+{
+    size_t bytesToRead;
+    int bytesRead;
+    size_t bytesWritten;
+    size_t length;
+    bool multipart;
 
-                case LS_TRAILER:
-                    // Finish the list if there are files listed
-                    if (!sdCardEmpty)
-                        strcat_P(lineBuffer, htmlUlListEnd);
+    // Done when the file is closed
+    if ((!transfer->file.isOpen()) && (!transfer->cache))
+        return 0;
 
-                    // Finish the page body
-                    strcat_P(lineBuffer, htmlBodyEnd);
-                    state = LS_DONE;
+    multipart = (transfer->rangeCount > 1);
+    bytesWritten = 0;
+    while (bytesWritten < maxLen) {
+        // Send the rest of any multipart header or trailer
+        if (transfer->lineBufferData < transfer->lineBufferDataEnd) {
+            length = transfer->lineBufferDataEnd - transfer->lineBufferData;
+            if (length > (maxLen - bytesWritten))
+                length = maxLen - bytesWritten;
+            memcpy(&buffer[bytesWritten], transfer->lineBufferData, length);
+            transfer->lineBufferData += length;
+            bytesWritten += length;
+            continue;
+        }
+
+        // Read data from the file
+        if (transfer->rangeRemaining) {
+#ifdef DEFLATE_ENABLED
+            // Compress the data into the line buffer
+            if (transfer->deflate) {
+                bytesRead = deflateRead(transfer);
+                if (bytesRead <= 0) {
+                    transferClose(transfer);
                     break;
                 }
-
-                // Set the temporary buffer length
-                lineBufferData = lineBuffer;
-                lineBufferDataEnd = &lineBuffer[strlen(lineBuffer)];
+                transfer->rangeRemaining -= bytesRead;
+                continue;
             }
+#endif  // DEFLATE_ENABLED
+            bytesToRead = maxLen - bytesWritten;
+            if (bytesToRead > transfer->rangeRemaining)
+                bytesToRead = transfer->rangeRemaining;
+            bytesRead = transferRead(transfer, &buffer[bytesWritten], bytesToRead);
 
-            // Determine how much data will fit in the buffer
-            length = lineBufferDataEnd - lineBufferData;
-            if (length > maxLen)
-                length = maxLen;
-
-            // Move more data into the buffer
-            memcpy(&buffer[bytesWritten], lineBufferData, length);
-            lineBufferData += length;
-            bytesWritten += length;
-
-        // Determine if the listing is complete, end of the page reached
-        } while (((maxLen - bytesWritten) > NEXT_ENTRY_SIZE) && (state != LS_DONE));
+            // Don't return any more bytes on error
+            if (bytesRead <= 0) {
+                transferClose(transfer);
+                break;
+            }
+            transfer->rangeRemaining -= bytesRead;
+            bytesWritten += bytesRead;
+            continue;
+        }
 
-        // The listing is now complete.  Access to the SD card file system is no
-        // longer necessary.  Close the root directory which was opened in
-        // ListingPage below.
-        if (!bytesWritten) {
-            // Done with the root directory
-            sdRootDir->close();
-            delete sdRootDir;
-            sdRootDir = NULL;
+        // Close the file when done
+        if (transfer->rangeIndex >= transfer->rangeCount) {
+#ifdef RESPONSE_TRY_AGAIN
+            // Wait for more data to be written to the file
+            if (transfer->follow) {
+                followFile(transfer);
+                if (transfer->rangeRemaining || (!transfer->follow))
+                    continue;
+                if (!bytesWritten)
+                    return RESPONSE_TRY_AGAIN;
+                break;
+            }
+#endif  // RESPONSE_TRY_AGAIN
+#ifdef DEFLATE_ENABLED
+            // Finish the compressed data
+            if (transfer->deflate) {
+                deflateFinish(transfer);
+                continue;
+            }
+#endif  // DEFLATE_ENABLED
+            if ((!multipart) || (transfer->rangeIndex > transfer->rangeCount)) {
+                transferClose(transfer);
+                break;
+            }
 
-            // Done with the line buffer
-            free(lineBuffer);
-            lineBuffer = NULL;
+            // Finish the multipart response
+            transfer->lineBufferData = transfer->lineBuffer;
+            transfer->lineBufferDataEnd = &transfer->lineBuffer[
+                sprintf(transfer->lineBuffer, byteRangeTrailer, byteRangeBoundary)];
+            transfer->rangeIndex += 1;
+            continue;
         }
 
-        // Done redirecting the output
-        delete htmlPrint;
+        // Start the next range
+        if (!transferSeek(transfer, transfer->ranges[transfer->rangeIndex].offset)) {
+            transferClose(transfer);
+            break;
+        }
+        transfer->rangeRemaining = transfer->ranges[transfer->rangeIndex].length;
+#ifdef DEFLATE_ENABLED
+        if (transfer->deflate)
+            deflateStart(transfer);
+#endif  // DEFLATE_ENABLED
+        if (multipart) {
+            transfer->lineBufferData = transfer->lineBuffer;
+            transfer->lineBufferDataEnd = &transfer->lineBuffer[
+                buildPartHeader(transfer, transfer->rangeIndex, transfer->lineBuffer)];
+        }
+        transfer->rangeIndex += 1;
     }
 
-    // Return this portion of the page to the web server for transmission
+    // Return the number of bytes read
     return bytesWritten;
 }
 
 //------------------------------------------------------------------------------
-// listingPage
-//      The requested URL matches the SD card listing page
+// downloadChunk
+//      Fill the next response buffer of a download when the scheduler allows,
+//      measuring the time the web server spent waiting for the network since
+//      the previous buffer
 //
 //  Inputs:
 //      request: Address of the AsyncWebServerRequest object
+//      transfer: Address of the SD_TRANSFER object for this download
+//      buffer: Address of the response buffer
+//      maxLen: Size of the response buffer
+//
+//  Returns:
+//      The number of bytes placed in the buffer, zero (0) when done or
+//      RESPONSE_TRY_AGAIN while waiting for a followed file to grow or the
+//      client rate limit
 //------------------------------------------------------------------------------
 static
-void
-listingPage (
-    AsyncWebServerRequest * request
+size_t
+downloadChunk (
+    AsyncWebServerRequest * request,
+    SD_TRANSFER * transfer,
+    uint8_t * buffer,
+    size_t maxLen
     )
 {
-    AsyncWebServerResponse * response;
+    size_t bytesWritten;
+    uint32_t start;
+    SD_VOLUME * volume;
 
-    if (!sdCardSize())
-        // SD card not present
-        request->send(200, "text/html", no_sd_card_html, processor);
-    else {
-        // Allocate a temporary buffer to hold data across packets.
-        lineBuffer = (char *)malloc(LINE_BUFFER_SIZE);
-        lineBufferData = lineBuffer;
-        lineBufferDataEnd = lineBuffer;
-        if (!lineBuffer) {
-            // Invalid SD card format
-            request->send(200, "text/html", memory_allocation_failed, processor);
-        } else {
-            // Open the root directory.  This entry must remain open after this
-            // function exits to allow the code above to access the SD card file
-            // system and send more data as buffers become available in the web
-            // server.
-            sdCardEmpty = 1;
-            sdRootDir = new SdFile();
-            if ((!sdRootDir) || (!sdRootDir->openRoot(sdFat->vol()))) {
-                // Done with the root directory
-                if (sdRootDir) {
-                    delete sdRootDir;
-                    sdRootDir = NULL;
-                }
+    volume = transfer->volume;
 
-                // Done with the line buffer
-                free(lineBuffer);
-                lineBuffer = NULL;
+    // Share the SD card and network with the other transfers
+#ifdef RESPONSE_TRY_AGAIN
+    maxLen = scheduleGrant(transfer, maxLen);
+    if (!maxLen)
+        return RESPONSE_TRY_AGAIN;
+#endif  // RESPONSE_TRY_AGAIN
 
-                // Invalid SD card format
-                request->send(200, "text/html", invalid_SD_card_format_html, processor);
-            } else {
-                state = LS_HEADER;
-                response = request->beginChunkedResponse("text/html", [](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
-                    return cardListing(buffer, maxLen);
-                }, processor);
+    start = micros();
+    if (transfer->chunkEndUsec)
+        volume->metrics.networkWaitUsec += start - transfer->chunkEndUsec;
+    volume->metrics.chunks += 1;
+    bytesWritten = returnFile(transfer, buffer, maxLen);
+    metricsSent(transfer, bytesWritten);
 
-                // Send the response
-                if (serverHdrText)
-                    response->addHeader("Server", serverHdrText);
-                request->send(response);
-            }
-        }
-    }
+    // The client waits for the promised length when the file can't be read
+    // or the SdCardServer was deleted.  Closing the connection here would
+    // free the request while the web server is still using it, stop sending
+    // and let the receive timeout close the connection.
+    if ((!bytesWritten) && transfer->fixedLength
+        && (transfer->rangeRemaining
+            || (transfer->rangeIndex < transfer->rangeCount)))
+        request->client()->setRxTimeout(1);
+#ifdef RESPONSE_TRY_AGAIN
+    scheduleUsed(transfer, bytesWritten);
+#endif  // RESPONSE_TRY_AGAIN
+    transfer->chunkEndUsec = micros() | 1;
+    return bytesWritten;
 }
 
+#ifdef RESPONSE_TRY_AGAIN
 //------------------------------------------------------------------------------
-// sdCardSize
-//      Get the SD card size in bytes
+// followStart
+//      Send the file starting at the requested offset, then keep the response
+//      open and send the data appended to the file.  The from parameter
+//      specifies the starting offset, a negative value starts that many bytes
+//      before the end of the file.
 //
 //  Inputs:
-//      buffer: Address of a buffer to receive the next portion of the HTML response
-//      maxLen: Maximum length of the next portion of the HTML response
-//
-//  Returns:
-//      The number of characters written to the response buffer
+//      request: Address of the AsyncWebServerRequest object
+//      transfer: Address of the SD_TRANSFER object for this download
+//      fileSize: Size of the file in bytes
 //------------------------------------------------------------------------------
 static
-int
-returnFile(
-    uint8_t * buffer,
-    size_t maxLen
+void
+followStart (
+    AsyncWebServerRequest * request,
+    SD_TRANSFER * transfer,
+    uint64_t fileSize
     )
 {
-    int bytesToRead;
-    int bytesRead;
-
-    // Read data from the file
-    bytesToRead = maxLen;
-    bytesRead = sdFile->read(buffer, bytesToRead);
+    uint64_t offset;
+    AsyncWebServerResponse * response;
+    const char * value;
+    SD_VOLUME * volume;
 
-    // Don't return any more bytes on error
-    if (bytesRead < 0)
-        bytesRead = 0;
+    volume = transfer->volume;
 
-    // Close the file when done
-    if (!bytesRead) {
-        sdFile->close();
-        delete sdFile;
-        sdFile = NULL;
+    // Determine where to start
+    offset = 0;
+    if (request->hasParam("from")) {
+        value = request->getParam("from")->value().c_str();
+        offset = strtoull((*value == '-') ? value + 1 : value, NULL, 10);
+        if (*value == '-')
+            offset = (offset < fileSize) ? fileSize - offset : 0;
+        else if (offset > fileSize)
+            offset = fileSize;
     }
 
-    // Return the number of bytes read
-    return bytesRead;
+    // Send the rest of the file, then follow the file
+    transfer->follow = true;
+    transfer->followPoll = millis();
+    transfer->followIdle = transfer->followPoll;
+    transfer->fileSize = fileSize;
+    transfer->rangeCount = 1;
+    transfer->ranges[0].offset = offset;
+    transfer->ranges[0].length = fileSize - offset;
+    response = request->beginChunkedResponse("application/octet-stream", [request, transfer](uint8_t *buffer, size_t maxLen, size_t) -> size_t {
+        return downloadChunk(request, transfer, buffer, maxLen);
+    });
+    response->addHeader("Cache-Control", "no-cache");
+    if (volume->serverHdrText)
+        response->addHeader("Server", volume->serverHdrText);
+    request->send(response);
 }
+#endif  // RESPONSE_TRY_AGAIN
 
 //------------------------------------------------------------------------------
 // fileDownload
 //      Download the specified file to the browser
 //
 //  Inputs:
+//      volume: Address of the SD_VOLUME object
 //      request: Address of the AsyncWebServerRequest object
-//      filename: Zero terminated string containing the filename to download
+//      filename: Zero terminated path of the file relative to the root directory
 //
 //  Returns:
 //      One (1) if the file is available, zero (0) if no file is found
@@ -581,70 +3835,414 @@ returnFile(
 static
 int
 fileDownload (
+    SD_VOLUME * volume,
     AsyncWebServerRequest * request,
     const char * filename
     )
 {
+    bool acceptsGzip;
+    SD_FILE_CACHE * cache;
+    bool chunked;
+    uint64_t contentLength;
+    String contentType;
+    char digest[SUM_DIGEST_SIZE * 2 + 1];
+    bool digestCached;
+    bool encoded;
+    char etag[48];
+    AwsResponseFiller filler;
     uint64_t fileSize;
+    uint32_t firstSector;
+    bool follow;
+    bool gzipFile;
+    char lastModified[32];
+    uint32_t lastSector;
+    uint16_t modifyDate;
+    uint16_t modifyTime;
+    int part;
+    bool partial;
+    int rangeCount;
+    AsyncWebServerResponse * response;
+    SD_TRANSFER * transfer;
 
-    // Download the file if requested
-    // Attempt to open the root directory
-    sdRootDir = new SdFile();
-    if ((!sdRootDir) || (!sdRootDir->openRoot(sdFat->vol()))) {
-        Serial.println("ERROR - Failed to open root directory!");
-        return 0;
+    // Allocate the download state
+    volume->metrics.downloads += 1;
+    transfer = transferAllocate(volume, request);
+    if (!transfer)
+        return 1;
+
+    // Attempt to open the compressed copy of the file when the browser
+    // accepts gzip, the transfer state is released when the request
+    // completes
+    acceptsGzip = request->hasHeader("Accept-Encoding")
+               && strstr(request->getHeader("Accept-Encoding")->value().c_str(),
+                         "gzip");
+    encoded = false;
+    follow = false;
+#ifdef RESPONSE_TRY_AGAIN
+    follow = request->hasParam("follow")
+          && strcmp(request->getParam("follow")->value().c_str(), "0");
+#endif  // RESPONSE_TRY_AGAIN
+
+    // Send the small, frequently requested files from memory without
+    // opening the file while the SD card contents are unchanged, the
+    // revalidation mode opens the file to compare it with the copy
+    cache = NULL;
+    if ((!SD_CARD_SERVER_CACHE_REVALIDATE) && (!follow)
+        && (!request->hasHeader("Range")) && sdCardSize(volume)) {
+        cache = cacheFind(volume, filename, acceptsGzip);
+        if (cache && (!cacheCurrent(volume, cache))) {
+            cacheRemove(volume, cache);
+            cache = NULL;
+        }
     }
+    if (cache) {
+        encoded = cache->gzipFile;
+        fileSize = cache->fileSize;
+        firstSector = cache->firstSector;
+        modifyDate = cache->modifyDate;
+        modifyTime = cache->modifyTime;
+    } else {
+        sdLock(volume);
+        if (acceptsGzip && (!follow) && ((strlen(filename) + 4) <= MAX_PATH_SIZE)) {
+            sprintf(transfer->path, "%s.gz", filename);
+            encoded = pathOpen(volume, &transfer->file, transfer->path);
+            if (encoded && transfer->file.isDir()) {
+                transfer->file.close();
+                encoded = false;
+            }
+        }
 
-    // Attempt to open the file
-    sdFile = new SdFile();
-    if ((!sdFile) || (!sdFile->open(sdRootDir, filename, O_RDONLY))) {
-        // File not found
-        Serial.println("ERROR - File not found!");
-        if (sdFile) {
-            delete sdFile;
-            sdFile = NULL;
+        // Attempt to open the file
+        if ((!encoded) && (!pathOpen(volume, &transfer->file, filename))) {
+            // File not found
+            sdUnlock(volume);
+            cache = cacheFind(volume, filename, acceptsGzip);
+            if (cache)
+                cacheRemove(volume, cache);
+            Serial.println("ERROR - File not found!");
+            volume->metrics.errors[ME_NOT_FOUND] += 1;
+            return 0;
         }
-        sdRootDir->close();
-        delete sdRootDir;
-        sdRootDir = NULL;
-        return 0;
+
+        // The listing page URL of a directory ends with a slash
+        if (transfer->file.isDir()) {
+            transfer->file.close();
+            sdUnlock(volume);
+            urlEncode(transfer->lineBuffer, sizeof(transfer->lineBuffer) - 1,
+                      request->url().c_str());
+            strcat(transfer->lineBuffer, "/");
+            request->redirect(transfer->lineBuffer);
+            return 1;
+        }
+        fileSize = transfer->file.fileSize();
+
+        // Send the data as it is written to the file
+#ifdef RESPONSE_TRY_AGAIN
+        if (follow) {
+            strcpy(transfer->path, filename);
+            sdUnlock(volume);
+            followStart(request, transfer, fileSize);
+            return 1;
+        }
+#endif  // RESPONSE_TRY_AGAIN
+        if (!transfer->file.getModifyDateTime(&modifyDate, &modifyTime)) {
+            modifyDate = 0;
+            modifyTime = 0;
+        }
+        firstSector = transfer->file.firstSector();
+        sdUnlock(volume);
+    }
+
+    gzipFile = encoded;
+
+    // Identify this version of the file by its size, modify time and
+    // location on the SD card
+    sprintf(etag, "\"%llx-%lx-%lx\"", (unsigned long long)fileSize,
+            (unsigned long)(((uint32_t)modifyDate << 16) | modifyTime),
+            (unsigned long)firstSector);
+
+    // Compress the text files when the entire file is requested
+#ifdef DEFLATE_ENABLED
+    if (acceptsGzip && (!encoded) && (!cache) && (!request->hasHeader("Range"))
+        && isTextFile(filename)) {
+        transfer->deflate = true;
+        encoded = true;
+    }
+#endif  // DEFLATE_ENABLED
+    if (encoded)
+        strcpy(&etag[strlen(etag) - 1], "-gz\"");
+    if (modifyDate)
+        httpDate(lastModified, modifyDate, modifyTime);
+
+    // Determine if the browser already has this version of the file
+    if (notModified(request, etag,
+                    modifyDate ? fatToEpoch(modifyDate, modifyTime) : 0)) {
+        transferClose(transfer);
+        sendNotModified(volume, request, etag, modifyDate ? lastModified : NULL);
+        return 1;
+    }
+
+    // Determine the portions of the file to send
+    transfer->fileSize = fileSize;
+    rangeCount = -1;
+    partial = request->hasHeader("Range");
+    if (partial)
+        rangeCount = parseRange(request->getHeader("Range")->value().c_str(),
+                                fileSize, transfer->ranges);
+    if (!rangeCount) {
+        // None of the requested ranges are within the file
+        transferClose(transfer);
+        volume->metrics.errors[ME_RANGE] += 1;
+        response = request->beginResponse(416);
+        sprintf(transfer->lineBuffer, "bytes */%llu", (unsigned long long)fileSize);
+        response->addHeader("Content-Range", transfer->lineBuffer);
+        request->send(response);
+        return 1;
     }
+    if (rangeCount < 0) {
+        // Send the entire file
+        partial = false;
+        rangeCount = 1;
+        transfer->ranges[0].offset = 0;
+        transfer->ranges[0].length = fileSize;
+    }
+    transfer->rangeCount = rangeCount;
+
+    // Get the SHA-256 of the entire file from the sidecar file when the
+    // client asks for the digest
+    digestCached = false;
+    if ((!partial) && (!encoded)
+        && (request->hasHeader("Want-Repr-Digest")
+            || request->hasHeader("Want-Digest"))) {
+        strcpy(transfer->path, filename);
+        transfer->sumModifyDate = modifyDate;
+        transfer->sumModifyTime = modifyTime;
+        sdLock(volume);
+        digestCached = sumLookup(transfer, SUM_SHA256, digest);
+        sdUnlock(volume);
+    }
+
+    // Send the small, frequently requested files from memory while the
+    // file's size, modify time and location are unchanged, otherwise load
+    // the file into the cache as it is sent.  Only the entire file is
+    // cached, not the ranges or the compressed data.
+    if (cache) {
+        volume->metrics.cacheHits += 1;
+        cacheAttach(transfer, cache);
+    } else if ((!partial)
+#ifdef DEFLATE_ENABLED
+        && (!transfer->deflate)
+#endif  // DEFLATE_ENABLED
+        ) {
+        cache = cacheFind(volume, filename, acceptsGzip);
+        if (cache && cacheValid(cache, gzipFile, fileSize, firstSector,
+                                modifyDate, modifyTime)) {
+            volume->metrics.cacheHits += 1;
+            cacheAttach(transfer, cache);
+        } else {
+            if (cache)
+                cacheRemove(volume, cache);
+            if ((SD_CARD_SERVER_CACHE_BYTES > 0)
+                && (fileSize <= SD_CARD_SERVER_CACHE_FILE_BYTES))
+                volume->metrics.cacheMisses += 1;
+            cacheStart(transfer, filename, acceptsGzip, gzipFile, fileSize,
+                       firstSector, modifyDate, modifyTime);
+        }
+    }
+
+    if (!transfer->cache) {
+        // Read the sectors of a contiguous file directly from the SD card
+        sdLock(volume);
+        if (transfer->file.contiguousRange(&firstSector, &lastSector))
+            transfer->contiguousSector = firstSector;
+        sdUnlock(volume);
 
-    // Close the root directory
-    sdRootDir->close();
-    delete sdRootDir;
-    sdRootDir = NULL;
+        // Read the file ahead of the web server
+#ifdef PREFETCH_ENABLED
+        prefetchStart(transfer);
+#endif  // PREFETCH_ENABLED
+    }
 
     // Return the file
-    AsyncWebServerResponse *response = request->beginChunkedResponse("application/octet-stream", [](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
-        return returnFile(buffer, maxLen);
-    });
-    fileSize = sdFile->fileSize();
-    response->addHeader("Content-Length", String((int)fileSize));
+    if (rangeCount == 1) {
+        contentType = "application/octet-stream";
+        contentLength = transfer->ranges[0].length;
+    } else {
+        // Determine the length of the multipart response
+        sprintf(transfer->lineBuffer, "multipart/byteranges; boundary=%s",
+                byteRangeBoundary);
+        contentType = transfer->lineBuffer;
+        contentLength = 0;
+        for (part = 0; part < rangeCount; part++)
+            contentLength += transfer->ranges[part].length
+                           + buildPartHeader(transfer, part, volume->htmlBuffer);
+        contentLength += sprintf(volume->htmlBuffer, byteRangeTrailer,
+                                 byteRangeBoundary);
+    }
+    filler = [request, transfer](uint8_t *buffer, size_t maxLen, size_t) -> size_t {
+        return downloadChunk(request, transfer, buffer, maxLen);
+    };
+
+    // Send the data without chunk framing when the length is known.  The
+    // length of the compressed data is not known and the web server limits
+    // the response length to size_t.
+    chunked = (contentLength > (uint64_t)(size_t)-1);
+#ifdef DEFLATE_ENABLED
+    chunked |= transfer->deflate;
+#endif  // DEFLATE_ENABLED
+    if (chunked)
+        response = request->beginChunkedResponse(contentType, filler);
+    else {
+        transfer->fixedLength = true;
+        response = request->beginResponse(contentType, (size_t)contentLength,
+                                          filler);
+    }
+    addValidators(response, etag, modifyDate ? lastModified : NULL);
+    if (digestCached) {
+        sumBase64(digest, digest);
+        sprintf(transfer->lineBuffer, "sha-256=:%s:", digest);
+        response->addHeader("Repr-Digest", transfer->lineBuffer);
+        sprintf(transfer->lineBuffer, "SHA-256=%s", digest);
+        response->addHeader("Digest", transfer->lineBuffer);
+    }
+    if (encoded) {
+        response->addHeader("Content-Encoding", "gzip");
+        response->addHeader("Vary", "Accept-Encoding");
+    }
+#ifdef DEFLATE_ENABLED
+    if (!transfer->deflate)
+#endif  // DEFLATE_ENABLED
+        response->addHeader("Accept-Ranges", "bytes");
+    if (partial) {
+        // Partial content
+        response->setCode(206);
+        if (rangeCount == 1) {
+            sprintf(transfer->lineBuffer, "bytes %llu-%llu/%llu",
+                    (unsigned long long)transfer->ranges[0].offset,
+                    (unsigned long long)(transfer->ranges[0].offset
+                                         + transfer->ranges[0].length - 1),
+                    (unsigned long long)fileSize);
+            response->addHeader("Content-Range", transfer->lineBuffer);
+        }
+    }
     request->send(response);
     return 1;
 }
 
+//------------------------------------------------------------------------------
+// sdCardPath
+//      Get the SD card path from the requested URL
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      request: Address of the AsyncWebServerRequest object
+//      length: Address of the variable to receive the length of the path
+//
+//  Returns:
+//      Returns the address of the zero terminated path relative to the root
+//      directory or NULL if the URL is not one of the SD card's web pages
+//------------------------------------------------------------------------------
+const char *
+sdCardPath (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request,
+    size_t * length
+    )
+{
+    const char * filename;
+    const char * url;
+
+    // Get the URL
+    url = (const char*)(request->url().c_str());
+
+    // Determine if this is one of the SD card's web pages
+    if (strncmp(url, volume->webPage, volume->webPageLength)
+        || (volume->webPageMissingSlash && (url[volume->webPageLength] != '/')))
+
+        // This request does not match any of the SD card's web pages
+        return NULL;
+
+    // This is one of the SD card's web pages
+    // Determine the filename, the web server has already decoded the URL
+    filename = &url[volume->webPageLength + volume->webPageMissingSlash];
+    *length = strlen(filename);
+    if (*length >= MAX_PATH_SIZE)
+        return NULL;
+    return filename;
+}
+
 //------------------------------------------------------------------------------
 // indexPage
 //      Main page for the SD card web site
 //
 //  Inputs:
+//      volume: Address of the SD_VOLUME object
 //      request: Address of the AsyncWebServerRequest object
 //------------------------------------------------------------------------------
 static
 void
 indexPage (
+    SD_VOLUME * volume,
     AsyncWebServerRequest * request
     )
 {
     const char * page;
 
     // Determine which page to send
-    page = sdCardSizeMB ? index_html : no_sd_card_html;
+    page = sdCardSize(volume) ? index_html : no_sd_card_html;
 
     // Send the response
-    request->send(200, "text/html", page, processor);
+    request->send(200, "text/html", page, [volume](const String& var) {
+        return processor(volume, var);
+    });
+}
+
+//------------------------------------------------------------------------------
+// volumeFind
+//      Locate the SdCardServer instance serving the requested URL.  The
+//      volumes are sorted by URL, so the longest URL that is a prefix of
+//      the requested URL is the last matching entry that sorts before it.
+//
+//  Inputs:
+//      request: Address of the AsyncWebServerRequest object
+//
+//  Returns:
+//      Returns the address of the SD_VOLUME object or NULL if the URL
+//      does not match any of the SD card web pages
+//------------------------------------------------------------------------------
+static
+SD_VOLUME *
+volumeFind (
+    AsyncWebServerRequest * request
+    )
+{
+    int high;
+    int low;
+    int middle;
+    const char * url;
+    SD_VOLUME * volume;
+
+    // Locate the first volume that sorts after the URL
+    url = (const char*)(request->url().c_str());
+    low = 0;
+    high = volumeCount;
+    while (low < high) {
+        middle = (low + high) / 2;
+        if (strcmp(volumes[middle]->webPage, url) <= 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    // Walk back to the longest URL that is a prefix of the requested URL
+    while (low-- > 0) {
+        volume = volumes[low];
+        if ((!strncmp(url, volume->webPage, volume->webPageLength))
+            && ((!volume->webPageMissingSlash)
+                || (url[volume->webPageLength] == '/')))
+            return volume;
+    }
+    return NULL;
 }
 
 //------------------------------------------------------------------------------
@@ -653,37 +4251,50 @@ indexPage (
 //      the URL passed to the SdCardServer constructor.  Start the SD card
 //      file download if the requested URL starts with the URL passed to
 //      the sdCardServer constructor and the file is found on the SD card.
+//      Complete the upload of a file when the uploads are allowed.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      request: Address of the AsyncWebServerRequest object
+//
+//  Returns:
+//      Zero (0) if the URL does not match the volume, non-zero if the
+//      response is sent
 //------------------------------------------------------------------------------
 static
 int
 isSdCardPage(
+    SD_VOLUME * volume,
     AsyncWebServerRequest * request
     )
 {
     const char * filename;
-    const char * url;
-
-    // Get the URL
-    url = (const char*)(request->url().c_str());
+    size_t length;
 
     // Determine if this is one of the SD card's web pages
-    if (strncmp(url, webPage, webPageLength)
-        || (webPageMissingSlash && (url[webPageLength] != '/')))
-
-        // This request does not match any of the SD card's web pages
+    filename = sdCardPath(volume, request, &length);
+    if (!filename)
         return 0;
 
-    // This is one of the SD card's web pages
-    // Determine the filename
-    filename = &url[webPageLength + webPageMissingSlash];
+    // Complete the file upload
+    if (volume->uploadsAllowed
+        && (request->method() & (HTTP_PUT | HTTP_POST)))
+        return uploadPage(volume, request, filename, length);
 
-    //  Determine which SD card web page was requested
-    if (filename[0])
-        return fileDownload(request, filename);
+    // Display the server metrics
+    if ((!length) && request->hasParam("metrics"))
+        return metricsPage(volume, request);
 
-    //  Display the listing page if requested
-    listingPage(request);
-    return 1;
+    //  Display the listing page for directories
+    if ((!length) || (filename[length - 1] == '/'))
+        return listingPage(volume, request, filename, length ? length - 1 : 0);
+
+    //  Send the checksum of the file
+    if (request->hasParam("sum"))
+        return sumPage(volume, request, filename);
+
+    //  Download the file
+    return fileDownload(volume, request, filename);
 }
 
 //------------------------------------------------------------------------------
@@ -700,8 +4311,11 @@ pageNotFound (
     AsyncWebServerRequest * request
     )
 {
+    SD_VOLUME * volume;
+
     // Display the SD card page if necessary
-    if (isSdCardPage(request))
+    volume = volumeFind(request);
+    if (volume && isSdCardPage(volume, request))
         return;
 
     // URL not found
@@ -713,21 +4327,25 @@ pageNotFound (
 //      Main page for the SD card web site
 //
 //  Inputs:
+//      volume: Address of the SD_VOLUME object
 //      request: Address of the AsyncWebServerRequest object
 //------------------------------------------------------------------------------
 static
 void
 redirectPage (
+    SD_VOLUME * volume,
     AsyncWebServerRequest * request
     )
 {
     const char * page;
 
     // Determine which page to send
-    page = sdCardSizeMB ? redirect_html : no_sd_card_html;
+    page = sdCardSize(volume) ? redirect_html : no_sd_card_html;
 
     // Send the response
-    request->send(200, "text/html", page, processor);
+    request->send(200, "text/html", page, [volume](const String& var) {
+        return processor(volume, var);
+    });
 }
 
 //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
@@ -741,6 +4359,9 @@ redirectPage (
 SdCardServer::~SdCardServer (
     )
 {
+    int index;
+    bool release;
+
     if (server) {
         // Shutdown the SD card server website
         if (webSiteHandler)
@@ -749,6 +4370,39 @@ SdCardServer::~SdCardServer (
         // Done with the server
         server = NULL;
     }
+
+    if (volume) {
+        // Stop routing the requests to this instance, the prefetch task no
+        // longer reads ahead for this instance once it is removed
+#ifdef PREFETCH_ENABLED
+        xSemaphoreTake(volumesMutex, portMAX_DELAY);
+#endif  // PREFETCH_ENABLED
+        for (index = 0; index < volumeCount; index++)
+            if (volumes[index] == volume)
+                break;
+        if (index < volumeCount) {
+            volumeCount -= 1;
+            memmove(&volumes[index], &volumes[index + 1],
+                    (volumeCount - index) * sizeof(volumes[0]));
+        }
+#ifdef PREFETCH_ENABLED
+        xSemaphoreGive(volumesMutex);
+#endif  // PREFETCH_ENABLED
+
+        // Cancel the transfers still in progress.  The web server still
+        // calls their fillers and disconnect routines, the state is released
+        // when the last transfer is freed.
+        sdLock(volume);
+        for (index = 0; index < volume->maxTransfers; index++)
+            if (volume->transfers[index].inUse)
+                transferCancel(&volume->transfers[index]);
+        volume->deleted = true;
+        release = !volume->activeTransfers;
+        sdUnlock(volume);
+        if (release)
+            volumeFree(volume);
+        volume = NULL;
+    }
 }
 
 //------------------------------------------------------------------------------
@@ -759,20 +4413,97 @@ SdCardServer::SdCardServer (
     SdFat * sd,
     SD_CARD_PRESENT sdCardPresent,
     const char * url,
-    const char * serverHeaderText
+    const char * serverHeaderText,
+    int maxTransfersInProgress,
+    bool allowUploads
     )
 {
+    int index;
+    SD_VOLUME ** newVolumes;
+#ifdef PREFETCH_ENABLED
+    uint8_t * prefetchData;
+
+    // Serialize the changes to the volumes with the prefetch task
+    if (!volumesMutex)
+        volumesMutex = xSemaphoreCreateMutex();
+#endif  // PREFETCH_ENABLED
+
+    // Allocate the state for this instance, the volumes do not share any
+    // caches, limits or metrics
+    volume = new SD_VOLUME();
+    volume->cardFreeClusters = -1;
+
+    // Serialize the SD card access between the web server and prefetch task,
+    // the instances serving the same SdFat object share the lock
+#ifdef PREFETCH_ENABLED
+    xSemaphoreTake(volumesMutex, portMAX_DELAY);
+    for (index = 0; index < volumeCount; index++)
+        if (volumes[index]->sdFat == sd) {
+            volume->cardLock = volumes[index]->cardLock;
+            break;
+        }
+    if (!volume->cardLock) {
+        volume->cardLock = new SD_CARD_LOCK();
+        volume->cardLock->mutex = xSemaphoreCreateMutex();
+    }
+    volume->cardLock->users += 1;
+    xSemaphoreGive(volumesMutex);
+#endif  // PREFETCH_ENABLED
+
+    // Allocate the state for the simultaneous listings and downloads.  No
+    // further memory is allocated by the listings and downloads, avoiding
+    // heap fragmentation.
+    volume->transfers = new (std::nothrow) SD_TRANSFER[maxTransfersInProgress]();
+    volume->maxTransfers = volume->transfers ? maxTransfersInProgress : 0;
+#ifdef PREFETCH_ENABLED
+    if (volume->transfers) {
+        // Allocate the read-ahead buffers, downloads read the SD card
+        // directly if this allocation fails
+        prefetchData = (uint8_t *)malloc(volume->maxTransfers * PREFETCH_BUFFERS
+                                         * PREFETCH_BUFFER_SIZE);
+        for (index = 0; prefetchData && (index < volume->maxTransfers); index++)
+            volume->transfers[index].prefetchData = &prefetchData[index
+                                     * PREFETCH_BUFFERS * PREFETCH_BUFFER_SIZE];
+    }
+#endif  // PREFETCH_ENABLED
+
+    // Keep the browsers from matching the listings of a previous boot
+    if (!etagSeed)
+        etagSeed = random(0x7fffffff) + 1;
+
     // Remember the SdFat object that will be used to access the SD card
-    sdFat = sd;
-    cardPresent = sdCardPresent;
+    volume->sdFat = sd;
+    volume->cardPresent = sdCardPresent;
 
     // Remember the server name to be added as an HTML header
-    serverHdrText = serverHeaderText;
+    volume->serverHdrText = serverHeaderText;
+
+    // Accept the file uploads when requested
+    volume->uploadsAllowed = allowUploads;
 
     // Save the base URL
-    webPage = url;
-    webPageLength = strlen(webPage);
-    webPageMissingSlash = (webPage[webPageLength - 1] == '/') ? 0 : 1;
+    volume->webPage = url;
+    volume->webPageLength = strlen(volume->webPage);
+    volume->webPageMissingSlash = (volume->webPage[volume->webPageLength - 1] == '/') ? 0 : 1;
+
+    // Route the requests by URL, keep the volumes sorted for volumeFind
+#ifdef PREFETCH_ENABLED
+    xSemaphoreTake(volumesMutex, portMAX_DELAY);
+#endif  // PREFETCH_ENABLED
+    newVolumes = (SD_VOLUME **)realloc(volumes, (volumeCount + 1) * sizeof(volumes[0]));
+    if (newVolumes) {
+        volumes = newVolumes;
+        for (index = volumeCount; index > 0; index--) {
+            if (strcmp(volumes[index - 1]->webPage, url) <= 0)
+                break;
+            volumes[index] = volumes[index - 1];
+        }
+        volumes[index] = volume;
+        volumeCount += 1;
+    }
+#ifdef PREFETCH_ENABLED
+    xSemaphoreGive(volumesMutex);
+#endif  // PREFETCH_ENABLED
 
     // No handlers are installed yet
     webSiteHandler = NULL;
@@ -796,7 +4527,78 @@ SdCardServer::isSdCardWebPage(
     AsyncWebServerRequest * request
     )
 {
-    return isSdCardPage(request);
+    // Only handle the URLs not served by an instance with a longer URL
+    if (volumeFind(request) != volume)
+        return 0;
+    return isSdCardPage(volume, request);
+}
+
+//------------------------------------------------------------------------------
+// sdCardFilesChanged
+//      Notify the SD card server that files were created, modified or deleted
+//      on the SD card.  The cached directory listing is rebuilt by the next
+//      listing request.
+//------------------------------------------------------------------------------
+void
+SdCardServer::sdCardFilesChanged(
+    void
+    )
+{
+    volume->sdGeneration += 1;
+}
+
+//------------------------------------------------------------------------------
+// sdCardFreeSpace
+//      Get the free space on the SD card
+//------------------------------------------------------------------------------
+int64_t
+SdCardServer::sdCardFreeSpace(
+    void
+    )
+{
+    bool background;
+
+    // Start the count in the background, or count the free space now when
+    // the prefetch task is not available
+    if (!sdCardSize(volume))
+        return -1;
+    background = false;
+#ifdef PREFETCH_ENABLED
+    background = (prefetchTask != NULL);
+#endif  // PREFETCH_ENABLED
+    if ((!background) && freeSpaceStale(volume)) {
+        sdLock(volume);
+        freeSpaceCount(volume);
+        sdUnlock(volume);
+    }
+    if (volume->cardFreeClusters < 0)
+        return -1;
+    return (int64_t)volume->cardFreeClusters * volume->cardClusterBytes;
+}
+
+//------------------------------------------------------------------------------
+// sdCardMetrics
+//      Get the server metrics
+//------------------------------------------------------------------------------
+void
+SdCardServer::sdCardMetrics(
+    String * text,
+    bool json
+    )
+{
+    char buffer[METRICS_LINE_SIZE * 4];
+    size_t length;
+    size_t offset;
+    SD_METRICS_SNAPSHOT snapshot;
+
+    metricsSnapshot(volume, &snapshot, json);
+    offset = 0;
+    do {
+        length = metricsRead(&snapshot, offset, buffer, sizeof(buffer) - 1);
+        buffer[length] = 0;
+        *text += buffer;
+        offset += length;
+    } while (length == (sizeof(buffer) - 1));
 }
 
 //------------------------------------------------------------------------------
@@ -817,12 +4619,12 @@ SdCardServer::sdCardListingWebPageLink(
 
     // Determine the amount of space necessary to build the anchor link
     sizeNeeded = 2 + (options && *options ? ((*options != ' ') ? 1 : 0) : 0)
-               + (options ? strlen(options) : 0) + 6 + strlen(webPage) + 2
+               + (options ? strlen(options) : 0) + 6 + strlen(volume->webPage) + 2
                + strlen(linkText) + 4 + 1;
 
     // Add the link only if it fits
     initialLength = strlen(buffer);
-    if (maxLen >= sizeNeeded) {
+    if (maxLen >= (size_t)sizeNeeded) {
         strcat(buffer, "<a");
         if (options && *options) {
             if (*options != ' ')
@@ -830,7 +4632,7 @@ SdCardServer::sdCardListingWebPageLink(
             strcat(buffer, options);
         }
         strcat(buffer, " href=\"");
-        strcat(buffer, webPage);
+        strcat(buffer, volume->webPage);
         strcat(buffer, "\">");
         strcat(buffer, linkText);
         strcat(buffer, "</a>");
@@ -858,23 +4660,25 @@ SdCardServer::sdCardWebSite(
     this->server = server;
 
     // Determine if the SD card is present
-    sdCardSize();
+    sdCardSize(volume);
 
     // Send the response
     if (redirect)
-        webSiteHandler = &(server->on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-            redirectPage (request);
+        webSiteHandler = &(server->on("/", HTTP_GET, [this](AsyncWebServerRequest *request) {
+            redirectPage (volume, request);
         }));
     else
-        webSiteHandler = &(server->on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-            indexPage (request);
+        webSiteHandler = &(server->on("/", HTTP_GET, [this](AsyncWebServerRequest *request) {
+            indexPage (volume, request);
         }));
 }
 
 //------------------------------------------------------------------------------
 // onNotFound
 //      Add the request not found event.  This event handles the SD card
-//      requests for listing and file download.
+//      requests for listing and file download.  When one of the
+//      SdCardServer objects allows uploads, the request body event is also
+//      added to handle the file uploads.
 //
 //      Call this routine if and only if the AsyncWebServer.onNotFound event
 //      handler is not delared by the code calling SdCardServer.  The call
@@ -885,6 +4689,9 @@ SdCardServer::onNotFound (
     AsyncWebServer * server
     )
 {
+    bool uploads;
+    int index;
+
     // Save the server address
     this->server = server;
 
@@ -892,4 +4699,42 @@ SdCardServer::onNotFound (
     server->onNotFound([](AsyncWebServerRequest *request) {
         pageNotFound(request);
     });
+
+    // Leave the request body event to the application when no volume
+    // accepts uploads
+    uploads = false;
+    for (index = 0; index < volumeCount; index++)
+        uploads |= volumes[index]->uploadsAllowed;
+    if (!uploads)
+        return;
+
+    // Write the uploaded files to the SD card
+    server->onRequestBody([](AsyncWebServerRequest *request, uint8_t *data,
+                             size_t len, size_t index, size_t total) {
+        SD_VOLUME * volume;
+
+        volume = volumeFind(request);
+        if (volume)
+            uploadBody(volume, request, data, len, index, total);
+    });
+}
+
+//------------------------------------------------------------------------------
+// isSdCardUpload
+//      Write the next portion of a PUT or POST request body to the SD card.
+//      This routine is designed to be called from the
+//      server.onRequestBody event routine.
+//------------------------------------------------------------------------------
+void
+SdCardServer::isSdCardUpload (
+    AsyncWebServerRequest * request,
+    uint8_t * data,
+    size_t len,
+    size_t index,
+    size_t total
+    )
+{
+    // Only handle the URLs not served by an instance with a longer URL
+    if (volumeFind(request) == volume)
+        uploadBody(volume, request, data, len, index, total);
 }
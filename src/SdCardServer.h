@@ -10,6 +10,15 @@
 #include <ESPAsyncWebServer.h>  //Get from: https://github.com/me-no-dev/ESPAsyncWebServer
 #include "SdFat.h" //http://librarymanager/All#sdfat_exfat by Bill Greiman. Currently uses v2.1.1
 
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+// Default maximum number of simultaneous listings and downloads
+#ifndef SD_CARD_SERVER_MAX_TRANSFERS
+#define SD_CARD_SERVER_MAX_TRANSFERS    4
+#endif  // SD_CARD_SERVER_MAX_TRANSFERS
+
 //------------------------------------------------------------------------------
 // SD_CARD_PRESENT
 //      Determine if the SD card is present and ready for use.  This routine
@@ -28,11 +37,17 @@ int
     void
     );
 
+struct _SD_VOLUME;
+
 class SdCardServer
 {
 private:
     AsyncWebServer * server;
 
+    // SD card, transfer pool, caches and metrics of this instance,
+    // allocated by the constructor
+    struct _SD_VOLUME * volume;
+
     // Handlers
     AsyncCallbackWebHandler * webSiteHandler;   // Handler for web site main page
 
@@ -56,12 +71,19 @@ public:
     //          This web page will list the files on the SD card.
     //      serverHeaderText: Zero terminated string containing the server name
     //          that is added as an optional html header.
+    //      maxTransfersInProgress: Maximum number of listings, downloads and
+    //          uploads that may be in progress at the same time.  Additional
+    //          requests receive a 503 (Service Unavailable) response.
+    //      allowUploads: Write the body of the PUT and POST requests to the
+    //          file on the SD card.
     //--------------------------------------------------------------------------
     SdCardServer (
         SdFat * sd,
         SD_CARD_PRESENT sdCardPresent,
         const char * url,
-        const char * serverHeaderText = NULL
+        const char * serverHeaderText = NULL,
+        int maxTransfersInProgress = SD_CARD_SERVER_MAX_TRANSFERS,
+        bool allowUploads = false
         );
 
     //--------------------------------------------------------------------------
@@ -87,6 +109,81 @@ public:
         AsyncWebServerRequest * request
         );
 
+    //--------------------------------------------------------------------------
+    // isSdCardUpload
+    //      Write the next portion of a PUT or POST request body to the SD card
+    //      when the requested URL starts with the URL passed to the
+    //      SdCardServer constructor and the uploads are allowed.  The upload
+    //      response is sent by isSdCardWebPage after the entire body is
+    //      received.
+    //
+    //      This routine is designed to be called from the server.onRequestBody
+    //      event routine.
+    //
+    //  Inputs:
+    //      request: Address of the AsyncWebServerRequest object
+    //      data: Address of the data received
+    //      len: Number of bytes received
+    //      index: Offset of the data in the request body
+    //      total: Number of bytes in the request body
+    //--------------------------------------------------------------------------
+    void
+    isSdCardUpload (
+        AsyncWebServerRequest * request,
+        uint8_t * data,
+        size_t len,
+        size_t index,
+        size_t total
+        );
+
+    //--------------------------------------------------------------------------
+    // sdCardFilesChanged
+    //      Notify the SD card server that files were created, modified or
+    //      deleted on the SD card.  Call this routine after writing to the SD
+    //      card so that the cached directory listing is rebuilt by the next
+    //      listing request and the cached small files are checked against the
+    //      SD card by the next download.
+    //--------------------------------------------------------------------------
+    void
+    sdCardFilesChanged(
+        void
+        );
+
+    //--------------------------------------------------------------------------
+    // sdCardFreeSpace
+    //      Get the free space on the SD card.  Counting the free space reads
+    //      the entire file allocation table, which may take seconds.  On the
+    //      ESP32 the count is made in the background by the SdPrefetch task
+    //      and this routine returns the last count.  Otherwise the count is
+    //      made by this routine when the SD card contents changed.
+    //
+    //  Returns:
+    //      Returns the number of free bytes, -1 if the SD card is not present
+    //      or the free space is not counted yet.
+    //--------------------------------------------------------------------------
+    int64_t
+    sdCardFreeSpace(
+        void
+        );
+
+    //--------------------------------------------------------------------------
+    // sdCardMetrics
+    //      Get the server metrics: transfers in progress, requests, bytes
+    //      sent, SD card read and network wait times, listing rate, errors by
+    //      type, heap low water mark and the time to first byte and total
+    //      transfer time histograms.  The same text is returned by the SD card
+    //      listing URL followed by ?metrics or ?metrics=json.
+    //
+    //  Inputs:
+    //      text: Address of the String object to receive the metrics
+    //      json: True for JSON, false for the Prometheus text format
+    //--------------------------------------------------------------------------
+    void
+    sdCardMetrics(
+        String * text,
+        bool json = false
+        );
+
     //--------------------------------------------------------------------------
     // sdCardListingWebPageLink
     //      Add a link (HTML anchor) to an existing web page.  The link points
@@ -131,7 +228,9 @@ public:
     //--------------------------------------------------------------------------
     // onNotFound
     //      Add the request not found event.  This event handles the SD card
-    //      requests for listing and file download.
+    //      requests for listing and file download.  When one of the
+    //      SdCardServer objects allows uploads, the request body event is also
+    //      added to handle the file uploads.
     //
     //      Call this routine if and only if the AsyncWebServer.onNotFound event
     //      handler is not delared by the code calling SdCardServer.  The call
@@ -0,0 +1,798 @@
+// Arduino SD Card Server Library
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Definitions shared by the SdCardServer translation units
+
+#ifndef SD_CARD_SERVER_PRIVATE_H_INCLUDED
+#define SD_CARD_SERVER_PRIVATE_H_INCLUDED
+
+#include <malloc.h>
+#include <new>
+#include <stdarg.h>
+#include <string.h>
+
+#include "SdCardServer.h"
+
+// Read ahead on a separate task when the web server supports retrying the
+// response callback later
+#if defined(ESP32) && defined(RESPONSE_TRY_AGAIN) && !defined(SD_CARD_SERVER_NO_PREFETCH)
+#define PREFETCH_ENABLED
+#include "freertos/semphr.h"
+#endif
+
+// Compress the text files for the browsers that accept gzip
+#ifdef SD_CARD_SERVER_DEFLATE
+#define DEFLATE_ENABLED
+#endif
+
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Constants
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+#define MAX_FILE_NAME_SIZE      (256 * 3)   // File names are 255 UTF-8 characters
+#define MAX_PATH_SIZE           256     // Path below the SD card web page URL
+
+#define LINE_BUFFER_SIZE        1024    // Buffer to hold line across packets
+
+#define MAX_BYTE_RANGES         8       // Ranges supported in a Range header
+
+#define PREFETCH_BUFFERS        2       // Read-ahead buffers per download
+#define PREFETCH_BUFFER_SIZE    (4 * 512)   // Sector multiple
+#define PREFETCH_TASK_PRIORITY  2       // Below the async_tcp task (3)
+#define PREFETCH_TASK_STACK     4096
+
+#define TAR_BLOCK_SIZE          512     // Archive header and data alignment
+#define TAR_NAME_SIZE           100     // Name field in the archive header
+
+#define DEFLATE_WINDOW_SIZE     2048    // Match distance, power of 2
+#define DEFLATE_HASH_BITS       9
+#define DEFLATE_HASH_SIZE       (1 << DEFLATE_HASH_BITS) // Match positions
+#define DEFLATE_INPUT_SIZE      512     // File bytes compressed per step
+#define DEFLATE_MIN_MATCH       3
+#define DEFLATE_MAX_MATCH       258
+
+#define UPLOAD_SUFFIX           ".part" // Name of the file being uploaded
+#define UPLOAD_SUFFIX_LENGTH    (sizeof(UPLOAD_SUFFIX) - 1)
+
+#define SUM_SUFFIX              ".sum"  // Sidecar holding the file checksums
+#define SUM_SUFFIX_LENGTH       (sizeof(SUM_SUFFIX) - 1)
+#define SUM_DIGEST_SIZE         32      // Largest digest, SHA-256
+#define SUM_ENTRIES             4       // Checksums kept in memory
+
+// Time spent hashing the file in each response callback
+#ifndef SD_CARD_SERVER_SUM_MSEC
+#define SD_CARD_SERVER_SUM_MSEC 50
+#endif  // SD_CARD_SERVER_SUM_MSEC
+
+#define FOLLOW_POLL_MSEC        500     // Time between file size checks
+
+// Time to wait for the followed file to grow before ending the response
+#ifndef SD_CARD_SERVER_FOLLOW_IDLE_MSEC
+#define SD_CARD_SERVER_FOLLOW_IDLE_MSEC (60 * 1000)
+#endif  // SD_CARD_SERVER_FOLLOW_IDLE_MSEC
+
+// Bytes each stream may send in a scheduling round while other streams are
+// active, and the maximum length of a round
+#ifndef SD_CARD_SERVER_STREAM_QUOTA
+#define SD_CARD_SERVER_STREAM_QUOTA     (32 * 1024)
+#endif  // SD_CARD_SERVER_STREAM_QUOTA
+
+#ifndef SD_CARD_SERVER_ROUND_MSEC
+#define SD_CARD_SERVER_ROUND_MSEC       100
+#endif  // SD_CARD_SERVER_ROUND_MSEC
+
+// Maximum bytes per second sent to a single client, 0 = no limit
+#ifndef SD_CARD_SERVER_CLIENT_RATE
+#define SD_CARD_SERVER_CLIENT_RATE      0
+#endif  // SD_CARD_SERVER_CLIENT_RATE
+
+#define SCHEDULE_MIN_GRANT      1436    // One TCP segment, sent after the quota
+#define RATE_MIN_GRANT          512     // Smallest rate limited response buffer
+
+#define RETRY_AFTER_SECONDS     "2"     // Retry-After value when all transfers are busy
+
+// Minimum time between free space counts after the SD card contents change
+#ifndef SD_CARD_SERVER_FREE_SPACE_MSEC
+#define SD_CARD_SERVER_FREE_SPACE_MSEC  (60 * 1000)
+#endif  // SD_CARD_SERVER_FREE_SPACE_MSEC
+
+// Maximum memory used by the cached directory indexes of each SdCardServer
+#ifndef SD_CARD_SERVER_INDEX_BYTES
+#ifdef BOARD_HAS_PSRAM
+#define SD_CARD_SERVER_INDEX_BYTES  (1024 * 1024)
+#else   // BOARD_HAS_PSRAM
+#define SD_CARD_SERVER_INDEX_BYTES  (32 * 1024)
+#endif  // BOARD_HAS_PSRAM
+#endif  // SD_CARD_SERVER_INDEX_BYTES
+
+// Maximum memory used by the cached small files of each SdCardServer, 0 = no
+// cache, and the largest file kept in the cache
+#ifndef SD_CARD_SERVER_CACHE_BYTES
+#ifdef BOARD_HAS_PSRAM
+#define SD_CARD_SERVER_CACHE_BYTES  (512 * 1024)
+#else   // BOARD_HAS_PSRAM
+#define SD_CARD_SERVER_CACHE_BYTES  (16 * 1024)
+#endif  // BOARD_HAS_PSRAM
+#endif  // SD_CARD_SERVER_CACHE_BYTES
+
+#ifndef SD_CARD_SERVER_CACHE_FILE_BYTES
+#ifdef BOARD_HAS_PSRAM
+#define SD_CARD_SERVER_CACHE_FILE_BYTES (64 * 1024)
+#else   // BOARD_HAS_PSRAM
+#define SD_CARD_SERVER_CACHE_FILE_BYTES (4 * 1024)
+#endif  // BOARD_HAS_PSRAM
+#endif  // SD_CARD_SERVER_CACHE_FILE_BYTES
+
+// Open the file on each cache hit to verify that the file was not changed
+// without calling sdCardFilesChanged, 0 = send the hits without SD card reads
+#ifndef SD_CARD_SERVER_CACHE_REVALIDATE
+#define SD_CARD_SERVER_CACHE_REVALIDATE 0
+#endif  // SD_CARD_SERVER_CACHE_REVALIDATE
+
+#define INDEX_ENTRIES_INCREMENT 64      // Entries added when the index grows
+#define INDEX_NAMES_INCREMENT   1024    // Name bytes added when the index grows
+
+#define INDEX_WALK_ENTRIES      32      // Entries indexed per listing callback
+#define DIR_HANDLES             4       // Directories kept open, at least 2
+#define DIR_INDEXES             4       // Directory indexes kept in memory
+#define MAX_MATCH_SIZE          64      // Size of the file name filter pattern
+
+#define METRICS_BUCKETS         11      // Latency histogram buckets before +Inf
+#define METRICS_LINE_SIZE       160     // Longest line of the metrics page
+
+// SD_DIR_ENTRY attributes
+#define SD_ATTR_DIRECTORY       1
+#define SD_ATTR_HIDDEN          2
+#define SD_ATTR_READ_ONLY       4
+
+typedef enum {
+    LS_HEADER = 0,
+    LS_PATH,
+    LS_INDEX,
+    LS_DISPLAY_FILES,
+    LS_TRAILER,
+    LS_DONE
+} LISTING_STATE;
+
+typedef enum {
+    LF_HTML = 0,                        // Web page for browsers
+    LF_JSON,                            // JSON for automated collectors
+    LF_CSV,                             // CSV for automated collectors
+    LF_TAR                              // Archive of the files
+} LISTING_FORMAT;
+
+typedef enum {
+    SUM_NONE = 0,                       // Not computing a checksum
+    SUM_CRC32,                          // CRC-32 as used by gzip and zip
+    SUM_SHA256,                         // SHA-256
+    SUM_COUNT
+} SUM_TYPE;
+
+typedef enum {
+    ME_NOT_FOUND = 0,                   // File or directory not found
+    ME_BUSY,                            // All of the transfers in use
+    ME_RANGE,                           // Range not satisfiable
+    ME_READ,                            // SD card read failure
+    ME_UPLOAD,                          // Upload failure
+    ME_COUNT
+} METRICS_ERROR;
+
+//------------------------------------------------------------------------------
+// SD_HISTOGRAM
+//      Latency histogram with fixed bucket bounds
+//------------------------------------------------------------------------------
+typedef struct _SD_HISTOGRAM {
+    uint32_t count[METRICS_BUCKETS + 1];// Samples in each bucket, last is +Inf
+    uint64_t sumMsec;                   // Sum of the samples
+} SD_HISTOGRAM;
+
+//------------------------------------------------------------------------------
+// SD_METRICS
+//      Counters describing the server activity since boot
+//------------------------------------------------------------------------------
+typedef struct _SD_METRICS {
+    uint32_t downloads;                 // Download requests
+    uint32_t listings;                  // Listing requests
+    uint32_t uploads;                   // Upload requests
+    uint32_t sums;                      // Checksum requests
+    uint32_t sumsCached;                // Checksums found in the sidecar files
+    uint32_t cacheHits;                 // Downloads sent from the file cache
+    uint32_t cacheMisses;               // Small file downloads read from the SD card
+    uint64_t bytesSent;                 // Listing and download bytes sent
+    uint32_t chunks;                    // Download callbacks from the web server
+    uint64_t networkWaitUsec;           // Time between the download callbacks
+    uint32_t sdReads;                   // Reads of the downloaded files
+    uint64_t sdReadUsec;                // Time reading the downloaded files
+    uint32_t listingEntries;            // Entries sent in the listings
+    uint64_t listingUsec;               // Time building the listings
+    uint32_t errors[ME_COUNT];          // Errors by type
+    SD_HISTOGRAM firstByte;             // Time to first byte
+    SD_HISTOGRAM total;                 // Total transfer time
+} SD_METRICS;
+
+//------------------------------------------------------------------------------
+// SD_METRICS_SNAPSHOT
+//      Copy of the metrics taken when a metrics request arrives
+//------------------------------------------------------------------------------
+typedef struct _SD_METRICS_SNAPSHOT {
+    SD_METRICS metrics;                 // Server activity since boot
+    int activeTransfers;                // Transfers in progress
+    size_t cacheBytes;                  // File bytes in the cache
+    int64_t freeBytes;                  // Free space on the SD card, -1 = not known
+    uint32_t heapMinFree;               // Heap low water mark, ESP32 only
+    bool json;                          // JSON instead of the Prometheus text format
+} SD_METRICS_SNAPSHOT;
+
+//------------------------------------------------------------------------------
+// SD_TEXT
+//      Window into generated text.  The text is generated from the start for
+//      each window and only the bytes within the window are kept, so long
+//      text is sent in pieces without holding all of it in memory.
+//------------------------------------------------------------------------------
+typedef struct _SD_TEXT {
+    char * buffer;                      // Receives the bytes within the window
+    size_t offset;                      // Offset of the window in the text
+    size_t maxLen;                      // Size of the window in bytes
+    size_t length;                      // Length of the text generated so far
+} SD_TEXT;
+
+typedef enum {
+    SORT_NONE = 0,                      // Directory order
+    SORT_NAME,
+    SORT_MTIME,
+    SORT_SIZE,
+    SORT_COUNT
+} LISTING_SORT;
+
+//------------------------------------------------------------------------------
+// SD_RANGE
+//      Portion of a file to download
+//------------------------------------------------------------------------------
+typedef struct _SD_RANGE {
+    uint64_t offset;                    // Offset of the first byte in the file
+    uint64_t length;                    // Number of bytes to send
+} SD_RANGE;
+
+//------------------------------------------------------------------------------
+// SD_SHA256
+//      SHA-256 state for the checksum of a file
+//------------------------------------------------------------------------------
+typedef struct _SD_SHA256 {
+    uint32_t state[8];                  // Hash value
+    uint64_t length;                    // Bytes hashed
+    uint8_t block[64];                  // Partial block
+} SD_SHA256;
+
+//------------------------------------------------------------------------------
+// SD_SUM_ENTRY
+//      Checksum of a file kept in memory, so the repeated checksum requests
+//      are answered without hashing the file when the sidecar file is not
+//      written
+//------------------------------------------------------------------------------
+typedef struct _SD_SUM_ENTRY {
+    char path[MAX_PATH_SIZE];           // Path of the file, empty when not used
+    uint64_t fileSize;                  // Size of the file when hashed
+    uint16_t modifyDate;                // FAT modify date when hashed
+    uint16_t modifyTime;                // FAT modify time when hashed
+    SUM_TYPE type;                      // Checksum type
+    char text[SUM_DIGEST_SIZE * 2 + 1]; // Hexadecimal checksum
+    uint32_t lastUse;                   // sumEntryUse when last used
+} SD_SUM_ENTRY;
+
+//------------------------------------------------------------------------------
+// SD_DIR_ENTRY
+//      Directory entry in the cached directory index
+//------------------------------------------------------------------------------
+typedef struct _SD_DIR_ENTRY {
+    uint64_t fileSize;                  // Size of the file in bytes
+    uint32_t nameOffset;                // Offset of the name in the name pool
+    uint16_t modifyDate;                // FAT modify date
+    uint16_t modifyTime;                // FAT modify time
+    uint8_t attributes;                 // SD_ATTR_* values
+} SD_DIR_ENTRY;
+
+//------------------------------------------------------------------------------
+// SD_DIR_INDEX
+//      In memory copy of a directory.  The index is shared by the listings
+//      and recycled when the last reference is released.
+//------------------------------------------------------------------------------
+typedef struct _SD_DIR_INDEX {
+    SD_DIR_ENTRY * entries;             // Directory entries in directory order
+    char * names;                       // Pool of zero terminated file names
+    uint32_t entryCount;                // Number of entries in use
+    uint32_t entryMax;                  // Number of entries allocated
+    uint32_t namesLength;               // Number of name bytes in use
+    uint32_t namesMax;                  // Number of name bytes allocated
+    uint32_t newest;                    // Latest FAT modify date and time
+    uint64_t totalBytes;                // Sum of the entry sizes
+    uint32_t generation;                // sdGeneration when the walk started
+    int references;                     // Listings and cache using the index
+    uint32_t lastUse;                   // dirIndexUse when last listed
+    uint32_t * sorted[SORT_COUNT];      // Entry numbers in sorted order
+    uint32_t sortedMax[SORT_COUNT];     // Entry numbers allocated
+    uint32_t sortedValid;               // Bit mask of the sort orders computed
+    char path[MAX_PATH_SIZE];           // Directory path
+} SD_DIR_INDEX;
+
+//------------------------------------------------------------------------------
+// SD_FILE_CACHE
+//      Copy of a small file kept in memory.  The entry is shared by the
+//      downloads and recycled when the last reference is released.
+//------------------------------------------------------------------------------
+typedef struct _SD_FILE_CACHE {
+    struct _SD_FILE_CACHE * next;       // Next less recently used file
+    int references;                     // Cache and downloads using the entry
+    uint64_t fileSize;                  // Size of the file in bytes
+    uint32_t firstSector;               // Location of the file on the SD card
+    uint16_t modifyDate;                // FAT modify date
+    uint16_t modifyTime;                // FAT modify time
+    uint32_t generation;                // sdGeneration when loaded
+    bool acceptsGzip;                   // Request accepted the gzip copy
+    bool gzipFile;                      // Data is the gzip copy of the file
+    size_t capacity;                    // Bytes allocated for the path and data
+    const char * path;                  // Requested path, follows this structure
+    uint8_t * data;                     // File data, follows the path
+} SD_FILE_CACHE;
+
+//------------------------------------------------------------------------------
+// SD_DIR_HANDLE
+//      Directory kept open to locate the files in the directory without
+//      walking the path from the root directory
+//------------------------------------------------------------------------------
+typedef struct _SD_DIR_HANDLE {
+    SdFile dir;                         // Open directory
+    uint32_t generation;                // sdGeneration when opened
+    uint32_t lastUse;                   // dirHandleUse when last used
+    char path[MAX_PATH_SIZE];           // Directory path from the root
+} SD_DIR_HANDLE;
+
+//------------------------------------------------------------------------------
+// SD_TRANSFER
+//      State for a single listing or download.  One of these is allocated for
+//      each request and is captured by the request's chunked response routine,
+//      allowing multiple transfers to proceed at the same time.
+//------------------------------------------------------------------------------
+typedef struct _SD_TRANSFER {
+    bool inUse;                         // Transfer pool entry is in use
+    struct _SD_VOLUME * volume;         // SdCardServer instance of the transfer
+    SdFile file;                        // File on the SD card
+    SdFile dir;                         // Directory being listed
+    char * lineBufferData;              // Next byte to send from lineBuffer
+    char * lineBufferDataEnd;           // End of the data in lineBuffer
+    int sdCardEmpty;                    // No files found in the FAT file system
+    LISTING_STATE state;                // Listing state
+    LISTING_FORMAT format;              // Listing format
+    bool archiveHeader;                 // Archive header follows the long name
+    size_t pathOffset;                  // Next directory in the path links
+    SD_DIR_INDEX * index;               // Cached index being listed
+    SD_DIR_INDEX * building;            // Index being built from this listing
+    uint32_t entryIndex;                // Next entry to list from the index
+    SD_DIR_ENTRY entry;                 // Entry being listed
+    const char * entryName;             // Name of the entry being listed
+    bool entryPending;                  // List item needs the name and size
+    bool moreEntries;                   // More entries follow this page
+    uint32_t listCount;                 // Entries listed on this page
+    uint32_t listSkipped;               // Matching entries skipped before page
+    uint32_t listOffset;                // Matching entries to skip
+    uint32_t listLimit;                 // Maximum entries on this page, 0 = all
+    LISTING_SORT listSort;              // Listing order
+    bool listDescending;                // Reverse the listing order
+    uint32_t listFrom;                  // First FAT date and time to list
+    uint32_t listTo;                    // Last FAT date and time to list
+    char listFromText[11];              // YYYY-MM-DD for the from parameter
+    char listToText[11];                // YYYY-MM-DD for the to parameter
+    char listMatch[MAX_MATCH_SIZE];     // File name pattern, * and ? wildcards
+    uint64_t fileSize;                  // Size of the file being downloaded
+    uint32_t contiguousSector;          // First sector of a contiguous file, 0 = use the cluster chain
+    bool fixedLength;                   // Response has a Content-Length
+    SD_FILE_CACHE * cache;              // Cached copy of the file being downloaded
+    SD_FILE_CACHE * cacheFill;          // Copy of the file being loaded into the cache
+    uint64_t cachePosition;             // Offset of the next byte to send or load
+    uint64_t rangeRemaining;            // Bytes remaining in the current range
+    int rangeCount;                     // Number of ranges to download
+    int rangeIndex;                     // Index of the next range to start
+    SD_RANGE ranges[MAX_BYTE_RANGES];   // Portions of the file to download
+    bool follow;                        // Send the data appended to the file
+    uint32_t followPoll;                // millis() of the last file size check
+    uint32_t followIdle;                // millis() when the file last grew
+    uint32_t startMsec;                 // millis() when the request arrived
+    uint32_t chunkEndUsec;              // micros() after the last callback
+    bool firstByteSent;                 // First byte of the response was sent
+    bool metricsRequest;                // Metrics page, not counted in the histograms
+    SD_METRICS_SNAPSHOT metricsSnapshot; // Metrics sent by the metrics page
+    uint32_t clientAddress;             // IPv4 address of the client
+    uint32_t schedRound;                // Scheduling round of schedBytes
+    size_t schedBytes;                  // Bytes sent in the scheduling round
+    uint32_t rateMsec;                  // millis() when rateTokens was filled
+    uint32_t rateTokens;                // Bytes that may be sent to the client
+    AsyncWebServerRequest * upload;     // Request uploading into file
+    int uploadStatus;                   // HTTP status, zero while uploading
+    bool uploadReplaced;                // Upload replaced an existing file
+    uint8_t * uploadData;               // Sector aligned write buffer
+    size_t uploadLength;                // Bytes in the write buffer
+    size_t uploadSize;                  // Size of the write buffer
+    SUM_TYPE sumType;                   // Checksum being computed
+    uint32_t sumCrc;                    // CRC-32 of the file data, inverted
+    SD_SHA256 sumSha;                   // SHA-256 of the file data
+    uint16_t sumModifyDate;             // FAT modify date of the file
+    uint16_t sumModifyTime;             // FAT modify time of the file
+#ifdef PREFETCH_ENABLED
+    struct _SD_TRANSFER * prefetchNext; // Next download in the prefetch list
+    bool prefetchActive;                // Download is in the prefetch list
+    uint8_t * prefetchData;             // Read-ahead buffers
+    volatile size_t prefetchLength[PREFETCH_BUFFERS]; // Bytes in buffer, 0 = empty
+    volatile bool prefetchDone;         // Prefetch task read all of the ranges
+    size_t drainOffset;                 // Bytes sent from the drain buffer
+    int drainIndex;                     // Buffer to send to the web server
+    int fillIndex;                      // Buffer to fill from the SD card
+    int fillRangeIndex;                 // Next range to read
+    uint64_t fillRemaining;             // Bytes remaining to read in the range
+#endif  // PREFETCH_ENABLED
+#ifdef DEFLATE_ENABLED
+    bool deflate;                       // Compress the file data
+    uint32_t deflateCrc;                // CRC-32 of the file data, inverted
+    uint32_t deflatePosition;           // File bytes compressed, modulo 2^32
+    uint32_t deflateBitBuffer;          // Compressed bits not yet output
+    int deflateBitCount;                // Number of bits in deflateBitBuffer
+    uint32_t deflateHash[DEFLATE_HASH_SIZE]; // Last position + 1 for a hash
+    uint8_t deflateWindow[DEFLATE_WINDOW_SIZE]; // Recent file data
+#endif  // DEFLATE_ENABLED
+    char lineBuffer[LINE_BUFFER_SIZE];  // Temporary buffer to hold the next line
+    char nameBuffer[MAX_FILE_NAME_SIZE];// Name of the entry read from the SD card
+    char path[MAX_PATH_SIZE];           // Directory being listed, no end slash
+} SD_TRANSFER;
+
+#ifdef PREFETCH_ENABLED
+//------------------------------------------------------------------------------
+// SD_CARD_LOCK
+//      Mutex shared by the volumes using the same SdFat object.  The users
+//      are counted while holding volumesMutex.
+//------------------------------------------------------------------------------
+typedef struct _SD_CARD_LOCK {
+    SemaphoreHandle_t mutex;            // Serialize the SdFat calls
+    int users;                          // Volumes using this lock
+} SD_CARD_LOCK;
+#endif  // PREFETCH_ENABLED
+
+//------------------------------------------------------------------------------
+// SD_VOLUME
+//      State for an SdCardServer instance.  Each instance serves an SdFat
+//      volume at its own URL and has its own transfer pool, caches, limits
+//      and metrics.
+//------------------------------------------------------------------------------
+typedef struct _SD_VOLUME {
+    SdFat * sdFat;                      // Address of a SdFat object
+    SD_CARD_PRESENT cardPresent;        // Routine to determine if SD card is present
+    const char * webPage;               // Zero terminated string for SD card's web pages
+    int webPageLength;                  // Length of the webPage string
+    int webPageMissingSlash;            // Non zero if last character is a not a slash
+    const char * serverHdrText;         // Zero terminated string for web server name
+    bool uploadsAllowed;                // Accept the PUT and POST uploads
+    int maxTransfers;                   // Maximum number of simultaneous transfers
+    SD_TRANSFER * transfers;            // Transfer pool, maxTransfers entries
+    int activeTransfers;                // Number of transfers in progress
+    bool deleted;                       // SdCardServer deleted, free after the transfers
+    volatile uint32_t sdGeneration;     // Changes when the SD card contents change
+    uint64_t cardBytes;                 // Size of the SD card, 0 = not read yet
+    cid_t cardCid;                      // Identity of the SD card
+    float sdCardSizeMB;                 // Size of the SD card in MB (1000 * 1000 bytes)
+    volatile uint32_t cardClusterBytes; // Size of a cluster in bytes
+    volatile int32_t cardFreeClusters;  // Free clusters, -1 = not known
+    volatile uint32_t cardFreeGeneration; // sdGeneration when counted
+    uint32_t cardFreeMsec;              // millis() when the free space was counted
+    SD_DIR_HANDLE dirHandles[DIR_HANDLES]; // Directories kept open
+    uint32_t dirHandleUse;              // Counts the directory handle lookups
+    SD_DIR_INDEX * dirIndexes[DIR_INDEXES]; // Cached directory indexes
+    uint32_t dirIndexUse;               // Counts the directory index lookups
+    SD_DIR_INDEX * dirIndexSpare;       // Released index kept for the next build
+    SD_FILE_CACHE * cache;              // Cached small files, most recently used first
+    size_t cacheBytes;                  // File bytes in the cache
+    SD_FILE_CACHE * cacheSpare;         // Released entry kept for the next load
+    int schedExhausted;                 // Streams that used the quota this round
+    uint32_t schedRound;                // Current scheduling round
+    uint32_t schedRoundStart;           // millis() when the round started
+    SD_METRICS metrics;                 // Server activity since boot
+    SD_SUM_ENTRY sumEntries[SUM_ENTRIES]; // Checksums kept in memory
+    uint32_t sumEntryUse;               // Counts the checksum lookups
+    char hrefBuffer[MAX_FILE_NAME_SIZE]; // Buffer for the listing links
+    char htmlBuffer[256];               // Buffer for HTML token replacement
+#ifdef PREFETCH_ENABLED
+    SD_CARD_LOCK * cardLock;            // Serialize SD card access, shared per SdFat
+    struct _SD_TRANSFER * prefetchList; // Downloads being read ahead
+#endif  // PREFETCH_ENABLED
+} SD_VOLUME;
+
+//------------------------------------------------------------------------------
+// HTML header pieces
+//
+// The pieces are concatenated by the compiler to build the complete pages,
+// leaving only the dynamic values to be added at run time.
+//------------------------------------------------------------------------------
+
+#define HTML_HEADER_START       "<!DOCTYPE HTML>\n<html lang=\"en\">\n<head>\n"
+
+#define HTML_CONTENT_TYPE       "  <meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\"/>\n"
+
+#define HTML_REDIRECT           "  <meta http-equiv=\"refresh\" content=\"0; url='http://"
+
+#define HTML_REDIRECT_END       "'\" />\n"
+
+#define HTML_TITLE              "  <title>"
+
+#define HTML_TITLE_END          "</title>\n"
+
+#define HTML_HEADER_END         "</head>\n"
+
+#define HTML_HEADER_END_BODY_START  "</head>\n<body>"
+
+#define HTML_BODY_END           "</body>\n</html>\n"
+
+//------------------------------------------------------------------------------
+// html anchor
+//------------------------------------------------------------------------------
+
+#define HTML_ANCHOR_START       "<a target=\"_blank\" href=\""
+
+#define HTML_ANCHOR_CENTER      "\">"
+
+#define HTML_ANCHOR_END         "</a>"
+
+#define HTML_LINK_START         "<a href=\""
+
+//------------------------------------------------------------------------------
+// html lists
+//------------------------------------------------------------------------------
+
+#define HTML_LIST_ITEM_START    "    <li>"
+
+#define HTML_LIST_ITEM_END      "</li>\n"
+
+#define HTML_LIST_END           "  </ol>\n"
+
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Shared data
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+extern prog_char byteRangeBoundary[];
+extern prog_char byteRangeTrailer[];
+
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Support routines
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+// SdArchive.cpp
+
+size_t
+archiveRead (
+    SD_TRANSFER * transfer,
+    uint8_t * buffer,
+    size_t maxLen
+    );
+
+// SdCardServer.cpp
+
+uint32_t
+fatToEpoch (
+    uint16_t date,
+    uint16_t time
+    );
+
+void
+freeSpaceCount(
+    SD_VOLUME * volume
+    );
+
+bool
+listingNextMatch (
+    SD_TRANSFER * transfer
+    );
+
+bool
+pathOpen (
+    SD_VOLUME * volume,
+    SdFile * file,
+    const char * path,
+    oflag_t oflag = O_RDONLY
+    );
+
+int
+fileRead (
+    SD_TRANSFER * transfer,
+    uint8_t * buffer,
+    size_t length
+    );
+
+int
+transferRead (
+    SD_TRANSFER * transfer,
+    uint8_t * buffer,
+    size_t maxLen
+    );
+
+void
+transferClose (
+    SD_TRANSFER * transfer
+    );
+
+void
+sdLock (
+    SD_VOLUME * volume
+    );
+
+void
+sdUnlock (
+    SD_VOLUME * volume
+    );
+
+SD_TRANSFER *
+transferAllocate (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request
+    );
+
+bool
+prefetchStart (
+    SD_TRANSFER * transfer
+    );
+
+SdFile *
+pathParent (
+    SD_VOLUME * volume,
+    const char * path,
+    SdFile * rootDir,
+    const char ** name
+    );
+
+const char *
+sdCardPath (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request,
+    size_t * length
+    );
+
+SD_TRANSFER *
+transferGet (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request
+    );
+
+void
+sendBusy (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request
+    );
+
+// SdChecksum.cpp
+
+bool
+sumSidecar (
+    SD_TRANSFER * transfer,
+    SdFile * file,
+    const char * name
+    );
+
+bool
+sumLookup (
+    SD_TRANSFER * transfer,
+    SUM_TYPE type,
+    char * text
+    );
+
+void
+sumBase64 (
+    char * text,
+    const char * hex
+    );
+
+int
+sumPage (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request,
+    const char * filename
+    );
+
+uint32_t
+crcUpdate (
+    uint32_t crc,
+    const uint8_t * data,
+    size_t length
+    );
+
+// SdDeflate.cpp
+
+#ifdef DEFLATE_ENABLED
+int
+deflateRead (
+    SD_TRANSFER * transfer
+    );
+
+void
+deflateFinish (
+    SD_TRANSFER * transfer
+    );
+
+void
+deflateStart (
+    SD_TRANSFER * transfer
+    );
+
+bool
+isTextFile (
+    const char * filename
+    );
+#endif  // DEFLATE_ENABLED
+
+// SdMetrics.cpp
+
+void
+histogramRecord (
+    SD_HISTOGRAM * histogram,
+    uint32_t msec
+    );
+
+void
+metricsSent (
+    SD_TRANSFER * transfer,
+    size_t bytes
+    );
+
+int
+metricsPage (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request
+    );
+
+void
+metricsSnapshot (
+    SD_VOLUME * volume,
+    SD_METRICS_SNAPSHOT * snapshot,
+    bool json
+    );
+
+size_t
+metricsRead (
+    const SD_METRICS_SNAPSHOT * snapshot,
+    size_t offset,
+    char * buffer,
+    size_t maxLen
+    );
+
+// SdRange.cpp
+
+int
+buildPartHeader (
+    SD_TRANSFER * transfer,
+    int index,
+    char * buffer
+    );
+
+int
+parseRange (
+    const char * value,
+    uint64_t fileSize,
+    SD_RANGE * ranges
+    );
+
+// SdUpload.cpp
+
+int
+uploadPage (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request,
+    const char * filename,
+    size_t length
+    );
+
+void
+uploadBody (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request,
+    uint8_t * data,
+    size_t length,
+    size_t index,
+    size_t total
+    );
+
+#endif  // SD_CARD_SERVER_PRIVATE_H_INCLUDED
@@ -0,0 +1,881 @@
+// Arduino SD Card Server Library
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// CRC-32 and SHA-256 checksums of the files and the checksum sidecar files
+
+#include "SdCardServerPrivate.h"
+
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Constants
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+// Names used by the sum parameter and the sidecar files
+static const char * const sumNames[SUM_COUNT] = {
+    "", "crc32", "sha256"
+};
+
+static const uint32_t crcTable[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256Initial[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const char base64Digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Support routines
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//------------------------------------------------------------------------------
+// crcUpdate
+//      Add data to a CRC-32
+//
+//  Inputs:
+//      crc: CRC-32 of the previous data, inverted
+//      data: Address of the data
+//      length: Number of bytes of data
+//
+//  Returns:
+//      Returns the CRC-32 including the data, inverted
+//------------------------------------------------------------------------------
+uint32_t
+crcUpdate (
+    uint32_t crc,
+    const uint8_t * data,
+    size_t length
+    )
+{
+    while (length--) {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ crcTable[crc & 15];
+        crc = (crc >> 4) ^ crcTable[crc & 15];
+    }
+    return crc;
+}
+
+#define SHA256_ROTR(x, n)       (((x) >> (n)) | ((x) << (32 - (n))))
+
+//------------------------------------------------------------------------------
+// sha256Block
+//      Add a 64 byte block to the SHA-256 hash value
+//
+//  Inputs:
+//      sha: Address of the SD_SHA256 object
+//      data: Address of the block
+//------------------------------------------------------------------------------
+static
+void
+sha256Block (
+    SD_SHA256 * sha,
+    const uint8_t * data
+    )
+{
+    int index;
+    uint32_t t1;
+    uint32_t t2;
+    uint32_t v[8];
+    uint32_t w[64];
+
+    // Expand the message schedule
+    for (index = 0; index < 16; index++)
+        w[index] = ((uint32_t)data[index * 4] << 24)
+                 | ((uint32_t)data[index * 4 + 1] << 16)
+                 | ((uint32_t)data[index * 4 + 2] << 8)
+                 | data[index * 4 + 3];
+    for (; index < 64; index++)
+        w[index] = (SHA256_ROTR(w[index - 2], 17) ^ SHA256_ROTR(w[index - 2], 19)
+                    ^ (w[index - 2] >> 10))
+                 + w[index - 7]
+                 + (SHA256_ROTR(w[index - 15], 7) ^ SHA256_ROTR(w[index - 15], 18)
+                    ^ (w[index - 15] >> 3))
+                 + w[index - 16];
+
+    // Compress the block, v holds a through h
+    memcpy(v, sha->state, sizeof(v));
+    for (index = 0; index < 64; index++) {
+        t1 = v[7] + (SHA256_ROTR(v[4], 6) ^ SHA256_ROTR(v[4], 11)
+                     ^ SHA256_ROTR(v[4], 25))
+           + ((v[4] & v[5]) ^ ((~v[4]) & v[6])) + sha256K[index] + w[index];
+        t2 = (SHA256_ROTR(v[0], 2) ^ SHA256_ROTR(v[0], 13) ^ SHA256_ROTR(v[0], 22))
+           + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        memmove(&v[1], &v[0], 7 * sizeof(v[0]));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+    for (index = 0; index < 8; index++)
+        sha->state[index] += v[index];
+}
+
+//------------------------------------------------------------------------------
+// sha256Start
+//      Start a SHA-256 hash
+//
+//  Inputs:
+//      sha: Address of the SD_SHA256 object
+//------------------------------------------------------------------------------
+static
+void
+sha256Start (
+    SD_SHA256 * sha
+    )
+{
+    memcpy(sha->state, sha256Initial, sizeof(sha->state));
+    sha->length = 0;
+}
+
+//------------------------------------------------------------------------------
+// sha256Update
+//      Add data to a SHA-256 hash
+//
+//  Inputs:
+//      sha: Address of the SD_SHA256 object
+//      data: Address of the data
+//      length: Number of bytes of data
+//------------------------------------------------------------------------------
+static
+void
+sha256Update (
+    SD_SHA256 * sha,
+    const uint8_t * data,
+    size_t length
+    )
+{
+    size_t count;
+    size_t offset;
+
+    // Hash the complete blocks in place, collect the partial blocks
+    offset = sha->length & 63;
+    sha->length += length;
+    while (length) {
+        count = 64 - offset;
+        if (count > length)
+            count = length;
+        if ((!offset) && (count == 64))
+            sha256Block(sha, data);
+        else {
+            memcpy(&sha->block[offset], data, count);
+            offset += count;
+            if (offset == 64) {
+                sha256Block(sha, sha->block);
+                offset = 0;
+            }
+        }
+        data += count;
+        length -= count;
+    }
+}
+
+//------------------------------------------------------------------------------
+// sha256Finish
+//      Complete a SHA-256 hash
+//
+//  Inputs:
+//      sha: Address of the SD_SHA256 object
+//      digest: Address of a 32 byte buffer to receive the hash value
+//------------------------------------------------------------------------------
+static
+void
+sha256Finish (
+    SD_SHA256 * sha,
+    uint8_t * digest
+    )
+{
+    uint64_t bits;
+    int index;
+    size_t offset;
+
+    // Pad the data and append the length in bits
+    bits = sha->length * 8;
+    offset = sha->length & 63;
+    sha->block[offset++] = 0x80;
+    if (offset > 56) {
+        memset(&sha->block[offset], 0, 64 - offset);
+        sha256Block(sha, sha->block);
+        offset = 0;
+    }
+    memset(&sha->block[offset], 0, 56 - offset);
+    for (index = 0; index < 8; index++)
+        sha->block[56 + index] = (uint8_t)(bits >> (56 - (index * 8)));
+    sha256Block(sha, sha->block);
+
+    // Return the hash value, most significant byte first
+    for (index = 0; index < 32; index++)
+        digest[index] = (uint8_t)(sha->state[index / 4] >> (24 - ((index & 3) * 8)));
+}
+
+//------------------------------------------------------------------------------
+// sumBase64
+//      Convert a hexadecimal checksum to base 64
+//
+//  Inputs:
+//      text: Address of the buffer to receive the zero terminated base 64 text
+//      hex: Zero terminated string containing the hexadecimal checksum
+//------------------------------------------------------------------------------
+void
+sumBase64 (
+    char * text,
+    const char * hex
+    )
+{
+    uint32_t bits;
+    uint8_t data[SUM_DIGEST_SIZE];
+    char digit;
+    size_t index;
+    size_t length;
+
+    // Convert the lower case hexadecimal digits to bytes
+    length = strlen(hex);
+    if (length > (SUM_DIGEST_SIZE * 2))
+        length = SUM_DIGEST_SIZE * 2;
+    for (index = 0; index < length; index++) {
+        digit = hex[index];
+        digit = (digit <= '9') ? digit - '0' : digit - 'a' + 10;
+        if (index & 1)
+            data[index / 2] |= digit;
+        else
+            data[index / 2] = digit << 4;
+    }
+    length /= 2;
+
+    // Encode three bytes as four characters
+    for (index = 0; index < length; index += 3) {
+        bits = (uint32_t)data[index] << 16;
+        if ((index + 1) < length)
+            bits |= (uint32_t)data[index + 1] << 8;
+        if ((index + 2) < length)
+            bits |= data[index + 2];
+        *text++ = base64Digits[(bits >> 18) & 63];
+        *text++ = base64Digits[(bits >> 12) & 63];
+        *text++ = ((index + 1) < length) ? base64Digits[(bits >> 6) & 63] : '=';
+        *text++ = ((index + 2) < length) ? base64Digits[bits & 63] : '=';
+    }
+    *text = 0;
+}
+
+//------------------------------------------------------------------------------
+// sumParse
+//      Parse a line of the checksum sidecar file.  Each line contains the
+//      checksum name, the hexadecimal checksum, the file size and the FAT
+//      modify date and time of the file when the checksum was computed.
+//
+//  Inputs:
+//      line: Zero terminated line from the sidecar file
+//      type: Address of the variable to receive the checksum type
+//      text: Address of the buffer to receive the hexadecimal checksum
+//      size: Address of the variable to receive the file size
+//      modifyDate: Address of the variable to receive the FAT modify date
+//      modifyTime: Address of the variable to receive the FAT modify time
+//
+//  Returns:
+//      True if the line has the sidecar format, false otherwise
+//------------------------------------------------------------------------------
+static
+bool
+sumParse (
+    const char * line,
+    SUM_TYPE * type,
+    char * text,
+    unsigned long long * size,
+    unsigned short * modifyDate,
+    unsigned short * modifyTime
+    )
+{
+    char name[8];
+
+    if (sscanf(line, "%7s %64s %llu %hx-%hx", name, text, size,
+               modifyDate, modifyTime) != 5)
+        return false;
+
+    // Determine the checksum type
+    for (*type = SUM_CRC32; *type < SUM_COUNT; *type = (SUM_TYPE)(*type + 1))
+        if (!strcmp(name, sumNames[*type]))
+            return strlen(text) == ((*type == SUM_CRC32) ? 8 : 64);
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// sumLine
+//      Parse a line of the checksum sidecar file for the file being summed
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for the file
+//      line: Zero terminated line from the sidecar file
+//      type: Address of the variable to receive the checksum type
+//      text: Address of the buffer to receive the hexadecimal checksum
+//
+//  Returns:
+//      True if the checksum is for this version of the file, false otherwise
+//------------------------------------------------------------------------------
+static
+bool
+sumLine (
+    SD_TRANSFER * transfer,
+    const char * line,
+    SUM_TYPE * type,
+    char * text
+    )
+{
+    unsigned short modifyDate;
+    unsigned short modifyTime;
+    unsigned long long size;
+
+    // Verify that the file has not changed since the checksum was computed
+    return sumParse(line, type, text, &size, &modifyDate, &modifyTime)
+        && (size == transfer->fileSize)
+        && (modifyDate == transfer->sumModifyDate)
+        && (modifyTime == transfer->sumModifyTime);
+}
+
+//------------------------------------------------------------------------------
+// sumRecall
+//      Get the checksum of the file in transfer->path from the checksums kept
+//      in memory.  The caller sets transfer->fileSize, sumModifyDate and
+//      sumModifyTime.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for the file
+//      type: Checksum type
+//      text: Address of the buffer to receive the hexadecimal checksum
+//
+//  Returns:
+//      True if the checksum of this version of the file is in memory, false
+//      otherwise
+//------------------------------------------------------------------------------
+static
+bool
+sumRecall (
+    SD_TRANSFER * transfer,
+    SUM_TYPE type,
+    char * text
+    )
+{
+    SD_SUM_ENTRY * entry;
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+    for (entry = volume->sumEntries; entry < &volume->sumEntries[SUM_ENTRIES]; entry++)
+        if ((entry->type == type)
+            && (entry->fileSize == transfer->fileSize)
+            && (entry->modifyDate == transfer->sumModifyDate)
+            && (entry->modifyTime == transfer->sumModifyTime)
+            && (!strcmp(entry->path, transfer->path))) {
+            entry->lastUse = ++volume->sumEntryUse;
+            strcpy(text, entry->text);
+            return true;
+        }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// sumRemember
+//      Keep the checksum of the file in transfer->path in memory, replacing
+//      the previous checksum of the file or the least recently used checksum
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for the file
+//      type: Checksum type
+//      text: Zero terminated string containing the hexadecimal checksum
+//------------------------------------------------------------------------------
+static
+void
+sumRemember (
+    SD_TRANSFER * transfer,
+    SUM_TYPE type,
+    const char * text
+    )
+{
+    SD_SUM_ENTRY * entry;
+    SD_SUM_ENTRY * oldest;
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+    oldest = volume->sumEntries;
+    for (entry = volume->sumEntries; entry < &volume->sumEntries[SUM_ENTRIES]; entry++) {
+        if ((entry->type == type) && (!strcmp(entry->path, transfer->path))) {
+            oldest = entry;
+            break;
+        }
+        if (entry->lastUse < oldest->lastUse)
+            oldest = entry;
+    }
+    strcpy(oldest->path, transfer->path);
+    oldest->fileSize = transfer->fileSize;
+    oldest->modifyDate = transfer->sumModifyDate;
+    oldest->modifyTime = transfer->sumModifyTime;
+    oldest->type = type;
+    strcpy(oldest->text, text);
+    oldest->lastUse = ++volume->sumEntryUse;
+}
+
+//------------------------------------------------------------------------------
+// sumSidecarRead
+//      Read the checksum sidecar file of the file in transfer->path into the
+//      line buffer.  The caller must hold the SD card lock.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for the file
+//
+//  Returns:
+//      The number of bytes read, zero (0) if the sidecar file does not exist
+//      or -1 if the sidecar path is too long
+//------------------------------------------------------------------------------
+static
+int
+sumSidecarRead (
+    SD_TRANSFER * transfer
+    )
+{
+    int length;
+    SdFile sidecar;
+
+    // The sidecar file name follows the file name in the name buffer
+    if ((strlen(transfer->path) + SUM_SUFFIX_LENGTH) >= MAX_PATH_SIZE)
+        return -1;
+    sprintf(transfer->nameBuffer, "%s" SUM_SUFFIX, transfer->path);
+    length = 0;
+    if (pathOpen(transfer->volume, &sidecar, transfer->nameBuffer)) {
+        length = sidecar.read(transfer->lineBuffer, LINE_BUFFER_SIZE - 1);
+        sidecar.close();
+    }
+    if (length < 0)
+        length = 0;
+    transfer->lineBuffer[length] = 0;
+    return length;
+}
+
+//------------------------------------------------------------------------------
+// sumSidecar
+//      Determine if a directory entry is a checksum sidecar file: the name is
+//      the name of a file in the same directory followed by SUM_SUFFIX and
+//      the first line has the sidecar format.  The other files whose names
+//      end with SUM_SUFFIX are listed.  The caller must hold the SD card lock.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object listing the directory in
+//                transfer->path
+//      file: Address of the open SdFile object for the entry, the file is
+//            positioned at the start on return
+//      name: Zero terminated string containing the file name
+//
+//  Returns:
+//      True if the entry is a checksum sidecar file, false otherwise
+//------------------------------------------------------------------------------
+bool
+sumSidecar (
+    SD_TRANSFER * transfer,
+    SdFile * file,
+    const char * name
+    )
+{
+    SdFile base;
+    int bytesRead;
+    bool found;
+    size_t length;
+    char line[128];
+    unsigned short modifyDate;
+    unsigned short modifyTime;
+    char path[MAX_PATH_SIZE];
+    size_t pathLength;
+    unsigned long long size;
+    char text[SUM_DIGEST_SIZE * 2 + 1];
+    SUM_TYPE type;
+
+    // The sidecar files are small and named by sumSidecarRead
+    length = strlen(name);
+    if ((length <= SUM_SUFFIX_LENGTH)
+        || strcmp(&name[length - SUM_SUFFIX_LENGTH], SUM_SUFFIX)
+        || (file->fileSize() >= LINE_BUFFER_SIZE))
+        return false;
+
+    // The first line has the sidecar format
+    bytesRead = file->read(line, sizeof(line) - 1);
+    file->rewind();
+    if (bytesRead <= 0)
+        return false;
+    line[bytesRead] = 0;
+    if (!sumParse(line, &type, text, &size, &modifyDate, &modifyTime))
+        return false;
+
+    // The file with the checksums exists
+    pathLength = transfer->path[0] ? strlen(transfer->path) + 1 : 0;
+    length -= SUM_SUFFIX_LENGTH;
+    if ((pathLength + length) >= sizeof(path))
+        return false;
+    if (pathLength) {
+        memcpy(path, transfer->path, pathLength - 1);
+        path[pathLength - 1] = '/';
+    }
+    memcpy(&path[pathLength], name, length);
+    path[pathLength + length] = 0;
+    found = pathOpen(transfer->volume, &base, path);
+    if (found) {
+        found = !base.isDir();
+        base.close();
+    }
+    return found;
+}
+
+//------------------------------------------------------------------------------
+// sumLookup
+//      Get the checksum of the file in transfer->path from memory or its
+//      sidecar file.  The caller sets transfer->fileSize, sumModifyDate and
+//      sumModifyTime and holds the SD card lock.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for the file
+//      type: Checksum type
+//      text: Address of the buffer to receive the hexadecimal checksum
+//
+//  Returns:
+//      True if the checksum is cached, false otherwise
+//------------------------------------------------------------------------------
+bool
+sumLookup (
+    SD_TRANSFER * transfer,
+    SUM_TYPE type,
+    char * text
+    )
+{
+    char * line;
+    SUM_TYPE lineType;
+    char * next;
+
+    // Locate the checksum for this version of the file
+    if (sumRecall(transfer, type, text))
+        return true;
+    if (sumSidecarRead(transfer) <= 0)
+        return false;
+    for (line = transfer->lineBuffer; line; line = next) {
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = 0;
+        if (sumLine(transfer, line, &lineType, text) && (lineType == type)) {
+            sumRemember(transfer, type, text);
+            return true;
+        }
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// sumStore
+//      Save the checksum of the file in transfer->path in its sidecar file,
+//      keeping the other checksums of this version of the file.  The sidecar
+//      files are not listed, so the SD card generation is not changed and
+//      the cached listings and files remain valid.  The caller holds the SD
+//      card lock.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for the file
+//      text: Zero terminated string containing the hexadecimal checksum
+//------------------------------------------------------------------------------
+static
+void
+sumStore (
+    SD_TRANSFER * transfer,
+    const char * text
+    )
+{
+    char digest[SUM_DIGEST_SIZE * 2 + 1];
+    char * end;
+    size_t length;
+    char * line;
+    SUM_TYPE lineType;
+    char * next;
+    SdFile sidecar;
+
+    // Keep the lines for the other checksums of this version of the file,
+    // leaving room for this checksum
+    if (sumSidecarRead(transfer) < 0)
+        return;
+    end = transfer->lineBuffer;
+    for (line = transfer->lineBuffer; line; line = next) {
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = 0;
+        length = strlen(line);
+        if (sumLine(transfer, line, &lineType, digest)
+            && (lineType != transfer->sumType)
+            && ((end + length) < &transfer->lineBuffer[LINE_BUFFER_SIZE / 2])) {
+            memmove(end, line, length);
+            end += length;
+            *end++ = '\n';
+        }
+    }
+
+    // Add this checksum
+    end += sprintf(end, "%s %s %llu %04x-%04x\n", sumNames[transfer->sumType],
+                   text, (unsigned long long)transfer->fileSize,
+                   transfer->sumModifyDate, transfer->sumModifyTime);
+
+    // Replace the sidecar file
+    if (pathOpen(transfer->volume, &sidecar, transfer->nameBuffer,
+                 O_WRONLY | O_CREAT | O_TRUNC)) {
+        sidecar.write((const uint8_t *)transfer->lineBuffer,
+                      end - transfer->lineBuffer);
+        sidecar.close();
+    }
+}
+
+//------------------------------------------------------------------------------
+// sumResult
+//      Place the checksum line in the line buffer using the format of the
+//      sha256sum and similar programs: checksum, two spaces and the file name
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for the file
+//      text: Zero terminated string containing the hexadecimal checksum
+//------------------------------------------------------------------------------
+static
+void
+sumResult (
+    SD_TRANSFER * transfer,
+    const char * text
+    )
+{
+    const char * name;
+
+    name = strrchr(transfer->path, '/');
+    name = name ? name + 1 : transfer->path;
+    transfer->lineBufferData = transfer->lineBuffer;
+    transfer->lineBufferDataEnd = &transfer->lineBuffer[
+        sprintf(transfer->lineBuffer, "%s  %s\n", text, name)];
+}
+
+//------------------------------------------------------------------------------
+// sumChunk
+//      Compute the checksum of the file, reading the file the same way as
+//      the downloads.  The response buffer holds the file data while it is
+//      hashed.  Each call hashes the file for up to SD_CARD_SERVER_SUM_MSEC
+//      and then asks the web server to call again, letting the web server
+//      handle the other connections.  Without RESPONSE_TRY_AGAIN a newline
+//      is sent instead.  The checksum line is sent after the entire file is
+//      hashed, the checksum is kept in memory and saved in the sidecar file
+//      when uploads are allowed.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for the file
+//      buffer: Address of the response buffer
+//      maxLen: Size of the response buffer
+//
+//  Returns:
+//      The number of bytes placed in the buffer, zero (0) when done or
+//      RESPONSE_TRY_AGAIN while hashing the file
+//------------------------------------------------------------------------------
+static
+size_t
+sumChunk (
+    SD_TRANSFER * transfer,
+    uint8_t * buffer,
+    size_t maxLen
+    )
+{
+    int bytesRead;
+    size_t bytesToRead;
+    uint8_t digest[SUM_DIGEST_SIZE];
+    int index;
+    size_t length;
+    uint32_t start;
+    char text[SUM_DIGEST_SIZE * 2 + 1];
+
+    // Hash the file data
+    start = millis();
+    while (transfer->file.isOpen() && transfer->rangeRemaining) {
+        bytesToRead = maxLen;
+        if (bytesToRead > transfer->rangeRemaining)
+            bytesToRead = transfer->rangeRemaining;
+        bytesRead = transferRead(transfer, buffer, bytesToRead);
+
+        // Don't send the checksum on error
+        if (bytesRead <= 0) {
+            transferClose(transfer);
+            return 0;
+        }
+        if (transfer->sumType == SUM_CRC32)
+            transfer->sumCrc = crcUpdate(transfer->sumCrc, buffer, bytesRead);
+        else
+            sha256Update(&transfer->sumSha, buffer, bytesRead);
+        transfer->rangeRemaining -= bytesRead;
+
+        // Let the web server handle the other connections
+        if (transfer->rangeRemaining
+            && ((millis() - start) >= SD_CARD_SERVER_SUM_MSEC)) {
+#ifdef RESPONSE_TRY_AGAIN
+            return RESPONSE_TRY_AGAIN;
+#else   // RESPONSE_TRY_AGAIN
+            buffer[0] = '\n';
+            return 1;
+#endif  // RESPONSE_TRY_AGAIN
+        }
+    }
+
+    // Complete the checksum, keep it in memory and save it in the sidecar
+    // file, a read-only server does not write to the SD card
+    if (transfer->file.isOpen()) {
+        transferClose(transfer);
+        if (transfer->sumType == SUM_CRC32)
+            sprintf(text, "%08lx", (unsigned long)~transfer->sumCrc);
+        else {
+            sha256Finish(&transfer->sumSha, digest);
+            for (index = 0; index < 32; index++)
+                sprintf(&text[index * 2], "%02x", digest[index]);
+        }
+        sumRemember(transfer, transfer->sumType, text);
+        if (transfer->volume->uploadsAllowed) {
+            sdLock(transfer->volume);
+            sumStore(transfer, text);
+            sdUnlock(transfer->volume);
+        }
+        sumResult(transfer, text);
+    }
+
+    // Send the checksum line
+    length = transfer->lineBufferDataEnd - transfer->lineBufferData;
+    if (length > maxLen)
+        length = maxLen;
+    memcpy(buffer, transfer->lineBufferData, length);
+    transfer->lineBufferData += length;
+    return length;
+}
+
+//------------------------------------------------------------------------------
+// sumPage
+//      Send the checksum of the specified file.  The sum parameter selects
+//      crc32 or sha256 (default).  The checksum is taken from memory or the
+//      sidecar file when the file has not changed since it was computed,
+//      otherwise the file is hashed.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      request: Address of the AsyncWebServerRequest object
+//      filename: Zero terminated path of the file relative to the root directory
+//
+//  Returns:
+//      One (1) if the file is available, zero (0) if no file is found
+//------------------------------------------------------------------------------
+int
+sumPage (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request,
+    const char * filename
+    )
+{
+    bool cached;
+    uint32_t firstSector;
+    uint32_t lastSector;
+    AsyncWebServerResponse * response;
+    char text[SUM_DIGEST_SIZE * 2 + 1];
+    SD_TRANSFER * transfer;
+    SUM_TYPE type;
+    const char * value;
+
+    // Determine the checksum type
+    volume->metrics.sums += 1;
+    value = request->getParam("sum")->value().c_str();
+    type = SUM_SHA256;
+    if (*value)
+        for (type = SUM_CRC32; type < SUM_COUNT; type = (SUM_TYPE)(type + 1))
+            if (!strcmp(value, sumNames[type]))
+                break;
+    if (type >= SUM_COUNT) {
+        request->send(400);
+        return 1;
+    }
+
+    // Allocate the transfer state
+    transfer = transferAllocate(volume, request);
+    if (!transfer)
+        return 1;
+
+    // Open the file
+    sdLock(volume);
+    if (!pathOpen(volume, &transfer->file, filename)) {
+        // File not found
+        sdUnlock(volume);
+        volume->metrics.errors[ME_NOT_FOUND] += 1;
+        return 0;
+    }
+    if (transfer->file.isDir()) {
+        transfer->file.close();
+        sdUnlock(volume);
+        request->send(400);
+        return 1;
+    }
+    strcpy(transfer->path, filename);
+    transfer->fileSize = transfer->file.fileSize();
+    if (!transfer->file.getModifyDateTime(&transfer->sumModifyDate,
+                                          &transfer->sumModifyTime)) {
+        transfer->sumModifyDate = 0;
+        transfer->sumModifyTime = 0;
+    }
+    transfer->sumType = type;
+
+    // Use the checksum from the sidecar file when possible
+    cached = sumLookup(transfer, type, text);
+    if (cached)
+        transfer->file.close();
+    else if (transfer->file.contiguousRange(&firstSector, &lastSector))
+        transfer->contiguousSector = firstSector;
+    sdUnlock(volume);
+    if (cached) {
+        volume->metrics.sumsCached += 1;
+        sumResult(transfer, text);
+        response = request->beginResponse(200, "text/plain", transfer->lineBuffer);
+        if (volume->serverHdrText)
+            response->addHeader("Server", volume->serverHdrText);
+        request->send(response);
+        return 1;
+    }
+
+    // Hash the entire file, read ahead of the web server the same way as
+    // the downloads
+    transfer->rangeCount = 1;
+    transfer->ranges[0].offset = 0;
+    transfer->ranges[0].length = transfer->fileSize;
+    transfer->rangeIndex = 1;
+    transfer->rangeRemaining = transfer->fileSize;
+    transfer->sumCrc = 0xffffffff;
+    sha256Start(&transfer->sumSha);
+#ifdef PREFETCH_ENABLED
+    prefetchStart(transfer);
+#endif  // PREFETCH_ENABLED
+    response = request->beginChunkedResponse("text/plain", [transfer](uint8_t *buffer, size_t maxLen, size_t) -> size_t {
+        size_t bytesWritten;
+
+        bytesWritten = sumChunk(transfer, buffer, maxLen);
+        metricsSent(transfer, bytesWritten);
+        return bytesWritten;
+    });
+    if (volume->serverHdrText)
+        response->addHeader("Server", volume->serverHdrText);
+    request->send(response);
+    return 1;
+}
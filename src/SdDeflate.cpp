@@ -0,0 +1,328 @@
+// Arduino SD Card Server Library
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// gzip compression of the text files
+
+#include "SdCardServerPrivate.h"
+
+#ifdef DEFLATE_ENABLED
+
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Constants
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+static const char * const textFileTypes[] = {
+    "csv", "htm", "html", "json", "log", "nmea", "txt", "xml"
+};
+
+// Member header: ID1, ID2, CM = deflate, FLG, MTIME, XFL, OS = unknown
+static const uint8_t gzipHeader[10] = {
+    0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff
+};
+
+// Length codes 257 - 285
+static const uint16_t lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t lengthExtraBits[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+// Distance codes 0 - 29
+static const uint16_t distanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+
+static const uint8_t distanceExtraBits[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Support routines
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//------------------------------------------------------------------------------
+// isTextFile
+//      Determine if the file contains text that compresses well
+//
+//  Inputs:
+//      filename: Zero terminated string containing the file name
+//
+//  Returns:
+//      True if the file name has one of the text file extensions
+//------------------------------------------------------------------------------
+bool
+isTextFile (
+    const char * filename
+    )
+{
+    const char * extension;
+    size_t index;
+
+    extension = strrchr(filename, '.');
+    if (extension && (!strchr(extension, '/')))
+        for (index = 0; index < sizeof(textFileTypes) / sizeof(textFileTypes[0]); index++)
+            if (!strcasecmp(&extension[1], textFileTypes[index]))
+                return true;
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// deflateBits
+//      Add bits to the compressed data in the line buffer, least significant
+//      bit first
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//      value: Bits to add
+//      count: Number of bits to add, 0 - 16
+//------------------------------------------------------------------------------
+static
+void
+deflateBits (
+    SD_TRANSFER * transfer,
+    uint32_t value,
+    int count
+    )
+{
+    transfer->deflateBitBuffer |= value << transfer->deflateBitCount;
+    transfer->deflateBitCount += count;
+    while (transfer->deflateBitCount >= 8) {
+        *transfer->lineBufferDataEnd++ = (char)transfer->deflateBitBuffer;
+        transfer->deflateBitBuffer >>= 8;
+        transfer->deflateBitCount -= 8;
+    }
+}
+
+//------------------------------------------------------------------------------
+// deflateSymbol
+//      Add a literal, length or end of block symbol using the fixed Huffman
+//      codes.  The Huffman codes are sent most significant bit first.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//      symbol: Symbol value, 0 - 287
+//------------------------------------------------------------------------------
+static
+void
+deflateSymbol (
+    SD_TRANSFER * transfer,
+    int symbol
+    )
+{
+    int bit;
+    int code;
+    int length;
+    uint32_t reversed;
+
+    if (symbol < 144) {
+        code = 0x30 + symbol;
+        length = 8;
+    } else if (symbol < 256) {
+        code = 0x190 + symbol - 144;
+        length = 9;
+    } else if (symbol < 280) {
+        code = symbol - 256;
+        length = 7;
+    } else {
+        code = 0xc0 + symbol - 280;
+        length = 8;
+    }
+    reversed = 0;
+    for (bit = 0; bit < length; bit++)
+        reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+    deflateBits(transfer, reversed, length);
+}
+
+//------------------------------------------------------------------------------
+// deflateMatch
+//      Add a copy of previous data to the compressed data
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//      length: Number of bytes to copy, 3 - 258
+//      distance: Number of bytes back to the start of the copy
+//------------------------------------------------------------------------------
+static
+void
+deflateMatch (
+    SD_TRANSFER * transfer,
+    int length,
+    int distance
+    )
+{
+    int bit;
+    int code;
+    uint32_t reversed;
+
+    // Add the length
+    for (code = 28; lengthBase[code] > length; code--)
+        ;
+    deflateSymbol(transfer, 257 + code);
+    deflateBits(transfer, length - lengthBase[code], lengthExtraBits[code]);
+
+    // Add the distance, the fixed distance codes are 5 bits
+    for (code = 29; distanceBase[code] > distance; code--)
+        ;
+    reversed = 0;
+    for (bit = 0; bit < 5; bit++)
+        reversed |= ((code >> bit) & 1) << (4 - bit);
+    deflateBits(transfer, reversed, 5);
+    deflateBits(transfer, distance - distanceBase[code], distanceExtraBits[code]);
+}
+
+//------------------------------------------------------------------------------
+// deflateStart
+//      Place the gzip header and the start of the compressed block into the
+//      line buffer.  The file is sent as a single final block using the
+//      fixed Huffman codes.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//------------------------------------------------------------------------------
+void
+deflateStart (
+    SD_TRANSFER * transfer
+    )
+{
+    memcpy(transfer->lineBuffer, gzipHeader, sizeof(gzipHeader));
+    transfer->lineBufferData = transfer->lineBuffer;
+    transfer->lineBufferDataEnd = &transfer->lineBuffer[sizeof(gzipHeader)];
+    transfer->deflateCrc = 0xffffffff;
+    transfer->deflateBitBuffer = 0;
+    transfer->deflateBitCount = 0;
+
+    // BFINAL = 1, BTYPE = 1 (fixed Huffman codes)
+    deflateBits(transfer, 1, 1);
+    deflateBits(transfer, 1, 2);
+}
+
+//------------------------------------------------------------------------------
+// deflateRead
+//      Read the next portion of the file into the window and compress it into
+//      the line buffer.  Matches are found using a single position per hash
+//      value, limiting the memory to the window and the hash table.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//
+//  Returns:
+//      The number of file bytes compressed or -1 at the end of the file or
+//      upon error
+//------------------------------------------------------------------------------
+int
+deflateRead (
+    SD_TRANSFER * transfer
+    )
+{
+    int bytesRead;
+    size_t bytesToRead;
+    uint32_t candidate;
+    uint32_t end;
+    uint32_t hash;
+    int length;
+    int maxLength;
+    uint32_t offset;
+    uint32_t position;
+    uint8_t * window;
+
+    // Read the file data into the window without wrapping
+    window = transfer->deflateWindow;
+    position = transfer->deflatePosition;
+    offset = position & (DEFLATE_WINDOW_SIZE - 1);
+    bytesToRead = DEFLATE_WINDOW_SIZE - offset;
+    if (bytesToRead > DEFLATE_INPUT_SIZE)
+        bytesToRead = DEFLATE_INPUT_SIZE;
+    if (bytesToRead > transfer->rangeRemaining)
+        bytesToRead = transfer->rangeRemaining;
+    bytesRead = transferRead(transfer, &window[offset], bytesToRead);
+    if (bytesRead <= 0)
+        return bytesRead;
+
+    // Update the CRC
+    transfer->deflateCrc = crcUpdate(transfer->deflateCrc, &window[offset],
+                                     bytesRead);
+
+    // Compress the data into the line buffer, the worst case is 9 bits per
+    // byte
+    transfer->lineBufferData = transfer->lineBuffer;
+    transfer->lineBufferDataEnd = transfer->lineBuffer;
+    end = position + bytesRead;
+    while (position != end) {
+        length = 0;
+        maxLength = end - position;
+        if (maxLength >= DEFLATE_MIN_MATCH) {
+            if (maxLength > DEFLATE_MAX_MATCH)
+                maxLength = DEFLATE_MAX_MATCH;
+
+            // Locate the previous data with the same hash
+            hash = ((window[position & (DEFLATE_WINDOW_SIZE - 1)] << 16)
+                 | (window[(position + 1) & (DEFLATE_WINDOW_SIZE - 1)] << 8)
+                 | window[(position + 2) & (DEFLATE_WINDOW_SIZE - 1)])
+                 * 2654435761u;
+            hash >>= 32 - DEFLATE_HASH_BITS;
+            candidate = transfer->deflateHash[hash] - 1;
+            transfer->deflateHash[hash] = position + 1;
+
+            // The previous data must still be in the window
+            if ((candidate != (uint32_t)-1) && (candidate != position)
+                && ((end - candidate) <= DEFLATE_WINDOW_SIZE))
+                while ((length < maxLength)
+                       && (window[(candidate + length) & (DEFLATE_WINDOW_SIZE - 1)]
+                           == window[(position + length) & (DEFLATE_WINDOW_SIZE - 1)]))
+                    length++;
+        }
+        if (length >= DEFLATE_MIN_MATCH) {
+            deflateMatch(transfer, length, position - candidate);
+            position += length;
+        } else {
+            deflateSymbol(transfer, window[position & (DEFLATE_WINDOW_SIZE - 1)]);
+            position += 1;
+        }
+    }
+    transfer->deflatePosition = end;
+    return bytesRead;
+}
+
+//------------------------------------------------------------------------------
+// deflateFinish
+//      Place the end of the compressed block and the gzip trailer into the
+//      line buffer
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//------------------------------------------------------------------------------
+void
+deflateFinish (
+    SD_TRANSFER * transfer
+    )
+{
+    uint32_t crc;
+    int index;
+
+    transfer->lineBufferData = transfer->lineBuffer;
+    transfer->lineBufferDataEnd = transfer->lineBuffer;
+
+    // End of block, then pad to a byte boundary
+    deflateSymbol(transfer, 256);
+    if (transfer->deflateBitCount)
+        deflateBits(transfer, 0, 8 - transfer->deflateBitCount);
+
+    // Add the CRC-32 and the file size modulo 2^32, least significant byte
+    // first
+    crc = ~transfer->deflateCrc;
+    for (index = 0; index < 4; index++)
+        *transfer->lineBufferDataEnd++ = (char)(crc >> (index * 8));
+    for (index = 0; index < 4; index++)
+        *transfer->lineBufferDataEnd++ = (char)(transfer->deflatePosition >> (index * 8));
+    transfer->deflate = false;
+}
+#endif  // DEFLATE_ENABLED
@@ -0,0 +1,430 @@
+// Arduino SD Card Server Library
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Server metrics: latency histograms, error counters and the metrics page
+
+#include "SdCardServerPrivate.h"
+
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Constants
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+// Upper bounds of the latency histogram buckets in milliseconds
+static const uint32_t histogramBounds[METRICS_BUCKETS] = {
+    5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000
+};
+
+static const char * const errorNames[ME_COUNT] = {
+    "not_found", "busy", "range", "read", "upload"
+};
+
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Support routines
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//------------------------------------------------------------------------------
+// histogramRecord
+//      Add a sample to a latency histogram
+//
+//  Inputs:
+//      histogram: Address of the SD_HISTOGRAM object
+//      msec: Latency in milliseconds
+//------------------------------------------------------------------------------
+void
+histogramRecord (
+    SD_HISTOGRAM * histogram,
+    uint32_t msec
+    )
+{
+    int bucket;
+
+    for (bucket = 0; (bucket < METRICS_BUCKETS)
+                     && (msec > histogramBounds[bucket]); bucket++)
+        ;
+    histogram->count[bucket] += 1;
+    histogram->sumMsec += msec;
+}
+
+//------------------------------------------------------------------------------
+// metricsSent
+//      Account for the data passed to the web server
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object
+//      bytes: Number of bytes placed in the response buffer
+//------------------------------------------------------------------------------
+void
+metricsSent (
+    SD_TRANSFER * transfer,
+    size_t bytes
+    )
+{
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+
+#ifdef RESPONSE_TRY_AGAIN
+    if (bytes == RESPONSE_TRY_AGAIN)
+        return;
+#endif  // RESPONSE_TRY_AGAIN
+    volume->metrics.bytesSent += bytes;
+    if (bytes && (!transfer->firstByteSent)) {
+        transfer->firstByteSent = true;
+        histogramRecord(&volume->metrics.firstByte, millis() - transfer->startMsec);
+    }
+}
+
+//------------------------------------------------------------------------------
+// metricsText
+//      Append text to the metrics, keeping the bytes within the window
+//
+//  Inputs:
+//      text: Address of the SD_TEXT object receiving the metrics
+//      data: Zero terminated string to append
+//------------------------------------------------------------------------------
+static
+void
+metricsText (
+    SD_TEXT * text,
+    const char * data
+    )
+{
+    size_t end;
+    size_t length;
+    size_t start;
+
+    length = strlen(data);
+    start = text->length;
+    end = start + length;
+    text->length = end;
+
+    // Copy the part of the data that falls within the window
+    if (start < text->offset)
+        start = text->offset;
+    if (end > (text->offset + text->maxLen))
+        end = text->offset + text->maxLen;
+    if (start < end)
+        memcpy(&text->buffer[start - text->offset],
+               &data[start - (text->length - length)], end - start);
+}
+
+//------------------------------------------------------------------------------
+// metricsEnd
+//      Determine the number of metrics bytes placed in the window
+//
+//  Inputs:
+//      text: Address of the SD_TEXT object receiving the metrics
+//
+//  Returns:
+//      The number of bytes in the window, zero (0) if the text ends before
+//      the window
+//------------------------------------------------------------------------------
+static
+size_t
+metricsEnd (
+    SD_TEXT * text
+    )
+{
+    if (text->length <= text->offset)
+        return 0;
+    if ((text->length - text->offset) > text->maxLen)
+        return text->maxLen;
+    return text->length - text->offset;
+}
+
+//------------------------------------------------------------------------------
+// metricsPrint
+//      Append a formatted line to the metrics text
+//
+//  Inputs:
+//      text: Address of the SD_TEXT object receiving the metrics
+//      format: Zero terminated printf format string
+//      ...: Values for the format string
+//------------------------------------------------------------------------------
+static
+void
+metricsPrint (
+    SD_TEXT * text,
+    const char * format,
+    ...
+    )
+{
+    va_list args;
+    char line[METRICS_LINE_SIZE];
+
+    // Skip the formatting once the window is full
+    if (text->length >= (text->offset + text->maxLen))
+        return;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    metricsText(text, line);
+}
+
+//------------------------------------------------------------------------------
+// metricsHistogram
+//      Append a latency histogram to the metrics text
+//
+//  Inputs:
+//      text: Address of the SD_TEXT object receiving the metrics
+//      name: Zero terminated name of the histogram
+//      histogram: Address of the SD_HISTOGRAM object
+//      json: True for JSON, false for the Prometheus text format
+//------------------------------------------------------------------------------
+static
+void
+metricsHistogram (
+    SD_TEXT * text,
+    const char * name,
+    const SD_HISTOGRAM * histogram,
+    bool json
+    )
+{
+    int bucket;
+    uint32_t count;
+
+    // JSON: bucket bounds in milliseconds and the samples in each bucket
+    if (json) {
+        metricsPrint(text, ",\"%sMsec\":{\"le\":[", name);
+        for (bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+            metricsPrint(text, "%s%lu", bucket ? "," : "",
+                         (unsigned long)histogramBounds[bucket]);
+        metricsText(text, "],\"counts\":[");
+        for (bucket = 0; bucket <= METRICS_BUCKETS; bucket++)
+            metricsPrint(text, "%s%lu", bucket ? "," : "",
+                         (unsigned long)histogram->count[bucket]);
+        metricsPrint(text, "],\"sum\":%llu}",
+                     (unsigned long long)histogram->sumMsec);
+        return;
+    }
+
+    // Prometheus: cumulative buckets in seconds
+    metricsPrint(text, "# TYPE sd_card_server_%s_seconds histogram\n", name);
+    count = 0;
+    for (bucket = 0; bucket <= METRICS_BUCKETS; bucket++) {
+        count += histogram->count[bucket];
+        if (bucket < METRICS_BUCKETS)
+            metricsPrint(text, "sd_card_server_%s_seconds_bucket{le=\"%lu.%03lu\"} %lu\n",
+                         name, (unsigned long)(histogramBounds[bucket] / 1000),
+                         (unsigned long)(histogramBounds[bucket] % 1000),
+                         (unsigned long)count);
+        else
+            metricsPrint(text, "sd_card_server_%s_seconds_bucket{le=\"+Inf\"} %lu\n",
+                         name, (unsigned long)count);
+    }
+    metricsPrint(text, "sd_card_server_%s_seconds_sum %llu.%03llu\n", name,
+                 (unsigned long long)(histogram->sumMsec / 1000),
+                 (unsigned long long)(histogram->sumMsec % 1000));
+    metricsPrint(text, "sd_card_server_%s_seconds_count %lu\n", name,
+                 (unsigned long)count);
+}
+
+//------------------------------------------------------------------------------
+// metricsSnapshot
+//      Copy the metrics for a metrics request
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      snapshot: Address of the SD_METRICS_SNAPSHOT object to fill
+//      json: True for JSON, false for the Prometheus text format
+//------------------------------------------------------------------------------
+void
+metricsSnapshot (
+    SD_VOLUME * volume,
+    SD_METRICS_SNAPSHOT * snapshot,
+    bool json
+    )
+{
+    // The counters are updated by the web server and prefetch tasks
+    snapshot->metrics = volume->metrics;
+    snapshot->activeTransfers = volume->activeTransfers;
+    snapshot->cacheBytes = volume->cacheBytes;
+    snapshot->freeBytes = (volume->cardFreeClusters < 0) ? -1
+                        : (int64_t)volume->cardFreeClusters * volume->cardClusterBytes;
+    snapshot->heapMinFree = 0;
+#ifdef ESP32
+    snapshot->heapMinFree = ESP.getMinFreeHeap();
+#endif  // ESP32
+    snapshot->json = json;
+}
+
+//------------------------------------------------------------------------------
+// metricsRead
+//      Get a portion of the metrics text
+//
+//  Inputs:
+//      snapshot: Address of the SD_METRICS_SNAPSHOT object
+//      offset: Offset of the portion in the metrics text
+//      buffer: Address of the buffer to receive the portion
+//      maxLen: Size of the buffer in bytes
+//
+//  Returns:
+//      The number of bytes placed in the buffer, zero (0) at the end of the
+//      text
+//------------------------------------------------------------------------------
+size_t
+metricsRead (
+    const SD_METRICS_SNAPSHOT * snapshot,
+    size_t offset,
+    char * buffer,
+    size_t maxLen
+    )
+{
+    int error;
+    bool json;
+    SD_TEXT textWindow;
+    SD_TEXT * text;
+
+    textWindow.buffer = buffer;
+    textWindow.offset = offset;
+    textWindow.maxLen = maxLen;
+    textWindow.length = 0;
+    text = &textWindow;
+    json = snapshot->json;
+
+    if (json) {
+        metricsPrint(text, "{\"activeTransfers\":%d,\"requests\":{\"download\":%lu,"
+                     "\"listing\":%lu,\"upload\":%lu,\"sum\":%lu},",
+                     snapshot->activeTransfers, (unsigned long)snapshot->metrics.downloads,
+                     (unsigned long)snapshot->metrics.listings,
+                     (unsigned long)snapshot->metrics.uploads,
+                     (unsigned long)snapshot->metrics.sums);
+        metricsPrint(text, "\"sumsCached\":%lu,\"cacheHits\":%lu,\"cacheMisses\":%lu,"
+                     "\"cacheBytes\":%lu,\"bytesSent\":%llu",
+                     (unsigned long)snapshot->metrics.sumsCached,
+                     (unsigned long)snapshot->metrics.cacheHits,
+                     (unsigned long)snapshot->metrics.cacheMisses,
+                     (unsigned long)snapshot->cacheBytes,
+                     (unsigned long long)snapshot->metrics.bytesSent);
+        metricsPrint(text, ",\"chunks\":%lu,\"networkWaitUsec\":%llu,"
+                     "\"sdReads\":%lu,\"sdReadUsec\":%llu",
+                     (unsigned long)snapshot->metrics.chunks,
+                     (unsigned long long)snapshot->metrics.networkWaitUsec,
+                     (unsigned long)snapshot->metrics.sdReads,
+                     (unsigned long long)snapshot->metrics.sdReadUsec);
+        metricsPrint(text, ",\"listingEntries\":%lu,\"listingUsec\":%llu,"
+                     "\"listingEntriesPerSec\":%lu",
+                     (unsigned long)snapshot->metrics.listingEntries,
+                     (unsigned long long)snapshot->metrics.listingUsec,
+                     (unsigned long)(snapshot->metrics.listingUsec
+                         ? (snapshot->metrics.listingEntries * 1000000ULL)
+                           / snapshot->metrics.listingUsec
+                         : 0));
+        metricsText(text, ",\"errors\":{");
+        for (error = 0; error < ME_COUNT; error++)
+            metricsPrint(text, "%s\"%s\":%lu", error ? "," : "",
+                         errorNames[error],
+                         (unsigned long)snapshot->metrics.errors[error]);
+        metricsPrint(text, "},\"heapMinFree\":%lu,\"freeBytes\":%lld",
+                     (unsigned long)snapshot->heapMinFree,
+                     (long long)snapshot->freeBytes);
+        metricsHistogram(text, "firstByte", &snapshot->metrics.firstByte, json);
+        metricsHistogram(text, "total", &snapshot->metrics.total, json);
+        metricsText(text, "}\n");
+        return metricsEnd(text);
+    }
+
+    metricsPrint(text, "# TYPE sd_card_server_active_transfers gauge\n"
+                 "sd_card_server_active_transfers %d\n", snapshot->activeTransfers);
+    metricsPrint(text, "# TYPE sd_card_server_requests_total counter\n"
+                 "sd_card_server_requests_total{type=\"download\"} %lu\n",
+                 (unsigned long)snapshot->metrics.downloads);
+    metricsPrint(text, "sd_card_server_requests_total{type=\"listing\"} %lu\n"
+                 "sd_card_server_requests_total{type=\"upload\"} %lu\n",
+                 (unsigned long)snapshot->metrics.listings,
+                 (unsigned long)snapshot->metrics.uploads);
+    metricsPrint(text, "sd_card_server_requests_total{type=\"sum\"} %lu\n",
+                 (unsigned long)snapshot->metrics.sums);
+    metricsPrint(text, "# TYPE sd_card_server_sums_cached_total counter\n"
+                 "sd_card_server_sums_cached_total %lu\n",
+                 (unsigned long)snapshot->metrics.sumsCached);
+    metricsPrint(text, "# TYPE sd_card_server_file_cache_total counter\n"
+                 "sd_card_server_file_cache_total{result=\"hit\"} %lu\n",
+                 (unsigned long)snapshot->metrics.cacheHits);
+    metricsPrint(text, "sd_card_server_file_cache_total{result=\"miss\"} %lu\n",
+                 (unsigned long)snapshot->metrics.cacheMisses);
+    metricsPrint(text, "# TYPE sd_card_server_file_cache_bytes gauge\n"
+                 "sd_card_server_file_cache_bytes %lu\n",
+                 (unsigned long)snapshot->cacheBytes);
+    metricsPrint(text, "# TYPE sd_card_server_sent_bytes_total counter\n"
+                 "sd_card_server_sent_bytes_total %llu\n",
+                 (unsigned long long)snapshot->metrics.bytesSent);
+    metricsPrint(text, "# TYPE sd_card_server_chunks_total counter\n"
+                 "sd_card_server_chunks_total %lu\n",
+                 (unsigned long)snapshot->metrics.chunks);
+    metricsPrint(text, "# TYPE sd_card_server_network_wait_seconds_total counter\n"
+                 "sd_card_server_network_wait_seconds_total %llu.%06llu\n",
+                 (unsigned long long)(snapshot->metrics.networkWaitUsec / 1000000),
+                 (unsigned long long)(snapshot->metrics.networkWaitUsec % 1000000));
+    metricsPrint(text, "# TYPE sd_card_server_sd_reads_total counter\n"
+                 "sd_card_server_sd_reads_total %lu\n",
+                 (unsigned long)snapshot->metrics.sdReads);
+    metricsPrint(text, "# TYPE sd_card_server_sd_read_seconds_total counter\n"
+                 "sd_card_server_sd_read_seconds_total %llu.%06llu\n",
+                 (unsigned long long)(snapshot->metrics.sdReadUsec / 1000000),
+                 (unsigned long long)(snapshot->metrics.sdReadUsec % 1000000));
+    metricsPrint(text, "# TYPE sd_card_server_listing_entries_total counter\n"
+                 "sd_card_server_listing_entries_total %lu\n",
+                 (unsigned long)snapshot->metrics.listingEntries);
+    metricsPrint(text, "# TYPE sd_card_server_listing_seconds_total counter\n"
+                 "sd_card_server_listing_seconds_total %llu.%06llu\n",
+                 (unsigned long long)(snapshot->metrics.listingUsec / 1000000),
+                 (unsigned long long)(snapshot->metrics.listingUsec % 1000000));
+    metricsText(text, "# TYPE sd_card_server_errors_total counter\n");
+    for (error = 0; error < ME_COUNT; error++)
+        metricsPrint(text, "sd_card_server_errors_total{type=\"%s\"} %lu\n",
+                     errorNames[error], (unsigned long)snapshot->metrics.errors[error]);
+#ifdef ESP32
+    metricsPrint(text, "# TYPE sd_card_server_heap_min_free_bytes gauge\n"
+                 "sd_card_server_heap_min_free_bytes %lu\n",
+                 (unsigned long)snapshot->heapMinFree);
+#endif  // ESP32
+    if (snapshot->freeBytes >= 0)
+        metricsPrint(text, "# TYPE sd_card_server_free_bytes gauge\n"
+                     "sd_card_server_free_bytes %llu\n",
+                     (unsigned long long)snapshot->freeBytes);
+    metricsHistogram(text, "first_byte", &snapshot->metrics.firstByte, json);
+    metricsHistogram(text, "total", &snapshot->metrics.total, json);
+    return metricsEnd(text);
+}
+
+//------------------------------------------------------------------------------
+// metricsPage
+//      Send the metrics, ?metrics=json selects JSON instead of the Prometheus
+//      text format.  The metrics request uses a transfer from the pool.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      request: Address of the AsyncWebServerRequest object
+//------------------------------------------------------------------------------
+int
+metricsPage (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request
+    )
+{
+    AsyncWebServerResponse * response;
+    SD_METRICS_SNAPSHOT snapshot;
+    SD_TRANSFER * transfer;
+
+    // Copy the metrics before this request is counted
+    metricsSnapshot(volume, &snapshot,
+                    !strcmp(request->getParam("metrics")->value().c_str(), "json"));
+
+    // The text is generated in pieces from the copy of the metrics held by
+    // the transfer
+    transfer = transferAllocate(volume, request);
+    if (transfer) {
+        transfer->metricsRequest = true;
+        transfer->metricsSnapshot = snapshot;
+        AwsResponseFiller filler = [transfer](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            return metricsRead(&transfer->metricsSnapshot, index, (char *)buffer, maxLen);
+        };
+        response = request->beginChunkedResponse(snapshot.json ? "application/json"
+                                                  : "text/plain; version=0.0.4", filler);
+        request->send(response);
+    }
+    return 1;
+}
@@ -0,0 +1,142 @@
+// Arduino SD Card Server Library
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// HTTP Range requests and multipart/byteranges responses
+
+#include "SdCardServerPrivate.h"
+
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Constants
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+prog_char byteRangeBoundary[] PROGMEM = "SdCardServer-byteranges-8f3a61c5";
+
+static prog_char byteRangePartHeader[] PROGMEM = "\r\n--%s\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "Content-Range: bytes %llu-%llu/%llu\r\n\r\n";
+
+prog_char byteRangeTrailer[] PROGMEM = "\r\n--%s--\r\n";
+
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Support routines
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//------------------------------------------------------------------------------
+// buildPartHeader
+//      Build the multipart/byteranges header that precedes a range
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object for this download
+//      index: Index of the range
+//      buffer: Address of a buffer to receive the part header
+//
+//  Returns:
+//      The number of characters written to the buffer
+//------------------------------------------------------------------------------
+int
+buildPartHeader (
+    SD_TRANSFER * transfer,
+    int index,
+    char * buffer
+    )
+{
+    SD_RANGE * range;
+
+    range = &transfer->ranges[index];
+    return sprintf(buffer, byteRangePartHeader, byteRangeBoundary,
+                   (unsigned long long)range->offset,
+                   (unsigned long long)(range->offset + range->length - 1),
+                   (unsigned long long)transfer->fileSize);
+}
+
+//------------------------------------------------------------------------------
+// parseRange
+//      Parse the value of the HTTP Range header
+//
+//  Inputs:
+//      value: Zero terminated string containing the Range header value
+//      fileSize: Size of the file in bytes
+//      ranges: Address of an array to receive the satisfiable ranges
+//
+//  Returns:
+//      The number of satisfiable ranges placed in the array, zero (0) if none
+//      of the ranges can be satisfied, or -1 if the header is invalid or
+//      contains too many ranges and must be ignored.
+//------------------------------------------------------------------------------
+int
+parseRange (
+    const char * value,
+    uint64_t fileSize,
+    SD_RANGE * ranges
+    )
+{
+    char * end;
+    uint64_t first;
+    uint64_t last;
+    int rangeCount;
+    bool suffix;
+
+    // Only byte ranges are supported
+    if (strncasecmp(value, "bytes=", 6))
+        return -1;
+    value += 6;
+
+    // Walk the comma separated list of ranges
+    rangeCount = 0;
+    while (*value) {
+        // Skip the white space and empty list elements
+        if ((*value == ' ') || (*value == '\t') || (*value == ',')) {
+            value++;
+            continue;
+        }
+
+        // Get the first byte position, missing for a suffix range
+        suffix = (*value == '-');
+        first = 0;
+        if (!suffix) {
+            if ((*value < '0') || (*value > '9'))
+                return -1;
+            first = strtoull(value, &end, 10);
+            value = end;
+            if (*value != '-')
+                return -1;
+        }
+        value++;
+
+        // Get the last byte position or the suffix length
+        last = fileSize - 1;
+        if ((*value >= '0') && (*value <= '9')) {
+            last = strtoull(value, &end, 10);
+            value = end;
+            if (suffix) {
+                // Send the last bytes of the file
+                if (!last)
+                    continue;
+                first = (last < fileSize) ? fileSize - last : 0;
+                last = fileSize - 1;
+            } else if (last < first)
+                return -1;
+            else if (last >= fileSize)
+                last = fileSize - 1;
+        } else if (suffix)
+            return -1;
+        while ((*value == ' ') || (*value == '\t'))
+            value++;
+        if (*value && (*value != ','))
+            return -1;
+
+        // Ignore the ranges that start beyond the end of the file
+        if (first >= fileSize)
+            continue;
+
+        // Save the range
+        if (rangeCount >= MAX_BYTE_RANGES)
+            return -1;
+        ranges[rangeCount].offset = first;
+        ranges[rangeCount].length = last - first + 1;
+        rangeCount += 1;
+    }
+    return rangeCount;
+}
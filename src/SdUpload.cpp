@@ -0,0 +1,359 @@
+// Arduino SD Card Server Library
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// PUT and POST uploads
+
+#include "SdCardServerPrivate.h"
+
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Support routines
+//-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//------------------------------------------------------------------------------
+// uploadFind
+//      Locate the upload state for a request
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      request: Address of the AsyncWebServerRequest object
+//
+//  Returns:
+//      Returns the address of the SD_TRANSFER object or NULL if the request
+//      is not uploading a file
+//------------------------------------------------------------------------------
+static
+SD_TRANSFER *
+uploadFind (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request
+    )
+{
+    int index;
+
+    for (index = 0; index < volume->maxTransfers; index++)
+        if (volume->transfers[index].inUse && (volume->transfers[index].upload == request))
+            return &volume->transfers[index];
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+// uploadStart
+//      Create the partial file that receives the upload.  The name of the
+//      partial file is the file name followed by UPLOAD_SUFFIX.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object
+//      filename: Zero terminated path of the file to upload
+//      length: Length of the path
+//      total: Number of bytes in the request body
+//------------------------------------------------------------------------------
+static
+void
+uploadStart (
+    SD_TRANSFER * transfer,
+    const char * filename,
+    size_t length,
+    size_t total
+    )
+{
+    SdFile * dir;
+    const char * name;
+    SdFile rootDir;
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+
+    volume->metrics.uploads += 1;
+
+    // Use the read-ahead buffers when available, the upload does not read
+    // the SD card.  Both buffers are a multiple of the sector size.
+    transfer->uploadData = (uint8_t *)transfer->lineBuffer;
+    transfer->uploadSize = LINE_BUFFER_SIZE;
+#ifdef PREFETCH_ENABLED
+    if (transfer->prefetchData) {
+        transfer->uploadData = transfer->prefetchData;
+        transfer->uploadSize = PREFETCH_BUFFERS * PREFETCH_BUFFER_SIZE;
+    }
+#endif  // PREFETCH_ENABLED
+
+    // Directories may not be uploaded
+    if ((!length) || (filename[length - 1] == '/')) {
+        transfer->uploadStatus = 405;
+        return;
+    }
+    if ((length + UPLOAD_SUFFIX_LENGTH) >= MAX_PATH_SIZE) {
+        transfer->uploadStatus = 414;
+        return;
+    }
+    strcpy(transfer->path, filename);
+
+    sdLock(volume);
+
+    // Don't replace a directory
+    dir = pathParent(volume, transfer->path, &rootDir, &name);
+    if (dir && transfer->file.open(dir, name, O_RDONLY)) {
+        transfer->uploadReplaced = true;
+        if (transfer->file.isDir())
+            dir = NULL;
+        transfer->file.close();
+    }
+
+    // Create the partial file in the parent directory
+    sprintf(transfer->nameBuffer, "%s" UPLOAD_SUFFIX, name);
+    if ((!dir) || (!transfer->file.open(dir, transfer->nameBuffer,
+                                        O_RDWR | O_CREAT | O_TRUNC)))
+        transfer->uploadStatus = 409;
+
+    // Allocate contiguous clusters for the file when the length is known.
+    // When the free space is fragmented the clusters are allocated as the
+    // data is written.  Refuse the upload before writing any data when the
+    // SD card does not have room for the file.
+    else if (total && (!transfer->file.preAllocate(total))) {
+        if ((volume->cardFreeClusters < 0)
+            || (volume->cardFreeGeneration != volume->sdGeneration))
+            freeSpaceCount(volume);
+        if ((volume->cardFreeClusters >= 0)
+            && (((uint64_t)volume->cardFreeClusters * volume->cardClusterBytes)
+                < total))
+            transfer->uploadStatus = 507;
+    }
+    if (rootDir.isOpen())
+        rootDir.close();
+    sdUnlock(volume);
+}
+
+//------------------------------------------------------------------------------
+// uploadFlush
+//      Write the data to the SD card.  The caller must hold the SD card
+//      lock.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object
+//      data: Address of the data to write
+//      length: Number of bytes to write
+//------------------------------------------------------------------------------
+static
+void
+uploadFlush (
+    SD_TRANSFER * transfer,
+    const uint8_t * data,
+    size_t length
+    )
+{
+    if ((!transfer->uploadStatus)
+        && (transfer->file.write(data, length) != length))
+        transfer->uploadStatus = 507;
+}
+
+//------------------------------------------------------------------------------
+// uploadWrite
+//      Write the next portion of the request body to the partial file.  The
+//      data is written to the SD card in multiples of the sector size, so the
+//      file position stays sector aligned and SdFat writes the sectors
+//      directly without reading them first.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object
+//      data: Address of the data received
+//      length: Number of bytes received
+//------------------------------------------------------------------------------
+static
+void
+uploadWrite (
+    SD_TRANSFER * transfer,
+    const uint8_t * data,
+    size_t length
+    )
+{
+    size_t bytes;
+
+    while (length && (!transfer->uploadStatus)) {
+        if ((!transfer->uploadLength) && (length >= transfer->uploadSize)) {
+            // Write the whole buffers directly from the received data
+            bytes = length - (length % transfer->uploadSize);
+            sdLock(transfer->volume);
+            uploadFlush(transfer, data, bytes);
+            sdUnlock(transfer->volume);
+        } else {
+            // Fill the write buffer
+            bytes = transfer->uploadSize - transfer->uploadLength;
+            if (bytes > length)
+                bytes = length;
+            memcpy(&transfer->uploadData[transfer->uploadLength], data, bytes);
+            transfer->uploadLength += bytes;
+            if (transfer->uploadLength == transfer->uploadSize) {
+                sdLock(transfer->volume);
+                uploadFlush(transfer, transfer->uploadData,
+                            transfer->uploadLength);
+                sdUnlock(transfer->volume);
+                transfer->uploadLength = 0;
+            }
+        }
+        data += bytes;
+        length -= bytes;
+    }
+}
+
+//------------------------------------------------------------------------------
+// uploadFinish
+//      Write the remaining data and rename the partial file, replacing any
+//      existing file.  The file is not renamed if any step of the upload
+//      failed, the partial file is removed by transferFree instead.
+//
+//  Inputs:
+//      transfer: Address of the SD_TRANSFER object
+//------------------------------------------------------------------------------
+static
+void
+uploadFinish (
+    SD_TRANSFER * transfer
+    )
+{
+    SdFile * dir;
+    const char * name;
+    bool removed;
+    SdFile rootDir;
+    SdFile target;
+    SD_VOLUME * volume;
+
+    volume = transfer->volume;
+
+    sdLock(volume);
+
+    // Write the last partial buffer and update the directory entry
+    uploadFlush(transfer, transfer->uploadData, transfer->uploadLength);
+    transfer->uploadLength = 0;
+    if ((!transfer->uploadStatus) && (!transfer->file.sync()))
+        transfer->uploadStatus = 507;
+
+    // Replace the file.  FAT has no atomic replace, the existing file is
+    // removed just before the rename, so the complete new file is the only
+    // one left if the rename is interrupted.
+    if (!transfer->uploadStatus) {
+        dir = pathParent(volume, transfer->path, &rootDir, &name);
+        removed = dir && target.open(dir, name, O_WRONLY) && target.remove();
+        if (dir && transfer->file.rename(dir, name)) {
+            transfer->file.close();
+            transfer->uploadStatus = transfer->uploadReplaced ? 204 : 201;
+        } else
+            transfer->uploadStatus = 500;
+        if (rootDir.isOpen())
+            rootDir.close();
+
+        // The listings and cached files change only when the files on the
+        // SD card changed
+        if (removed || (transfer->uploadStatus != 500))
+            volume->sdGeneration += 1;
+    }
+    sdUnlock(volume);
+}
+
+//------------------------------------------------------------------------------
+// uploadBody
+//      Write the next portion of a PUT or POST request body to the SD card.
+//      The response is sent by uploadPage after the entire body is received.
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      request: Address of the AsyncWebServerRequest object
+//      data: Address of the data received
+//      length: Number of bytes received
+//      index: Offset of the data in the request body
+//      total: Number of bytes in the request body
+//------------------------------------------------------------------------------
+void
+uploadBody (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request,
+    uint8_t * data,
+    size_t length,
+    size_t index,
+    size_t total
+    )
+{
+    const char * filename;
+    size_t pathLength;
+    SD_TRANSFER * transfer;
+
+    // Determine if this is an upload to the SD card
+    if ((!volume->uploadsAllowed)
+        || (!(request->method() & (HTTP_PUT | HTTP_POST))))
+        return;
+
+    // Start the upload with the first portion of the body.  uploadPage
+    // sends the 503 response if the transfer state is not available.
+    if (!index) {
+        filename = sdCardPath(volume, request, &pathLength);
+        if (!filename)
+            return;
+        transfer = transferGet(volume, request);
+        if (!transfer)
+            return;
+        transfer->upload = request;
+        uploadStart(transfer, filename, pathLength, total);
+    } else {
+        transfer = uploadFind(volume, request);
+        if (!transfer)
+            return;
+    }
+
+    // Write the data and complete the file
+    uploadWrite(transfer, data, length);
+    if ((!transfer->uploadStatus) && ((index + length) >= total))
+        uploadFinish(transfer);
+}
+
+//------------------------------------------------------------------------------
+// uploadPage
+//      Send the response for an upload after the request body is received
+//
+//  Inputs:
+//      volume: Address of the SD_VOLUME object
+//      request: Address of the AsyncWebServerRequest object
+//      filename: Zero terminated path of the file to upload
+//      length: Length of the path
+//
+//  Returns:
+//      Returns one (1) since the response is always sent
+//------------------------------------------------------------------------------
+int
+uploadPage (
+    SD_VOLUME * volume,
+    AsyncWebServerRequest * request,
+    const char * filename,
+    size_t length
+    )
+{
+    AsyncWebServerResponse * response;
+    SD_TRANSFER * transfer;
+
+    transfer = uploadFind(volume, request);
+    if (!transfer) {
+        // The transfer state was not available when the body arrived
+        if (request->contentLength()) {
+            sendBusy(volume, request);
+            return 1;
+        }
+
+        // No body was received, create an empty file
+        transfer = transferAllocate(volume, request);
+        if (!transfer)
+            return 1;
+        transfer->upload = request;
+        uploadStart(transfer, filename, length, 0);
+        if (!transfer->uploadStatus)
+            uploadFinish(transfer);
+    }
+
+    // The web server calls this routine after the entire body is received
+    if ((!transfer->uploadStatus) || (transfer->uploadStatus >= 400))
+        volume->metrics.errors[ME_UPLOAD] += 1;
+    response = request->beginResponse(transfer->uploadStatus
+                                      ? transfer->uploadStatus : 500);
+    if (transfer->uploadStatus == 405)
+        response->addHeader("Allow", "GET, HEAD");
+    request->send(response);
+    return 1;
+}
@@ -0,0 +1,64 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+
+#include "SdTest.h"
+
+bool testCardPresent = true;
+int testFailures;
+
+int
+testResult (
+    const char * name
+    )
+{
+    if (testFailures) {
+        printf("%s: %d check(s) failed\n", name, testFailures);
+        return 1;
+    }
+    printf("%s: passed\n", name);
+    return 0;
+}
+
+int
+testSdCardPresent (
+    )
+{
+    return testCardPresent;
+}
+
+std::unique_ptr<FakeConnection>
+testGet (
+    AsyncWebServer * server,
+    const char * target,
+    size_t space
+    )
+{
+    std::unique_ptr<FakeConnection> connection;
+
+    connection.reset(new FakeConnection(server, HTTP_GET, target));
+    connection->run(space);
+    return connection;
+}
+
+std::string
+testGenerated (
+    uint32_t seed,
+    uint64_t offset,
+    size_t length
+    )
+{
+    std::string data;
+
+    data.resize(length);
+    fakeFill(seed, offset, (uint8_t *)&data[0], length);
+    return data;
+}
+
+void
+testSettle (
+    )
+{
+    delay(5);
+}
@@ -0,0 +1,79 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Helpers shared by the tests and benchmarks
+
+#ifndef SD_TEST_H_INCLUDED
+#define SD_TEST_H_INCLUDED
+
+#include <memory>
+#include <string>
+
+#include "FakeAlloc.h"
+#include "SdCardServer.h"
+
+//------------------------------------------------------------------------------
+// Checks, a failure is reported and counted, the test continues
+//------------------------------------------------------------------------------
+
+extern int testFailures;
+
+#define CHECK(condition)                                                      \
+    do {                                                                      \
+        if (!(condition)) {                                                   \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__,  \
+                    #condition);                                              \
+            testFailures += 1;                                                \
+        }                                                                     \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                            \
+    do {                                                                      \
+        long long checkActual = (long long)(actual);                          \
+        long long checkExpected = (long long)(expected);                      \
+        if (checkActual != checkExpected) {                                   \
+            fprintf(stderr, "%s:%d: CHECK failed: %s == %s (%lld != %lld)\n", \
+                    __FILE__, __LINE__, #actual, #expected, checkActual,      \
+                    checkExpected);                                           \
+            testFailures += 1;                                                \
+        }                                                                     \
+    } while (0)
+
+#define CHECK_STR(actual, expected)                                           \
+    do {                                                                      \
+        std::string checkActual = (actual);                                   \
+        std::string checkExpected = (expected);                               \
+        if (checkActual != checkExpected) {                                   \
+            fprintf(stderr, "%s:%d: CHECK failed: %s == \"%s\" (\"%s\")\n",   \
+                    __FILE__, __LINE__, #actual, checkExpected.c_str(),       \
+                    checkActual.c_str());                                     \
+            testFailures += 1;                                                \
+        }                                                                     \
+    } while (0)
+
+// Report the result, returns the process exit status
+int testResult (const char * name);
+
+//------------------------------------------------------------------------------
+// Server fixture
+//------------------------------------------------------------------------------
+
+extern bool testCardPresent;
+
+// SD_CARD_PRESENT routine for the tests
+int testSdCardPresent ();
+
+// Send a GET request and return the completed response
+std::unique_ptr<FakeConnection> testGet (AsyncWebServer * server,
+                                         const char * target,
+                                         size_t space = 4 * FAKE_TCP_MSS);
+
+// Expected contents of a generated file
+std::string testGenerated (uint32_t seed, uint64_t offset, size_t length);
+
+// Wait for the prefetch task to go idle
+void testSettle ();
+
+#endif  // SD_TEST_H_INCLUDED
@@ -0,0 +1,108 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+
+#include <chrono>
+#include <thread>
+
+#include "Arduino.h"
+#include "WiFi.h"
+
+EspClass ESP;
+HardwareSerial Serial;
+WiFiClass WiFi;
+
+static const std::chrono::steady_clock::time_point bootTime
+    = std::chrono::steady_clock::now();
+static uint64_t randomState = 0x2545f4914f6cdd1dULL;
+
+//------------------------------------------------------------------------------
+// Print
+//------------------------------------------------------------------------------
+size_t
+Print::printf (
+    const char * format,
+    ...
+    )
+{
+    va_list args;
+    char buffer[256];
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0)
+        return 0;
+    if ((size_t)length >= sizeof(buffer))
+        length = sizeof(buffer) - 1;
+    return write((const uint8_t *)buffer, length);
+}
+
+//------------------------------------------------------------------------------
+// Clock
+//------------------------------------------------------------------------------
+unsigned long
+millis (
+    )
+{
+    return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - bootTime).count();
+}
+
+unsigned long
+micros (
+    )
+{
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - bootTime).count();
+}
+
+void
+delay (
+    unsigned long msec
+    )
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+}
+
+void
+delayMicroseconds (
+    unsigned int usec
+    )
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(usec));
+}
+
+void
+yield (
+    )
+{
+    std::this_thread::yield();
+}
+
+//------------------------------------------------------------------------------
+// Random numbers, repeatable between runs
+//------------------------------------------------------------------------------
+long
+random (
+    long limit
+    )
+{
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    if (limit <= 0)
+        return 0;
+    return (long)((randomState * 0x2545f4914f6cdd1dULL) >> 33) % limit;
+}
+
+long
+random (
+    long low,
+    long limit
+    )
+{
+    return (limit > low) ? low + random(limit - low) : low;
+}
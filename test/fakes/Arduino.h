@@ -0,0 +1,181 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Stand-in for the Arduino core: String, Print, the clock and the few
+// ESP32 globals used by the library.
+
+#ifndef FAKE_ARDUINO_H_INCLUDED
+#define FAKE_ARDUINO_H_INCLUDED
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+
+#ifdef ESP32
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif  // ESP32
+
+//------------------------------------------------------------------------------
+// Program memory, the host has a single address space
+//------------------------------------------------------------------------------
+
+#define PROGMEM
+#define PSTR(s)             (s)
+#define F(s)                (s)
+typedef char prog_char;
+typedef const char * PGM_P;
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+#define memcpy_P            memcpy
+#define snprintf_P          snprintf
+#define strcat_P            strcat
+#define strcpy_P            strcpy
+#define strlen_P            strlen
+#define strncpy_P           strncpy
+
+//------------------------------------------------------------------------------
+// String
+//------------------------------------------------------------------------------
+
+class String
+{
+public:
+    std::string s;
+
+    String () {}
+    String (const char * text) : s(text ? text : "") {}
+    String (const std::string & text) : s(text) {}
+    String (char c) : s(1, c) {}
+    explicit String (int value) : s(std::to_string(value)) {}
+    explicit String (unsigned int value) : s(std::to_string(value)) {}
+    explicit String (long value) : s(std::to_string(value)) {}
+    explicit String (unsigned long value) : s(std::to_string(value)) {}
+    explicit String (long long value) : s(std::to_string(value)) {}
+    explicit String (unsigned long long value) : s(std::to_string(value)) {}
+
+    const char * c_str () const { return s.c_str(); }
+    size_t length () const { return s.size(); }
+    bool reserve (size_t size) { s.reserve(size); return true; }
+    bool isEmpty () const { return s.empty(); }
+    long toInt () const { return atol(s.c_str()); }
+    bool equals (const char * text) const { return s == text; }
+    bool equalsIgnoreCase (const String & text) const
+        { return !strcasecmp(s.c_str(), text.c_str()); }
+    bool startsWith (const char * text) const
+        { return !s.compare(0, strlen(text), text); }
+    int indexOf (char c) const
+        { size_t offset = s.find(c); return (offset == std::string::npos) ? -1 : (int)offset; }
+    String substring (size_t start, size_t end = std::string::npos) const
+        { return (start < s.size()) ? String(s.substr(start, end - start)) : String(); }
+    char operator[] (size_t index) const { return s[index]; }
+    bool operator== (const char * text) const { return s == text; }
+    bool operator== (const String & text) const { return s == text.s; }
+    bool operator!= (const char * text) const { return s != text; }
+    String & operator+= (const char * text) { s += text; return *this; }
+    String & operator+= (const String & text) { s += text.s; return *this; }
+    String & operator+= (char c) { s += c; return *this; }
+    bool concat (const char * text, size_t length) { s.append(text, length); return true; }
+    friend String operator+ (const String & a, const String & b) { return String(a.s + b.s); }
+    friend String operator+ (const String & a, const char * b) { return String(a.s + b); }
+    friend String operator+ (const char * a, const String & b) { return String(a + b.s); }
+};
+
+//------------------------------------------------------------------------------
+// Print
+//------------------------------------------------------------------------------
+
+class Print
+{
+public:
+    virtual ~Print () {}
+    virtual size_t write (uint8_t data) = 0;
+    virtual size_t write (const uint8_t * buffer, size_t length)
+    {
+        size_t index;
+
+        for (index = 0; index < length; index++)
+            if (!write(buffer[index]))
+                break;
+        return index;
+    }
+    size_t write (const char * text) { return write((const uint8_t *)text, strlen(text)); }
+    size_t print (const char * text) { return write(text); }
+    size_t print (const String & text) { return write(text.c_str()); }
+    size_t println () { return write("\n"); }
+    size_t println (const char * text) { return print(text) + println(); }
+    size_t println (const String & text) { return print(text) + println(); }
+    size_t printf (const char * format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class HardwareSerial : public Print
+{
+public:
+    void begin (unsigned long baud) { (void)baud; }
+    using Print::write;
+    size_t write (uint8_t data) override { return fwrite(&data, 1, 1, stderr); }
+    size_t write (const uint8_t * buffer, size_t length) override
+        { return fwrite(buffer, 1, length, stderr); }
+};
+
+extern HardwareSerial Serial;
+
+//------------------------------------------------------------------------------
+// Network address
+//------------------------------------------------------------------------------
+
+class IPAddress
+{
+public:
+    uint8_t octets[4];
+
+    IPAddress () : octets{0, 0, 0, 0} {}
+    IPAddress (uint8_t a, uint8_t b, uint8_t c, uint8_t d) : octets{a, b, c, d} {}
+    IPAddress (uint32_t address) { memcpy(octets, &address, sizeof(octets)); }
+    uint8_t operator[] (int index) const { return octets[index]; }
+    operator uint32_t () const
+    {
+        uint32_t address;
+
+        memcpy(&address, octets, sizeof(address));
+        return address;
+    }
+    String toString () const
+    {
+        char text[16];
+
+        snprintf(text, sizeof(text), "%u.%u.%u.%u", octets[0], octets[1],
+                 octets[2], octets[3]);
+        return String(text);
+    }
+};
+
+//------------------------------------------------------------------------------
+// Clock, random numbers and the ESP32 system information
+//------------------------------------------------------------------------------
+
+unsigned long millis ();
+unsigned long micros ();
+void delay (unsigned long msec);
+void delayMicroseconds (unsigned int usec);
+void yield ();
+long random (long limit);
+long random (long low, long limit);
+
+class EspClass
+{
+public:
+    uint32_t getFreeHeap () { return 200000; }
+    uint32_t getMinFreeHeap () { return 150000; }
+    uint32_t getHeapSize () { return 320000; }
+};
+
+extern EspClass ESP;
+
+#endif  // FAKE_ARDUINO_H_INCLUDED
@@ -0,0 +1,767 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+
+#include <thread>
+
+#include "ESPAsyncWebServer.h"
+#include "FakeAlloc.h"
+
+// Give up on a response that keeps asking to try again
+#define TRY_AGAIN_LIMIT         2000000
+#define STALL_POLLS             3
+
+static const char * const statusText[][2] = {
+    {"200", "OK"},
+    {"206", "Partial Content"},
+    {"302", "Found"},
+    {"304", "Not Modified"},
+    {"400", "Bad Request"},
+    {"404", "Not Found"},
+    {"409", "Conflict"},
+    {"416", "Range Not Satisfiable"},
+    {"500", "Internal Server Error"},
+    {"503", "Service Unavailable"},
+    {"507", "Insufficient Storage"},
+};
+
+//------------------------------------------------------------------------------
+// Decode the %xx escapes and the plus signs
+//------------------------------------------------------------------------------
+static
+std::string
+urlDecode (
+    const std::string & text,
+    bool plus
+    )
+{
+    std::string decoded;
+    size_t index;
+
+    for (index = 0; index < text.size(); index++) {
+        if ((text[index] == '%') && ((index + 2) < text.size())
+            && isxdigit((uint8_t)text[index + 1])
+            && isxdigit((uint8_t)text[index + 2])) {
+            decoded += (char)strtoul(text.substr(index + 1, 2).c_str(), NULL, 16);
+            index += 2;
+        } else if (plus && (text[index] == '+'))
+            decoded += ' ';
+        else
+            decoded += text[index];
+    }
+    return decoded;
+}
+
+//------------------------------------------------------------------------------
+// Replace the %NAME% tokens with the processor output
+//------------------------------------------------------------------------------
+static
+String
+templateExpand (
+    const char * content,
+    AwsTemplateProcessor processor
+    )
+{
+    const char * end;
+    std::string expanded;
+
+    if (!processor)
+        return String(content);
+    while (*content) {
+        if (*content != '%') {
+            expanded += *content++;
+            continue;
+        }
+        end = strchr(content + 1, '%');
+        if (!end) {
+            expanded += content;
+            break;
+        }
+        if (end == (content + 1))
+            expanded += '%';
+        else
+            expanded += processor(String(std::string(content + 1, end - content - 1))).s;
+        content = end + 1;
+    }
+    return String(expanded);
+}
+
+//------------------------------------------------------------------------------
+// AsyncClient
+//------------------------------------------------------------------------------
+void
+AsyncClient::close (
+    bool now
+    )
+{
+    (void)now;
+    if (connection)
+        connection->closeRequested();
+}
+
+//------------------------------------------------------------------------------
+// AsyncWebServerResponse
+//------------------------------------------------------------------------------
+void
+AsyncWebServerResponse::addHeader (
+    const String & name,
+    const String & value
+    )
+{
+    FakeAllocScope scope;
+
+    _headers.push_back(AsyncWebHeader(name, value));
+}
+
+//------------------------------------------------------------------------------
+// AsyncWebServerRequest
+//------------------------------------------------------------------------------
+AsyncWebServerRequest::AsyncWebServerRequest (
+    AsyncWebServer * server,
+    FakeConnection * connection
+    )
+    : _server(server), _method(HTTP_GET), _contentLength(0), _response(NULL),
+      _sent(false)
+{
+    _client.connection = connection;
+}
+
+AsyncWebServerRequest::~AsyncWebServerRequest (
+    )
+{
+    FakeAllocScope scope;
+
+    for (AsyncWebHeader * header : _headers)
+        delete header;
+    for (AsyncWebParameter * param : _params)
+        delete param;
+    delete _response;
+}
+
+AsyncWebHeader *
+AsyncWebServerRequest::getHeader (
+    const String & name
+    ) const
+{
+    for (AsyncWebHeader * header : _headers)
+        if (!strcasecmp(header->name().c_str(), name.c_str()))
+            return header;
+    return NULL;
+}
+
+AsyncWebParameter *
+AsyncWebServerRequest::getParam (
+    const String & name,
+    bool post,
+    bool file
+    ) const
+{
+    (void)file;
+    for (AsyncWebParameter * param : _params)
+        if ((param->name() == name) && (param->isPost() == post))
+            return param;
+    return NULL;
+}
+
+AsyncWebParameter *
+AsyncWebServerRequest::getParam (
+    int index
+    ) const
+{
+    return ((index >= 0) && ((size_t)index < _params.size())) ? _params[index] : NULL;
+}
+
+void
+AsyncWebServerRequest::send (
+    AsyncWebServerResponse * response
+    )
+{
+    if (_sent) {
+        fprintf(stderr, "ERROR: Second response for %s\n", _url.c_str());
+        abort();
+    }
+    _sent = true;
+    _response = response;
+}
+
+void
+AsyncWebServerRequest::send (
+    int code,
+    const String & contentType,
+    const String & content
+    )
+{
+    send(beginResponse(code, contentType, content));
+}
+
+void
+AsyncWebServerRequest::send (
+    int code,
+    const String & contentType,
+    const char * content,
+    AwsTemplateProcessor callback
+    )
+{
+    send(beginResponse_P(code, contentType, content, callback));
+}
+
+void
+AsyncWebServerRequest::send_P (
+    int code,
+    const String & contentType,
+    PGM_P content,
+    AwsTemplateProcessor callback
+    )
+{
+    send(beginResponse_P(code, contentType, content, callback));
+}
+
+void
+AsyncWebServerRequest::redirect (
+    const String & url
+    )
+{
+    AsyncWebServerResponse * response;
+
+    response = beginResponse(302);
+    response->addHeader("Location", url);
+    send(response);
+}
+
+AsyncWebServerResponse *
+AsyncWebServerRequest::beginResponse (
+    int code,
+    const String & contentType,
+    const String & content
+    )
+{
+    FakeAllocScope scope;
+    AsyncWebServerResponse * response;
+
+    response = new AsyncWebServerResponse();
+    response->_code = code;
+    response->_contentType = contentType;
+    response->_content = content;
+    response->_contentLength = content.length();
+    return response;
+}
+
+AsyncWebServerResponse *
+AsyncWebServerRequest::beginResponse_P (
+    int code,
+    const String & contentType,
+    PGM_P content,
+    AwsTemplateProcessor callback
+    )
+{
+    String expanded;
+
+    expanded = templateExpand(content, callback);
+    return beginResponse(code, contentType, expanded);
+}
+
+AsyncWebServerResponse *
+AsyncWebServerRequest::beginResponse (
+    const String & contentType,
+    size_t length,
+    AwsResponseFiller callback,
+    AwsTemplateProcessor templateCallback
+    )
+{
+    FakeAllocScope scope;
+    AsyncWebServerResponse * response;
+
+    (void)templateCallback;
+    response = new AsyncWebServerResponse();
+    response->_kind = AsyncWebServerResponse::FIXED;
+    response->_contentType = contentType;
+    response->_contentLength = length;
+    response->_filler = callback;
+    return response;
+}
+
+AsyncWebServerResponse *
+AsyncWebServerRequest::beginChunkedResponse (
+    const String & contentType,
+    AwsResponseFiller callback,
+    AwsTemplateProcessor templateCallback
+    )
+{
+    FakeAllocScope scope;
+    AsyncWebServerResponse * response;
+
+    (void)templateCallback;
+    response = new AsyncWebServerResponse();
+    response->_kind = AsyncWebServerResponse::CHUNKED;
+    response->_contentType = contentType;
+    response->_filler = callback;
+    return response;
+}
+
+//------------------------------------------------------------------------------
+// AsyncWebServer
+//------------------------------------------------------------------------------
+AsyncWebServer::~AsyncWebServer (
+    )
+{
+    reset();
+}
+
+void
+AsyncWebServer::reset (
+    )
+{
+    FakeAllocScope scope;
+
+    for (AsyncCallbackWebHandler * handler : _handlers)
+        delete handler;
+    _handlers.clear();
+    _notFound = nullptr;
+    _body = nullptr;
+}
+
+AsyncCallbackWebHandler &
+AsyncWebServer::on (
+    const char * uri,
+    WebRequestMethodComposite method,
+    ArRequestHandlerFunction onRequest
+    )
+{
+    return on(uri, method, onRequest, nullptr, nullptr);
+}
+
+AsyncCallbackWebHandler &
+AsyncWebServer::on (
+    const char * uri,
+    WebRequestMethodComposite method,
+    ArRequestHandlerFunction onRequest,
+    ArUploadHandlerFunction onUpload,
+    ArBodyHandlerFunction onBody
+    )
+{
+    FakeAllocScope scope;
+    AsyncCallbackWebHandler * handler;
+
+    (void)onUpload;
+    handler = new AsyncCallbackWebHandler();
+    handler->_uri = uri;
+    handler->_method = method;
+    handler->_onRequest = onRequest;
+    handler->_onBody = onBody;
+    _handlers.push_back(handler);
+    return *handler;
+}
+
+bool
+AsyncWebServer::removeHandler (
+    AsyncWebHandler * handler
+    )
+{
+    FakeAllocScope scope;
+
+    for (size_t index = 0; index < _handlers.size(); index++)
+        if (_handlers[index] == handler) {
+            delete _handlers[index];
+            _handlers.erase(_handlers.begin() + index);
+            return true;
+        }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// FakeConnection
+//------------------------------------------------------------------------------
+FakeConnection::FakeConnection (
+    AsyncWebServer * server,
+    WebRequestMethodComposite method,
+    const char * target
+    )
+{
+    FakeAllocScope scope;
+    std::string name;
+    size_t offset;
+    std::string pair;
+    std::string query;
+    const char * question;
+
+    this->server = server;
+    request = new AsyncWebServerRequest(server, this);
+    request->_method = method;
+    request->_client.address = IPAddress(192, 168, 4, 2);
+    question = strchr(target, '?');
+    request->_url = urlDecode(question ? std::string(target, question - target)
+                                       : std::string(target), false);
+    if (question) {
+        query = question + 1;
+        while (query.size()) {
+            offset = query.find('&');
+            pair = query.substr(0, offset);
+            query = (offset == std::string::npos) ? "" : query.substr(offset + 1);
+            offset = pair.find('=');
+            name = urlDecode(pair.substr(0, offset), true);
+            request->_params.push_back(new AsyncWebParameter(name,
+                (offset == std::string::npos) ? String()
+                    : String(urlDecode(pair.substr(offset + 1), true)), false));
+        }
+    }
+    bodyChunk = FAKE_TCP_MSS;
+    started = false;
+    done = false;
+    code = 0;
+    chunked = false;
+    contentLength = 0;
+    callbacks = 0;
+    tryAgains = 0;
+    segments = 0;
+    polls = 0;
+    aborted = false;
+    hung = false;
+    closedInFiller = false;
+    firstByteUsec = 0;
+    fillerUsec = 0;
+    maxFillerUsec = 0;
+    totalUsec = 0;
+    response = NULL;
+    inFiller = false;
+    headerSent = false;
+    headerLength = 0;
+    index = 0;
+    startUsec = 0;
+}
+
+FakeConnection::~FakeConnection (
+    )
+{
+    if (request)
+        finish(true);
+}
+
+FakeConnection &
+FakeConnection::header (
+    const char * name,
+    const char * value
+    )
+{
+    FakeAllocScope scope;
+
+    request->_headers.push_back(new AsyncWebHeader(name, value));
+    return *this;
+}
+
+FakeConnection &
+FakeConnection::body (
+    const std::string & data,
+    size_t chunkSize
+    )
+{
+    FakeAllocScope scope;
+
+    requestBody = data;
+    bodyChunk = chunkSize;
+    request->_contentLength = data.size();
+    return *this;
+}
+
+FakeConnection &
+FakeConnection::from (
+    IPAddress address
+    )
+{
+    request->_client.address = address;
+    return *this;
+}
+
+void
+FakeConnection::start (
+    )
+{
+    AsyncCallbackWebHandler * handler;
+    size_t length;
+    size_t offset;
+
+    started = true;
+    startUsec = micros();
+
+    // Locate the handler
+    handler = NULL;
+    for (AsyncCallbackWebHandler * next : server->_handlers)
+        if ((next->_method & request->_method)
+            && ((next->_uri == request->_url)
+                || request->_url.startsWith((next->_uri.s + "/").c_str()))) {
+            handler = next;
+            break;
+        }
+
+    // Deliver the request body
+    for (offset = 0; offset < requestBody.size(); offset += length) {
+        length = std::min(bodyChunk, requestBody.size() - offset);
+        if (handler && handler->_onBody)
+            handler->_onBody(request, (uint8_t *)&requestBody[offset], length,
+                             offset, requestBody.size());
+        else if ((!handler) && server->_body)
+            server->_body(request, (uint8_t *)&requestBody[offset], length,
+                          offset, requestBody.size());
+        if (done)
+            return;
+    }
+
+    // Handle the request
+    if (handler)
+        handler->_onRequest(request);
+    else if (server->_notFound)
+        server->_notFound(request);
+    else
+        request->send(404);
+    if (done)
+        return;
+
+    // Start the response
+    response = request->_response;
+    if (!response) {
+        fprintf(stderr, "ERROR: No response for %s\n", request->_url.c_str());
+        abort();
+    }
+    {
+        FakeAllocScope scope;
+
+        code = response->_code;
+        contentType = response->_contentType.s;
+        chunked = (response->_kind == AsyncWebServerResponse::CHUNKED);
+        contentLength = response->_contentLength;
+        for (const AsyncWebHeader & next : response->_headers)
+            headers.push_back(std::make_pair(next.name().s, next.value().s));
+
+        // Status line and headers
+        headerLength = 17 + contentType.size() + 16 + 20;
+        for (const std::pair<std::string, std::string> & next : headers)
+            headerLength += next.first.size() + next.second.size() + 4;
+        for (const char * const * status : statusText)
+            if (atoi(status[0]) == code)
+                headerLength += strlen(status[1]);
+    }
+
+    // Basic responses are sent with the headers
+    if (response->_kind == AsyncWebServerResponse::BASIC) {
+        FakeAllocScope scope;
+
+        data = response->_content.s;
+        segments = (headerLength + data.size() + FAKE_TCP_MSS - 1) / FAKE_TCP_MSS;
+        firstByteUsec = micros() - startUsec;
+        finish(false);
+    }
+}
+
+bool
+FakeConnection::step (
+    size_t space
+    )
+{
+    size_t length;
+    size_t maxLen;
+    size_t overhead;
+    uint8_t * buffer;
+    uint32_t remaining;
+    uint32_t usec;
+
+    if (!started)
+        start();
+    if (done)
+        return false;
+
+    // Leave room for the headers and the chunk framing, the chunk size line
+    // and the trailing CRLF
+    overhead = headerSent ? 0 : headerLength;
+    if (chunked)
+        overhead += 8;
+    if (space <= overhead + 1)
+        space = overhead + 1 + FAKE_TCP_MSS;
+    maxLen = space - overhead;
+    if ((!chunked) && (maxLen > (contentLength - index)))
+        maxLen = contentLength - index;
+
+    // All of the fixed length content is sent
+    if ((!chunked) && (!maxLen)) {
+        if (!headerSent) {
+            segments += 1;
+            firstByteUsec = micros() - startUsec;
+        }
+        finish(false);
+        return false;
+    }
+
+    // Fill the buffer
+    {
+        FakeAllocScope scope;
+
+        buffer = new uint8_t[maxLen];
+    }
+    inFiller = true;
+    usec = micros();
+    {
+        FakeAllocCallback callback;
+
+        length = response->_filler(buffer, maxLen, index);
+    }
+    usec = micros() - usec;
+    inFiller = false;
+    callbacks += 1;
+    fillerUsec += usec;
+    if (maxFillerUsec < usec)
+        maxFillerUsec = usec;
+
+    // The response asked to close the connection inside the filler, the
+    // real AsyncTCP frees the request and response in the close call
+    if (closedInFiller) {
+        FakeAllocScope scope;
+
+        delete[] buffer;
+        finish(true);
+        return false;
+    }
+
+    // Try again after the next ACK or poll
+    if (length == RESPONSE_TRY_AGAIN) {
+        FakeAllocScope scope;
+
+        delete[] buffer;
+        tryAgains += 1;
+        if (tryAgains >= TRY_AGAIN_LIMIT) {
+            hung = true;
+            finish(true);
+            return false;
+        }
+        if (!(tryAgains % 16))
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        else
+            std::this_thread::yield();
+        return true;
+    }
+    if (length > maxLen) {
+        fprintf(stderr, "ERROR: Filler returned %zu > maxLen %zu\n", length, maxLen);
+        abort();
+    }
+
+    // Chunked responses end with an empty chunk
+    if (chunked && (!length)) {
+        FakeAllocScope scope;
+
+        delete[] buffer;
+        segments += 1;
+        if (!headerSent)
+            firstByteUsec = micros() - startUsec;
+        headerSent = true;
+        finish(false);
+        return false;
+    }
+
+    // A fixed length response stalled, AsyncWebServer polls again and the
+    // connection closes once the receive timeout expires
+    if (!length) {
+        FakeAllocScope scope;
+
+        delete[] buffer;
+        polls += 1;
+        remaining = request->_client.getRxTimeout();
+        if (remaining) {
+            finish(true);
+            return false;
+        }
+        if (polls >= STALL_POLLS) {
+            hung = true;
+            finish(true);
+            return false;
+        }
+        return true;
+    }
+
+    // Send the data
+    {
+        FakeAllocScope scope;
+
+        data.append((const char *)buffer, length);
+        delete[] buffer;
+    }
+    segments += (overhead + length + FAKE_TCP_MSS - 1) / FAKE_TCP_MSS;
+    if (!headerSent)
+        firstByteUsec = micros() - startUsec;
+    headerSent = true;
+    index += length;
+    polls = 0;
+    if ((!chunked) && (index >= contentLength)) {
+        finish(false);
+        return false;
+    }
+    return true;
+}
+
+FakeConnection &
+FakeConnection::run (
+    size_t space
+    )
+{
+    while (step(space))
+        ;
+    return *this;
+}
+
+void
+FakeConnection::disconnect (
+    )
+{
+    if (!started)
+        start();
+    if (!done)
+        finish(true);
+}
+
+void
+FakeConnection::closeRequested (
+    )
+{
+    // Close the connection after the filler returns
+    if (inFiller) {
+        closedInFiller = true;
+        return;
+    }
+    if (!done)
+        finish(true);
+}
+
+void
+FakeConnection::finish (
+    bool abortConnection
+    )
+{
+    AsyncWebServerRequest * oldRequest;
+
+    if (done)
+        return;
+    done = true;
+    aborted = abortConnection;
+    totalUsec = micros() - startUsec;
+
+    // AsyncWebServer calls the disconnect handler and then deletes the
+    // request and its response
+    oldRequest = request;
+    request = NULL;
+    response = NULL;
+    if (oldRequest->_onDisconnect)
+        oldRequest->_onDisconnect();
+    {
+        FakeAllocScope scope;
+
+        delete oldRequest;
+    }
+}
+
+std::string
+FakeConnection::responseHeader (
+    const char * name
+    ) const
+{
+    for (const std::pair<std::string, std::string> & next : headers)
+        if (!strcasecmp(next.first.c_str(), name))
+            return next.second;
+    return std::string();
+}
@@ -0,0 +1,295 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Stand-in for ESPAsyncWebServer.  The requests are delivered by
+// FakeConnection, which calls the response fillers the way
+// AsyncAbstractResponse does: once for each send opportunity with the
+// space available in the TCP window, again after RESPONSE_TRY_AGAIN, and
+// on the poll when a fixed length response stalls.
+
+#ifndef FAKE_ESP_ASYNC_WEB_SERVER_H_INCLUDED
+#define FAKE_ESP_ASYNC_WEB_SERVER_H_INCLUDED
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "WiFi.h"
+
+#define RESPONSE_TRY_AGAIN      0xFFFFFFFF
+
+// TCP maximum segment size used to count the segments sent
+#define FAKE_TCP_MSS            1436
+
+typedef uint8_t WebRequestMethodComposite;
+
+enum {
+    HTTP_GET     = 0b00000001,
+    HTTP_POST    = 0b00000010,
+    HTTP_DELETE  = 0b00000100,
+    HTTP_PUT     = 0b00001000,
+    HTTP_PATCH   = 0b00010000,
+    HTTP_HEAD    = 0b00100000,
+    HTTP_OPTIONS = 0b01000000,
+    HTTP_ANY     = 0b01111111,
+};
+
+class AsyncWebServer;
+class AsyncWebServerRequest;
+class FakeConnection;
+
+typedef std::function<size_t(uint8_t *, size_t, size_t)> AwsResponseFiller;
+typedef std::function<String(const String &)> AwsTemplateProcessor;
+typedef std::function<void(AsyncWebServerRequest * request)> ArRequestHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest * request, const String & filename,
+                           size_t index, uint8_t * data, size_t len,
+                           bool final)> ArUploadHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest * request, uint8_t * data,
+                           size_t len, size_t index, size_t total)> ArBodyHandlerFunction;
+typedef std::function<void(void)> ArDisconnectHandler;
+
+class AsyncWebHeader
+{
+public:
+    AsyncWebHeader (const String & name, const String & value)
+        : _name(name), _value(value) {}
+    const String & name () const { return _name; }
+    const String & value () const { return _value; }
+
+private:
+    String _name;
+    String _value;
+};
+
+class AsyncWebParameter
+{
+public:
+    AsyncWebParameter (const String & name, const String & value, bool post)
+        : _name(name), _value(value), _post(post) {}
+    const String & name () const { return _name; }
+    const String & value () const { return _value; }
+    bool isPost () const { return _post; }
+    bool isFile () const { return false; }
+
+private:
+    String _name;
+    String _value;
+    bool _post;
+};
+
+class AsyncClient
+{
+public:
+    IPAddress remoteIP () const { return address; }
+    uint16_t remotePort () const { return 49152; }
+    void setRxTimeout (uint32_t seconds) { rxTimeout = seconds; }
+    uint32_t getRxTimeout () const { return rxTimeout; }
+    size_t space () const { return 5744; }
+    bool canSend () const { return true; }
+    void close (bool now = false);
+    void abort () { close(true); }
+
+    IPAddress address;
+    uint32_t rxTimeout = 0;
+    FakeConnection * connection = NULL;
+};
+
+class AsyncWebServerResponse
+{
+public:
+    enum Kind {
+        BASIC,
+        CHUNKED,
+        FIXED,
+    };
+
+    virtual ~AsyncWebServerResponse () {}
+    void setCode (int code) { _code = code; }
+    void setContentLength (size_t length) { _contentLength = length; }
+    void setContentType (const String & type) { _contentType = type; }
+    void addHeader (const String & name, const String & value);
+
+    Kind _kind = BASIC;
+    int _code = 200;
+    String _contentType;
+    std::vector<AsyncWebHeader> _headers;
+    String _content;
+    size_t _contentLength = 0;
+    AwsResponseFiller _filler;
+};
+
+class AsyncWebHandler
+{
+public:
+    virtual ~AsyncWebHandler () {}
+};
+
+class AsyncCallbackWebHandler : public AsyncWebHandler
+{
+public:
+    String _uri;
+    WebRequestMethodComposite _method;
+    ArRequestHandlerFunction _onRequest;
+    ArBodyHandlerFunction _onBody;
+};
+
+class AsyncWebServerRequest
+{
+public:
+    AsyncWebServerRequest (AsyncWebServer * server, FakeConnection * connection);
+    ~AsyncWebServerRequest ();
+
+    AsyncClient * client () { return &_client; }
+    const String & url () const { return _url; }
+    WebRequestMethodComposite method () const { return _method; }
+    size_t contentLength () const { return _contentLength; }
+
+    bool hasHeader (const String & name) const { return getHeader(name) != NULL; }
+    AsyncWebHeader * getHeader (const String & name) const;
+    size_t headers () const { return _headers.size(); }
+    bool hasParam (const String & name, bool post = false, bool file = false) const
+        { return getParam(name, post, file) != NULL; }
+    AsyncWebParameter * getParam (const String & name, bool post = false,
+                                  bool file = false) const;
+    size_t params () const { return _params.size(); }
+    AsyncWebParameter * getParam (int index) const;
+
+    void onDisconnect (ArDisconnectHandler handler) { _onDisconnect = handler; }
+
+    void send (AsyncWebServerResponse * response);
+    void send (int code, const String & contentType = String(),
+               const String & content = String());
+    void send (int code, const String & contentType, const char * content,
+               AwsTemplateProcessor callback);
+    void send_P (int code, const String & contentType, PGM_P content,
+                 AwsTemplateProcessor callback = nullptr);
+    void redirect (const String & url);
+
+    AsyncWebServerResponse * beginResponse (int code,
+                                            const String & contentType = String(),
+                                            const String & content = String());
+    AsyncWebServerResponse * beginResponse_P (int code, const String & contentType,
+                                              PGM_P content,
+                                              AwsTemplateProcessor callback = nullptr);
+    AsyncWebServerResponse * beginResponse (const String & contentType, size_t length,
+                                            AwsResponseFiller callback,
+                                            AwsTemplateProcessor templateCallback = nullptr);
+    AsyncWebServerResponse * beginChunkedResponse (const String & contentType,
+                                                   AwsResponseFiller callback,
+                                                   AwsTemplateProcessor templateCallback = nullptr);
+
+    AsyncWebServer * _server;
+    AsyncClient _client;
+    String _url;
+    WebRequestMethodComposite _method;
+    size_t _contentLength;
+    std::vector<AsyncWebHeader *> _headers;
+    std::vector<AsyncWebParameter *> _params;
+    ArDisconnectHandler _onDisconnect;
+    AsyncWebServerResponse * _response;
+    bool _sent;
+};
+
+class AsyncWebServer
+{
+public:
+    AsyncWebServer (uint16_t port) : _port(port) {}
+    ~AsyncWebServer ();
+
+    void begin () {}
+    void end () {}
+    AsyncCallbackWebHandler & on (const char * uri, WebRequestMethodComposite method,
+                                  ArRequestHandlerFunction onRequest);
+    AsyncCallbackWebHandler & on (const char * uri, WebRequestMethodComposite method,
+                                  ArRequestHandlerFunction onRequest,
+                                  ArUploadHandlerFunction onUpload,
+                                  ArBodyHandlerFunction onBody);
+    bool removeHandler (AsyncWebHandler * handler);
+    void onNotFound (ArRequestHandlerFunction handler) { _notFound = handler; }
+    void onRequestBody (ArBodyHandlerFunction handler) { _body = handler; }
+    void onFileUpload (ArUploadHandlerFunction handler) { (void)handler; }
+    void reset ();
+
+    uint16_t _port;
+    std::vector<AsyncCallbackWebHandler *> _handlers;
+    ArRequestHandlerFunction _notFound;
+    ArBodyHandlerFunction _body;
+};
+
+//------------------------------------------------------------------------------
+// FakeConnection
+//      One HTTP request and its response
+//------------------------------------------------------------------------------
+
+class FakeConnection
+{
+public:
+    FakeConnection (AsyncWebServer * server, WebRequestMethodComposite method,
+                    const char * target);
+    ~FakeConnection ();
+
+    // Build the request
+    FakeConnection & header (const char * name, const char * value);
+    FakeConnection & body (const std::string & data, size_t chunkSize = FAKE_TCP_MSS);
+    FakeConnection & from (IPAddress address);
+
+    // Deliver the request body and call the request handler
+    void start ();
+
+    // Offer one send opportunity with space bytes available, returns false
+    // when the response is complete
+    bool step (size_t space = 4 * FAKE_TCP_MSS);
+
+    // Send the whole response
+    FakeConnection & run (size_t space = 4 * FAKE_TCP_MSS);
+
+    // The client closes the connection
+    void disconnect ();
+
+    // Response header value or an empty string
+    std::string responseHeader (const char * name) const;
+
+    // Request
+    AsyncWebServer * server;
+    AsyncWebServerRequest * request;
+    std::string requestBody;
+    size_t bodyChunk;
+
+    // Response
+    bool started;
+    bool done;
+    int code;
+    bool chunked;
+    std::string contentType;
+    uint64_t contentLength;                 // Fixed length responses
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string data;
+
+    // Delivery statistics
+    size_t callbacks;                       // Filler calls
+    size_t tryAgains;                       // RESPONSE_TRY_AGAIN returns
+    size_t segments;                        // TCP segments sent
+    size_t polls;                           // Stalled fixed length polls
+    bool aborted;                           // Closed before the end
+    bool hung;                              // Stalled without a timeout
+    bool closedInFiller;                    // AsyncClient::close in a filler
+    uint32_t firstByteUsec;
+    uint32_t totalUsec;
+    uint32_t fillerUsec;                    // Time spent in the fillers
+    uint32_t maxFillerUsec;                 // Longest filler call
+
+    // Internal state
+    void finish (bool aborted);
+    void closeRequested ();
+    AsyncWebServerResponse * response;
+    bool inFiller;
+    bool headerSent;
+    size_t headerLength;
+    size_t index;
+    uint32_t startUsec;
+};
+
+#endif  // FAKE_ESP_ASYNC_WEB_SERVER_H_INCLUDED
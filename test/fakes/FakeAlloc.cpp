@@ -0,0 +1,173 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+#include "FakeAlloc.h"
+
+extern "C" void * __libc_malloc (size_t size);
+extern "C" void * __libc_calloc (size_t count, size_t size);
+extern "C" void * __libc_realloc (void * data, size_t size);
+extern "C" void * __libc_memalign (size_t alignment, size_t size);
+extern "C" void __libc_free (void * data);
+
+static std::atomic<uint64_t> callbackAllocs;
+static thread_local int inCallback;
+static thread_local int inFake;
+static std::atomic<uint64_t> mallocs;
+static std::atomic<uint64_t> news;
+
+//------------------------------------------------------------------------------
+// Count an allocation
+//------------------------------------------------------------------------------
+static
+void
+allocCount (
+    std::atomic<uint64_t> * counter
+    )
+{
+    if (inFake)
+        return;
+    *counter += 1;
+    if (inCallback)
+        callbackAllocs += 1;
+}
+
+FAKE_ALLOC_COUNTS
+fakeAllocCounts (
+    )
+{
+    FAKE_ALLOC_COUNTS counts;
+
+    counts.mallocs = mallocs;
+    counts.news = news;
+    counts.callbackAllocs = callbackAllocs;
+    return counts;
+}
+
+FAKE_ALLOC_COUNTS
+fakeAllocDelta (
+    const FAKE_ALLOC_COUNTS & start,
+    const FAKE_ALLOC_COUNTS & end
+    )
+{
+    FAKE_ALLOC_COUNTS delta;
+
+    delta.mallocs = end.mallocs - start.mallocs;
+    delta.news = end.news - start.news;
+    delta.callbackAllocs = end.callbackAllocs - start.callbackAllocs;
+    return delta;
+}
+
+FakeAllocScope::FakeAllocScope () { inFake += 1; }
+FakeAllocScope::~FakeAllocScope () { inFake -= 1; }
+FakeAllocCallback::FakeAllocCallback () { inCallback += 1; }
+FakeAllocCallback::~FakeAllocCallback () { inCallback -= 1; }
+
+//------------------------------------------------------------------------------
+// C heap
+//------------------------------------------------------------------------------
+extern "C" void *
+malloc (
+    size_t size
+    )
+{
+    allocCount(&mallocs);
+    return __libc_malloc(size);
+}
+
+extern "C" void *
+calloc (
+    size_t count,
+    size_t size
+    )
+{
+    allocCount(&mallocs);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *
+realloc (
+    void * data,
+    size_t size
+    )
+{
+    if (size)
+        allocCount(&mallocs);
+    return __libc_realloc(data, size);
+}
+
+extern "C" void
+free (
+    void * data
+    )
+{
+    __libc_free(data);
+}
+
+//------------------------------------------------------------------------------
+// C++ heap
+//------------------------------------------------------------------------------
+static
+void *
+newAllocate (
+    size_t size,
+    size_t alignment
+    )
+{
+    allocCount(&news);
+    if (!size)
+        size = 1;
+    return alignment ? __libc_memalign(alignment, size) : __libc_malloc(size);
+}
+
+void * operator new (size_t size)
+{
+    void * data = newAllocate(size, 0);
+    if (!data)
+        throw std::bad_alloc();
+    return data;
+}
+
+void * operator new[] (size_t size)
+{
+    return operator new(size);
+}
+
+void * operator new (size_t size, const std::nothrow_t &) noexcept
+{
+    return newAllocate(size, 0);
+}
+
+void * operator new[] (size_t size, const std::nothrow_t &) noexcept
+{
+    return newAllocate(size, 0);
+}
+
+void * operator new (size_t size, std::align_val_t alignment)
+{
+    void * data = newAllocate(size, (size_t)alignment);
+    if (!data)
+        throw std::bad_alloc();
+    return data;
+}
+
+void * operator new[] (size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void operator delete (void * data) noexcept { __libc_free(data); }
+void operator delete[] (void * data) noexcept { __libc_free(data); }
+void operator delete (void * data, size_t) noexcept { __libc_free(data); }
+void operator delete[] (void * data, size_t) noexcept { __libc_free(data); }
+void operator delete (void * data, const std::nothrow_t &) noexcept { __libc_free(data); }
+void operator delete[] (void * data, const std::nothrow_t &) noexcept { __libc_free(data); }
+void operator delete (void * data, std::align_val_t) noexcept { __libc_free(data); }
+void operator delete[] (void * data, std::align_val_t) noexcept { __libc_free(data); }
+void operator delete (void * data, size_t, std::align_val_t) noexcept { __libc_free(data); }
+void operator delete[] (void * data, size_t, std::align_val_t) noexcept { __libc_free(data); }
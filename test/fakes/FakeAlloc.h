@@ -0,0 +1,45 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Heap allocation counting.  The test executables replace malloc, calloc,
+// realloc and operator new to count the allocations made by the library.
+// The fakes use FakeAllocScope around their own bookkeeping so that only
+// the library's allocations are counted.
+
+#ifndef FAKE_ALLOC_H_INCLUDED
+#define FAKE_ALLOC_H_INCLUDED
+
+#include <stdint.h>
+
+typedef struct _FAKE_ALLOC_COUNTS {
+    uint64_t mallocs;           // malloc, calloc and realloc calls
+    uint64_t news;              // operator new calls
+    uint64_t callbackAllocs;    // Any allocation made inside a filler
+} FAKE_ALLOC_COUNTS;
+
+// Get the allocation counts since the program started
+FAKE_ALLOC_COUNTS fakeAllocCounts ();
+
+// Get the difference between two sets of counts
+FAKE_ALLOC_COUNTS fakeAllocDelta (const FAKE_ALLOC_COUNTS & start,
+                                  const FAKE_ALLOC_COUNTS & end);
+
+// Ignore the allocations made by the fakes themselves
+class FakeAllocScope
+{
+public:
+    FakeAllocScope ();
+    ~FakeAllocScope ();
+};
+
+// Mark the calls to the response fillers on this thread
+class FakeAllocCallback
+{
+public:
+    FakeAllocCallback ();
+    ~FakeAllocCallback ();
+};
+
+#endif  // FAKE_ALLOC_H_INCLUDED
@@ -0,0 +1,886 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+
+#include <chrono>
+#include <thread>
+
+#include "FakeAlloc.h"
+#include "SdFat.h"
+
+#define SECTOR_SIZE     512
+#define ENTRY_SIZE      32
+
+//------------------------------------------------------------------------------
+// Generated file contents
+//------------------------------------------------------------------------------
+static inline
+uint64_t
+fakeWord (
+    uint32_t seed,
+    uint64_t word
+    )
+{
+    uint64_t value;
+
+    value = (word + seed) * 0x9e3779b97f4a7c15ULL;
+    value ^= value >> 29;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 32;
+    return value;
+}
+
+uint8_t
+fakeByte (
+    uint32_t seed,
+    uint64_t offset
+    )
+{
+    return (uint8_t)(fakeWord(seed, offset >> 3) >> ((offset & 7) * 8));
+}
+
+void
+fakeFill (
+    uint32_t seed,
+    uint64_t offset,
+    uint8_t * buffer,
+    size_t length
+    )
+{
+    uint64_t value;
+
+    while (length && (offset & 7)) {
+        *buffer++ = fakeByte(seed, offset++);
+        length--;
+    }
+    while (length >= 8) {
+        value = fakeWord(seed, offset >> 3);
+        memcpy(buffer, &value, 8);
+        buffer += 8;
+        offset += 8;
+        length -= 8;
+    }
+    while (length--)
+        *buffer++ = fakeByte(seed, offset++);
+}
+
+//------------------------------------------------------------------------------
+// SdCard
+//------------------------------------------------------------------------------
+bool
+SdCard::readCID (
+    cid_t * cid
+    )
+{
+    if (!sd->present)
+        return false;
+    sd->charge(1, 0);
+    *cid = sd->cid;
+    return true;
+}
+
+uint32_t
+SdCard::sectorCount (
+    )
+{
+    return sd->present ? sd->sectors : 0;
+}
+
+bool
+SdCard::readSectors (
+    uint32_t sector,
+    uint8_t * buffer,
+    size_t count
+    )
+{
+    std::map<uint32_t, FakeNode *>::iterator entry;
+    FakeNode * node;
+    uint64_t offset;
+
+    if (!sd->present)
+        return false;
+    sd->charge(1, count);
+
+    // Locate the file containing the sector
+    entry = sd->sectorMap.upper_bound(sector);
+    if (entry == sd->sectorMap.begin()) {
+        memset(buffer, 0, count * SECTOR_SIZE);
+        return true;
+    }
+    node = (--entry)->second;
+    offset = (uint64_t)(sector - node->firstSector) * SECTOR_SIZE;
+    if ((offset + count * SECTOR_SIZE) > node->failReadOffset)
+        return false;
+    sd->readContents(node, offset, buffer, count * SECTOR_SIZE);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// SdFat
+//------------------------------------------------------------------------------
+SdFat::SdFat (
+    )
+{
+    FakeAllocScope scope;
+
+    sdCard.sd = this;
+    volume.sd = this;
+    present = true;
+    memset(&cid, 0, sizeof(cid));
+    cid.mid = 3;
+    memcpy(cid.oid, "SD", 2);
+    memcpy(cid.pnm, "FAKE1", 5);
+    cid.psn = 0x12345678;
+    sectors = 64 * 1024 * 1024;                 // 32 GiB
+    clusterBytes = 32768;
+    freeClusters = 900000;
+    nowDate = FS_DATE(2024, 1, 1);
+    nowTime = FS_TIME(12, 0, 0);
+    failPreAllocate = false;
+    commandUsec = 0;
+    sectorUsec = 0;
+    clusterSectors = 64;
+    freeCountUsec = 0;
+    commands = 0;
+    sectorsRead = 0;
+    directoryReads = 0;
+    cacheNode = NULL;
+    cacheSector = 0;
+    nextSector = 8192;
+
+    root = new FakeNode();
+    root->parent = NULL;
+    root->directory = true;
+    root->attributes = 0;
+    root->modifyDate = nowDate;
+    root->modifyTime = nowTime;
+    root->size = 0;
+    root->generated = false;
+    root->firstSector = 0;
+    root->failReadOffset = UINT64_MAX;
+}
+
+static
+void
+nodeDelete (
+    FakeNode * node
+    )
+{
+    for (FakeNode * child : node->children)
+        nodeDelete(child);
+    delete node;
+}
+
+SdFat::~SdFat (
+    )
+{
+    FakeAllocScope scope;
+
+    nodeDelete(root);
+    for (FakeNode * node : removed)
+        nodeDelete(node);
+}
+
+int32_t
+SdFat::freeClusterCount (
+    )
+{
+    if (freeCountUsec)
+        std::this_thread::sleep_for(std::chrono::microseconds(freeCountUsec));
+    return present ? freeClusters : -1;
+}
+
+//------------------------------------------------------------------------------
+// Charge the latency of the SD card commands
+//------------------------------------------------------------------------------
+void
+SdFat::charge (
+    uint32_t commandCount,
+    uint64_t sectorCount
+    )
+{
+    uint64_t usec;
+
+    commands += commandCount;
+    sectorsRead += sectorCount;
+    usec = (uint64_t)commandCount * commandUsec + sectorCount * sectorUsec;
+    if (usec)
+        std::this_thread::sleep_for(std::chrono::microseconds(usec));
+}
+
+//------------------------------------------------------------------------------
+// Allocate contiguous sectors for a file
+//------------------------------------------------------------------------------
+uint32_t
+SdFat::allocate (
+    uint64_t size,
+    FakeNode * node
+    )
+{
+    uint32_t first;
+    uint64_t count;
+
+    count = (size + clusterBytes - 1) / clusterBytes;
+    count = (count ? count : 1) * (clusterBytes / SECTOR_SIZE);
+    first = nextSector;
+    nextSector += (uint32_t)count;
+    sectorMap[first] = node;
+    node->allocated = count * SECTOR_SIZE;
+    return first;
+}
+
+//------------------------------------------------------------------------------
+// Read the file contents without charging any latency
+//------------------------------------------------------------------------------
+void
+SdFat::readContents (
+    FakeNode * node,
+    uint64_t offset,
+    uint8_t * buffer,
+    size_t length
+    )
+{
+    size_t valid;
+
+    valid = (offset >= node->size) ? 0
+          : (size_t)std::min<uint64_t>(length, node->size - offset);
+    if (node->generated)
+        fakeFill(node->seed, offset, buffer, valid);
+    else if (valid)
+        memcpy(buffer, &node->data[offset], valid);
+    memset(&buffer[valid], 0, length - valid);
+}
+
+//------------------------------------------------------------------------------
+// Walk a path, return the parent directory and name of the last component
+//------------------------------------------------------------------------------
+FakeNode *
+SdFat::lookup (
+    FakeNode * dir,
+    const char * path,
+    FakeNode ** parent,
+    const char ** name
+    )
+{
+    const char * end;
+    FakeNode * next;
+    size_t length;
+
+    *parent = NULL;
+    while (dir && *path) {
+        if (*path == '/') {
+            path++;
+            continue;
+        }
+        end = strchr(path, '/');
+        length = end ? (size_t)(end - path) : strlen(path);
+        next = NULL;
+        for (FakeNode * child : dir->children)
+            if ((child->name.size() == length)
+                && (!strncasecmp(child->name.c_str(), path, length))) {
+                next = child;
+                break;
+            }
+        if (!end) {
+            *parent = dir;
+            *name = path;
+            return next;
+        }
+        if (next && (!next->directory))
+            return NULL;
+        dir = next;
+        path = end + 1;
+    }
+    return dir;
+}
+
+FakeNode *
+SdFat::makeDir (
+    const char * path
+    )
+{
+    FakeAllocScope scope;
+    FakeNode * dir;
+    const char * name;
+    FakeNode * node;
+    FakeNode * parent;
+    std::string prefix;
+    const char * slash;
+
+    // Create the parent directories
+    slash = strrchr(path, '/');
+    if (slash && (slash != path)) {
+        prefix.assign(path, slash - path);
+        dir = makeDir(prefix.c_str());
+    } else
+        dir = root;
+    node = lookup(dir, slash ? slash + 1 : path, &parent, &name);
+    if (node)
+        return node;
+    node = new FakeNode();
+    node->name = name;
+    node->parent = parent;
+    node->directory = true;
+    node->attributes = 0;
+    node->modifyDate = nowDate;
+    node->modifyTime = nowTime;
+    node->size = 0;
+    node->generated = false;
+    node->seed = 0;
+    node->firstSector = allocate(clusterBytes, node);
+    node->failReadOffset = UINT64_MAX;
+    parent->children.push_back(node);
+    return node;
+}
+
+static
+FakeNode *
+fileCreate (
+    SdFat * sd,
+    const char * path
+    )
+{
+    FakeNode * dir;
+    const char * name;
+    FakeNode * node;
+    FakeNode * parent;
+    std::string prefix;
+    const char * slash;
+
+    slash = strrchr(path, '/');
+    if (slash && (slash != path)) {
+        prefix.assign(path, slash - path);
+        dir = sd->makeDir(prefix.c_str());
+    } else
+        dir = sd->root;
+    node = sd->lookup(dir, slash ? slash + 1 : path, &parent, &name);
+    if (!node) {
+        node = new FakeNode();
+        node->name = name;
+        node->parent = parent;
+        parent->children.push_back(node);
+    }
+    node->directory = false;
+    node->attributes = 0;
+    node->modifyDate = sd->nowDate;
+    node->modifyTime = sd->nowTime;
+    node->failReadOffset = UINT64_MAX;
+    return node;
+}
+
+FakeNode *
+SdFat::addFile (
+    const char * path,
+    const void * data,
+    size_t length
+    )
+{
+    FakeAllocScope scope;
+    FakeNode * node;
+
+    node = fileCreate(this, path);
+    node->generated = false;
+    node->seed = 0;
+    node->data.assign((const char *)data, length);
+    node->size = length;
+    node->firstSector = allocate(length, node);
+    return node;
+}
+
+FakeNode *
+SdFat::addGeneratedFile (
+    const char * path,
+    uint64_t size,
+    uint32_t seed
+    )
+{
+    FakeAllocScope scope;
+    FakeNode * node;
+
+    node = fileCreate(this, path);
+    node->generated = true;
+    node->seed = seed;
+    node->data.clear();
+    node->size = size;
+    node->firstSector = allocate(size, node);
+    return node;
+}
+
+FakeNode *
+SdFat::find (
+    const char * path
+    )
+{
+    const char * name;
+    FakeNode * parent;
+
+    if ((!*path) || (!strcmp(path, "/")))
+        return root;
+    return lookup(root, path, &parent, &name);
+}
+
+void
+SdFat::unlink (
+    FakeNode * node
+    )
+{
+    FakeAllocScope scope;
+    std::vector<FakeNode *> & children = node->parent->children;
+
+    for (size_t index = 0; index < children.size(); index++)
+        if (children[index] == node) {
+            children.erase(children.begin() + index);
+            break;
+        }
+    if (node->firstSector)
+        sectorMap.erase(node->firstSector);
+    if (cacheNode == node)
+        cacheNode = NULL;
+    node->parent = NULL;
+    removed.push_back(node);
+}
+
+bool
+SdFat::removePath (
+    const char * path
+    )
+{
+    FakeNode * node;
+
+    node = find(path);
+    if ((!node) || (node == root))
+        return false;
+    unlink(node);
+    return true;
+}
+
+void
+SdFat::setModifyDateTime (
+    FakeNode * node,
+    uint16_t date,
+    uint16_t time
+    )
+{
+    node->modifyDate = date;
+    node->modifyTime = time;
+}
+
+std::string
+SdFat::contents (
+    const char * path
+    )
+{
+    FakeAllocScope scope;
+    std::string data;
+    FakeNode * node;
+
+    node = find(path);
+    if ((!node) || node->directory)
+        return data;
+    data.resize(node->size);
+    readContents(node, 0, (uint8_t *)&data[0], node->size);
+    return data;
+}
+
+//------------------------------------------------------------------------------
+// SdFile
+//------------------------------------------------------------------------------
+bool
+SdFile::openRoot (
+    FsVolume * volume
+    )
+{
+    if (isOpen() || (!volume->sd->present))
+        return false;
+    sd = volume->sd;
+    node = sd->root;
+    position = 0;
+    flags = O_RDONLY;
+    nextEntry = 0;
+    return true;
+}
+
+bool
+SdFile::open (
+    SdFile * dir,
+    const char * path,
+    oflag_t oflag
+    )
+{
+    FakeAllocScope scope;
+    const char * name;
+    FakeNode * parent;
+    FakeNode * target;
+    bool writable;
+
+    if (isOpen() || (!dir->isDir()) || (!dir->sd->present))
+        return false;
+
+    // Searching the directory reads a directory sector
+    dir->sd->charge(1, 1);
+    target = dir->sd->lookup(dir->node, path, &parent, &name);
+    writable = (oflag & O_ACCMODE) != O_RDONLY;
+    if (target) {
+        if ((oflag & O_CREAT) && (oflag & O_EXCL))
+            return false;
+        if (writable && (target->directory
+                         || (target->attributes & FAKE_ATTR_READ_ONLY)))
+            return false;
+    } else {
+        if ((!(oflag & O_CREAT)) || (!parent) || (!*name) || strchr(name, '/'))
+            return false;
+        target = new FakeNode();
+        target->name = name;
+        target->parent = parent;
+        target->directory = false;
+        target->attributes = 0;
+        target->size = 0;
+        target->generated = false;
+        target->seed = 0;
+        target->firstSector = 0;
+        target->failReadOffset = UINT64_MAX;
+        target->modifyDate = dir->sd->nowDate;
+        target->modifyTime = dir->sd->nowTime;
+        parent->children.push_back(target);
+    }
+    sd = dir->sd;
+    node = target;
+    position = 0;
+    flags = oflag;
+    nextEntry = 0;
+    if (writable && (oflag & O_TRUNC))
+        truncate();
+    return true;
+}
+
+bool
+SdFile::openNext (
+    SdFile * dir,
+    oflag_t oflag
+    )
+{
+    if (isOpen() || (!dir->isDir()) || (!dir->sd->present))
+        return false;
+    if (dir->nextEntry >= dir->node->children.size())
+        return false;
+
+    // Each directory sector holds 16 entries
+    if (!(dir->nextEntry % (SECTOR_SIZE / ENTRY_SIZE)))
+        dir->sd->charge(1, 1);
+    dir->sd->directoryReads += 1;
+    sd = dir->sd;
+    node = dir->node->children[dir->nextEntry++];
+    position = 0;
+    flags = oflag;
+    nextEntry = 0;
+    return true;
+}
+
+bool
+SdFile::close (
+    )
+{
+    bool status;
+
+    status = isOpen();
+    node = NULL;
+    position = 0;
+    nextEntry = 0;
+    return status;
+}
+
+bool
+SdFile::contiguousRange (
+    uint32_t * firstSector,
+    uint32_t * lastSector
+    )
+{
+    if ((!isFile()) || (!node->firstSector) || (!node->size))
+        return false;
+    *firstSector = node->firstSector;
+    *lastSector = node->firstSector
+                + (uint32_t)((node->size + SECTOR_SIZE - 1) / SECTOR_SIZE) - 1;
+    return true;
+}
+
+bool
+SdFile::seekSet (
+    uint64_t offset
+    )
+{
+    if ((!isOpen()) || (offset > fileSize()))
+        return false;
+    position = offset;
+    return true;
+}
+
+bool
+SdFile::getModifyDateTime (
+    uint16_t * date,
+    uint16_t * time
+    )
+{
+    if (!isOpen())
+        return false;
+    *date = node->modifyDate;
+    *time = node->modifyTime;
+    return true;
+}
+
+size_t
+SdFile::getName (
+    char * name,
+    size_t size
+    )
+{
+    if ((!isOpen()) || (node->name.size() >= size)) {
+        if (size)
+            *name = 0;
+        return 0;
+    }
+    memcpy(name, node->name.c_str(), node->name.size() + 1);
+    return node->name.size();
+}
+
+//------------------------------------------------------------------------------
+// Build the raw directory entries, one long name entry for each 13
+// characters followed by the short entry, padded to the sector size
+//------------------------------------------------------------------------------
+static
+void
+directoryImage (
+    FakeNode * dir,
+    std::string * image
+    )
+{
+    uint8_t entry[ENTRY_SIZE];
+    uint32_t hash;
+    size_t length;
+    size_t offset;
+    size_t records;
+
+    image->clear();
+    for (FakeNode * child : dir->children) {
+        length = child->name.size();
+        records = (length + 12) / 13;
+        for (size_t record = records; record > 0; record--) {
+            memset(entry, 0xff, sizeof(entry));
+            entry[0] = (uint8_t)(record | ((record == records) ? 0x40 : 0));
+            entry[11] = 0x0f;
+            offset = (record - 1) * 13;
+            for (size_t index = 0; index < 13; index++) {
+                static const uint8_t position[13] = {1, 3, 5, 7, 9, 14, 16, 18,
+                                                     20, 22, 24, 28, 30};
+                if ((offset + index) <= length) {
+                    entry[position[index]] = (offset + index < length)
+                                           ? child->name[offset + index] : 0;
+                    entry[position[index] + 1] = 0;
+                }
+            }
+            image->append((const char *)entry, sizeof(entry));
+        }
+        hash = 2166136261u;
+        for (char c : child->name)
+            hash = (hash ^ (uint8_t)c) * 16777619u;
+        memset(entry, 0, sizeof(entry));
+        snprintf((char *)entry, 12, "~%08X  ", hash);
+        entry[11] = (child->directory ? 0x10 : 0x20) | child->attributes;
+        memcpy(&entry[20], &child->firstSector, 2);
+        entry[22] = (uint8_t)child->modifyTime;
+        entry[23] = (uint8_t)(child->modifyTime >> 8);
+        entry[24] = (uint8_t)child->modifyDate;
+        entry[25] = (uint8_t)(child->modifyDate >> 8);
+        memcpy(&entry[26], &child->firstSector, 2);
+        memcpy(&entry[28], &child->size, 4);
+        image->append((const char *)entry, sizeof(entry));
+    }
+    image->append(SECTOR_SIZE - (image->size() % SECTOR_SIZE), 0);
+}
+
+int
+SdFile::read (
+    void * buffer,
+    size_t length
+    )
+{
+    uint64_t cluster;
+    uint64_t end;
+    std::string image;
+    uint64_t sector;
+    uint64_t size;
+
+    if ((!isOpen()) || ((flags & O_ACCMODE) == O_WRONLY))
+        return -1;
+
+    // Directories return the raw directory entries
+    if (node->directory) {
+        FakeAllocScope scope;
+
+        directoryImage(node, &image);
+        if (position >= image.size())
+            return 0;
+        length = std::min<uint64_t>(length, image.size() - position);
+        for (sector = position / SECTOR_SIZE;
+             sector <= (position + length - 1) / SECTOR_SIZE; sector++)
+            sd->charge(1, 1);
+        memcpy(buffer, &image[position], length);
+        position += length;
+        return (int)length;
+    }
+
+    size = node->size;
+    if (position >= size)
+        return 0;
+    length = std::min<uint64_t>(length, size - position);
+    end = position + length;
+    if (end > node->failReadOffset)
+        return -1;
+
+    // Charge the sector reads
+    sector = position / SECTOR_SIZE;
+    while (sector * SECTOR_SIZE < end) {
+        if (((sector * SECTOR_SIZE) < position)
+            || (((sector + 1) * SECTOR_SIZE) > end)) {
+            // Partial sector through the cache
+            if ((sd->cacheNode != node) || (sd->cacheSector != sector)) {
+                sd->charge(1, 1);
+                sd->cacheNode = node;
+                sd->cacheSector = sector;
+            }
+            sector += 1;
+            continue;
+        }
+
+        // Whole sectors, one command for each run within a cluster
+        cluster = sd->clusterSectors
+                - (sector % sd->clusterSectors);
+        cluster = std::min<uint64_t>(cluster, (end / SECTOR_SIZE) - sector);
+        sd->charge(1, cluster);
+        sector += cluster;
+    }
+
+    sd->readContents(node, position, (uint8_t *)buffer, length);
+    position = end;
+    return (int)length;
+}
+
+int
+SdFile::read (
+    )
+{
+    uint8_t data;
+
+    return (read(&data, 1) == 1) ? data : -1;
+}
+
+size_t
+SdFile::write (
+    const uint8_t * buffer,
+    size_t length
+    )
+{
+    FakeAllocScope scope;
+    uint64_t end;
+
+    if ((!isFile()) || ((flags & O_ACCMODE) == O_RDONLY) || node->generated)
+        return 0;
+    if (flags & O_APPEND)
+        position = node->size;
+    end = position + length;
+    if (end > node->data.size())
+        node->data.resize(end);
+    memcpy(&node->data[position], buffer, length);
+    position = end;
+    if (end > node->size)
+        node->size = end;
+
+    // Writing beyond the preallocated space fragments the file
+    if (node->firstSector && (end > node->allocated)) {
+        sd->sectorMap.erase(node->firstSector);
+        node->firstSector = 0;
+    }
+    node->modifyDate = sd->nowDate;
+    node->modifyTime = sd->nowTime;
+    sd->charge(1, (length + SECTOR_SIZE - 1) / SECTOR_SIZE);
+    return length;
+}
+
+bool
+SdFile::sync (
+    )
+{
+    return isOpen();
+}
+
+bool
+SdFile::preAllocate (
+    uint64_t length
+    )
+{
+    FakeAllocScope scope;
+
+    if ((!isFile()) || ((flags & O_ACCMODE) == O_RDONLY) || node->size
+        || sd->failPreAllocate
+        || (length > (uint64_t)sd->freeClusters * sd->clusterBytes))
+        return false;
+    node->data.reserve(length);
+    node->firstSector = sd->allocate(length, node);
+    return true;
+}
+
+bool
+SdFile::truncate (
+    )
+{
+    FakeAllocScope scope;
+
+    if ((!isFile()) || ((flags & O_ACCMODE) == O_RDONLY))
+        return false;
+    node->data.clear();
+    node->size = 0;
+    node->generated = false;
+    if (node->firstSector)
+        sd->sectorMap.erase(node->firstSector);
+    node->firstSector = 0;
+    position = 0;
+    return true;
+}
+
+bool
+SdFile::rename (
+    SdFile * dir,
+    const char * newPath
+    )
+{
+    FakeAllocScope scope;
+    const char * name;
+    FakeNode * parent;
+    std::vector<FakeNode *> * children;
+
+    if ((!isOpen()) || (!dir->isDir()) || (node == sd->root))
+        return false;
+    if (sd->lookup(dir->node, newPath, &parent, &name) || (!parent))
+        return false;
+    children = &node->parent->children;
+    for (size_t index = 0; index < children->size(); index++)
+        if ((*children)[index] == node) {
+            children->erase(children->begin() + index);
+            break;
+        }
+    node->name = name;
+    node->parent = parent;
+    parent->children.push_back(node);
+    return true;
+}
+
+bool
+SdFile::remove (
+    )
+{
+    if ((!isFile()) || ((flags & O_ACCMODE) == O_RDONLY))
+        return false;
+    sd->unlink(node);
+    node = NULL;
+    return true;
+}
@@ -0,0 +1,224 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Stand-in for SdFat v2 backed by an in-memory directory tree.  Files hold
+// either real contents or generated contents, which allows sparse files
+// larger than 4 GiB.  Every SD card command is charged a configurable
+// latency:
+//
+//      * Partial sector reads go through a one sector cache, like SdFat
+//      * Whole sector reads through SdFile::read use one command for each
+//        run of sectors within a cluster
+//      * SdCard::readSectors uses one command for the whole request
+//      * Directory reads use one command for each 16 entries
+
+#ifndef FAKE_SDFAT_H_INCLUDED
+#define FAKE_SDFAT_H_INCLUDED
+
+#include <fcntl.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+
+typedef int oflag_t;
+
+//------------------------------------------------------------------------------
+// FAT date and time
+//------------------------------------------------------------------------------
+
+static inline uint16_t FS_DATE (uint16_t year, uint8_t month, uint8_t day)
+    { return ((year - 1980) << 9) | (month << 5) | day; }
+static inline uint16_t FS_TIME (uint8_t hour, uint8_t minute, uint8_t second)
+    { return (hour << 11) | (minute << 5) | (second >> 1); }
+static inline uint16_t FS_YEAR (uint16_t date) { return 1980 + (date >> 9); }
+static inline uint8_t FS_MONTH (uint16_t date) { return (date >> 5) & 0xf; }
+static inline uint8_t FS_DAY (uint16_t date) { return date & 0x1f; }
+static inline uint8_t FS_HOUR (uint16_t time) { return time >> 11; }
+static inline uint8_t FS_MINUTE (uint16_t time) { return (time >> 5) & 0x3f; }
+static inline uint8_t FS_SECOND (uint16_t time) { return 2 * (time & 0x1f); }
+
+//------------------------------------------------------------------------------
+// Generated file contents
+//------------------------------------------------------------------------------
+
+// Get the byte at an offset in a generated file
+uint8_t fakeByte (uint32_t seed, uint64_t offset);
+
+// Fill a buffer with the generated file contents
+void fakeFill (uint32_t seed, uint64_t offset, uint8_t * buffer, size_t length);
+
+//------------------------------------------------------------------------------
+// Directory tree
+//------------------------------------------------------------------------------
+
+#define FAKE_ATTR_HIDDEN        0x02
+#define FAKE_ATTR_READ_ONLY     0x01
+
+struct FakeNode {
+    std::string name;
+    FakeNode * parent;
+    std::vector<FakeNode *> children;
+    bool directory;
+    uint8_t attributes;
+    uint16_t modifyDate;
+    uint16_t modifyTime;
+    uint64_t size;
+    bool generated;             // Contents from fakeByte
+    uint32_t seed;
+    std::string data;           // Contents when not generated
+    uint32_t firstSector;       // Zero when the file is not contiguous
+    uint64_t allocated;         // Bytes of contiguous sectors
+    uint64_t failReadOffset;    // Reads at or beyond this offset fail
+};
+
+typedef struct _cid_t {
+    uint8_t mid;
+    char oid[2];
+    char pnm[5];
+    uint8_t prv;
+    uint32_t psn;
+    uint16_t mdt;
+    uint8_t crc;
+} cid_t;
+
+class SdFat;
+
+class SdCard
+{
+public:
+    SdFat * sd;
+
+    bool readCID (cid_t * cid);
+    uint32_t sectorCount ();
+    bool readSectors (uint32_t sector, uint8_t * buffer, size_t count);
+    bool readSector (uint32_t sector, uint8_t * buffer)
+        { return readSectors(sector, buffer, 1); }
+};
+
+class FsVolume
+{
+public:
+    SdFat * sd;
+};
+
+//------------------------------------------------------------------------------
+// SdFile
+//------------------------------------------------------------------------------
+
+class SdFile : public Print
+{
+public:
+    SdFile () : sd(NULL), node(NULL), position(0), flags(0), nextEntry(0) {}
+
+    bool open (SdFile * dir, const char * path, oflag_t oflag = O_RDONLY);
+    bool openNext (SdFile * dir, oflag_t oflag = O_RDONLY);
+    bool openRoot (FsVolume * volume);
+    bool close ();
+    bool isOpen () const { return node != NULL; }
+    bool isDir () const { return node && node->directory; }
+    bool isFile () const { return node && (!node->directory); }
+    bool isHidden () const { return node && (node->attributes & FAKE_ATTR_HIDDEN); }
+    bool isReadOnly () const { return node && (node->attributes & FAKE_ATTR_READ_ONLY); }
+    bool contiguousRange (uint32_t * firstSector, uint32_t * lastSector);
+    uint32_t firstSector () const { return node ? node->firstSector : 0; }
+    uint64_t fileSize () const { return node ? node->size : 0; }
+    uint64_t curPosition () const { return position; }
+    bool seekSet (uint64_t offset);
+    bool rewind () { nextEntry = 0; return seekSet(0); }
+    int available () { return (int)((fileSize() > position) ? fileSize() - position : 0); }
+    bool getModifyDateTime (uint16_t * date, uint16_t * time);
+    size_t getName (char * name, size_t size);
+    int read (void * buffer, size_t length);
+    int read ();
+    using Print::write;
+    size_t write (uint8_t data) override { return write(&data, 1); }
+    size_t write (const uint8_t * buffer, size_t length) override;
+    size_t write (const void * buffer, size_t length)
+        { return write((const uint8_t *)buffer, length); }
+    bool sync ();
+    bool preAllocate (uint64_t length);
+    bool truncate ();
+    bool rename (SdFile * dir, const char * newPath);
+    bool remove ();
+
+    SdFat * sd;
+    FakeNode * node;
+    uint64_t position;
+    oflag_t flags;
+    size_t nextEntry;           // openNext position in a directory
+};
+
+//------------------------------------------------------------------------------
+// SdFat
+//------------------------------------------------------------------------------
+
+class SdFat
+{
+public:
+    SdFat ();
+    ~SdFat ();
+
+    // SdFat API
+    SdCard * card () { return &sdCard; }
+    FsVolume * vol () { return &volume; }
+    int32_t freeClusterCount ();
+    uint32_t bytesPerCluster () { return clusterBytes; }
+
+    // Build the directory tree
+    FakeNode * makeDir (const char * path);
+    FakeNode * addFile (const char * path, const void * data, size_t length);
+    FakeNode * addFile (const char * path, const char * text)
+        { return addFile(path, text, strlen(text)); }
+    FakeNode * addGeneratedFile (const char * path, uint64_t size, uint32_t seed);
+    FakeNode * find (const char * path);
+    bool removePath (const char * path);
+    void setModifyDateTime (FakeNode * node, uint16_t date, uint16_t time);
+    std::string contents (const char * path);
+    void fragment (FakeNode * node) { node->firstSector = 0; }
+
+    // Card state
+    bool present;
+    cid_t cid;
+    uint32_t sectors;
+    uint32_t clusterBytes;
+    int32_t freeClusters;
+    uint16_t nowDate;           // Time stamp of the written files
+    uint16_t nowTime;
+    bool failPreAllocate;
+
+    // Latency model
+    uint32_t commandUsec;       // Per command
+    uint32_t sectorUsec;        // Per sector transferred
+    uint32_t clusterSectors;    // Sectors per cluster for SdFile::read
+    uint32_t freeCountUsec;     // Time to read the FAT
+
+    // Statistics
+    std::atomic<uint64_t> commands;
+    std::atomic<uint64_t> sectorsRead;
+    std::atomic<uint64_t> directoryReads;
+
+    // Internal state
+    void charge (uint32_t commandCount, uint64_t sectorCount);
+    uint32_t allocate (uint64_t size, FakeNode * node);
+    FakeNode * lookup (FakeNode * dir, const char * path, FakeNode ** parent,
+                       const char ** name);
+    void unlink (FakeNode * node);
+    void readContents (FakeNode * node, uint64_t offset, uint8_t * buffer,
+                       size_t length);
+
+    SdCard sdCard;
+    FsVolume volume;
+    FakeNode * root;
+    FakeNode * cacheNode;
+    uint64_t cacheSector;
+    uint32_t nextSector;
+    std::map<uint32_t, FakeNode *> sectorMap;
+    std::vector<FakeNode *> removed;
+};
+
+#endif  // FAKE_SDFAT_H_INCLUDED
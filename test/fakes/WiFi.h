@@ -0,0 +1,21 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+
+#ifndef FAKE_WIFI_H_INCLUDED
+#define FAKE_WIFI_H_INCLUDED
+
+#include "Arduino.h"
+
+class WiFiClass
+{
+public:
+    IPAddress address = IPAddress(192, 168, 4, 1);
+
+    IPAddress localIP () { return address; }
+};
+
+extern WiFiClass WiFi;
+
+#endif  // FAKE_WIFI_H_INCLUDED
@@ -0,0 +1,187 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "FakeAlloc.h"
+#include "FreeRTOS.h"
+
+struct _FAKE_SEMAPHORE {
+    std::mutex lock;
+    std::condition_variable available;
+    int count;
+};
+
+struct _FAKE_TASK {
+    std::mutex lock;
+    std::condition_variable notified;
+    uint32_t notifications;
+};
+
+// The critical sections protect a few words, one lock is enough
+static std::mutex criticalLock;
+static thread_local TaskHandle_t currentTask;
+
+//------------------------------------------------------------------------------
+// Critical sections
+//------------------------------------------------------------------------------
+void
+portENTER_CRITICAL (
+    portMUX_TYPE * mux
+    )
+{
+    criticalLock.lock();
+    mux->locked = 1;
+}
+
+void
+portEXIT_CRITICAL (
+    portMUX_TYPE * mux
+    )
+{
+    mux->locked = 0;
+    criticalLock.unlock();
+}
+
+//------------------------------------------------------------------------------
+// Semaphores
+//------------------------------------------------------------------------------
+static
+SemaphoreHandle_t
+semaphoreCreate (
+    int count
+    )
+{
+    FakeAllocScope scope;
+    SemaphoreHandle_t semaphore;
+
+    semaphore = new _FAKE_SEMAPHORE;
+    semaphore->count = count;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex () { return semaphoreCreate(1); }
+SemaphoreHandle_t xSemaphoreCreateBinary () { return semaphoreCreate(0); }
+
+void
+vSemaphoreDelete (
+    SemaphoreHandle_t semaphore
+    )
+{
+    delete semaphore;
+}
+
+BaseType_t
+xSemaphoreTake (
+    SemaphoreHandle_t semaphore,
+    TickType_t ticks
+    )
+{
+    std::unique_lock<std::mutex> lock(semaphore->lock);
+
+    if (ticks == portMAX_DELAY)
+        semaphore->available.wait(lock, [semaphore] { return semaphore->count > 0; });
+    else if (!semaphore->available.wait_for(lock, std::chrono::milliseconds(ticks),
+                                            [semaphore] { return semaphore->count > 0; }))
+        return pdFALSE;
+    semaphore->count -= 1;
+    return pdTRUE;
+}
+
+BaseType_t
+xSemaphoreGive (
+    SemaphoreHandle_t semaphore
+    )
+{
+    std::lock_guard<std::mutex> lock(semaphore->lock);
+
+    if (semaphore->count)
+        return pdFALSE;
+    semaphore->count = 1;
+    semaphore->available.notify_one();
+    return pdTRUE;
+}
+
+//------------------------------------------------------------------------------
+// Tasks
+//------------------------------------------------------------------------------
+BaseType_t
+xTaskCreate (
+    TaskFunction_t function,
+    const char * name,
+    uint32_t stackDepth,
+    void * parameter,
+    UBaseType_t priority,
+    TaskHandle_t * task
+    )
+{
+    FakeAllocScope scope;
+    TaskHandle_t handle;
+
+    (void)name;
+    (void)stackDepth;
+    (void)priority;
+    handle = new _FAKE_TASK;
+    handle->notifications = 0;
+    if (task)
+        *task = handle;
+    std::thread([function, parameter, handle] {
+        currentTask = handle;
+        function(parameter);
+    }).detach();
+    return pdPASS;
+}
+
+void
+vTaskDelay (
+    TickType_t ticks
+    )
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TaskHandle_t
+xTaskGetCurrentTaskHandle (
+    )
+{
+    return currentTask;
+}
+
+BaseType_t
+xTaskNotifyGive (
+    TaskHandle_t task
+    )
+{
+    std::lock_guard<std::mutex> lock(task->lock);
+
+    task->notifications += 1;
+    task->notified.notify_one();
+    return pdPASS;
+}
+
+uint32_t
+ulTaskNotifyTake (
+    BaseType_t clearOnExit,
+    TickType_t ticks
+    )
+{
+    uint32_t count;
+    TaskHandle_t task;
+
+    task = currentTask;
+    std::unique_lock<std::mutex> lock(task->lock);
+    if (ticks == portMAX_DELAY)
+        task->notified.wait(lock, [task] { return task->notifications > 0; });
+    else
+        task->notified.wait_for(lock, std::chrono::milliseconds(ticks),
+                                [task] { return task->notifications > 0; });
+    count = task->notifications;
+    if (count)
+        task->notifications = clearOnExit ? 0 : count - 1;
+    return count;
+}
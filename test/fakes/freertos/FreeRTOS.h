@@ -0,0 +1,51 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Stand-in for the FreeRTOS tasks, semaphores and critical sections using
+// host threads.  One tick is one millisecond.
+
+#ifndef FAKE_FREERTOS_H_INCLUDED
+#define FAKE_FREERTOS_H_INCLUDED
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef struct _FAKE_SEMAPHORE * SemaphoreHandle_t;
+typedef struct _FAKE_TASK * TaskHandle_t;
+typedef void (* TaskFunction_t) (void * parameter);
+
+#define pdFALSE                 0
+#define pdTRUE                  1
+#define pdFAIL                  0
+#define pdPASS                  1
+#define portMAX_DELAY           0xffffffffUL
+#define pdMS_TO_TICKS(msec)     ((TickType_t)(msec))
+
+typedef struct _portMUX_TYPE {
+    volatile int locked;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    {0}
+
+void portENTER_CRITICAL (portMUX_TYPE * mux);
+void portEXIT_CRITICAL (portMUX_TYPE * mux);
+
+SemaphoreHandle_t xSemaphoreCreateMutex ();
+SemaphoreHandle_t xSemaphoreCreateBinary ();
+void vSemaphoreDelete (SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreTake (SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive (SemaphoreHandle_t semaphore);
+
+BaseType_t xTaskCreate (TaskFunction_t function, const char * name,
+                        uint32_t stackDepth, void * parameter,
+                        UBaseType_t priority, TaskHandle_t * task);
+void vTaskDelay (TickType_t ticks);
+BaseType_t xTaskNotifyGive (TaskHandle_t task);
+uint32_t ulTaskNotifyTake (BaseType_t clearOnExit, TickType_t ticks);
+TaskHandle_t xTaskGetCurrentTaskHandle ();
+
+#endif  // FAKE_FREERTOS_H_INCLUDED
@@ -0,0 +1,422 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Benchmarks for the listings and downloads against the SdFat fake.
+//
+//  Usage: sd_bench [--quick] [--command-usec N] [--sector-usec N] [name ...]
+//
+//      --quick: Small data sets, used by ctest to keep the benchmarks building
+//               and running
+//      --command-usec: Latency of each SD card command
+//      --sector-usec: Latency of each sector transferred
+//      name: Benchmarks to run, all of them by default
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "SdTest.h"
+
+typedef struct _BENCH_OPTIONS {
+    bool quick;
+    uint32_t commandUsec;
+    uint32_t sectorUsec;
+} BENCH_OPTIONS;
+
+typedef struct _BENCH_RESULT {
+    uint64_t bytes;
+    uint32_t usec;
+    uint32_t firstByteUsec;
+    size_t callbacks;
+    size_t segments;
+    size_t tryAgains;
+    uint32_t fillerUsec;
+    uint32_t maxFillerUsec;
+    FAKE_ALLOC_COUNTS allocs;
+} BENCH_RESULT;
+
+typedef struct _BENCH {
+    const char * name;
+    const char * description;
+    void (* run) (const BENCH_OPTIONS * options);
+} BENCH;
+
+//------------------------------------------------------------------------------
+// Send a request and measure it
+//------------------------------------------------------------------------------
+static
+BENCH_RESULT
+benchRequest (
+    AsyncWebServer * web,
+    const char * target,
+    size_t space = 4 * FAKE_TCP_MSS
+    )
+{
+    FAKE_ALLOC_COUNTS end;
+    BENCH_RESULT result;
+    FAKE_ALLOC_COUNTS start;
+
+    start = fakeAllocCounts();
+    {
+        std::unique_ptr<FakeConnection> connection = testGet(web, target, space);
+
+        if ((connection->code < 200) || (connection->code > 299) || connection->aborted)
+            printf("    %s: HTTP %d%s\n", target, connection->code,
+                   connection->aborted ? " aborted" : "");
+        result.bytes = connection->data.size();
+        result.usec = connection->totalUsec ? connection->totalUsec : 1;
+        result.firstByteUsec = connection->firstByteUsec;
+        result.callbacks = connection->callbacks;
+        result.segments = connection->segments;
+        result.tryAgains = connection->tryAgains;
+        result.fillerUsec = connection->fillerUsec;
+        result.maxFillerUsec = connection->maxFillerUsec;
+    }
+    end = fakeAllocCounts();
+    result.allocs = fakeAllocDelta(start, end);
+    return result;
+}
+
+//------------------------------------------------------------------------------
+// Apply the latency model
+//------------------------------------------------------------------------------
+static
+void
+benchLatency (
+    SdFat * sd,
+    const BENCH_OPTIONS * options
+    )
+{
+    sd->commandUsec = options->commandUsec;
+    sd->sectorUsec = options->sectorUsec;
+}
+
+//------------------------------------------------------------------------------
+// Apply the latency model, using the defaults when the options do not
+// specify the latency
+//------------------------------------------------------------------------------
+static
+void
+benchLatency (
+    SdFat * sd,
+    const BENCH_OPTIONS * options,
+    uint32_t commandUsec,
+    uint32_t sectorUsec
+    )
+{
+    sd->commandUsec = options->commandUsec ? options->commandUsec : commandUsec;
+    sd->sectorUsec = options->sectorUsec ? options->sectorUsec : sectorUsec;
+}
+
+//------------------------------------------------------------------------------
+// basic
+//      Listing entries per second, download throughput, time to first byte
+//      and allocations per request
+//------------------------------------------------------------------------------
+static
+void
+benchBasic (
+    const BENCH_OPTIONS * options
+    )
+{
+    char name[64];
+    int entries;
+    int file;
+    uint64_t fileSize;
+    BENCH_RESULT result;
+    SdFat sd;
+    AsyncWebServer web(80);
+
+    entries = options->quick ? 100 : 1000;
+    fileSize = options->quick ? 256 * 1024 : 8 * 1024 * 1024;
+    for (file = 0; file < entries; file++) {
+        snprintf(name, sizeof(name), "list/file-%05d.txt", file);
+        sd.addGeneratedFile(name, 1000 + file, file);
+    }
+    sd.addGeneratedFile("download.bin", fileSize, 1);
+    benchLatency(&sd, options);
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Bench", 4, false);
+    server.onNotFound(&web);
+
+    printf("  %-24s %12s %10s %10s %8s %8s\n", "request", "rate", "ttfb usec",
+           "total usec", "mallocs", "news");
+    for (const char * target : {"/SD/list/", "/SD/list/?format=json",
+                                "/SD/list/?format=csv"}) {
+        result = benchRequest(&web, target);
+        printf("  %-24s %8.0f e/s %10u %10u %8llu %8llu\n", target,
+               entries * 1e6 / result.usec, result.firstByteUsec, result.usec,
+               (unsigned long long)result.allocs.mallocs,
+               (unsigned long long)result.allocs.news);
+    }
+    for (const char * target : {"/SD/download.bin", "/SD/download.bin"}) {
+        result = benchRequest(&web, target);
+        printf("  %-24s %7.2f MB/s %10u %10u %8llu %8llu\n", target,
+               result.bytes / (double)result.usec, result.firstByteUsec,
+               result.usec, (unsigned long long)result.allocs.mallocs,
+               (unsigned long long)result.allocs.news);
+    }
+}
+
+//------------------------------------------------------------------------------
+// prefetch
+//      Downloads from a slow SD card.  With the prefetch task (sd_bench) the
+//      fillers copy data read ahead and return quickly, without it
+//      (sd_bench_sync) each filler waits for the SD card.
+//------------------------------------------------------------------------------
+static
+void
+benchPrefetch (
+    const BENCH_OPTIONS * options
+    )
+{
+    bool busy;
+    std::unique_ptr<FakeConnection> connections[2];
+    uint64_t fileSize;
+    uint32_t maxFillerUsec;
+    BENCH_RESULT result;
+    SdFat sd;
+    uint32_t usec;
+    AsyncWebServer web(80);
+
+    fileSize = options->quick ? 128 * 1024 : 4 * 1024 * 1024;
+    sd.addGeneratedFile("slow-1.bin", fileSize, 1);
+    sd.addGeneratedFile("slow-2.bin", fileSize, 2);
+    benchLatency(&sd, options, 500, 40);
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Bench", 4, false);
+    server.onNotFound(&web);
+
+#ifdef ESP32
+    printf("  Prefetch task, %u usec per command, %u usec per sector\n",
+           sd.commandUsec, sd.sectorUsec);
+#else   // ESP32
+    printf("  Synchronous reads, %u usec per command, %u usec per sector\n",
+           sd.commandUsec, sd.sectorUsec);
+#endif  // ESP32
+    printf("  %-24s %12s %10s %11s %12s %10s\n", "request", "rate", "ttfb usec",
+           "filler usec", "longest usec", "try again");
+
+    // One download at a time
+    result = benchRequest(&web, "/SD/slow-1.bin");
+    printf("  %-24s %7.2f MB/s %10u %11u %12u %10zu\n", "/SD/slow-1.bin",
+           result.bytes / (double)result.usec, result.firstByteUsec,
+           result.fillerUsec, result.maxFillerUsec, result.tryAgains);
+    testSettle();
+
+    // Two downloads sharing the web server task
+    connections[0].reset(new FakeConnection(&web, HTTP_GET, "/SD/slow-1.bin"));
+    connections[1].reset(new FakeConnection(&web, HTTP_GET, "/SD/slow-2.bin"));
+    usec = micros();
+    do {
+        busy = false;
+        for (std::unique_ptr<FakeConnection> & connection : connections)
+            if (!connection->done)
+                busy |= connection->step();
+    } while (busy);
+    usec = micros() - usec;
+    maxFillerUsec = std::max(connections[0]->maxFillerUsec,
+                             connections[1]->maxFillerUsec);
+    if ((connections[0]->data.size() != fileSize)
+        || (connections[1]->data.size() != fileSize))
+        printf("    Concurrent downloads are incomplete\n");
+    printf("  %-24s %7.2f MB/s %10u %11u %12u %10zu\n", "2 concurrent",
+           2 * fileSize / (double)(usec ? usec : 1),
+           std::max(connections[0]->firstByteUsec, connections[1]->firstByteUsec),
+           connections[0]->fillerUsec + connections[1]->fillerUsec,
+           maxFillerUsec, connections[0]->tryAgains + connections[1]->tryAgains);
+}
+
+//------------------------------------------------------------------------------
+// listing
+//      Processor time to build the listings, measured inside the response
+//      callbacks with the SD card latency removed.  Names containing the
+//      template delimiter (%) are included.
+//------------------------------------------------------------------------------
+static
+void
+benchListing (
+    const BENCH_OPTIONS * options
+    )
+{
+    int entries;
+    int file;
+    uint32_t fillerUsec;
+    char name[64];
+    int pass;
+    int passes;
+    BENCH_RESULT result;
+    SdFat sd;
+    AsyncWebServer web(80);
+
+    entries = options->quick ? 100 : 2000;
+    passes = options->quick ? 2 : 20;
+    for (file = 0; file < entries; file++) {
+        snprintf(name, sizeof(name), (file & 1) ? "list/%%file-%05d%%.txt"
+                                                : "list/file-%05d-long-name.txt", file);
+        sd.addGeneratedFile(name, 1000 + file, file);
+    }
+    benchLatency(&sd, options, 0, 0);
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Bench", 4, false);
+    server.onNotFound(&web);
+
+    printf("  %-32s %10s %10s %10s %10s\n", "request", "usec/entry", "bytes/entry",
+           "callbacks", "segments");
+    for (const char * target : {"/SD/list/", "/SD/list/?format=json",
+                                "/SD/list/?format=csv", "/SD/list/?sort=size&order=desc",
+                                "/SD/list/?match=*5*", "/SD/list/?offset=100&limit=50"}) {
+        // The first listing builds the directory index
+        result = benchRequest(&web, target);
+        fillerUsec = 0;
+        for (pass = 0; pass < passes; pass++) {
+            result = benchRequest(&web, target);
+            fillerUsec += result.fillerUsec;
+        }
+        printf("  %-32s %10.3f %11.1f %10zu %10zu\n", target,
+               fillerUsec / (double)passes / entries, result.bytes / (double)entries,
+               result.callbacks, result.segments);
+    }
+}
+
+//------------------------------------------------------------------------------
+// contiguous
+//      Download throughput of a contiguous file read with multi-sector reads
+//      and a fragmented file read through the cluster chain, for small and
+//      large clusters
+//------------------------------------------------------------------------------
+static
+void
+benchContiguous (
+    const BENCH_OPTIONS * options
+    )
+{
+    uint64_t commands;
+    uint64_t fileSize;
+    BENCH_RESULT result;
+    SdFat sd;
+    AsyncWebServer web(80);
+
+    fileSize = options->quick ? 256 * 1024 : 8 * 1024 * 1024;
+    sd.addGeneratedFile("contiguous.bin", fileSize, 1);
+    sd.fragment(sd.addGeneratedFile("fragmented.bin", fileSize, 2));
+    benchLatency(&sd, options, 100, 20);
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Bench", 4, false);
+    server.onNotFound(&web);
+
+    printf("  %u usec per command, %u usec per sector\n", sd.commandUsec,
+           sd.sectorUsec);
+    printf("  %-8s %-24s %12s %12s %10s\n", "cluster", "request", "rate",
+           "commands/MB", "try again");
+    for (uint32_t clusterSectors : {1, 2, 8, 64}) {
+        sd.clusterSectors = clusterSectors;
+        for (const char * target : {"/SD/contiguous.bin", "/SD/fragmented.bin"}) {
+            commands = sd.commands;
+            result = benchRequest(&web, target);
+            commands = sd.commands - commands;
+            printf("  %6u B %-24s %7.2f MB/s %12.1f %10zu\n",
+                   clusterSectors * 512, target, result.bytes / (double)result.usec,
+                   commands * 1024.0 * 1024.0 / (double)(result.bytes ? result.bytes : 1),
+                   result.tryAgains);
+            testSettle();
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// segments
+//      TCP segments sent by the listings for several send buffer sizes.  Each
+//      response callback should fill the buffer, so the segments sent are
+//      close to the minimum for the listing size.
+//------------------------------------------------------------------------------
+static
+void
+benchSegments (
+    const BENCH_OPTIONS * options
+    )
+{
+    int entries;
+    int file;
+    size_t minimum;
+    char name[64];
+    BENCH_RESULT result;
+    SdFat sd;
+    AsyncWebServer web(80);
+
+    entries = options->quick ? 100 : 1000;
+    for (file = 0; file < entries; file++) {
+        snprintf(name, sizeof(name), "list/file-%05d.txt", file);
+        sd.addGeneratedFile(name, 100 + file, file);
+    }
+    benchLatency(&sd, options, 0, 0);
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Bench", 4, false);
+    server.onNotFound(&web);
+
+    printf("  %-24s %6s %10s %10s %10s %10s %10s\n", "request", "space",
+           "bytes", "callbacks", "bytes/call", "segments", "minimum");
+    for (const char * target : {"/SD/list/", "/SD/list/?format=json",
+                                "/SD/list/?format=csv", "/SD/list/?format=tar"}) {
+        // The first listing builds the directory index
+        benchRequest(&web, target);
+        for (size_t space : {(size_t)FAKE_TCP_MSS, (size_t)(4 * FAKE_TCP_MSS), (size_t)1000}) {
+            result = benchRequest(&web, target, space);
+            minimum = (result.bytes + FAKE_TCP_MSS - 1) / FAKE_TCP_MSS;
+            printf("  %-24s %6zu %10llu %10zu %10.1f %10zu %10zu\n", target, space,
+                   (unsigned long long)result.bytes, result.callbacks,
+                   result.bytes / (double)(result.callbacks ? result.callbacks : 1),
+                   result.segments, minimum);
+        }
+    }
+}
+
+static const BENCH benchmarks[] = {
+    {"basic", "Listing and download throughput", benchBasic},
+    {"prefetch", "Downloads from a slow SD card", benchPrefetch},
+    {"listing", "Processor time to build the listings", benchListing},
+    {"contiguous", "Contiguous and fragmented file downloads", benchContiguous},
+    {"segments", "TCP segments sent by the listings", benchSegments},
+};
+
+int
+main (
+    int argc,
+    char ** argv
+    )
+{
+    int arg;
+    std::vector<const char *> names;
+    BENCH_OPTIONS options;
+
+    options.quick = false;
+    options.commandUsec = 0;
+    options.sectorUsec = 0;
+    for (arg = 1; arg < argc; arg++) {
+        if (!strcmp(argv[arg], "--quick"))
+            options.quick = true;
+        else if ((!strcmp(argv[arg], "--command-usec")) && ((arg + 1) < argc))
+            options.commandUsec = strtoul(argv[++arg], NULL, 0);
+        else if ((!strcmp(argv[arg], "--sector-usec")) && ((arg + 1) < argc))
+            options.sectorUsec = strtoul(argv[++arg], NULL, 0);
+        else if (argv[arg][0] == '-') {
+            fprintf(stderr, "Usage: %s [--quick] [--command-usec N] "
+                    "[--sector-usec N] [name ...]\n", argv[0]);
+            return 1;
+        } else
+            names.push_back(argv[arg]);
+    }
+
+    for (const BENCH & bench : benchmarks) {
+        bool selected = names.empty();
+        for (const char * name : names)
+            selected |= !strcmp(name, bench.name);
+        if (!selected)
+            continue;
+        printf("%s: %s\n", bench.name, bench.description);
+        bench.run(&options);
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Heap allocations of the steady state requests.  After the first request
+// allocates the caches, the downloads, listings and metrics must not call
+// malloc and the response callbacks must not allocate memory at all.
+
+#include "SdTest.h"
+
+//------------------------------------------------------------------------------
+// Count the allocations made by a request
+//------------------------------------------------------------------------------
+static
+FAKE_ALLOC_COUNTS
+allocRequest (
+    AsyncWebServer * web,
+    const char * target,
+    int code
+    )
+{
+    FAKE_ALLOC_COUNTS start;
+
+    start = fakeAllocCounts();
+    {
+        std::unique_ptr<FakeConnection> connection = testGet(web, target);
+
+        CHECK_EQ(connection->code, code);
+        CHECK(!connection->aborted);
+    }
+    return fakeAllocDelta(start, fakeAllocCounts());
+}
+
+//------------------------------------------------------------------------------
+// Verify that the steady state requests do not allocate memory
+//------------------------------------------------------------------------------
+static
+void
+allocSteady (
+    AsyncWebServer * web,
+    const char * target,
+    int code
+    )
+{
+    FAKE_ALLOC_COUNTS counts;
+    int pass;
+
+    // The first request allocates the caches and the transfer buffers
+    allocRequest(web, target, code);
+    for (pass = 0; pass < 3; pass++) {
+        counts = allocRequest(web, target, code);
+        if (counts.mallocs || counts.callbackAllocs)
+            printf("    %s: %llu mallocs, %llu callback allocations\n", target,
+                   (unsigned long long)counts.mallocs,
+                   (unsigned long long)counts.callbackAllocs);
+        CHECK_EQ(counts.mallocs, 0);
+        CHECK_EQ(counts.callbackAllocs, 0);
+    }
+}
+
+int
+main (
+    )
+{
+    FAKE_ALLOC_COUNTS counts;
+    char name[64];
+    int index;
+    int pass;
+    SdFat sd;
+    AsyncWebServer web(80);
+
+    sd.addGeneratedFile("big.bin", 1024 * 1024 + 3, 1);
+    sd.addFile("small.txt", "Small file\n");
+    for (index = 0; index < 300; index++) {
+        snprintf(name, sizeof(name), "list/file-%03d.txt", index);
+        sd.addGeneratedFile(name, 1000 + index, index);
+    }
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Test Server", 4, false);
+    server.onNotFound(&web);
+
+    // Downloads read from the SD card and sent from the file cache
+    allocSteady(&web, "/SD/big.bin", 200);
+    allocSteady(&web, "/SD/small.txt", 200);
+
+    // Listings sent from the cached directory index
+    allocSteady(&web, "/SD/list/", 200);
+    allocSteady(&web, "/SD/list/?format=json&sort=size&order=desc", 200);
+    allocSteady(&web, "/SD/list/?format=csv&offset=100&limit=50", 200);
+
+    // Rebuilding the directory index reuses the memory of the previous index
+    allocRequest(&web, "/SD/list/?sort=mtime", 200);
+    for (pass = 0; pass < 3; pass++) {
+        server.sdCardFilesChanged();
+        counts = allocRequest(&web, "/SD/list/?sort=mtime", 200);
+        CHECK_EQ(counts.mallocs, 0);
+        CHECK_EQ(counts.callbackAllocs, 0);
+    }
+
+    // Metrics
+    allocSteady(&web, "/SD/?metrics", 200);
+    allocSteady(&web, "/SD/?metrics=json", 200);
+
+    return testResult("test_alloc");
+}
@@ -0,0 +1,114 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// tar archives of a directory
+
+#include <vector>
+
+#include "SdTest.h"
+
+typedef struct _TAR_MEMBER {
+    std::string name;
+    std::string data;
+} TAR_MEMBER;
+
+//------------------------------------------------------------------------------
+// Split a tar archive into its members, returns false if the archive is not
+// complete
+//------------------------------------------------------------------------------
+static
+bool
+tarMembers (
+    const std::string & archive,
+    std::vector<TAR_MEMBER> * members
+    )
+{
+    std::string longName;
+    TAR_MEMBER member;
+    size_t offset;
+    uint64_t size;
+
+    members->clear();
+    for (offset = 0; (offset + 512) <= archive.size(); ) {
+        // Two zero blocks end the archive
+        if (archive.compare(offset, 512, std::string(512, '\0')) == 0)
+            return (offset + 1024) == archive.size();
+        size = strtoull(archive.substr(offset + 124, 12).c_str(), NULL, 8);
+        if ((offset + 512 + size) > archive.size())
+            return false;
+        member.data = archive.substr(offset + 512, size);
+        if (archive[offset + 156] == 'L')
+            longName = member.data.c_str();
+        else {
+            member.name = longName.size() ? longName
+                        : std::string(archive.c_str() + offset);
+            longName.clear();
+            members->push_back(member);
+        }
+        offset += 512 + ((size + 511) & ~511ULL);
+    }
+    return false;
+}
+
+int
+main (
+    )
+{
+    std::unique_ptr<FakeConnection> connection;
+    std::string longName;
+    std::vector<TAR_MEMBER> members;
+    FakeNode * node;
+    SdFat sd;
+    AsyncWebServer web(80);
+
+    longName = std::string(150, 'n') + ".txt";
+    sd.addFile("logs/a.csv", "1,2,3\n");
+    sd.addGeneratedFile("logs/b.bin", 300 * 1000 + 7, 3);
+    sd.addFile(("logs/" + longName).c_str(), "long");
+    sd.addFile("logs/sub/c.txt", "not archived");
+    sd.addFile("top.txt", "top");
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Test Server", 4, false);
+    server.onNotFound(&web);
+
+    // The member names include the directory path
+    connection = testGet(&web, "/SD/logs/?format=tar");
+    CHECK_EQ(connection->code, 200);
+    CHECK_STR(connection->contentType, "application/x-tar");
+    CHECK(tarMembers(connection->data, &members));
+    CHECK_EQ(members.size(), 3);
+    if (members.size() == 3) {
+        CHECK_STR(members[0].name, "logs/a.csv");
+        CHECK_STR(members[0].data, "1,2,3\n");
+        CHECK_STR(members[1].name, "logs/b.bin");
+        CHECK(members[1].data == testGenerated(3, 0, 300 * 1000 + 7));
+        CHECK_STR(members[2].name, "logs/" + longName);
+        CHECK_STR(members[2].data, "long");
+    }
+    connection = testGet(&web, "/SD/?format=tar");
+    CHECK(tarMembers(connection->data, &members));
+    CHECK_EQ(members.size(), 1);
+    if (members.size() == 1)
+        CHECK_STR(members[0].name, "top.txt");
+
+    // The archives are not sorted
+    connection = testGet(&web, "/SD/logs/?format=tar&sort=size");
+    CHECK_EQ(connection->code, 400);
+    connection = testGet(&web, "/SD/logs/?format=tar&order=desc");
+    CHECK_EQ(connection->code, 400);
+
+    // A read error ends the archive early instead of sending zeros
+    node = sd.addGeneratedFile("bad/bad.bin", 100000, 4);
+    node->failReadOffset = 65536;
+    connection = testGet(&web, "/SD/bad/?format=tar");
+    CHECK_EQ(connection->code, 200);
+    CHECK(!tarMembers(connection->data, &members));
+    CHECK(connection->data.size() < (512 + 100000));
+    CHECK(connection->data.size() > 512);
+    CHECK(connection->data.find(std::string(512, '\0'), 512) == std::string::npos);
+    CHECK(connection->data.substr(512) == testGenerated(4, 0, connection->data.size() - 512));
+
+    return testResult("test_archive");
+}
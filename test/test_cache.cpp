@@ -0,0 +1,152 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Small file cache: loading while sending, sending the hits without reading
+// the SD card, the changes that discard the copy and the downloads that are
+// not cached
+
+#include "SdTest.h"
+#include "SdCardServerPrivate.h"
+
+//------------------------------------------------------------------------------
+// Get a counter from the JSON metrics
+//------------------------------------------------------------------------------
+static
+unsigned long
+metric (
+    SdCardServer * server,
+    const char * name
+    )
+{
+    std::string key;
+    size_t offset;
+    String text;
+
+    server->sdCardMetrics(&text, true);
+    key = std::string("\"") + name + "\":";
+    offset = std::string(text.c_str()).find(key);
+    if (offset == std::string::npos)
+        return (unsigned long)-1;
+    return strtoul(text.c_str() + offset + key.size(), NULL, 10);
+}
+
+int
+main (
+    )
+{
+    uint64_t commands;
+    std::unique_ptr<FakeConnection> connection;
+    std::string expected;
+    unsigned long hits;
+    unsigned long misses;
+    FakeNode * node;
+    SdFat sd;
+    AsyncWebServer web(80);
+
+    node = sd.addFile("status.txt", "status 1\n");
+    sd.addFile("page.html", "<html></html>");
+    sd.addFile("page.html.gz", "gzip copy");
+    sd.addFile("range.txt", "0123456789");
+    sd.addGeneratedFile("abort.bin", 3000, 7);
+    sd.addFile("my dir/a.txt", "a");
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Test Server", 4, false);
+    server.onNotFound(&web);
+
+    // The second download is sent from the cache without reading the SD card
+    connection = testGet(&web, "/SD/status.txt");
+    CHECK_STR(connection->data, "status 1\n");
+    commands = sd.commands;
+    connection = testGet(&web, "/SD/status.txt");
+    CHECK_STR(connection->data, "status 1\n");
+    CHECK_EQ(sd.commands, commands);
+    CHECK_EQ(metric(&server, "cacheMisses"), 1);
+    CHECK_EQ(metric(&server, "cacheHits"), 1);
+
+    // The copy is sent until the server is notified of the change
+    node->data += "status 2\n";
+    node->size = node->data.size();
+    connection = testGet(&web, "/SD/status.txt");
+    CHECK_STR(connection->data, "status 1\n");
+    server.sdCardFilesChanged();
+    connection = testGet(&web, "/SD/status.txt");
+    CHECK_STR(connection->data, "status 1\nstatus 2\n");
+    CHECK_EQ(metric(&server, "cacheMisses"), 2);
+    connection = testGet(&web, "/SD/status.txt");
+    CHECK_STR(connection->data, "status 1\nstatus 2\n");
+    CHECK_EQ(metric(&server, "cacheHits"), 3);
+
+    // A listing of the directory showing a different size or modify time
+    // discards the copy
+    node->data = "status 3\nstatus 4\n";
+    sd.setModifyDateTime(node, FS_DATE(2024, 5, 6), FS_TIME(7, 8, 9));
+    connection = testGet(&web, "/SD/");
+    CHECK_EQ(connection->code, 200);
+    connection = testGet(&web, "/SD/status.txt");
+    CHECK_STR(connection->data, "status 3\nstatus 4\n");
+    CHECK_EQ(metric(&server, "cacheHits"), 3);
+    connection = testGet(&web, "/SD/status.txt");
+    CHECK_STR(connection->data, "status 3\nstatus 4\n");
+    CHECK_EQ(metric(&server, "cacheHits"), 4);
+
+    // The gzip copy is cached separately from the file
+    connection = testGet(&web, "/SD/page.html");
+    connection.reset(new FakeConnection(&web, HTTP_GET, "/SD/page.html"));
+    connection->header("Accept-Encoding", "gzip").run();
+    connection.reset(new FakeConnection(&web, HTTP_GET, "/SD/page.html"));
+    connection->header("Accept-Encoding", "gzip").run();
+    CHECK_STR(connection->responseHeader("Content-Encoding"), "gzip");
+    CHECK_STR(connection->data, "gzip copy");
+    connection = testGet(&web, "/SD/page.html");
+    CHECK_STR(connection->data, "<html></html>");
+    CHECK_EQ(metric(&server, "cacheHits"), 6);
+
+    // Range requests do not load the cache
+    hits = metric(&server, "cacheHits");
+    misses = metric(&server, "cacheMisses");
+    connection.reset(new FakeConnection(&web, HTTP_GET, "/SD/range.txt"));
+    connection->header("Range", "bytes=2-4").run();
+    CHECK_EQ(connection->code, 206);
+    CHECK_STR(connection->data, "234");
+    connection = testGet(&web, "/SD/range.txt");
+    CHECK_STR(connection->data, "0123456789");
+    CHECK_EQ(metric(&server, "cacheHits"), hits);
+    CHECK_EQ(metric(&server, "cacheMisses"), misses + 1);
+
+    // The compressed downloads do not load the cache
+#ifdef DEFLATE_ENABLED
+    hits = metric(&server, "cacheHits");
+    connection.reset(new FakeConnection(&web, HTTP_GET, "/SD/range.txt"));
+    connection->header("Accept-Encoding", "gzip").run();
+    connection.reset(new FakeConnection(&web, HTTP_GET, "/SD/range.txt"));
+    connection->header("Accept-Encoding", "gzip").run();
+    CHECK_STR(connection->responseHeader("Content-Encoding"), "gzip");
+    CHECK_EQ(metric(&server, "cacheHits"), hits);
+#endif  // DEFLATE_ENABLED
+
+    // A download that ends early does not leave a partial copy
+    expected = testGenerated(7, 0, 3000);
+    connection.reset(new FakeConnection(&web, HTTP_GET, "/SD/abort.bin"));
+    connection->start();
+    connection->step(100);
+    CHECK(connection->data == expected.substr(0, connection->data.size()));
+    connection->disconnect();
+    connection.reset();
+    testSettle();
+    hits = metric(&server, "cacheHits");
+    connection = testGet(&web, "/SD/abort.bin", 100);
+    CHECK(connection->data == expected);
+    CHECK_EQ(metric(&server, "cacheHits"), hits);
+    connection = testGet(&web, "/SD/abort.bin");
+    CHECK(connection->data == expected);
+    CHECK_EQ(metric(&server, "cacheHits"), hits + 1);
+
+    // The directory redirect encodes the path
+    connection = testGet(&web, "/SD/my dir");
+    CHECK_EQ(connection->code, 302);
+    CHECK_STR(connection->responseHeader("Location"), "/SD/my%20dir/");
+
+    return testResult("test_cache");
+}
@@ -0,0 +1,123 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// File checksums and their sidecar files
+
+#include "SdTest.h"
+
+//------------------------------------------------------------------------------
+// Compute the CRC-32 of the data one bit at a time
+//------------------------------------------------------------------------------
+static
+uint32_t
+crc32Bits (
+    const std::string & data
+    )
+{
+    int bit;
+    uint32_t crc;
+
+    crc = 0xffffffff;
+    for (unsigned char byte : data) {
+        crc ^= byte;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+    }
+    return ~crc;
+}
+
+int
+main (
+    )
+{
+    std::unique_ptr<FakeConnection> connection;
+    std::string etag;
+    char expected[80];
+    SdFat sd;
+    SdFat sdReadOnly;
+    AsyncWebServer web(80);
+
+    sd.addFile("abc.txt", "abc");
+    sd.addFile("digits.txt", "123456789");
+    sd.addGeneratedFile("logs/big.bin", 4 * 1024 * 1024, 9);
+    sd.addFile("logs/small.txt", "small");
+    sd.addFile("notes.sum", "ordinary file\n");
+    sd.addFile("logs/data.sum", "sha256 0123 5 0-0\n");
+    sdReadOnly.addFile("abc.txt", "abc");
+    sdReadOnly.addGeneratedFile("big.bin", 1024 * 1024, 3);
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Test Server", 4, true);
+    SdCardServer readOnly(&sdReadOnly, testSdCardPresent, "/RO/", "Test Server", 4, false);
+    server.onNotFound(&web);
+
+    // The checksums are saved in the sidecar files
+    connection = testGet(&web, "/SD/abc.txt?sum=sha256");
+    CHECK_EQ(connection->code, 200);
+    CHECK_STR(connection->data,
+              "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad  abc.txt\n");
+    CHECK(sd.find("abc.txt.sum") != NULL);
+    connection = testGet(&web, "/SD/digits.txt?sum=crc32");
+    CHECK_STR(connection->data, "cbf43926  digits.txt\n");
+    connection = testGet(&web, "/SD/digits.txt?sum=crc32");
+    CHECK_STR(connection->data, "cbf43926  digits.txt\n");
+
+    // A read-only server does not write to the SD card
+    connection = testGet(&web, "/RO/abc.txt?sum=sha256");
+    CHECK_STR(connection->data,
+              "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad  abc.txt\n");
+    CHECK(sdReadOnly.find("abc.txt.sum") == NULL);
+
+    // A read-only server keeps the checksums in memory
+    snprintf(expected, sizeof(expected), "%08lx  big.bin\n",
+             (unsigned long)crc32Bits(testGenerated(3, 0, 1024 * 1024)));
+    sdReadOnly.commandUsec = 100;
+    sdReadOnly.sectorUsec = 50;
+    connection = testGet(&web, "/RO/big.bin?sum=crc32");
+    CHECK_STR(connection->data, expected);
+    CHECK(connection->tryAgains > 0);
+    connection = testGet(&web, "/RO/big.bin?sum=crc32");
+    CHECK_STR(connection->data, expected);
+    CHECK_EQ(connection->tryAgains, 0);
+    sdReadOnly.commandUsec = 0;
+    sdReadOnly.sectorUsec = 0;
+
+    // A slow file is hashed in steps, letting the web server handle the
+    // other connections instead of waiting
+    connection = testGet(&web, "/SD/logs/small.txt?sum=crc32");
+    connection = testGet(&web, "/SD/logs/");
+    connection = testGet(&web, "/SD/logs/");
+    etag = connection->responseHeader("ETag");
+    CHECK(etag.size() > 2);
+    sd.commandUsec = 100;
+    sd.sectorUsec = 50;
+    connection = testGet(&web, "/SD/logs/big.bin?sum=crc32");
+    sd.commandUsec = 0;
+    sd.sectorUsec = 0;
+    snprintf(expected, sizeof(expected), "%08lx  big.bin\n",
+             (unsigned long)crc32Bits(testGenerated(9, 0, 4 * 1024 * 1024)));
+    CHECK_EQ(connection->code, 200);
+    CHECK(connection->tryAgains > 0);
+    CHECK_STR(connection->data, expected);
+
+    // The sidecar files are not listed or archived and do not change the
+    // listing, the other files named *.sum are listed and archived
+    CHECK(sd.find("logs/big.bin.sum") != NULL);
+    connection = testGet(&web, "/SD/logs/");
+    CHECK_STR(connection->responseHeader("ETag"), etag);
+    CHECK(connection->data.find("big.bin.sum") == std::string::npos);
+    CHECK(connection->data.find("small.txt.sum") == std::string::npos);
+    CHECK(connection->data.find("data.sum") != std::string::npos);
+    connection = testGet(&web, "/SD/?format=csv");
+    CHECK(connection->data.find("abc.txt,") != std::string::npos);
+    CHECK(connection->data.find("abc.txt.sum") == std::string::npos);
+    CHECK(connection->data.find("notes.sum,") != std::string::npos);
+    connection = testGet(&web, "/SD/logs/?format=tar");
+    CHECK(connection->data.find("logs/small.txt") != std::string::npos);
+    CHECK(connection->data.find("big.bin.sum") == std::string::npos);
+    CHECK(connection->data.find("logs/data.sum") != std::string::npos);
+    CHECK(connection->data.find("sha256 0123 5 0-0") != std::string::npos);
+
+    return testResult("test_checksum");
+}
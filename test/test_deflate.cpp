@@ -0,0 +1,161 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// gzip compression of the text files, the responses are decompressed with
+// zlib and the gzip trailer is checked
+
+#include <zlib.h>
+
+#include "SdTest.h"
+#include "SdCardServerPrivate.h"
+
+//------------------------------------------------------------------------------
+// Decompress a gzip stream, returns false if zlib rejects the stream
+//------------------------------------------------------------------------------
+static
+bool
+gunzip (
+    const std::string & data,
+    std::string * text
+    )
+{
+    char buffer[4096];
+    int status;
+    z_stream stream;
+
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+        return false;
+    stream.next_in = (Bytef *)data.data();
+    stream.avail_in = data.size();
+    text->clear();
+    do {
+        stream.next_out = (Bytef *)buffer;
+        stream.avail_out = sizeof(buffer);
+        status = inflate(&stream, Z_NO_FLUSH);
+        text->append(buffer, sizeof(buffer) - stream.avail_out);
+    } while (status == Z_OK);
+    inflateEnd(&stream);
+
+    // The whole response is a single gzip member
+    return (status == Z_STREAM_END) && (!stream.avail_in);
+}
+
+//------------------------------------------------------------------------------
+// Get a little endian 32-bit value from the gzip trailer
+//------------------------------------------------------------------------------
+static
+uint32_t
+trailerValue (
+    const std::string & data,
+    size_t offset
+    )
+{
+    return (uint32_t)(uint8_t)data[offset]
+         | ((uint32_t)(uint8_t)data[offset + 1] << 8)
+         | ((uint32_t)(uint8_t)data[offset + 2] << 16)
+         | ((uint32_t)(uint8_t)data[offset + 3] << 24);
+}
+
+//------------------------------------------------------------------------------
+// Download a file with gzip compression and verify the contents
+//------------------------------------------------------------------------------
+static
+void
+checkDeflate (
+    AsyncWebServer * web,
+    const char * name,
+    const std::string & contents,
+    size_t space
+    )
+{
+    std::unique_ptr<FakeConnection> connection;
+    std::string target;
+    std::string text;
+
+    target = std::string("/SD/") + name;
+    connection.reset(new FakeConnection(web, HTTP_GET, target.c_str()));
+    connection->header("Accept-Encoding", "gzip, deflate").run(space);
+    CHECK_EQ(connection->code, 200);
+    CHECK(!connection->aborted);
+    CHECK_STR(connection->responseHeader("Content-Encoding"), "gzip");
+    CHECK_STR(connection->responseHeader("Accept-Ranges"), "");
+    if (!gunzip(connection->data, &text)) {
+        printf("    %s: zlib rejected the %zu byte response\n", name,
+               connection->data.size());
+        CHECK(false);
+        return;
+    }
+    CHECK_EQ(text.size(), contents.size());
+    CHECK(text == contents);
+
+    // Trailer: CRC-32 and the size modulo 2^32
+    CHECK(connection->data.size() >= 18);
+    if (connection->data.size() >= 18) {
+        CHECK_EQ(trailerValue(connection->data, connection->data.size() - 8),
+                 (uint32_t)crc32(0, (const Bytef *)contents.data(), contents.size()));
+        CHECK_EQ(trailerValue(connection->data, connection->data.size() - 4),
+                 (uint32_t)contents.size());
+    }
+}
+
+int
+main (
+    )
+{
+    std::unique_ptr<FakeConnection> connection;
+    std::string csv;
+    char line[80];
+    int row;
+    SdFat sd;
+    AsyncWebServer web(80);
+
+    // Compressible text around the input and window sizes
+    for (row = 0; csv.size() < (64 * 1024); row++) {
+        snprintf(line, sizeof(line), "%d,2024-01-01T12:%02d:%02d,%d.%03d,OK\r\n",
+                 row, (row / 60) % 60, row % 60, row * 7, row % 1000);
+        csv += line;
+    }
+    const struct {
+        const char * name;
+        std::string contents;
+    } files[] = {
+        {"empty.txt", ""},
+        {"one.txt", "x"},
+        {"input.csv", csv.substr(0, DEFLATE_INPUT_SIZE)},
+        {"input-plus-one.csv", csv.substr(0, DEFLATE_INPUT_SIZE + 1)},
+        {"window.csv", csv.substr(0, DEFLATE_WINDOW_SIZE)},
+        {"window-plus-one.csv", csv.substr(0, DEFLATE_WINDOW_SIZE + 1)},
+        {"repeated.log", std::string(10000, 'a')},
+        {"large.csv", csv},
+        {"random.txt", testGenerated(5, 0, 3 * DEFLATE_WINDOW_SIZE + 7)},
+    };
+    for (const auto & file : files)
+        sd.addFile(file.name, file.contents.data(), file.contents.size());
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Test Server", 4, false);
+    server.onNotFound(&web);
+
+    for (const auto & file : files) {
+        checkDeflate(&web, file.name, file.contents, 4 * FAKE_TCP_MSS);
+        checkDeflate(&web, file.name, file.contents, 7);
+    }
+
+    // The text compresses
+    connection.reset(new FakeConnection(&web, HTTP_GET, "/SD/large.csv"));
+    connection->header("Accept-Encoding", "gzip").run();
+    CHECK(connection->data.size() < (csv.size() / 2));
+
+    // Range requests and the clients that do not accept gzip get the file
+    connection.reset(new FakeConnection(&web, HTTP_GET, "/SD/large.csv"));
+    connection->header("Accept-Encoding", "gzip").header("Range", "bytes=0-9").run();
+    CHECK_EQ(connection->code, 206);
+    CHECK_STR(connection->data, csv.substr(0, 10));
+    connection = testGet(&web, "/SD/large.csv");
+    CHECK_STR(connection->responseHeader("Content-Encoding"), "");
+    CHECK(connection->data == csv);
+
+    return testResult("test_deflate");
+}
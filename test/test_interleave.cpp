@@ -0,0 +1,173 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Concurrent transfers interleaved on the same server, each transfer must
+// keep its own file offset and data
+
+#include <vector>
+
+#include "SdTest.h"
+
+typedef struct _INTERLEAVE {
+    const char * target;
+    const char * range;                 // Range header value or NULL
+    uint32_t seed;                      // Generated file contents
+    uint64_t offset;                    // First byte expected
+    size_t length;                      // Bytes expected
+    size_t space;                       // Send space offered each step
+} INTERLEAVE;
+
+//------------------------------------------------------------------------------
+// Step the connections round robin until all of them are complete
+//------------------------------------------------------------------------------
+static
+void
+interleave (
+    std::vector<std::unique_ptr<FakeConnection>> & connections,
+    const std::vector<INTERLEAVE> & transfers
+    )
+{
+    bool busy;
+    size_t index;
+
+    do {
+        busy = false;
+        for (index = 0; index < connections.size(); index++)
+            if (!connections[index]->done)
+                busy |= connections[index]->step(transfers[index].space);
+    } while (busy);
+}
+
+//------------------------------------------------------------------------------
+// Start the requests
+//------------------------------------------------------------------------------
+static
+std::vector<std::unique_ptr<FakeConnection>>
+interleaveStart (
+    AsyncWebServer * web,
+    const std::vector<INTERLEAVE> & transfers
+    )
+{
+    std::vector<std::unique_ptr<FakeConnection>> connections;
+
+    for (const INTERLEAVE & transfer : transfers) {
+        connections.emplace_back(new FakeConnection(web, HTTP_GET, transfer.target));
+        if (transfer.range)
+            connections.back()->header("Range", transfer.range);
+        connections.back()->start();
+    }
+    return connections;
+}
+
+int
+main (
+    )
+{
+    std::vector<std::unique_ptr<FakeConnection>> connections;
+    size_t index;
+    SdFat sd;
+    std::vector<INTERLEAVE> transfers;
+    AsyncWebServer web(80);
+
+    sd.addGeneratedFile("a.bin", 300 * 1000 + 1, 11);
+    sd.addGeneratedFile("b.bin", 123457, 12);
+    sd.addGeneratedFile("c.bin", 5, 13);
+    sd.addGeneratedFile("d.bin", 2 * 1024 * 1024, 14);
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Test Server", 4, false);
+    server.onNotFound(&web);
+
+    // Different files with different send space, the small sends keep the
+    // transfers interleaved within the read buffers
+    transfers = {
+        {"/SD/a.bin", NULL, 11, 0, 300 * 1000 + 1, 1000},
+        {"/SD/b.bin", NULL, 12, 0, 123457, 17},
+        {"/SD/c.bin", NULL, 13, 0, 5, 3},
+        {"/SD/d.bin", NULL, 14, 0, 2 * 1024 * 1024, 4 * FAKE_TCP_MSS},
+    };
+    connections = interleaveStart(&web, transfers);
+
+    // All of the transfer slots are in use
+    {
+        FakeConnection busy(&web, HTTP_GET, "/SD/c.bin");
+
+        busy.run();
+        CHECK_EQ(busy.code, 503);
+    }
+
+    interleave(connections, transfers);
+    for (index = 0; index < transfers.size(); index++) {
+        CHECK_EQ(connections[index]->code, 200);
+        CHECK(!connections[index]->aborted);
+
+        // The scheduler and read-ahead never refuse to send data
+        CHECK_EQ(connections[index]->tryAgains, 0);
+        CHECK_EQ(connections[index]->data.size(), transfers[index].length);
+        CHECK(connections[index]->data == testGenerated(transfers[index].seed,
+                                                        transfers[index].offset,
+                                                        transfers[index].length));
+    }
+    connections.clear();
+    testSettle();
+
+    // The same file at different offsets
+    transfers = {
+        {"/SD/d.bin", "bytes=0-99999", 14, 0, 100000, 700},
+        {"/SD/d.bin", "bytes=1000000-1099999", 14, 1000000, 100000, 1300},
+        {"/SD/d.bin", "bytes=12345-", 14, 12345, 2 * 1024 * 1024 - 12345, 4 * FAKE_TCP_MSS},
+        {"/SD/d.bin", "bytes=-4097", 14, 2 * 1024 * 1024 - 4097, 4097, 11},
+    };
+    connections = interleaveStart(&web, transfers);
+    interleave(connections, transfers);
+    for (index = 0; index < transfers.size(); index++) {
+        CHECK_EQ(connections[index]->code, 206);
+        CHECK(!connections[index]->aborted);
+        CHECK_EQ(connections[index]->tryAgains, 0);
+        CHECK_EQ(connections[index]->data.size(), transfers[index].length);
+        CHECK(connections[index]->data == testGenerated(transfers[index].seed,
+                                                        transfers[index].offset,
+                                                        transfers[index].length));
+    }
+    connections.clear();
+    testSettle();
+
+    // A transfer closed in the middle does not disturb the others
+    transfers = {
+        {"/SD/a.bin", NULL, 11, 0, 300 * 1000 + 1, 2000},
+        {"/SD/d.bin", NULL, 14, 0, 2 * 1024 * 1024, 3000},
+        {"/SD/b.bin", NULL, 12, 0, 123457, 500},
+    };
+    connections = interleaveStart(&web, transfers);
+    for (index = 0; index < 20; index++) {
+        connections[0]->step(transfers[0].space);
+        connections[1]->step(transfers[1].space);
+        connections[2]->step(transfers[2].space);
+    }
+    connections[1]->disconnect();
+    interleave(connections, transfers);
+    CHECK(connections[1]->aborted);
+    for (index = 0; index < transfers.size(); index += 2) {
+        CHECK(!connections[index]->aborted);
+        CHECK(connections[index]->data == testGenerated(transfers[index].seed,
+                                                        transfers[index].offset,
+                                                        transfers[index].length));
+    }
+    connections.clear();
+    testSettle();
+
+    // The transfer slots are all released
+    transfers = {
+        {"/SD/c.bin", NULL, 13, 0, 5, 1},
+        {"/SD/c.bin", NULL, 13, 0, 5, 2},
+        {"/SD/c.bin", NULL, 13, 0, 5, 3},
+        {"/SD/c.bin", NULL, 13, 0, 5, 4},
+    };
+    connections = interleaveStart(&web, transfers);
+    interleave(connections, transfers);
+    for (index = 0; index < transfers.size(); index++)
+        CHECK_STR(connections[index]->data, testGenerated(13, 0, 5));
+
+    return testResult("test_interleave");
+}
@@ -0,0 +1,159 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Files larger than 4 GiB: sizes in the listings, Content-Length and the
+// byte ranges.  The generated files are sparse, only the bytes sent are
+// computed.
+
+#include "SdTest.h"
+
+#define GIB                     (1024ULL * 1024 * 1024)
+#define HUGE_SIZE               ((6 * GIB) + 12345)
+#define HUGE_SEED               21
+
+//------------------------------------------------------------------------------
+// Send a range request for the large file
+//------------------------------------------------------------------------------
+static
+std::unique_ptr<FakeConnection>
+rangeGet (
+    AsyncWebServer * web,
+    const char * range
+    )
+{
+    std::unique_ptr<FakeConnection> connection;
+
+    connection.reset(new FakeConnection(web, HTTP_GET, "/SD/huge.bin"));
+    connection->header("Range", range).run();
+    CHECK(!connection->aborted);
+    return connection;
+}
+
+//------------------------------------------------------------------------------
+// Verify a single range response
+//------------------------------------------------------------------------------
+static
+void
+checkRange (
+    AsyncWebServer * web,
+    const char * range,
+    uint64_t offset,
+    size_t length
+    )
+{
+    std::unique_ptr<FakeConnection> connection;
+    char expected[80];
+
+    connection = rangeGet(web, range);
+    CHECK_EQ(connection->code, 206);
+    CHECK_EQ(connection->contentLength, length);
+    snprintf(expected, sizeof(expected), "bytes %llu-%llu/%llu",
+             (unsigned long long)offset, (unsigned long long)(offset + length - 1),
+             (unsigned long long)HUGE_SIZE);
+    CHECK_STR(connection->responseHeader("Content-Range"), expected);
+    CHECK_EQ(connection->data.size(), length);
+    CHECK(connection->data == testGenerated(HUGE_SEED, offset, length));
+}
+
+int
+main (
+    )
+{
+    std::unique_ptr<FakeConnection> connection;
+    char expected[80];
+    size_t part;
+    size_t position;
+    uint64_t ranges[3][2];
+    SdFat sd;
+    AsyncWebServer web(80);
+
+    sd.addGeneratedFile("huge.bin", HUGE_SIZE, HUGE_SEED);
+    sd.addGeneratedFile("billion.bin", 1000000005ULL, 22);
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Test Server", 4, false);
+    server.onNotFound(&web);
+
+    // The sizes are listed with all of their digits
+    connection = testGet(&web, "/SD/?format=csv");
+    CHECK(connection->data.find("huge.bin," + std::to_string(HUGE_SIZE) + ",")
+          != std::string::npos);
+    CHECK(connection->data.find("billion.bin,1000000005,") != std::string::npos);
+    connection = testGet(&web, "/SD/?format=json");
+    CHECK(connection->data.find("\"size\":" + std::to_string(HUGE_SIZE) + ",")
+          != std::string::npos);
+    connection = testGet(&web, "/SD/");
+    CHECK(connection->data.find("1000000005") != std::string::npos);
+
+    // The Content-Length of the entire file, only the start is sent
+    connection.reset(new FakeConnection(&web, HTTP_GET, "/SD/huge.bin"));
+    connection->start();
+    connection->step();
+    CHECK_EQ(connection->code, 200);
+    CHECK_EQ(connection->contentLength, HUGE_SIZE);
+    CHECK(connection->data.size() > 0);
+    CHECK(connection->data == testGenerated(HUGE_SEED, 0, connection->data.size()));
+    connection->disconnect();
+    connection.reset();
+    testSettle();
+
+    // Ranges beyond 4 GiB, including one that crosses the 4 GiB boundary
+    checkRange(&web, "bytes=4294967290-4294967309", 4 * GIB - 6, 20);
+    checkRange(&web, "bytes=5368709120-5368809119", 5 * GIB, 100000);
+    checkRange(&web, "bytes=6442450944-", 6 * GIB, 12345);
+
+    // Suffix ranges, longer than the file sends the entire file
+    checkRange(&web, "bytes=-1", HUGE_SIZE - 1, 1);
+    checkRange(&web, "bytes=-70000", HUGE_SIZE - 70000, 70000);
+    connection.reset(new FakeConnection(&web, HTTP_GET, "/SD/huge.bin"));
+    connection->header("Range", "bytes=-99999999999").start();
+    connection->step();
+    CHECK_EQ(connection->code, 206);
+    CHECK_EQ(connection->contentLength, HUGE_SIZE);
+    CHECK_STR(connection->responseHeader("Content-Range"),
+              "bytes 0-" + std::to_string(HUGE_SIZE - 1) + "/" + std::to_string(HUGE_SIZE));
+    connection->disconnect();
+    connection.reset();
+    testSettle();
+
+    // Overlapping ranges are sent as separate parts of a multipart response
+    connection = rangeGet(&web, "bytes=4294967000-4294968000,4294967500-4294967599,-10");
+    CHECK_EQ(connection->code, 206);
+    CHECK(connection->contentType.find("multipart/byteranges") == 0);
+    CHECK_EQ(connection->data.size(), connection->contentLength);
+    ranges[0][0] = 4294967000ULL;
+    ranges[0][1] = 1001;
+    ranges[1][0] = 4294967500ULL;
+    ranges[1][1] = 100;
+    ranges[2][0] = HUGE_SIZE - 10;
+    ranges[2][1] = 10;
+    position = 0;
+    for (part = 0; part < 3; part++) {
+        snprintf(expected, sizeof(expected), "Content-Range: bytes %llu-%llu/%llu\r\n\r\n",
+                 (unsigned long long)ranges[part][0],
+                 (unsigned long long)(ranges[part][0] + ranges[part][1] - 1),
+                 (unsigned long long)HUGE_SIZE);
+        position = connection->data.find(expected, position);
+        CHECK(position != std::string::npos);
+        if (position == std::string::npos)
+            break;
+        position += strlen(expected);
+        CHECK(connection->data.substr(position, ranges[part][1])
+              == testGenerated(HUGE_SEED, ranges[part][0], ranges[part][1]));
+    }
+
+    // Unsatisfiable ranges
+    for (const char * range : {"bytes=-0", "bytes=6442463289-", "bytes=9999999999-10000000000",
+                               "bytes=-0,6442463289-6442463300"}) {
+        connection = rangeGet(&web, range);
+        CHECK_EQ(connection->code, 416);
+        CHECK_STR(connection->responseHeader("Content-Range"),
+                  "bytes */" + std::to_string(HUGE_SIZE));
+    }
+
+    // An unsatisfiable range along with a satisfiable range
+    checkRange(&web, "bytes=-0,6442450944-6442450953", 6 * GIB, 10);
+
+    return testResult("test_large");
+}
@@ -0,0 +1,231 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Cached directory indexes and sorted listings
+
+#include <vector>
+
+#include "SdTest.h"
+
+//------------------------------------------------------------------------------
+// Get the file names from a CSV listing
+//------------------------------------------------------------------------------
+static
+std::vector<std::string>
+csvNames (
+    const std::string & csv
+    )
+{
+    size_t end;
+    std::vector<std::string> names;
+    size_t start;
+
+    // Skip the heading and the white space sent while building the index
+    start = csv.find("\r\n");
+    while ((start != std::string::npos) && ((start + 2) < csv.size())) {
+        start += 2;
+        while ((start < csv.size()) && (csv[start] == '\n'))
+            start += 1;
+        end = csv.find(',', start);
+        if (end == std::string::npos)
+            break;
+        names.push_back(csv.substr(start, end - start));
+        start = csv.find("\r\n", end);
+    }
+    return names;
+}
+
+//------------------------------------------------------------------------------
+// Verify that the listing is sorted by size, largest first
+//------------------------------------------------------------------------------
+static
+void
+checkSizeDescending (
+    const std::string & csv,
+    size_t files
+    )
+{
+    size_t index;
+    std::vector<std::string> names;
+
+    names = csvNames(csv);
+    CHECK_EQ(names.size(), files);
+    for (index = 0; index < names.size(); index++)
+        CHECK_STR(names[index], "file-" + std::to_string(files - 1 - index) + ".txt");
+}
+
+//------------------------------------------------------------------------------
+// Get the SD card generation from a listing ETag
+//------------------------------------------------------------------------------
+static
+unsigned long
+etagGeneration (
+    const std::string & etag
+    )
+{
+    size_t dash;
+
+    dash = etag.find('-');
+    if (dash == std::string::npos)
+        return 0;
+    return strtoul(etag.c_str() + dash + 1, NULL, 16);
+}
+
+int
+main (
+    )
+{
+    std::unique_ptr<FakeConnection> connection;
+    std::string etag;
+    std::unique_ptr<FakeConnection> first;
+    int index;
+    char name[64];
+    std::vector<std::string> names;
+    FakeNode * node;
+    uint32_t reads;
+    SdFat sd;
+    std::unique_ptr<FakeConnection> second;
+    AsyncWebServer web(80);
+
+    // The names sort in the opposite order of the sizes
+    for (index = 0; index < 200; index++) {
+        snprintf(name, sizeof(name), "big/file-%d.txt", index);
+        sd.addGeneratedFile(name, 1000 + index, index);
+    }
+    for (index = 0; index < 6; index++) {
+        snprintf(name, sizeof(name), "dir-%d/a.txt", index);
+        sd.addFile(name, "a");
+    }
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Test Server", 4, false);
+    server.onNotFound(&web);
+
+    // A sorted listing started while another listing builds the index of the
+    // same directory is still sorted
+    first.reset(new FakeConnection(&web, HTTP_GET, "/SD/big/?format=csv&sort=size&order=desc"));
+    second.reset(new FakeConnection(&web, HTTP_GET, "/SD/big/?format=csv&sort=size&order=desc"));
+    first->start();
+    first->step(100);
+    first->step(100);
+    second->start();
+    while ((!first->done) || (!second->done)) {
+        if (!first->done)
+            first->step(100);
+        if (!second->done)
+            second->step(100);
+    }
+    CHECK_EQ(first->code, 200);
+    CHECK_EQ(second->code, 200);
+    checkSizeDescending(first->data, 200);
+    checkSizeDescending(second->data, 200);
+
+    // The next listing is sent from the cached index
+    reads = sd.directoryReads;
+    connection = testGet(&web, "/SD/big/?format=csv&sort=size&order=desc");
+    checkSizeDescending(connection->data, 200);
+    CHECK_EQ(sd.directoryReads, reads);
+
+    // The indexes of several directories are kept
+    for (index = 0; index < 3; index++) {
+        snprintf(name, sizeof(name), "/SD/dir-%d/?format=csv", index);
+        connection = testGet(&web, name);
+        CHECK_EQ(connection->code, 200);
+    }
+    reads = sd.directoryReads;
+    connection = testGet(&web, "/SD/big/?format=csv&sort=size&order=desc");
+    checkSizeDescending(connection->data, 200);
+    for (index = 0; index < 3; index++) {
+        snprintf(name, sizeof(name), "/SD/dir-%d/?format=csv", index);
+        connection = testGet(&web, name);
+        CHECK(connection->data.find("a.txt,1,") != std::string::npos);
+    }
+    CHECK_EQ(sd.directoryReads, reads);
+
+    // The least recently listed directory is replaced
+    connection = testGet(&web, "/SD/dir-4/?format=csv");
+    reads = sd.directoryReads;
+    connection = testGet(&web, "/SD/dir-1/?format=csv");
+    CHECK_EQ(sd.directoryReads, reads);
+    connection = testGet(&web, "/SD/big/?format=csv");
+    CHECK(sd.directoryReads != reads);
+
+    // Changing the SD card contents discards the indexes
+    server.sdCardFilesChanged();
+    reads = sd.directoryReads;
+    connection = testGet(&web, "/SD/dir-1/?format=csv");
+    CHECK(sd.directoryReads != reads);
+
+    // The ETag is sent once the directory index is cached and changes with
+    // the directory contents
+    connection = testGet(&web, "/SD/etag/");
+    CHECK_EQ(connection->code, 404);
+    sd.addFile("etag/one.txt", "1");
+    server.sdCardFilesChanged();
+    connection = testGet(&web, "/SD/etag/");
+    CHECK_EQ(connection->code, 200);
+    CHECK_STR(connection->responseHeader("ETag"), "");
+    connection = testGet(&web, "/SD/etag/");
+    etag = connection->responseHeader("ETag");
+    CHECK(etag.size() > 2);
+    connection.reset(new FakeConnection(&web, HTTP_GET, "/SD/etag/"));
+    connection->header("If-None-Match", etag.c_str()).run();
+    CHECK_EQ(connection->code, 304);
+    sd.addFile("etag/two.txt", "22");
+    server.sdCardFilesChanged();
+    connection = testGet(&web, "/SD/etag/");
+    connection = testGet(&web, "/SD/etag/");
+    CHECK(connection->responseHeader("ETag") != etag);
+    connection.reset(new FakeConnection(&web, HTTP_GET, "/SD/etag/"));
+    connection->header("If-None-Match", etag.c_str()).run();
+    CHECK_EQ(connection->code, 200);
+
+    // Removing and inserting the SD card changes the ETag once each, no
+    // matter how often the missing SD card is polled
+    etag = connection->responseHeader("ETag");
+    testCardPresent = false;
+    sd.present = false;
+    for (index = 0; index < 5; index++) {
+        connection = testGet(&web, "/SD/etag/");
+        CHECK(connection->data.find("SD card not present") != std::string::npos);
+    }
+    testCardPresent = true;
+    sd.present = true;
+    connection = testGet(&web, "/SD/etag/");
+    connection = testGet(&web, "/SD/etag/");
+    CHECK_EQ(etagGeneration(connection->responseHeader("ETag")), etagGeneration(etag) + 2);
+    CHECK_STR(testGet(&web, "/SD/etag/")->responseHeader("ETag"),
+              connection->responseHeader("ETag"));
+
+    // Modify dates after 2043 use the top bit of the FAT date
+    node = sd.addFile("dates/old.txt", "old");
+    sd.setModifyDateTime(node, FS_DATE(2030, 6, 1), FS_TIME(12, 0, 0));
+    node = sd.addFile("dates/new.txt", "new");
+    sd.setModifyDateTime(node, FS_DATE(2060, 6, 1), FS_TIME(12, 0, 0));
+    server.sdCardFilesChanged();
+    for (const char * target : {"/SD/dates/?format=csv&from=2050-01-01",
+                                "/SD/dates/?format=csv&from=2050-01-01&sort=mtime"}) {
+        connection = testGet(&web, target);
+        CHECK(connection->data.find("new.txt") != std::string::npos);
+        CHECK(connection->data.find("old.txt") == std::string::npos);
+    }
+    connection = testGet(&web, "/SD/dates/?format=csv&sort=mtime&order=desc");
+    names = csvNames(connection->data);
+    CHECK_EQ(names.size(), 2);
+    if (names.size() == 2) {
+        CHECK_STR(names[0], "new.txt");
+        CHECK_STR(names[1], "old.txt");
+    }
+    connection = testGet(&web, "/SD/dates/?to=2070-01-01&from=2020-01-01&limit=1");
+    CHECK(connection->data.find("from=2020-01-01") != std::string::npos);
+    CHECK(connection->data.find("to=2070-01-01") != std::string::npos);
+
+    // The names are not passed through the template processor
+    sd.addFile("percent/%name%.txt", "%");
+    server.sdCardFilesChanged();
+    connection = testGet(&web, "/SD/percent/");
+    CHECK(connection->data.find(">%name%.txt<") != std::string::npos);
+
+    return testResult("test_listing");
+}
@@ -0,0 +1,96 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Basic listing, download, upload and metrics requests
+
+#include "SdTest.h"
+
+int
+main (
+    )
+{
+    std::unique_ptr<FakeConnection> connection;
+    std::string expected;
+    FakeNode * node;
+    SdFat sd;
+    AsyncWebServer web(80);
+
+    sd.addFile("hello.txt", "Hello, world!\n");
+    sd.addGeneratedFile("data/big.bin", 1024 * 1024 + 17, 7);
+    sd.makeDir("empty");
+
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Test Server", 4, true);
+    server.onNotFound(&web);
+
+    // HTML listing of the root directory
+    connection = testGet(&web, "/SD/");
+    CHECK_EQ(connection->code, 200);
+    CHECK(connection->data.find("hello.txt") != std::string::npos);
+    CHECK(connection->data.find("data/") != std::string::npos);
+    CHECK(connection->data.find("</html>") != std::string::npos);
+
+    // JSON listing of a subdirectory
+    connection = testGet(&web, "/SD/data/?format=json");
+    CHECK_EQ(connection->code, 200);
+    CHECK(connection->data.find("\"big.bin\"") != std::string::npos);
+    CHECK(connection->data.find("1048593") != std::string::npos);
+
+    // Downloads
+    connection = testGet(&web, "/SD/hello.txt");
+    CHECK_EQ(connection->code, 200);
+    CHECK_STR(connection->data, "Hello, world!\n");
+    connection = testGet(&web, "/SD/data/big.bin");
+    CHECK_EQ(connection->code, 200);
+    CHECK_EQ(connection->data.size(), 1024 * 1024 + 17);
+    CHECK(connection->data == testGenerated(7, 0, 1024 * 1024 + 17));
+    CHECK(!connection->aborted);
+    connection = testGet(&web, "/SD/missing.txt");
+    CHECK_EQ(connection->code, 404);
+
+    // A read error after the headers are sent stops the response without
+    // closing the connection from the response callback
+    node = sd.addGeneratedFile("data/bad.bin", 300000, 8);
+    node->failReadOffset = 100000;
+    connection = testGet(&web, "/SD/data/bad.bin");
+    CHECK_EQ(connection->code, 200);
+    CHECK_EQ(connection->contentLength, 300000);
+    CHECK(!connection->closedInFiller);
+    CHECK(connection->aborted);
+    CHECK(connection->data.size() <= 100000);
+    CHECK(connection->data == testGenerated(8, 0, connection->data.size()));
+
+    // Upload
+    expected = testGenerated(3, 0, 10000);
+    connection.reset(new FakeConnection(&web, HTTP_PUT, "/SD/upload.bin"));
+    connection->body(expected).run();
+    CHECK_EQ(connection->code, 201);
+    CHECK(sd.contents("upload.bin") == expected);
+
+    // Metrics
+    connection = testGet(&web, "/SD/?metrics");
+    CHECK_EQ(connection->code, 200);
+    CHECK(connection->data.find("sd_card_server_requests_total{type=\"download\"}")
+          != std::string::npos);
+
+    // The metrics text is the same when sent in small pieces
+    expected = connection->data;
+    connection = testGet(&web, "/SD/?metrics", 7);
+    CHECK_STR(connection->data, expected);
+    CHECK(connection->data.find("sd_card_server_active_transfers 0\n") != std::string::npos);
+    connection = testGet(&web, "/SD/?metrics=json", 5);
+    CHECK(connection->data.find("{\"activeTransfers\":0,") == 0);
+    CHECK_STR(connection->data.substr(connection->data.size() - 3), "}}\n");
+
+    // No SD card
+    testCardPresent = false;
+    sd.present = false;
+    connection = testGet(&web, "/SD/");
+    CHECK_EQ(connection->code, 200);
+    CHECK(connection->data.find("SD card not present") != std::string::npos);
+    testCardPresent = true;
+    sd.present = true;
+
+    return testResult("test_smoke");
+}
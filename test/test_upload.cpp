@@ -0,0 +1,76 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// PUT and POST uploads
+
+#include "SdTest.h"
+#include "SdCardServerPrivate.h"
+
+int
+main (
+    )
+{
+    std::unique_ptr<FakeConnection> connection;
+    std::string expected;
+    SdFat sd;
+
+    sd.addFile("config/old.txt", "old");
+
+    // The request body event is only added when uploads are allowed
+    {
+        AsyncWebServer web(80);
+        SdCardServer server(&sd, testSdCardPresent, "/SD/", "Test Server", 4, false);
+
+        server.onNotFound(&web);
+        CHECK(!web._body);
+    }
+
+    AsyncWebServer web(80);
+    SdCardServer server(&sd, testSdCardPresent, "/SD/", "Test Server", 4, true);
+    server.onNotFound(&web);
+    CHECK(web._body);
+
+    // New and replaced files
+    expected = testGenerated(1, 0, 20000);
+    connection.reset(new FakeConnection(&web, HTTP_PUT, "/SD/config/new.bin"));
+    connection->body(expected).run();
+    CHECK_EQ(connection->code, 201);
+    CHECK(sd.contents("config/new.bin") == expected);
+    connection.reset(new FakeConnection(&web, HTTP_POST, "/SD/config/old.txt"));
+    connection->body("new").run();
+    CHECK_EQ(connection->code, 204);
+    CHECK_STR(sd.contents("config/old.txt"), "new");
+
+    // Without contiguous free space the clusters are allocated by the writes
+    sd.failPreAllocate = true;
+    expected = testGenerated(2, 0, 70000);
+    connection.reset(new FakeConnection(&web, HTTP_PUT, "/SD/config/fragmented.bin"));
+    connection->body(expected, 1000).run();
+    CHECK_EQ(connection->code, 201);
+    CHECK(sd.contents("config/fragmented.bin") == expected);
+    sd.failPreAllocate = false;
+
+    // Directories are not replaced and the parent directory must exist
+    connection.reset(new FakeConnection(&web, HTTP_PUT, "/SD/config"));
+    connection->body("x").run();
+    CHECK_EQ(connection->code, 409);
+    connection.reset(new FakeConnection(&web, HTTP_PUT, "/SD/missing/x.txt"));
+    connection->body("x").run();
+    CHECK_EQ(connection->code, 409);
+    connection.reset(new FakeConnection(&web, HTTP_PUT, "/SD/config/"));
+    connection->body("x").run();
+    CHECK_EQ(connection->code, 405);
+    CHECK_STR(connection->responseHeader("Allow"), "GET, HEAD");
+
+    // An upload larger than the free space fails without writing the data
+    sd.freeClusters = 2;
+    connection.reset(new FakeConnection(&web, HTTP_PUT, "/SD/config/full.bin"));
+    connection->body(testGenerated(3, 0, 200000)).run();
+    CHECK_EQ(connection->code, 507);
+    CHECK(sd.find("config/full.bin") == NULL);
+    CHECK(sd.find("config/full.bin" UPLOAD_SUFFIX) == NULL);
+
+    return testResult("test_upload");
+}
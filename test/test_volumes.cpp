@@ -0,0 +1,121 @@
+// Arduino SD Card Server Library - host build
+// https://github.com/LeeLeahy2/SdCardServer
+// Copyright (C) 2022 by Lee Leahy and licensed under
+// GNU GPL v3.0, https://www.gnu.org/licenses/gpl.html
+//
+// Several SdCardServer instances: routing by URL, concurrent listings of
+// different volumes and deleting an instance while the others are in use
+
+#include "SdTest.h"
+
+int
+main (
+    )
+{
+    std::unique_ptr<FakeConnection> a;
+    std::unique_ptr<FakeConnection> b;
+    std::unique_ptr<FakeConnection> connection;
+    std::unique_ptr<SdCardServer> extra;
+    int index;
+    char name[64];
+    SdFat sdA;
+    SdFat sdB;
+    AsyncWebServer web(80);
+
+    for (index = 0; index < 50; index++) {
+        snprintf(name, sizeof(name), "dir/a-%03d.txt", index);
+        sdA.addFile(name, "a");
+        snprintf(name, sizeof(name), "dir/b-%03d.txt", index);
+        sdB.addFile(name, "b");
+    }
+    sdA.addFile("log.txt", "log");
+    sdA.addFile("logs/log.txt", "not routed");
+    sdA.addGeneratedFile("big.bin", 200000, 1);
+
+    SdCardServer serverA(&sdA, testSdCardPresent, "/A/", "Test Server", 4, false);
+    SdCardServer serverLogs(&sdA, testSdCardPresent, "/A/logs/", "Test Server", 4, false);
+    SdCardServer serverB(&sdB, testSdCardPresent, "/B/", "Test Server", 4, false);
+    serverA.onNotFound(&web);
+
+    // The longest URL prefix selects the instance, each instance serves the
+    // root directory of its volume
+    connection = testGet(&web, "/A/logs/log.txt");
+    CHECK_EQ(connection->code, 200);
+    CHECK_STR(connection->data, "log");
+    connection = testGet(&web, "/A/dir/a-001.txt");
+    CHECK_STR(connection->data, "a");
+    connection = testGet(&web, "/B/dir/a-001.txt");
+    CHECK_EQ(connection->code, 404);
+
+    // Listings of different volumes in small pieces do not share buffers
+    for (const char * query : {"", "?sort=name&order=desc"}) {
+        a.reset(new FakeConnection(&web, HTTP_GET, (std::string("/A/dir/") + query).c_str()));
+        b.reset(new FakeConnection(&web, HTTP_GET, (std::string("/B/dir/") + query).c_str()));
+        a->start();
+        b->start();
+        while ((!a->done) || (!b->done)) {
+            if (!a->done)
+                a->step(100);
+            if (!b->done)
+                b->step(100);
+        }
+        CHECK_EQ(a->code, 200);
+        CHECK_EQ(b->code, 200);
+        for (index = 0; index < 50; index++) {
+            snprintf(name, sizeof(name), "href=\"a-%03d.txt\"", index);
+            CHECK(a->data.find(name) != std::string::npos);
+            snprintf(name, sizeof(name), "href=\"b-%03d.txt\"", index);
+            CHECK(b->data.find(name) != std::string::npos);
+        }
+        CHECK(a->data.find("b-0") == std::string::npos);
+        CHECK(b->data.find("a-0") == std::string::npos);
+    }
+    a.reset();
+    b.reset();
+
+    // An instance without transfers
+    extra.reset(new SdCardServer(&sdB, testSdCardPresent, "/X/", "Test Server", 0, false));
+    connection = testGet(&web, "/X/dir/b-001.txt");
+    CHECK_EQ(connection->code, 503);
+    extra.reset();
+
+    // Deleting an instance that shares the SD card keeps the others working
+    extra.reset(new SdCardServer(&sdA, testSdCardPresent, "/C/", "Test Server", 2, false));
+    connection = testGet(&web, "/C/big.bin");
+    CHECK(connection->data == testGenerated(1, 0, 200000));
+    extra.reset();
+    connection = testGet(&web, "/C/big.bin");
+    CHECK_EQ(connection->code, 404);
+    connection = testGet(&web, "/A/big.bin");
+    CHECK_EQ(connection->code, 200);
+    CHECK(connection->data == testGenerated(1, 0, 200000));
+    connection = testGet(&web, "/B/dir/b-049.txt");
+    CHECK_STR(connection->data, "b");
+
+    // Deleting an instance during a download and a listing ends the
+    // responses, the state is released when the last client disconnects
+    extra.reset(new SdCardServer(&sdA, testSdCardPresent, "/C/", "Test Server", 2, false));
+    a.reset(new FakeConnection(&web, HTTP_GET, "/C/big.bin"));
+    b.reset(new FakeConnection(&web, HTTP_GET, "/C/dir/"));
+    a->start();
+    a->step(1000);
+    b->start();
+    b->step(100);
+    extra.reset();
+    while (a->step(1000))
+        ;
+    CHECK(a->aborted);
+    CHECK(a->data.size() < 200000);
+    CHECK(a->data == testGenerated(1, 0, a->data.size()));
+    a.reset();
+    testSettle();
+    while (b->step(100))
+        ;
+    CHECK_EQ(b->code, 200);
+    b.reset();
+    testSettle();
+    connection = testGet(&web, "/A/big.bin");
+    CHECK(connection->data == testGenerated(1, 0, 200000));
+
+    return testResult("test_volumes");
+}